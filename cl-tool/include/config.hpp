@@ -65,6 +65,22 @@ namespace Config {
             void SetRandManhattanDistance(double rand_manhattan_distance);
             void SetRandOutDegree(double rand_out_degree);
             void TogglePlotKML(bool plot_kml);
+            void ToggleKMZ(bool kmz);
+            void SetKMLThreads(uint32_t kml_threads);
+            void SetKMLTolerance(double kml_tolerance);
+            void SetTileCacheSize(uint32_t tile_cache_size);
+            void SetSpatialIndex(const std::string& spatial_index);
+            void SetQuadMaxElements(uint32_t quad_max_elements);
+            void SetQuadMinDegrees(double quad_min_degrees);
+            void SetQuadReductionFactor(double quad_reduction_factor);
+            void SetQuadCapacityGrowth(double quad_capacity_growth);
+            void SetFitDecimationDistance(double fit_decimation_distance);
+            void SetFitDecimationHeading(double fit_decimation_heading);
+            void SetFitSegmentPoints(uint32_t fit_segment_points);
+            void SetFitSegmentOverlap(uint32_t fit_segment_overlap);
+            void SetFitSegmentThreads(uint32_t fit_segment_threads);
+            void SetErrorMaxSpeed(double error_max_speed);
+            void SetErrorJumpPoints(uint32_t error_jump_points);
             double GetQuadSWLat(void) const;
             double GetQuadSWLng(void) const;
             double GetQuadNELat(void) const;
@@ -97,6 +113,19 @@ namespace Config {
             double GetRandManhattanDistance(void) const;
             double GetRandOutDegree(void) const;
             bool IsPlotKML(void) const;
+            bool IsKMZ(void) const;
+            uint32_t GetKMLThreads(void) const;
+            double GetKMLTolerance(void) const;
+            uint32_t GetTileCacheSize(void) const;
+            const std::string& GetSpatialIndex(void) const;
+            const QuadParams& GetQuadParams(void) const;
+            double GetFitDecimationDistance(void) const;
+            double GetFitDecimationHeading(void) const;
+            uint32_t GetFitSegmentPoints(void) const;
+            uint32_t GetFitSegmentOverlap(void) const;
+            uint32_t GetFitSegmentThreads(void) const;
+            double GetErrorMaxSpeed(void) const;
+            uint32_t GetErrorJumpPoints(void) const;
 
             /**
              * \brief Print out the current configuration values to an output stream.
@@ -105,6 +134,34 @@ namespace Config {
              */
             void PrintConfig(std::ostream& stream) const;
 
+            /**
+             * \brief Compute a fingerprint of every configuration value that affects the de-identified output.
+             *
+             * Values are hashed at full precision, so any change to a parameter changes the fingerprint.
+             *
+             * \return the 64-bit fingerprint.
+             */
+            uint64_t Fingerprint(void) const;
+
+            /**
+             * \brief Predicate indicating another configuration makes the same map matching decisions as this one: the
+             * same quad bounds, GPS error filter, and map fitting parameters. Trips map matched under one can be
+             * de-identified under the other's detector and privacy parameters.
+             *
+             * \param other the configuration to compare.
+             * \return true if the map matching parameters are equal, false otherwise.
+             */
+            bool SharesMapMatching(const DIConfig& other) const;
+
+            /**
+             * \brief Compute a fingerprint of the configuration values that affect parsing and map matching: the input
+             * fields, the quad bounds, the GPS error filter, and the map fitting parameters. Map matching results made under one configuration
+             * can be reused under any other with the same fingerprint.
+             *
+             * \return the 64-bit fingerprint.
+             */
+            uint64_t MapMatchFingerprint(void) const;
+
             /**
              * \brief Set configuration values using the values in the specified file.
              *
@@ -146,10 +203,24 @@ namespace Config {
             double quad_ne_lat_                 = 42.431;
             double quad_ne_lng_                 = -83.54;
 
+            double error_max_speed_             = 44.7;         // meters per second (100 mph) beyond which a point is in error.
+            uint32_t error_jump_points_         = 0;            // longest run of jumping points removed; 0 checks only trip ends.
+
             bool plot_kml_                      = false;        // do not create KML files by default.
+            bool kmz_                           = false;        // write zipped KML (KMZ) files.
+            uint32_t kml_threads_               = 1;            // threads rendering KML files.
+            double kml_tolerance_               = 0.0;          // meters; 0 renders every nth point instead.
+            uint32_t tile_cache_size_           = 64;           // loaded map tiles kept when the map is tiled.
+            std::string spatial_index_          = "quad";       // index over an untiled map: quad or rtree.
+            QuadParams quad_params_;                            // shape of the quad trees built over the map.
             double fit_ext_                     = 5.0;          // meters.
             bool scale_map_fit_                 = false;        // do not scale boxes based on road type.
             double map_fit_scale_               = 1;
+            double fit_decimation_distance_     = 0.0;          // meters between fully fit points; 0 fits every point.
+            double fit_decimation_heading_      = 15.0;         // degrees of heading change that force a full fit.
+            uint32_t fit_segment_points_        = 0;            // trips longer than this are fit in segments; 0 fits trips whole.
+            uint32_t fit_segment_overlap_       = 100;          // points each segment's fitter fits before the segment.
+            uint32_t fit_segment_threads_       = 0;            // threads fitting segments, shared by all trips; 0 uses the thread count.
             uint32_t n_heading_groups_          = 36;           // 10 degree sectors.
             uint32_t min_edge_trip_points_      = 50;
 
@@ -173,6 +244,14 @@ namespace Config {
             double rand_direct_distance_        = 0.0;
             double rand_manhattan_distance_     = 0.0;
             double rand_out_degree_             = 0.0;
+
+            /**
+             * \brief Write the keys hashed by MapMatchFingerprint, one per line at full precision; Fingerprint hashes
+             * them followed by the rest of the keys that affect the output.
+             *
+             * \param stream where the keys are written.
+             */
+            void WriteMapMatchKeys(std::ostream& stream) const;
     };
 }
 
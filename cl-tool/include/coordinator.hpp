@@ -0,0 +1,183 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#ifndef COORDINATOR_HPP
+#define COORDINATOR_HPP
+
+#include "di_multi.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+
+namespace DIMulti {
+    /**
+     * \brief Hands out the trips of a manifest to cv_di worker processes over a Unix domain socket and journals their
+     * results, so that any number of workers on one host share a run with dynamic load balancing.
+     *
+     * Workers ask for trips as they have room for them, so faster workers take more of the manifest. The trips held by
+     * a worker whose connection drops (a crashed or killed worker) are given to other workers; a trip is reported as
+     * failed after kMaxAttempts workers were lost while holding it.
+     *
+     * The protocol is tab delimited lines. A worker sends "hello <pid>" once, then "next <n>" to ask for up to n trips,
+     * and one journal line (see Journal::FormatLine) per finished trip. The coordinator answers each "next" with one
+     * "trip <path> <aux data> <size>" line per trip followed by "end", or with "finish" when every trip is done.
+     */
+    class Coordinator {
+        public:
+            static const unsigned kMaxAttempts = 3;
+
+            /**
+             * \brief Start listening for workers.
+             *
+             * \param socket_path the path of the socket to create; a stale socket at this path is replaced.
+             * \param manifest_path a file having a trip file on each line.
+             * \param out_dir_path the directory for the run's journal.
+             * \param resume flag to skip the trip files finished in the journal of an earlier run.
+             * \throws invalid_argument if the manifest or journal cannot be opened or the socket cannot be created.
+             */
+            Coordinator(const std::string& socket_path, const std::string& manifest_path, const std::string& out_dir_path, bool resume);
+            ~Coordinator();
+
+            Coordinator(const Coordinator&) = delete;
+            Coordinator& operator=(const Coordinator&) = delete;
+
+            /**
+             * \brief Serve workers until every trip of the manifest has been finished.
+             */
+            void Run(void);
+
+            /**
+             * \brief Get the sum of the point counts reported by the workers, including the trips of a resumed run.
+             *
+             * \return the point counts.
+             */
+            const instrument::PointCounter& GetPointCounter(void) const;
+
+        private:
+            /**
+             * \brief A trip file waiting for or held by a worker.
+             */
+            struct Trip {
+                FileInfo::Ptr file_ptr;
+                unsigned attempts;                          ///< workers lost while holding this trip.
+            };
+
+            /**
+             * \brief A connected worker.
+             */
+            struct Worker {
+                std::string name;
+                std::string buffer;                         ///< received bytes not yet forming a whole line.
+                std::multimap<std::string, Trip> trips;     ///< held trips by input path.
+                unsigned requested;                         ///< trips asked for and not yet sent.
+                uint64_t n_done;
+                uint64_t n_failed;
+            };
+
+            std::string socket_path_;
+            std::ifstream manifest_;
+            uint64_t line_number_;
+            Journal::Ptr journal_ptr_;
+            int listen_fd_;
+            unsigned n_workers_;
+            std::map<int, Worker> workers_;
+            std::deque<Trip> pending_;
+            uint64_t n_done_;
+            uint64_t n_failed_;
+            instrument::PointCounter point_counter_;
+
+            bool HasPending(void);
+            bool IsFinished(void);
+            void Accept(void);
+            bool Receive(int fd, Worker& worker);
+            void HandleLine(Worker& worker, const std::string& line);
+            bool Serve(int fd, Worker& worker);
+            void Lose(int fd);
+    };
+
+    /**
+     * \brief A worker's connection to a Coordinator; supplies DICSV with trips and sends back their results.
+     */
+    class CoordinatorClient {
+        public:
+            using Ptr = std::shared_ptr<CoordinatorClient>;
+
+            /**
+             * \brief Connect to a coordinator.
+             *
+             * \param socket_path the coordinator's socket.
+             * \throws invalid_argument if the coordinator cannot be reached.
+             */
+            CoordinatorClient(const std::string& socket_path);
+            ~CoordinatorClient();
+
+            CoordinatorClient(const CoordinatorClient&) = delete;
+            CoordinatorClient& operator=(const CoordinatorClient&) = delete;
+
+            /**
+             * \brief Set the number of trips this worker holds at once.
+             *
+             * \param capacity the number of trips.
+             */
+            void SetCapacity(unsigned capacity);
+
+            /**
+             * \brief Get the next trip, waiting until this worker has room for it.
+             *
+             * \return the trip file, or nullptr once the coordinator has no more trips or cannot be reached.
+             */
+            FileInfo::Ptr NextItem(void);
+
+            /**
+             * \brief Report a trip file that was de-identified and written.
+             *
+             * \param input_path the path of the trip file as given in the manifest.
+             * \param uid the trip UID.
+             * \param output_path the path of the de-identified trip file.
+             * \param point_counter the point counts for this trip.
+             */
+            void ReportDone(const std::string& input_path, const std::string& uid, const std::string& output_path, const instrument::PointCounter& point_counter);
+
+            /**
+             * \brief Report a trip file that could not be de-identified.
+             *
+             * \param input_path the path of the trip file as given in the manifest.
+             * \param point_counter the point counts gathered before the failure.
+             */
+            void ReportFail(const std::string& input_path, const instrument::PointCounter& point_counter);
+
+        private:
+            int fd_;
+            unsigned capacity_;
+            unsigned n_held_;                               ///< trips handed out and not yet reported.
+            bool finished_;
+            bool lost_;
+            std::deque<FileInfo::Ptr> batch_;
+            std::string buffer_;
+            std::mutex mutex_;
+            std::condition_variable cond_;
+
+            bool ReadLine(std::string& line);
+            void Report(const std::string& line);
+    };
+}
+
+#endif
@@ -3,9 +3,19 @@
 
 #include "config.hpp"
 #include "cvlib.hpp"
+#include "journal.hpp"
+#include "fingerprint.hpp"
+#include "shard.hpp"
+#include "kml_pipeline.hpp"
+#include "topology.hpp"
+#include "match_cache.hpp"
+
+#include <atomic>
 #include "multi_thread.hpp"
 
 namespace DIMulti {
+    class CoordinatorClient;
+
     using IFSTPtr = std::shared_ptr<std::ifstream>;
 
     /**
@@ -87,25 +97,129 @@ namespace DIMulti {
             SingleBatchCSV(const std::string& file_path);
             virtual void Thread(unsigned thread_num, MultiThread::SharedQueue<FileInfo::Ptr>* q) = 0;
             FileInfo::Ptr NextItem(void);
+
+            /**
+             * \brief Get the 1-based manifest line of the trip file last returned by NextItem.
+             */
+            uint64_t GetLineNumber(void) const;
+
+            /**
+             * \brief Read the next trip file from a manifest; lines naming files that cannot be opened are reported and
+             * skipped.
+             *
+             * \param manifest the manifest stream, one trip file path (optionally followed by :<aux data>) per line.
+             * \param line_number the 1-based number of the last line read; updated as lines are read.
+             * \return the trip file, or nullptr at the end of the manifest.
+             */
+            static FileInfo::Ptr ReadItem(std::istream& manifest, uint64_t& line_number);
+        private:
+            uint64_t line_number_;
     };
 
     class DICSV : public SingleBatchCSV
     {
         public:
-            DICSV(const std::string& file_path, const std::string& quad_file_path, const std::string& out_dir_path, const std::string& config_file_path, const std::string& kml_dir_path, bool count_points=false);
+            DICSV(const std::string& file_path, const std::string& quad_file_path, const std::string& out_dir_path, const std::string& config_file_path, const std::string& kml_dir_path, bool count_points=false, bool resume=false, bool incremental=false, const Shard::Ptr& shard_ptr=nullptr, const std::shared_ptr<CoordinatorClient>& client_ptr=nullptr, bool numa=false, const std::string& sweep_file_path="", const std::string& sidecar_dir_path="");
             void Init(unsigned n_used_threads);
             void Close(void);
             void Thread(unsigned thread_num, MultiThread::SharedQueue<FileInfo::Ptr>* q);
+
+            /**
+             * \brief Get the next trip file from the coordinator when running as a worker; otherwise from the manifest,
+             * skipping the trip files of other shards and the trip files finished in a resumed run.
+             */
+            FileInfo::Ptr NextItem(void);
+
+            /**
+             * \brief Load every edge of a road network from a shapes (.quad) file or an OpenStreetMap .osm.pbf extract.
+             *
+             * \param map_file_path the map file.
+             * \return the edges.
+             */
+            static std::vector<geo::EdgeCPtr> LoadMap(const std::string& map_file_path);
+
+            /**
+             * \brief Build the trajectory of a trip file; files with the columnar extension are read as BSMP1 columnar
+             * files and all others as BSMP1 CSV files.
+             *
+             * \param trip_file_path the trip file.
+             * \param uid set to the UID of the trip.
+             * \param point_counter the counts to update; nullptr to not count points.
+             * \return the trajectory.
+             * \throws invalid_argument if the trip file cannot be read.
+             */
+            static trajectory::Trajectory MakeTrajectory(const std::string& trip_file_path, std::string& uid, instrument::PointCounter* point_counter = nullptr);
+
+            /**
+             * \brief Convert the CSV trip files of a manifest to BSMP1 columnar files named by trip UID, and write a
+             * manifest of the columnar files. Trip files that cannot be read are reported and skipped.
+             *
+             * \param manifest_path the manifest of CSV trip files.
+             * \param out_dir_path the existing directory for the columnar files.
+             * \param manifest_out the stream receiving the columnar manifest, one file path per line.
+             * \return the number of trip files converted.
+             * \throws invalid_argument if the manifest cannot be opened.
+             */
+            static size_t ConvertToColumnar(const std::string& manifest_path, const std::string& out_dir_path, std::ostream& manifest_out);
+
+            /**
+             * \brief Merge the shard journals of a sharded run into the run's journal and print the combined point
+             * summary.
+             *
+             * \param out_dir_path the output directory holding the shard journals.
+             * \param n_shards the number of shards in the run.
+             * \throws invalid_argument if a shard journal is missing or the journal cannot be written.
+             */
+            static void MergeShards(const std::string& out_dir_path, unsigned n_shards);
+
+            /**
+             * \brief Print a point summary to standard error.
+             *
+             * \param summary the point counts.
+             */
+            static void PrintPointSummary(const instrument::PointCounter& summary);
         private:
+            /**
+             * \brief One configuration of a parameter sweep, with its own output directories and point counts.
+             */
+            struct SweepVariant {
+                std::string name;
+                Config::DIConfig::Ptr config_ptr;
+                std::string out_dir_path;
+                std::string kml_dir_path;
+                std::vector<std::shared_ptr<instrument::PointCounter>> counters;    ///< one per thread.
+            };
+
             Config::DIConfig::Ptr config_ptr_;
             std::string out_dir_path_;
             std::string kml_dir_path_;
             bool count_points_;
-            Quad::Ptr quad_ptr_;
+            Shard::Ptr shard_ptr_;                          ///< nullptr unless running one shard of a manifest.
+            std::shared_ptr<CoordinatorClient> client_ptr_; ///< nullptr unless running as a worker.
+            Journal::Ptr journal_ptr_;                      ///< nullptr when running as a worker.
+            FingerprintDB::Ptr fingerprint_db_ptr_;         ///< nullptr unless running incrementally.
+            MatchCache::Ptr match_cache_ptr_;               ///< nullptr unless keeping map matching sidecars.
+            std::atomic<uint64_t> n_unchanged_;
+            unsigned n_threads_;                            ///< the number of threads de-identifying trips.
+            KMLPipeline::Ptr kml_pipeline_ptr_;             ///< nullptr unless plotting KML.
+            MultiThread::Topology::Ptr topology_ptr_;       ///< nullptr unless placing threads by NUMA node.
+            std::vector<spatial::EdgeIndex::CPtr> index_ptrs_;  ///< one per NUMA node; empty when the map is tiled.
+            std::vector<tiles::TileCache::Ptr> tile_cache_ptrs_;    ///< one per NUMA node; empty unless the map is tiled.
+            std::vector<SegmentPool::Ptr> segment_pools_;   ///< one per NUMA node; empty unless long trips are cut into segments.
             std::vector<std::shared_ptr<instrument::PointCounter>> counters_;
+            std::vector<SweepVariant> variants_;            ///< empty unless sweeping.
 
-            trajectory::Trajectory DeIdentify(trajectory::Trajectory& traj, const std::string& uid) const;
-            trajectory::Trajectory DeIdentify(trajectory::Trajectory& traj, const std::string& uid, instrument::PointCounter& point_counter) const;
+            void RecordDone(const std::string& input_path, const std::string& uid, const std::string& output_path, const instrument::PointCounter& point_counter);
+            void RecordFail(const std::string& input_path, const instrument::PointCounter& point_counter);
+            void LoadSweep(const std::string& sweep_file_path);
+            void Sweep(const std::string& input_path, unsigned thread_num, std::vector<BSMP1::BSMP1CSVTrajectoryWriter>& traj_writers);
+            trajectory::Trajectory Privatize(trajectory::Trajectory& traj, const std::string& uid, const Config::DIConfig& config, const std::string& kml_dir_path, const MapFitter::AreaSet& explicit_areas, const ImplicitMapFitter::AreaSet& implicit_areas, instrument::PointCounter& point_counter) const;
+            MapFitter MakeMapFitter(unsigned thread_num) const;
+            spatial::EdgeIndex::CPtr MakeIndex(const std::vector<geo::EdgeCPtr>& edges, const geo::Point& sw, const geo::Point& ne) const;
+            static std::vector<geo::EdgeCPtr> CopyEdges(const std::vector<geo::EdgeCPtr>& edges);
+            void MapMatch(trajectory::Trajectory& traj, const std::string& input_path, unsigned thread_num, MapFitter::AreaSet& explicit_areas, ImplicitMapFitter::AreaSet& implicit_areas, MapFitter::TileSet& held_tiles) const;
+            trajectory::Trajectory DeIdentify(trajectory::Trajectory& traj, const std::string& uid, const std::string& input_path, unsigned thread_num) const;
+            trajectory::Trajectory DeIdentify(trajectory::Trajectory& traj, const std::string& uid, const std::string& input_path, instrument::PointCounter& point_counter, unsigned thread_num) const;
     };
 }
 
@@ -0,0 +1,117 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#ifndef FINGERPRINT_HPP
+#define FINGERPRINT_HPP
+
+#include "cvlib.hpp"
+
+#include <fstream>
+#include <map>
+#include <mutex>
+
+namespace DIMulti {
+    /**
+     * \brief A local database of the trip files processed by previous runs, used to skip unchanged trips in
+     * incremental mode.
+     *
+     * Each trip file is keyed by its path and stored with a fingerprint of its contents and a fingerprint of the run
+     * (configuration and map) that produced its output. A trip is unchanged only when both fingerprints match and its
+     * output file still exists, so changing any parameter or the map invalidates every result made with the old value.
+     *
+     * Database lines are tab delimited: <input path> <input fingerprint> <run fingerprint> <uid> <output path> <point
+     * counts>. Each result is appended as it is recorded, so a run that stops early keeps the results it finished;
+     * the last line for a trip file wins, and Save rewrites the database with one line per trip file.
+     */
+    class FingerprintDB {
+        public:
+            using Ptr = std::shared_ptr<FingerprintDB>;
+
+            /**
+             * \brief A previously processed trip file.
+             */
+            struct Entry {
+                uint64_t input_fingerprint;
+                uint64_t run_fingerprint;
+                std::string uid;
+                std::string output_path;
+                instrument::PointCounter point_counter;
+            };
+
+            /**
+             * \brief Load the database at the provided path, a missing database is treated as empty, and open it for
+             * appending this run's results.
+             *
+             * \param file_path the path of the database file.
+             * \param run_fingerprint the fingerprint of the current run's configuration and map.
+             * \throws invalid_argument if the database cannot be written.
+             */
+            FingerprintDB(const std::string& file_path, uint64_t run_fingerprint);
+
+            /**
+             * \brief Compute the fingerprint of a trip file's contents.
+             *
+             * \param input_path the trip file.
+             * \return the fingerprint.
+             * \throws invalid_argument if the file cannot be opened.
+             */
+            static uint64_t InputFingerprint(const std::string& input_path);
+
+            /**
+             * \brief Find an up-to-date result for a trip file.
+             *
+             * \param input_path the path of the trip file as given in the manifest.
+             * \param input_fingerprint the fingerprint of the trip file's current contents.
+             * \param entry set to the stored entry when an up-to-date result is found.
+             * \return true if the trip is unchanged and its output exists, false otherwise.
+             */
+            bool FindUnchanged(const std::string& input_path, uint64_t input_fingerprint, Entry& entry) const;
+
+            /**
+             * \brief Record the result of processing a trip file in this run and append it to the database.
+             *
+             * \param input_path the path of the trip file as given in the manifest.
+             * \param input_fingerprint the fingerprint of the trip file's contents.
+             * \param uid the trip UID.
+             * \param output_path the path of the de-identified trip file.
+             * \param point_counter the point counts for this trip.
+             */
+            void Update(const std::string& input_path, uint64_t input_fingerprint, const std::string& uid, const std::string& output_path, const instrument::PointCounter& point_counter);
+
+            /**
+             * \brief Rewrite the database with one line per trip file; the file is replaced only once the new contents
+             * are completely written.
+             *
+             * \throws invalid_argument if the database cannot be written.
+             */
+            void Save(void);
+
+        private:
+            std::string file_path_;
+            uint64_t run_fingerprint_;
+            mutable std::mutex mutex_;
+            std::map<std::string, Entry> entries_;
+            std::ofstream file_;                            ///< the database, open for appending.
+
+            void Rewrite(void);
+            static std::string FormatLine(const std::string& input_path, const Entry& entry);
+    };
+}
+
+#endif
@@ -0,0 +1,151 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#ifndef JOURNAL_HPP
+#define JOURNAL_HPP
+
+#include "cvlib.hpp"
+
+#include <fstream>
+#include <mutex>
+
+namespace DIMulti {
+    /**
+     * \brief A checkpoint journal for a batch run. Each finished trip file is appended to the journal as a single
+     * line, with its output location and point counts, so an interrupted run can be resumed without redoing the trips
+     * that were already finished.
+     *
+     * Journal lines are tab delimited: <status> <input path> <uid> <output path> <point counts>; status is "done" for
+     * de-identified trips and "fail" for trips that raised an error.
+     */
+    class Journal {
+        public:
+            using Ptr = std::shared_ptr<Journal>;
+
+            /**
+             * \brief The totals of a merged journal.
+             */
+            struct MergeSummary {
+                uint64_t n_done;
+                uint64_t n_failed;
+                instrument::PointCounter point_counter;
+            };
+
+            /**
+             * \brief Open the journal at the provided path.
+             *
+             * When resuming, the valid entries of an existing journal are loaded and the journal is rewritten without
+             * any torn trailing line; entries whose output file is missing are dropped so those trips are redone.
+             * Otherwise the journal is truncated.
+             *
+             * \param file_path the path of the journal file.
+             * \param resume flag to load the existing journal.
+             * \throws invalid_argument if the journal cannot be opened.
+             */
+            Journal(const std::string& file_path, bool resume);
+
+            /**
+             * \brief Predicate indicating the trip file was finished in a previous run.
+             *
+             * \param input_path the path of the trip file as given in the manifest.
+             * \return true if the trip file is in the loaded journal, false otherwise.
+             */
+            bool IsFinished(const std::string& input_path) const;
+
+            /**
+             * \brief Record a trip file that was de-identified and written.
+             *
+             * \param input_path the path of the trip file as given in the manifest.
+             * \param uid the trip UID.
+             * \param output_path the path of the de-identified trip file.
+             * \param point_counter the point counts for this trip.
+             */
+            void RecordDone(const std::string& input_path, const std::string& uid, const std::string& output_path, const instrument::PointCounter& point_counter);
+
+            /**
+             * \brief Record a trip file that could not be de-identified.
+             *
+             * \param input_path the path of the trip file as given in the manifest.
+             * \param point_counter the point counts gathered before the failure.
+             */
+            void RecordFail(const std::string& input_path, const instrument::PointCounter& point_counter);
+
+            /**
+             * \brief Get the sum of the point counts of the trips finished in previous runs.
+             *
+             * \return the point counts.
+             */
+            const instrument::PointCounter& GetResumedCounter(void) const;
+
+            /**
+             * \brief Get the number of trips finished in previous runs.
+             *
+             * \return the number of trips.
+             */
+            uint64_t GetResumedCount(void) const;
+
+            /**
+             * \brief Format a journal line, without the line terminator.
+             *
+             * \param status "done" or "fail".
+             * \param input_path the path of the trip file as given in the manifest.
+             * \param uid the trip UID; empty for failed trips.
+             * \param output_path the path of the de-identified trip file; empty for failed trips.
+             * \param point_counter the point counts for this trip.
+             * \return the line.
+             */
+            static std::string FormatLine(const std::string& status, const std::string& input_path, const std::string& uid, const std::string& output_path, const instrument::PointCounter& point_counter);
+
+            /**
+             * \brief Parse a journal line.
+             *
+             * \param line the line, without the line terminator.
+             * \param parts set to the line's fields: status, input path, uid, output path, and point counts.
+             * \param point_counter set to the line's point counts.
+             * \return true if the line is valid, false otherwise.
+             */
+            static bool ParseLine(const std::string& line, StrVector& parts, instrument::PointCounter& point_counter);
+
+            /**
+             * \brief Combine the journals of the shards of a sharded run into one journal.
+             *
+             * Torn trailing lines and invalid lines are skipped as they are when resuming. Since shards process
+             * disjoint trips, the merged journal is the index of every output file of the run and its point counts
+             * sum to the counts of the whole run.
+             *
+             * \param shard_file_paths the shard journals.
+             * \param file_path the path of the merged journal.
+             * \return the number of trips and the point counts in the merged journal.
+             * \throws invalid_argument if a shard journal is missing or the merged journal cannot be written.
+             */
+            static MergeSummary Merge(const std::vector<std::string>& shard_file_paths, const std::string& file_path);
+
+        private:
+            std::string file_path_;
+            std::ofstream file_;
+            std::mutex mutex_;
+            std::unordered_set<std::string> finished_;
+            instrument::PointCounter resumed_counter_;
+
+            void Load(void);
+            void Append(const std::string& status, const std::string& input_path, const std::string& uid, const std::string& output_path, const instrument::PointCounter& point_counter);
+    };
+}
+
+#endif
@@ -0,0 +1,107 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#ifndef KML_PIPELINE_HPP
+#define KML_PIPELINE_HPP
+
+#include "cvlib.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <thread>
+
+namespace DIMulti {
+    /**
+     * \brief The data needed to render the KML file of one de-identified trip.
+     *
+     * The capture only copies shared pointers; none of the captured points, areas, or intervals are modified after a
+     * trip has been de-identified, so rendering can happen later on another thread.
+     */
+    struct KMLJob {
+        using Ptr = std::shared_ptr<KMLJob>;
+
+        std::string uid;
+        std::string file_path;                              ///< .kml or .kmz output path.
+        bool kmz = false;
+        double tolerance = 0.0;                             ///< simplification tolerance in meters.
+        trajectory::Trajectory traj;
+        MapFitter::AreaSet explicit_areas;
+        MapFitter::AreaSet implicit_areas;
+        trajectory::Interval::PtrList stop_intervals;
+        trajectory::Interval::PtrList ta_intervals;
+        trajectory::Interval::PtrList priv_intervals;
+    };
+
+    /**
+     * \brief A small pool of low priority threads that render KML files off the de-identification critical path.
+     *
+     * Submitting blocks when too many jobs are pending so captured trips cannot accumulate without bound.
+     */
+    class KMLPipeline {
+        public:
+            using Ptr = std::shared_ptr<KMLPipeline>;
+
+            /**
+             * \brief Start the rendering threads.
+             *
+             * \param n_threads the number of rendering threads (at least one is used).
+             * \param max_pending the number of jobs that can wait before Submit blocks.
+             */
+            KMLPipeline(unsigned n_threads, std::size_t max_pending = 64);
+
+            /**
+             * \brief Finish the pending jobs and stop the threads.
+             */
+            ~KMLPipeline();
+
+            /**
+             * \brief Queue a job for rendering.
+             *
+             * \param job_ptr the captured trip data.
+             */
+            void Submit(KMLJob::Ptr job_ptr);
+
+            /**
+             * \brief Render all pending jobs and stop the threads; later jobs are rendered synchronously.
+             */
+            void Finish(void);
+
+            /**
+             * \brief Render a job into a buffer and write it to its KML or KMZ file with a single write.
+             *
+             * \param job the captured trip data.
+             * \throws invalid_argument if the output file cannot be opened.
+             */
+            static void Render(const KMLJob& job);
+
+        private:
+            std::mutex mutex_;
+            std::condition_variable not_empty_;
+            std::condition_variable not_full_;
+            std::queue<KMLJob::Ptr> jobs_;
+            std::size_t max_pending_;
+            bool done_;
+            std::vector<std::thread> threads_;
+
+            void Worker(void);
+    };
+}
+
+#endif
@@ -0,0 +1,95 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#ifndef MATCH_CACHE_HPP
+#define MATCH_CACHE_HPP
+
+#include "cvlib.hpp"
+
+#include <atomic>
+
+namespace DIMulti {
+    /**
+     * \brief A directory of map matching sidecar files, one per trip file, that lets a later run skip map matching
+     * when only the detector or privacy parameters changed.
+     *
+     * A sidecar holds a trip's fit edges, explicit and implicit, with their geometry, and the cumulative out-degree of
+     * each point. It is named and stamped with a key made from the map and the parsing and map matching parameters,
+     * and with a fingerprint of the trip file's contents; a sidecar is used only when both still match and it
+     * describes the same number of points as the error corrected trip.
+     */
+    class MatchCache {
+        public:
+            using Ptr = std::shared_ptr<MatchCache>;
+
+            /**
+             * \brief Use the sidecars in an existing directory.
+             *
+             * \param dir_path the sidecar directory.
+             * \param match_key the key of the map and the parsing and map matching parameters.
+             * \param fit_width_scaling the map fitter's scale applied to the way widths; used to rebuild the fit areas.
+             * \param fit_extension the map fitter's area extension; used to rebuild the fit areas.
+             * \throws invalid_argument if the directory does not exist.
+             */
+            MatchCache(const std::string& dir_path, uint64_t match_key, double fit_width_scaling, double fit_extension);
+
+            /**
+             * \brief Get the path of the sidecar for a trip file.
+             *
+             * \param input_path the path of the trip file as given in the manifest.
+             * \return the sidecar path.
+             */
+            std::string SidecarPath(const std::string& input_path) const;
+
+            /**
+             * \brief Restore the map matching of an error corrected trip from its sidecar.
+             *
+             * \param input_path the path of the trip file as given in the manifest.
+             * \param input_fingerprint the fingerprint of the trip file's contents.
+             * \param traj the trip; its points are given their fit edges and out-degrees.
+             * \param explicit_areas set to the areas of the explicit fit edges.
+             * \param implicit_areas set to the areas of the implicit fit edges.
+             * \return true if the sidecar was found and current, false otherwise; the trip is unchanged when false.
+             */
+            bool Load(const std::string& input_path, uint64_t input_fingerprint, trajectory::Trajectory& traj, MapFitter::AreaSet& explicit_areas, ImplicitMapFitter::AreaSet& implicit_areas);
+
+            /**
+             * \brief Write the sidecar of a map matched trip; the file is replaced only once it is completely written.
+             *
+             * \param input_path the path of the trip file as given in the manifest.
+             * \param input_fingerprint the fingerprint of the trip file's contents.
+             * \param traj the map matched trip with its out-degrees counted.
+             * \throws invalid_argument if the sidecar cannot be written.
+             */
+            void Store(const std::string& input_path, uint64_t input_fingerprint, const trajectory::Trajectory& traj);
+
+            uint64_t GetHits(void) const;
+            uint64_t GetStores(void) const;
+
+        private:
+            std::string dir_path_;
+            uint64_t match_key_;
+            double fit_width_scaling_;
+            double fit_extension_;
+            std::atomic<uint64_t> n_hits_;
+            std::atomic<uint64_t> n_stores_;
+    };
+}
+
+#endif
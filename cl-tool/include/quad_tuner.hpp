@@ -0,0 +1,112 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#ifndef QUAD_TUNER_HPP
+#define QUAD_TUNER_HPP
+
+#include "cvlib.hpp"
+#include "config.hpp"
+
+namespace DIMulti {
+    /**
+     * \brief Searches for the quad tree parameters that map match a sample of trips fastest on one map.
+     *
+     * Every candidate setting builds a quad tree over the map and map matches the sample trips with it. A setting is
+     * only eligible if it misses no more candidate edges than the configured setting does: a sample point misses when
+     * the leaf that holds it lacks an edge whose fit area contains the point.
+     */
+    class QuadTuner {
+        public:
+            /**
+             * \brief How one setting performed on the sample trips.
+             */
+            struct Trial {
+                QuadParams params;
+                double build_ms = 0.0;              ///< milliseconds to build the tree.
+                double fit_ms = 0.0;                ///< milliseconds to map match every sample trip; the best of up to three runs.
+                double candidates = 0.0;            ///< the mean number of edges in the leaf of a sample point.
+                uint64_t misses = 0;                ///< sample points whose leaf lacks an edge whose fit area contains them.
+                QuadReport report;
+            };
+
+            /**
+             * \brief Load the map to tune for.
+             *
+             * \param map_file_path the map as given to --quad; tiled maps and map images are not supported.
+             * \param config_ptr the configuration giving the quad bounds, the map fitting parameters, and the setting to
+             * improve on.
+             * \throws invalid_argument if the map is tiled or cannot be loaded.
+             */
+            QuadTuner(const std::string& map_file_path, const Config::DIConfig::Ptr& config_ptr);
+
+            /**
+             * \brief Parse and error correct up to a number of trips spread evenly through a manifest.
+             *
+             * \param manifest_path the manifest of trip files, one per line.
+             * \param max_trips the number of trips to sample.
+             * \return the number of trips loaded.
+             */
+            size_t LoadTrips(const std::string& manifest_path, size_t max_trips);
+
+            /**
+             * \brief Build a quad tree with the given parameters and map match the sample trips with it.
+             *
+             * \param params the parameters to try.
+             * \return the trial.
+             */
+            Trial Evaluate(const QuadParams& params) const;
+
+            /**
+             * \brief Evaluate the configured setting and every candidate, writing a line per trial to a stream.
+             *
+             * \param stream where the trials are reported.
+             * \return the fastest eligible trial.
+             */
+            Trial Tune(std::ostream& stream) const;
+
+            /**
+             * \brief Make the settings to try around a configured one: a grid over the leaf capacity, the minimum quad
+             * size, the reduction factor, which sets the margin for roads near a leaf's edge, and the capacity growth.
+             *
+             * \param base the configured setting.
+             * \return the settings, starting with base.
+             */
+            static std::vector<QuadParams> Candidates(const QuadParams& base);
+
+            /**
+             * \brief Write a configuration file with the quad parameters replaced by the tuned ones.
+             *
+             * \param config_file_path the configuration to copy; empty to write only the quad parameters.
+             * \param out_path the file to write.
+             * \param params the tuned parameters.
+             * \throws invalid_argument if either file cannot be opened.
+             */
+            static void WriteConfig(const std::string& config_file_path, const std::string& out_path, const QuadParams& params);
+
+        private:
+            Config::DIConfig::Ptr config_ptr_;
+            std::vector<geo::EdgeCPtr> edges_;
+            geo::Point sw_;
+            geo::Point ne_;
+            std::vector<trajectory::Trajectory> trips_;
+            std::vector<std::vector<geo::EdgeCPtr>> containing_edges_;  ///< for each sample point, in trip order, the edges whose fit areas contain it.
+    };
+}
+
+#endif
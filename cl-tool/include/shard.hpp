@@ -0,0 +1,107 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#ifndef SHARD_HPP
+#define SHARD_HPP
+
+#include "cvlib.hpp"
+
+namespace DIMulti {
+    /**
+     * \brief Static assignment of the trips in one manifest to one of several independent runs (shards), so that many
+     * nodes can each de-identify a disjoint part of the manifest without coordinating.
+     *
+     * A trip's shard depends only on its key and the shard count: the FNV-1a hash of the trip UID (the first data line
+     * of a BSMP1 CSV file, see BSMP1CSVTrajectoryFactory::make_uid), or the trip's line number in the manifest. The
+     * assignment is therefore the same on every rerun. Trip files whose UID cannot be read cheaply (columnar files,
+     * unreadable files) are keyed by their path instead.
+     */
+    class Shard {
+        public:
+            using Ptr = std::shared_ptr<Shard>;
+
+            enum class KeyType { UID, LINE };
+
+            /**
+             * \brief Construct a shard.
+             *
+             * \param index this shard's index, 0 to count - 1.
+             * \param count the number of shards.
+             * \param key_type what trips are assigned by.
+             * \throws invalid_argument if count is zero or the index is not less than count.
+             */
+            Shard(unsigned index, unsigned count, KeyType key_type);
+
+            /**
+             * \brief Make a shard from its command line form.
+             *
+             * \param spec the shard as "<index>/<count>", e.g. "0/8".
+             * \param key_name "uid" or "line".
+             * \return the shard.
+             * \throws invalid_argument if either argument is malformed.
+             */
+            static Ptr FromString(const std::string& spec, const std::string& key_name);
+
+            /**
+             * \brief Predicate indicating a trip file belongs to this shard.
+             *
+             * \param line_number the 1-based manifest line of the trip file.
+             * \param trip_file_path the path of the trip file.
+             * \return true if this shard should process the trip, false otherwise.
+             */
+            bool IsAssigned(uint64_t line_number, const std::string& trip_file_path) const;
+
+            unsigned GetIndex(void) const;
+            unsigned GetCount(void) const;
+
+            /**
+             * \brief Get the name of this shard's copy of a per-run file, e.g. cv_di.journal becomes
+             * cv_di.shard-0-of-8.journal.
+             *
+             * \param file_name the name used by an unsharded run.
+             * \return the shard's file name.
+             */
+            std::string FileName(const std::string& file_name) const;
+
+            /**
+             * \brief Get the name of a shard's copy of a per-run file.
+             *
+             * \param file_name the name used by an unsharded run.
+             * \param index the shard index.
+             * \param count the number of shards.
+             * \return the shard's file name.
+             */
+            static std::string FileName(const std::string& file_name, unsigned index, unsigned count);
+
+            /**
+             * \brief Get the key a trip file is assigned by when sharding by UID.
+             *
+             * \param trip_file_path the path of the trip file.
+             * \return the trip UID, or the path when the UID cannot be read.
+             */
+            static std::string TripKey(const std::string& trip_file_path);
+
+        private:
+            unsigned index_;
+            unsigned count_;
+            KeyType key_type_;
+    };
+}
+
+#endif
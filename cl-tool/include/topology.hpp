@@ -0,0 +1,94 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#ifndef TOPOLOGY_HPP
+#define TOPOLOGY_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace MultiThread {
+    /**
+     * \brief The NUMA nodes of this machine and the CPUs of each that this process may run on, used to pin worker
+     * threads and to place one copy of the read-only map on each node.
+     *
+     * Threads are spread round robin across the nodes and pinned to one CPU each, so thread i runs on node
+     * i % NodeCount(). Memory a pinned thread touches first is allocated on its node by the kernel's default policy,
+     * which is what keeps per-node map copies and per-thread allocations node-local.
+     */
+    class Topology {
+        public:
+            using Ptr = std::shared_ptr<Topology>;
+
+            /**
+             * \brief A NUMA node.
+             */
+            struct Node {
+                unsigned id;
+                std::vector<unsigned> cpus;
+            };
+
+            /**
+             * \brief Read the topology from /sys/devices/system/node; when there is no NUMA information the machine
+             * is a single node. Only the CPUs in this process's affinity mask are used.
+             */
+            Topology();
+
+            size_t NodeCount(void) const;
+            const Node& GetNode(size_t index) const;
+
+            /**
+             * \brief Get the node index a worker thread runs on.
+             *
+             * \param thread_num the thread's number.
+             * \return the node index.
+             */
+            size_t ThreadNode(unsigned thread_num) const;
+
+            /**
+             * \brief Get the CPU a worker thread is pinned to.
+             *
+             * \param thread_num the thread's number.
+             * \return the CPU number.
+             */
+            unsigned ThreadCPU(unsigned thread_num) const;
+
+            /**
+             * \brief Restrict the calling thread to a set of CPUs.
+             *
+             * \param cpus the CPUs.
+             * \return true if the thread was pinned, false if pinning is not supported or failed.
+             */
+            static bool PinCurrentThread(const std::vector<unsigned>& cpus);
+
+            /**
+             * \brief Parse a sysfs CPU list, e.g. "0-3,8-11".
+             *
+             * \param cpu_list the list.
+             * \return the CPU numbers.
+             */
+            static std::vector<unsigned> ParseCPUList(const std::string& cpu_list);
+
+        private:
+            std::vector<Node> nodes_;
+    };
+}
+
+#endif
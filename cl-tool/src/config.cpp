@@ -19,6 +19,8 @@
  *******************************************************************************/
 #include "config.hpp"
 #include <algorithm>
+#include <iomanip>
+#include <stdexcept>
 
 namespace Config {
     DIConfig::DIConfig() {}
@@ -151,6 +153,102 @@ namespace Config {
         plot_kml_ = plot_kml;
     }
 
+    void DIConfig::ToggleKMZ(bool kmz) {
+        kmz_ = kmz;
+    }
+
+    void DIConfig::SetKMLThreads(uint32_t kml_threads) {
+        kml_threads_ = kml_threads;
+    }
+
+    void DIConfig::SetKMLTolerance(double kml_tolerance) {
+        kml_tolerance_ = kml_tolerance;
+    }
+
+    void DIConfig::SetTileCacheSize(uint32_t tile_cache_size) {
+        tile_cache_size_ = tile_cache_size;
+    }
+
+    void DIConfig::SetSpatialIndex(const std::string& spatial_index) {
+        if (spatial_index != "quad" && spatial_index != "rtree") {
+            throw std::invalid_argument("Unknown spatial index: " + spatial_index);
+        }
+
+        spatial_index_ = spatial_index;
+    }
+
+    void DIConfig::SetQuadMaxElements(uint32_t quad_max_elements) {
+        if (quad_max_elements < 1) {
+            throw std::invalid_argument("The quad leaf capacity must be at least 1.");
+        }
+
+        quad_params_.max_elements = quad_max_elements;
+    }
+
+    void DIConfig::SetQuadMinDegrees(double quad_min_degrees) {
+        if (!(quad_min_degrees > 0.0)) {
+            throw std::invalid_argument("The quad minimum size must be positive.");
+        }
+
+        quad_params_.min_degrees = quad_min_degrees;
+    }
+
+    void DIConfig::SetQuadReductionFactor(double quad_reduction_factor) {
+        if (!(quad_reduction_factor > 0.0)) {
+            throw std::invalid_argument("The quad reduction factor must be positive.");
+        }
+
+        quad_params_.reduction_factor = quad_reduction_factor;
+    }
+
+    void DIConfig::SetQuadCapacityGrowth(double quad_capacity_growth) {
+        if (!(quad_capacity_growth > 0.0)) {
+            throw std::invalid_argument("The quad capacity growth must be positive.");
+        }
+
+        quad_params_.capacity_growth = quad_capacity_growth;
+    }
+
+    void DIConfig::SetFitDecimationDistance(double fit_decimation_distance) {
+        if (!(fit_decimation_distance >= 0.0)) {
+            throw std::invalid_argument("The fit decimation distance must not be negative.");
+        }
+
+        fit_decimation_distance_ = fit_decimation_distance;
+    }
+
+    void DIConfig::SetFitDecimationHeading(double fit_decimation_heading) {
+        if (!(fit_decimation_heading > 0.0)) {
+            throw std::invalid_argument("The fit decimation heading must be positive.");
+        }
+
+        fit_decimation_heading_ = fit_decimation_heading;
+    }
+
+    void DIConfig::SetFitSegmentPoints(uint32_t fit_segment_points) {
+        fit_segment_points_ = fit_segment_points;
+    }
+
+    void DIConfig::SetFitSegmentOverlap(uint32_t fit_segment_overlap) {
+        fit_segment_overlap_ = fit_segment_overlap;
+    }
+
+    void DIConfig::SetFitSegmentThreads(uint32_t fit_segment_threads) {
+        fit_segment_threads_ = fit_segment_threads;
+    }
+
+    void DIConfig::SetErrorMaxSpeed(double error_max_speed) {
+        if (!(error_max_speed > 0.0)) {
+            throw std::invalid_argument("The error max speed must be positive.");
+        }
+
+        error_max_speed_ = error_max_speed;
+    }
+
+    void DIConfig::SetErrorJumpPoints(uint32_t error_jump_points) {
+        error_jump_points_ = error_jump_points;
+    }
+
     const std::string& DIConfig::GetLatField(void) const {
         return lat_field_;
     }
@@ -279,6 +377,58 @@ namespace Config {
         return plot_kml_;
     }
 
+    bool DIConfig::IsKMZ(void) const {
+        return kmz_;
+    }
+
+    uint32_t DIConfig::GetKMLThreads(void) const {
+        return kml_threads_;
+    }
+
+    double DIConfig::GetKMLTolerance(void) const {
+        return kml_tolerance_;
+    }
+
+    uint32_t DIConfig::GetTileCacheSize(void) const {
+        return tile_cache_size_;
+    }
+
+    const std::string& DIConfig::GetSpatialIndex(void) const {
+        return spatial_index_;
+    }
+
+    const QuadParams& DIConfig::GetQuadParams(void) const {
+        return quad_params_;
+    }
+
+    double DIConfig::GetFitDecimationDistance(void) const {
+        return fit_decimation_distance_;
+    }
+
+    double DIConfig::GetFitDecimationHeading(void) const {
+        return fit_decimation_heading_;
+    }
+
+    uint32_t DIConfig::GetFitSegmentPoints(void) const {
+        return fit_segment_points_;
+    }
+
+    uint32_t DIConfig::GetFitSegmentOverlap(void) const {
+        return fit_segment_overlap_;
+    }
+
+    uint32_t DIConfig::GetFitSegmentThreads(void) const {
+        return fit_segment_threads_;
+    }
+
+    double DIConfig::GetErrorMaxSpeed(void) const {
+        return error_max_speed_;
+    }
+
+    uint32_t DIConfig::GetErrorJumpPoints(void) const {
+        return error_jump_points_;
+    }
+
     DIConfig::Ptr DIConfig::ConfigFromFile(const std::string& config_file_path) {
         std::ifstream file(config_file_path);
         DIConfig::Ptr config_ptr;
@@ -356,6 +506,38 @@ namespace Config {
                     config_ptr->SetQuadNELng(std::stod(parts[1]));
                 } else if (parts[0] == "plot_kml") {
                     config_ptr->TogglePlotKML(!!std::stoi(parts[1]));
+                } else if (parts[0] == "kmz") {
+                    config_ptr->ToggleKMZ(!!std::stoi(parts[1]));
+                } else if (parts[0] == "kml_threads") {
+                    config_ptr->SetKMLThreads(std::stoul(parts[1]));
+                } else if (parts[0] == "kml_tolerance") {
+                    config_ptr->SetKMLTolerance(std::stod(parts[1]));
+                } else if (parts[0] == "tile_cache_size") {
+                    config_ptr->SetTileCacheSize(std::stoul(parts[1]));
+                } else if (parts[0] == "spatial_index") {
+                    config_ptr->SetSpatialIndex(string_utilities::strip(parts[1]));
+                } else if (parts[0] == "quad_max_elements") {
+                    config_ptr->SetQuadMaxElements(std::stoul(parts[1]));
+                } else if (parts[0] == "quad_min_degrees") {
+                    config_ptr->SetQuadMinDegrees(std::stod(parts[1]));
+                } else if (parts[0] == "quad_reduction_factor") {
+                    config_ptr->SetQuadReductionFactor(std::stod(parts[1]));
+                } else if (parts[0] == "quad_capacity_growth") {
+                    config_ptr->SetQuadCapacityGrowth(std::stod(parts[1]));
+                } else if (parts[0] == "fit_decimation_distance") {
+                    config_ptr->SetFitDecimationDistance(std::stod(parts[1]));
+                } else if (parts[0] == "fit_decimation_heading") {
+                    config_ptr->SetFitDecimationHeading(std::stod(parts[1]));
+                } else if (parts[0] == "fit_segment_points") {
+                    config_ptr->SetFitSegmentPoints(std::stoul(parts[1]));
+                } else if (parts[0] == "fit_segment_overlap") {
+                    config_ptr->SetFitSegmentOverlap(std::stoul(parts[1]));
+                } else if (parts[0] == "fit_segment_threads") {
+                    config_ptr->SetFitSegmentThreads(std::stoul(parts[1]));
+                } else if (parts[0] == "error_max_speed") {
+                    config_ptr->SetErrorMaxSpeed(std::stod(parts[1]));
+                } else if (parts[0] == "error_jump_points") {
+                    config_ptr->SetErrorJumpPoints(std::stoul(parts[1]));
                 } else {
                     std::cerr << "Ignoring configuration line: " + line << std::endl;
                 }
@@ -375,8 +557,15 @@ namespace Config {
         stream << "Quad SW longitude: " << quad_sw_lng_ << std::endl;
         stream << "Quad NE latitude: " << quad_ne_lat_ << std::endl;
         stream << "Quad NE longitude: " << quad_ne_lng_ << std::endl;
+        stream << "Error max speed: " << error_max_speed_ << std::endl;
+        stream << "Error jump points: " << error_jump_points_ << std::endl;
         stream << "Fit extension: " << fit_ext_  << std::endl;
         stream << "Scale map fit: " << scale_map_fit_  << std::endl;
+        stream << "Fit decimation distance: " << fit_decimation_distance_ << std::endl;
+        stream << "Fit decimation heading: " << fit_decimation_heading_ << std::endl;
+        stream << "Fit segment points: " << fit_segment_points_ << std::endl;
+        stream << "Fit segment overlap: " << fit_segment_overlap_ << std::endl;
+        stream << "Fit segment threads: " << fit_segment_threads_ << std::endl;
         stream << "N Heading groups: " << n_heading_groups_ << std::endl;
         stream << "Min edge trip points: " << min_edge_trip_points_ << std::endl;
         stream << "TA max queue size: " << ta_max_q_size_ << std::endl;
@@ -395,6 +584,90 @@ namespace Config {
         stream << "Rand manhattan distance: " << rand_manhattan_distance_ << std::endl; 
         stream << "Rand out degree: " << rand_out_degree_ << std::endl; 
         stream << "Plot KML: " << plot_kml_ << std::endl;
+        stream << "KMZ: " << kmz_ << std::endl;
+        stream << "KML threads: " << kml_threads_ << std::endl;
+        stream << "KML tolerance: " << kml_tolerance_ << std::endl;
+        stream << "Tile cache size: " << tile_cache_size_ << std::endl;
+        stream << "Spatial index: " << spatial_index_ << std::endl;
+        stream << "Quad max elements: " << quad_params_.max_elements << std::endl;
+        stream << "Quad min degrees: " << quad_params_.min_degrees << std::endl;
+        stream << "Quad reduction factor: " << quad_params_.reduction_factor << std::endl;
+        stream << "Quad capacity growth: " << quad_params_.capacity_growth << std::endl;
         stream << "*****************************************************************************************" << std::endl;
     }
+
+    bool DIConfig::SharesMapMatching(const DIConfig& other) const {
+        return quad_sw_lat_ == other.quad_sw_lat_ && quad_sw_lng_ == other.quad_sw_lng_ && quad_ne_lat_ == other.quad_ne_lat_ && quad_ne_lng_ == other.quad_ne_lng_ &&
+               error_max_speed_ == other.error_max_speed_ && error_jump_points_ == other.error_jump_points_ &&
+               fit_ext_ == other.fit_ext_ && scale_map_fit_ == other.scale_map_fit_ && map_fit_scale_ == other.map_fit_scale_ &&
+               fit_decimation_distance_ == other.fit_decimation_distance_ && fit_decimation_heading_ == other.fit_decimation_heading_ &&
+               n_heading_groups_ == other.n_heading_groups_ && min_edge_trip_points_ == other.min_edge_trip_points_ &&
+               spatial_index_ == other.spatial_index_ && quad_params_.max_elements == other.quad_params_.max_elements &&
+               quad_params_.min_degrees == other.quad_params_.min_degrees && quad_params_.reduction_factor == other.quad_params_.reduction_factor &&
+               quad_params_.capacity_growth == other.quad_params_.capacity_growth;
+    }
+
+    void DIConfig::WriteMapMatchKeys(std::ostream& stream) const {
+        stream << std::setprecision(17);
+        stream << "lat_field:" << lat_field_ << "\n";
+        stream << "lon_field:" << lon_field_ << "\n";
+        stream << "heading_field:" << heading_field_ << "\n";
+        stream << "speed_field:" << speed_field_ << "\n";
+        stream << "gentime_field:" << gentime_field_ << "\n";
+        stream << "uid_fields:" << uid_fields_ << "\n";
+        stream << "quad_sw_lat:" << quad_sw_lat_ << "\n";
+        stream << "quad_sw_lng:" << quad_sw_lng_ << "\n";
+        stream << "quad_ne_lat:" << quad_ne_lat_ << "\n";
+        stream << "quad_ne_lng:" << quad_ne_lng_ << "\n";
+        stream << "error_max_speed:" << error_max_speed_ << "\n";
+        stream << "error_jump_points:" << error_jump_points_ << "\n";
+        stream << "spatial_index:" << spatial_index_ << "\n";
+        stream << "quad_max_elements:" << quad_params_.max_elements << "\n";
+        stream << "quad_min_degrees:" << quad_params_.min_degrees << "\n";
+        stream << "quad_reduction_factor:" << quad_params_.reduction_factor << "\n";
+        stream << "quad_capacity_growth:" << quad_params_.capacity_growth << "\n";
+        stream << "fit_ext:" << fit_ext_ << "\n";
+        stream << "scale_map_fit:" << scale_map_fit_ << "\n";
+        stream << "map_fit_scale:" << map_fit_scale_ << "\n";
+        stream << "fit_decimation_distance:" << fit_decimation_distance_ << "\n";
+        stream << "fit_decimation_heading:" << fit_decimation_heading_ << "\n";
+        stream << "n_heading_groups:" << n_heading_groups_ << "\n";
+        stream << "min_edge_trip_points:" << min_edge_trip_points_ << "\n";
+    }
+
+    uint64_t DIConfig::MapMatchFingerprint() const {
+        std::stringstream ss;
+        WriteMapMatchKeys(ss);
+
+        return hash_utilities::fnv1a(ss.str());
+    }
+
+    uint64_t DIConfig::Fingerprint() const {
+        std::stringstream ss;
+        WriteMapMatchKeys(ss);
+
+        // The KML and privacy keys follow the map matching keys. Segmented fitting matches every point as a whole trip
+        // fit does, so the fit_segment_* keys are left out and changing them does not reprocess trips.
+        ss << "plot_kml:" << plot_kml_ << "\n";
+        ss << "kmz:" << kmz_ << "\n";
+        ss << "kml_tolerance:" << kml_tolerance_ << "\n";
+        ss << "ta_max_q_size:" << ta_max_q_size_ << "\n";
+        ss << "ta_area_width:" << ta_area_width_ << "\n";
+        ss << "ta_max_speed:" << ta_max_speed_ << "\n";
+        ss << "ta_heading_delta:" << ta_heading_delta_ << "\n";
+        ss << "stop_max_time:" << stop_max_time_ << "\n";
+        ss << "stop_min_distance:" << stop_min_distance_ << "\n";
+        ss << "stop_max_speed:" << stop_max_speed_ << "\n";
+        ss << "min_direct_distance:" << min_direct_distance_ << "\n";
+        ss << "max_direct_distance:" << max_direct_distance_ << "\n";
+        ss << "min_manhattan_distance:" << min_manhattan_distance_ << "\n";
+        ss << "max_manhattan_distance:" << max_manhattan_distance_ << "\n";
+        ss << "min_out_degree:" << min_out_degree_ << "\n";
+        ss << "max_out_degree:" << max_out_degree_ << "\n";
+        ss << "rand_direct_distance:" << rand_direct_distance_ << "\n";
+        ss << "rand_manhattan_distance:" << rand_manhattan_distance_ << "\n";
+        ss << "rand_out_degree:" << rand_out_degree_ << "\n";
+
+        return hash_utilities::fnv1a(ss.str());
+    }
 }
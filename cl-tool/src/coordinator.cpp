@@ -0,0 +1,487 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#include "coordinator.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace DIMulti {
+    namespace {
+        sockaddr_un SocketAddress(const std::string& socket_path) {
+            sockaddr_un address;
+            std::memset(&address, 0, sizeof(address));
+            address.sun_family = AF_UNIX;
+
+            if (socket_path.empty() || socket_path.size() >= sizeof(address.sun_path)) {
+                throw std::invalid_argument("Invalid socket path: " + socket_path);
+            }
+
+            std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+            return address;
+        }
+
+        bool SendAll(int fd, const std::string& data) {
+#ifdef MSG_NOSIGNAL
+            const int flags = MSG_NOSIGNAL;
+#else
+            const int flags = 0;
+#endif
+            size_t n_sent = 0;
+
+            while (n_sent < data.size()) {
+                ssize_t n = ::send(fd, data.data() + n_sent, data.size() - n_sent, flags);
+
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+
+                if (n <= 0) {
+                    return false;
+                }
+
+                n_sent += static_cast<size_t>(n);
+            }
+
+            return true;
+        }
+
+        /**
+         * \brief Move the next whole line out of a receive buffer.
+         */
+        bool TakeLine(std::string& buffer, std::string& line) {
+            size_t end = buffer.find('\n');
+
+            if (end == std::string::npos) {
+                return false;
+            }
+
+            line = buffer.substr(0, end);
+            buffer.erase(0, end + 1);
+            return true;
+        }
+    }
+
+    // Coordinator
+
+    Coordinator::Coordinator(const std::string& socket_path, const std::string& manifest_path, const std::string& out_dir_path, bool resume) :
+        socket_path_(socket_path),
+        manifest_(manifest_path),
+        line_number_(0),
+        listen_fd_(-1),
+        n_workers_(0),
+        n_done_(0),
+        n_failed_(0)
+    {
+        if (manifest_.fail()) {
+            throw std::invalid_argument("Could not open file: " + manifest_path);
+        }
+
+        std::string journal_path = out_dir_path.empty() ? "cv_di.journal" : out_dir_path + "/cv_di.journal";
+        journal_ptr_ = std::make_shared<Journal>(journal_path, resume);
+        point_counter_ = journal_ptr_->GetResumedCounter();
+
+        if (resume) {
+            std::cerr << "Resuming: " << journal_ptr_->GetResumedCount() << " trip files already finished." << std::endl;
+        }
+
+        sockaddr_un address = SocketAddress(socket_path_);
+        listen_fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+
+        if (listen_fd_ < 0) {
+            throw std::invalid_argument("Could not create socket: " + socket_path_);
+        }
+
+        // A socket left behind by a coordinator that did not exit cleanly.
+        ::unlink(socket_path_.c_str());
+
+        if (::bind(listen_fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(listen_fd_, SOMAXCONN) != 0) {
+            ::close(listen_fd_);
+            throw std::invalid_argument("Could not listen on socket: " + socket_path_ + ": " + std::strerror(errno));
+        }
+    }
+
+    Coordinator::~Coordinator() {
+        for (auto& worker : workers_) {
+            ::close(worker.first);
+        }
+
+        ::close(listen_fd_);
+        ::unlink(socket_path_.c_str());
+    }
+
+    const instrument::PointCounter& Coordinator::GetPointCounter() const {
+        return point_counter_;
+    }
+
+    bool Coordinator::HasPending() {
+        FileInfo::Ptr item_ptr;
+
+        while (pending_.empty() && (item_ptr = SingleBatchCSV::ReadItem(manifest_, line_number_)) != nullptr) {
+            if (!journal_ptr_->IsFinished(item_ptr->GetFilePath())) {
+                pending_.push_back(Trip{ item_ptr, 0 });
+            }
+        }
+
+        return !pending_.empty();
+    }
+
+    bool Coordinator::IsFinished() {
+        if (HasPending()) {
+            return false;
+        }
+
+        for (auto& worker : workers_) {
+            if (!worker.second.trips.empty()) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void Coordinator::Run() {
+        std::cerr << "Coordinator: listening on " << socket_path_ << "." << std::endl;
+
+        while (true) {
+            std::vector<int> lost;
+
+            for (auto& worker : workers_) {
+                if (!Serve(worker.first, worker.second)) {
+                    lost.push_back(worker.first);
+                }
+            }
+
+            for (int fd : lost) {
+                Lose(fd);
+            }
+
+            if (!lost.empty()) {
+                // The lost workers' trips are pending again.
+                continue;
+            }
+
+            if (IsFinished()) {
+                break;
+            }
+
+            std::vector<pollfd> poll_fds{ pollfd{ listen_fd_, POLLIN, 0 } };
+
+            for (auto& worker : workers_) {
+                poll_fds.push_back(pollfd{ worker.first, POLLIN, 0 });
+            }
+
+            if (::poll(poll_fds.data(), poll_fds.size(), -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                throw std::runtime_error(std::string("Coordinator poll failed: ") + std::strerror(errno));
+            }
+
+            for (size_t i = 1; i < poll_fds.size(); ++i) {
+                if (poll_fds[i].revents != 0 && !Receive(poll_fds[i].fd, workers_[poll_fds[i].fd])) {
+                    Lose(poll_fds[i].fd);
+                }
+            }
+
+            if (poll_fds[0].revents & POLLIN) {
+                Accept();
+            }
+        }
+
+        for (auto& worker : workers_) {
+            // Waiting workers take this as their reply; the others read it when they next ask.
+            SendAll(worker.first, "finish\n");
+            std::cerr << "Coordinator: " << worker.second.name << ": " << worker.second.n_done << " trips de-identified; " << worker.second.n_failed << " failed." << std::endl;
+        }
+
+        std::cerr << "Coordinator: " << n_done_ << " trips de-identified; " << n_failed_ << " failed; " << n_workers_ << " workers." << std::endl;
+    }
+
+    void Coordinator::Accept() {
+        int fd = ::accept(listen_fd_, nullptr, nullptr);
+
+        if (fd < 0) {
+            return;
+        }
+
+        Worker& worker = workers_[fd];
+        worker.name = "worker " + std::to_string(++n_workers_);
+        worker.requested = 0;
+        worker.n_done = 0;
+        worker.n_failed = 0;
+    }
+
+    bool Coordinator::Receive(int fd, Worker& worker) {
+        char data[4096];
+        ssize_t n = ::recv(fd, data, sizeof(data), 0);
+
+        if (n < 0 && errno == EINTR) {
+            return true;
+        }
+
+        if (n <= 0) {
+            return false;
+        }
+
+        worker.buffer.append(data, static_cast<size_t>(n));
+        std::string line;
+
+        while (TakeLine(worker.buffer, line)) {
+            HandleLine(worker, line);
+        }
+
+        return true;
+    }
+
+    void Coordinator::HandleLine(Worker& worker, const std::string& line) {
+        StrVector parts;
+        instrument::PointCounter point_counter;
+
+        if (line.compare(0, 6, "hello\t") == 0) {
+            worker.name += " (pid " + line.substr(6) + ")";
+            std::cerr << "Coordinator: " << worker.name << " connected." << std::endl;
+        } else if (line.compare(0, 5, "next\t") == 0) {
+            try {
+                worker.requested = static_cast<unsigned>(std::stoul(line.substr(5)));
+            } catch (std::logic_error&) {
+                std::cerr << "Coordinator: invalid request from " << worker.name << ": " << line << std::endl;
+            }
+        } else if (Journal::ParseLine(line, parts, point_counter)) {
+            auto trip_item = worker.trips.find(parts[1]);
+
+            if (trip_item == worker.trips.end()) {
+                std::cerr << "Coordinator: ignoring result for a trip " << worker.name << " does not hold: " << parts[1] << std::endl;
+                return;
+            }
+
+            worker.trips.erase(trip_item);
+            point_counter_ = point_counter_ + point_counter;
+
+            if (parts[0] == "done") {
+                journal_ptr_->RecordDone(parts[1], parts[2], parts[3], point_counter);
+                worker.n_done++;
+                n_done_++;
+            } else {
+                journal_ptr_->RecordFail(parts[1], point_counter);
+                worker.n_failed++;
+                n_failed_++;
+            }
+        } else {
+            std::cerr << "Coordinator: invalid message from " << worker.name << ": " << line << std::endl;
+        }
+    }
+
+    bool Coordinator::Serve(int fd, Worker& worker) {
+        if (worker.requested == 0) {
+            return true;
+        }
+
+        std::string reply;
+
+        while (worker.requested > 0 && HasPending()) {
+            Trip trip = pending_.front();
+            pending_.pop_front();
+
+            std::string aux_data;
+            SingleFileInfo::Ptr file_ptr = std::dynamic_pointer_cast<SingleFileInfo>(trip.file_ptr);
+
+            if (file_ptr) {
+                aux_data = file_ptr->GetAuxData();
+            }
+
+            reply += "trip\t" + trip.file_ptr->GetFilePath() + "\t" + aux_data + "\t" + std::to_string(trip.file_ptr->GetSize()) + "\n";
+            worker.trips.emplace(trip.file_ptr->GetFilePath(), trip);
+            worker.requested--;
+        }
+
+        if (reply.empty()) {
+            // Nothing to hand out until another worker finishes or is lost, or until the run is finished.
+            return true;
+        }
+
+        worker.requested = 0;
+        return SendAll(fd, reply + "end\n");
+    }
+
+    void Coordinator::Lose(int fd) {
+        auto worker_item = workers_.find(fd);
+
+        if (worker_item == workers_.end()) {
+            return;
+        }
+
+        Worker& worker = worker_item->second;
+
+        if (!worker.trips.empty()) {
+            std::cerr << "Coordinator: lost " << worker.name << " holding " << worker.trips.size() << " trips." << std::endl;
+        }
+
+        for (auto& held : worker.trips) {
+            Trip trip = held.second;
+
+            if (++trip.attempts >= kMaxAttempts) {
+                std::cerr << "Coordinator: giving up on " << held.first << " after " << trip.attempts << " lost workers." << std::endl;
+                journal_ptr_->RecordFail(held.first, instrument::PointCounter());
+                n_failed_++;
+            } else {
+                // Hand it out again before the rest of the manifest.
+                pending_.push_front(trip);
+            }
+        }
+
+        std::cerr << "Coordinator: " << worker.name << ": " << worker.n_done << " trips de-identified; " << worker.n_failed << " failed." << std::endl;
+        ::close(fd);
+        workers_.erase(worker_item);
+    }
+
+    // CoordinatorClient
+
+    CoordinatorClient::CoordinatorClient(const std::string& socket_path) :
+        fd_(-1),
+        capacity_(1),
+        n_held_(0),
+        finished_(false),
+        lost_(false)
+    {
+        sockaddr_un address = SocketAddress(socket_path);
+        fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+
+        if (fd_ < 0 || ::connect(fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            std::string reason = std::strerror(errno);
+
+            if (fd_ >= 0) {
+                ::close(fd_);
+            }
+
+            throw std::invalid_argument("Could not connect to coordinator: " + socket_path + ": " + reason);
+        }
+
+        if (!SendAll(fd_, "hello\t" + std::to_string(::getpid()) + "\n")) {
+            ::close(fd_);
+            throw std::invalid_argument("Could not connect to coordinator: " + socket_path);
+        }
+    }
+
+    CoordinatorClient::~CoordinatorClient() {
+        ::close(fd_);
+    }
+
+    void CoordinatorClient::SetCapacity(unsigned capacity) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        capacity_ = std::max(1u, capacity);
+    }
+
+    FileInfo::Ptr CoordinatorClient::NextItem() {
+        if (batch_.empty() && !finished_) {
+            unsigned n_wanted;
+
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cond_.wait(lock, [this] { return n_held_ < capacity_ || lost_; });
+                n_wanted = capacity_ - n_held_;
+
+                if (lost_ || !SendAll(fd_, "next\t" + std::to_string(n_wanted) + "\n")) {
+                    lost_ = true;
+                }
+            }
+
+            std::string line;
+
+            while (!finished_) {
+                if (lost_ || !ReadLine(line)) {
+                    std::cerr << "Lost the coordinator; finishing the trips in hand." << std::endl;
+                    finished_ = true;
+                } else if (line == "finish") {
+                    finished_ = true;
+                } else if (line == "end") {
+                    break;
+                } else {
+                    StrVector parts = string_utilities::split(line, '\t');
+
+                    try {
+                        if (parts.size() != 4 || parts[0] != "trip") {
+                            throw std::invalid_argument(line);
+                        }
+
+                        batch_.push_back(std::make_shared<SingleFileInfo>(parts[1], parts[2], std::stoull(parts[3])));
+                    } catch (std::logic_error&) {
+                        std::cerr << "Invalid message from coordinator: " << line << std::endl;
+                    }
+                }
+            }
+        }
+
+        if (batch_.empty()) {
+            return nullptr;
+        }
+
+        FileInfo::Ptr item_ptr = batch_.front();
+        batch_.pop_front();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        n_held_++;
+        return item_ptr;
+    }
+
+    void CoordinatorClient::ReportDone(const std::string& input_path, const std::string& uid, const std::string& output_path, const instrument::PointCounter& point_counter) {
+        Report(Journal::FormatLine("done", input_path, uid, output_path, point_counter));
+    }
+
+    void CoordinatorClient::ReportFail(const std::string& input_path, const instrument::PointCounter& point_counter) {
+        Report(Journal::FormatLine("fail", input_path, "", "", point_counter));
+    }
+
+    void CoordinatorClient::Report(const std::string& line) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (!lost_ && !SendAll(fd_, line + "\n")) {
+            std::cerr << "Lost the coordinator; results are no longer journaled." << std::endl;
+            lost_ = true;
+        }
+
+        n_held_--;
+        cond_.notify_all();
+    }
+
+    bool CoordinatorClient::ReadLine(std::string& line) {
+        char data[4096];
+
+        while (!TakeLine(buffer_, line)) {
+            ssize_t n = ::recv(fd_, data, sizeof(data), 0);
+
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if (n <= 0) {
+                return false;
+            }
+
+            buffer_.append(data, static_cast<size_t>(n));
+        }
+
+        return true;
+    }
+}
@@ -20,6 +20,8 @@
 #include "cvlib.hpp"
 #include "tool.hpp"
 #include "di_multi.hpp"
+#include "coordinator.hpp"
+#include "quad_tuner.hpp"
 
 int main( int argc, char **argv ) {
     // Set up the tool.
@@ -28,9 +30,25 @@ int main( int argc, char **argv ) {
     tool.AddOption(tool::Option('t', "thread", "The number of threads to use (default: 1 thread).", "1"));
     tool.AddOption(tool::Option('o', "out_dir", "The output directory (default: working directory).", ""));
     tool.AddOption(tool::Option('k', "kml_dir", "The KML output directory (default: working directory).", ""));
-    tool.AddOption(tool::Option('q', "quad", "The file .quad file containing the circles defining the regions.", ""));
+    tool.AddOption(tool::Option('q', "quad", "The .quad shapes file, OpenStreetMap .osm.pbf extract, .cvmap map image, or tile directory defining the road network.", ""));
     tool.AddOption(tool::Option('c', "config", "A configuration file for de-identification.", ""));
     tool.AddOption(tool::Option('n', "count_pts", "Print summary of the points after de-identification to standard error."));
+    tool.AddOption(tool::Option('r', "resume", "Resume an interrupted run using the journal in the output directory."));
+    tool.AddOption(tool::Option('i', "incremental", "Skip trip files that are unchanged, with the same configuration and map, since the last incremental run."));
+    tool.AddOption(tool::Option('T', "make_tiles", "Partition the map file given as SOURCE into tiles written to this existing directory, or into a single map image when the name ends in .cvmap, then exit; pass the result to --quad to use the tiles.", ""));
+    tool.AddOption(tool::Option('D', "tile_degrees", "The tile size in degrees for --make_tiles (default: 0.25).", "0.25"));
+    tool.AddOption(tool::Option('X', "to_columnar", "Convert the CSV trip files listed in the manifest given as SOURCE to BSMP1 columnar (.bsmc) files in this existing directory, print a manifest of the columnar files to standard output, then exit.", ""));
+    tool.AddOption(tool::Option('Z', "compact_image", "Store vertex positions in a --make_tiles map image as 32-bit fixed-point microdegrees."));
+    tool.AddOption(tool::Option('S', "shard", "Process only shard <index>/<count> of the manifest, e.g. 0/8; every shard of a run uses the same manifest and count.", ""));
+    tool.AddOption(tool::Option('B', "shard_by", "Assign trips to shards by \"uid\" or by manifest \"line\" (default: uid).", "uid"));
+    tool.AddOption(tool::Option('s', "sweep", "A file listing one configuration file per line; each trip is parsed and map matched once under --config, then de-identified under every listed configuration into its own output directory.", ""));
+    tool.AddOption(tool::Option('F', "sidecars", "An existing directory of map matching sidecars: trips whose file, map, and map matching parameters are unchanged skip map matching, and every other trip's map matching is saved there.", ""));
+    tool.AddOption(tool::Option('N', "numa", "Pin threads to cores spread across the NUMA nodes and give each node its own copy of the map."));
+    tool.AddOption(tool::Option('C', "coordinate", "Hand out the trips of the manifest to workers connecting to this Unix socket and journal their results, instead of de-identifying them.", ""));
+    tool.AddOption(tool::Option('W', "worker", "De-identify trips handed out by the coordinator listening on the Unix socket given as SOURCE."));
+    tool.AddOption(tool::Option('U', "tune_quad", "Map match a sample of the trips in the manifest given as SOURCE with candidate quad tree settings for the --quad map, report each setting's lookup cost, candidate edges, and memory, and write the --config configuration with the fastest setting to this file, then exit.", ""));
+    tool.AddOption(tool::Option('P', "tune_trips", "The number of trips --tune_quad samples (default: 32).", "32"));
+    tool.AddOption(tool::Option('M', "merge_shards", "Merge the journals of this many shards in the output directory given as SOURCE into one journal, print the combined point summary, then exit.", ""));
     
     if (!tool.ParseArgs(std::vector<std::string>{argv + 1, argv + argc})) {
         exit(1);
@@ -50,8 +68,127 @@ int main( int argc, char **argv ) {
         exit(1);
     }
     
+    if (!tool.GetStringVal("make_tiles").empty()) {
+        try {
+            std::vector<geo::EdgeCPtr> edges = DIMulti::DICSV::LoadMap(tool.GetSource());
+            std::string tile_path = tool.GetStringVal("make_tiles");
+            size_t n_tiles = tiles::MapImage::is_image(tile_path) ? tiles::MapImage::write(edges, tile_path, tool.GetDoubleVal("tile_degrees"), tool.GetBoolVal("compact_image"))
+                                                                  : tiles::TileCache::write_tiles(edges, tile_path, tool.GetDoubleVal("tile_degrees"));
+            std::cerr << "Wrote " << n_tiles << " tiles from " << edges.size() << " edges." << std::endl;
+        } catch (std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            exit(1);
+        }
+
+        return 0;
+    }
+
+    if (!tool.GetStringVal("to_columnar").empty()) {
+        try {
+            size_t n_trips = DIMulti::DICSV::ConvertToColumnar(tool.GetSource(), tool.GetStringVal("to_columnar"), std::cout);
+            std::cerr << "Converted " << n_trips << " trip files." << std::endl;
+        } catch (std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            exit(1);
+        }
+
+        return 0;
+    }
+
+    if (!tool.GetStringVal("tune_quad").empty()) {
+        try {
+            Config::DIConfig::Ptr config_ptr = tool.GetStringVal("config").empty() ? std::make_shared<Config::DIConfig>() : Config::DIConfig::ConfigFromFile(tool.GetStringVal("config"));
+            DIMulti::QuadTuner tuner(tool.GetStringVal("quad"), config_ptr);
+            size_t n_trips = tuner.LoadTrips(tool.GetSource(), static_cast<size_t>(std::max(1, tool.GetIntVal("tune_trips"))));
+            std::cerr << "Tuning on " << n_trips << " trips." << std::endl;
+
+            DIMulti::QuadTuner::Trial best = tuner.Tune(std::cout);
+            DIMulti::QuadTuner::WriteConfig(tool.GetStringVal("config"), tool.GetStringVal("tune_quad"), best.params);
+            std::cerr << "Best: max_elements " << best.params.max_elements << ", min_degrees " << best.params.min_degrees << ", capacity_growth " << best.params.capacity_growth
+                      << "; " << best.fit_ms << " ms, " << best.candidates << " candidates per point, " << best.report.bytes << " bytes." << std::endl;
+        } catch (std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            exit(1);
+        }
+
+        return 0;
+    }
+
+    if (!tool.GetStringVal("merge_shards").empty()) {
+        int n_shards = 0;
+
+        try {
+            n_shards = tool.GetIntVal("merge_shards");
+        } catch (std::logic_error&) {
+            std::cerr << "Invalid value for \"merge_shards\"!" << std::endl;
+            exit(1);
+        }
+
+        if (n_shards < 1) {
+            std::cerr << "Number of shards must be at least 1." << std::endl;
+            exit(1);
+        }
+
+        try {
+            DIMulti::DICSV::MergeShards(tool.GetSource(), static_cast<unsigned>(n_shards));
+        } catch (std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            exit(1);
+        }
+
+        return 0;
+    }
+
+    if (!tool.GetStringVal("coordinate").empty()) {
+        try {
+            DIMulti::Coordinator coordinator(tool.GetStringVal("coordinate"), tool.GetSource(), tool.GetStringVal("out_dir"), tool.GetBoolVal("resume"));
+            coordinator.Run();
+
+            if (tool.GetBoolVal("count_pts")) {
+                DIMulti::DICSV::PrintPointSummary(coordinator.GetPointCounter());
+            }
+        } catch (std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            exit(1);
+        }
+
+        return 0;
+    }
+
+    if (!tool.GetStringVal("sweep").empty() && (tool.GetBoolVal("resume") || tool.GetBoolVal("incremental"))) {
+        std::cerr << "--sweep cannot be combined with --resume or --incremental." << std::endl;
+        exit(1);
+    }
+
+    DIMulti::CoordinatorClient::Ptr client_ptr;
+
+    if (tool.GetBoolVal("worker")) {
+        if (tool.GetBoolVal("resume") || tool.GetBoolVal("incremental") || !tool.GetStringVal("shard").empty()) {
+            std::cerr << "The coordinator decides which trips a worker runs; --resume belongs on the coordinator, and --incremental and --shard are not supported for workers." << std::endl;
+            exit(1);
+        }
+
+        try {
+            client_ptr = std::make_shared<DIMulti::CoordinatorClient>(tool.GetSource());
+        } catch (std::invalid_argument& e) {
+            std::cerr << e.what() << std::endl;
+            exit(1);
+        }
+    }
+
+    DIMulti::Shard::Ptr shard_ptr;
+
+    if (!tool.GetStringVal("shard").empty()) {
+        try {
+            shard_ptr = DIMulti::Shard::FromString(tool.GetStringVal("shard"), tool.GetStringVal("shard_by"));
+        } catch (std::invalid_argument& e) {
+            std::cerr << e.what() << std::endl;
+            exit(1);
+        }
+    }
+
     try {
-        DIMulti::DICSV parallel_csv(tool.GetSource(), tool.GetStringVal("quad"), tool.GetStringVal("out_dir"), tool.GetStringVal("config"), tool.GetStringVal("kml_dir"), tool.GetBoolVal("count_pts"));
+        DIMulti::DICSV parallel_csv(client_ptr ? "" : tool.GetSource(), tool.GetStringVal("quad"), tool.GetStringVal("out_dir"), tool.GetStringVal("config"), tool.GetStringVal("kml_dir"), tool.GetBoolVal("count_pts"), tool.GetBoolVal("resume"), tool.GetBoolVal("incremental"), shard_ptr, client_ptr, tool.GetBoolVal("numa"), tool.GetStringVal("sweep"), tool.GetStringVal("sidecars"));
         parallel_csv.Start(n_threads);
     } catch (std::invalid_argument& e) {    
         std::cerr << e.what() << std::endl; 
@@ -1,9 +1,12 @@
 #include "di_multi.hpp"
 #include "config.hpp"
+#include "coordinator.hpp"
 
 #include <iomanip>
 #include <chrono>
 #include <ctime>
+#include <cerrno>
+#include <sys/stat.h>
 
 namespace DIMulti {
     // FileInfo
@@ -36,6 +39,11 @@ namespace DIMulti {
         MultiThread::Parallel<FileInfo>(),
         file_path_(file_path)
     {
+        if (file_path_.empty()) {
+            // The subclass supplies the items.
+            return;
+        }
+
         std::ifstream file(file_path_, std::ios::binary | std::ios::ate);
         
         if (file.fail()) {
@@ -61,19 +69,31 @@ namespace DIMulti {
     }
 
     void BatchCSV::Close() {
-        file_ptr_->close();
+        if (file_ptr_) {
+            file_ptr_->close();
+        }
     }
 
     // SingleBatchCSV
       
     SingleBatchCSV::SingleBatchCSV(const std::string& file_path) :
-        BatchCSV(file_path)
+        BatchCSV(file_path),
+        line_number_(0)
         {}
 
+    uint64_t SingleBatchCSV::GetLineNumber() const {
+        return line_number_;
+    }
+
     FileInfo::Ptr SingleBatchCSV::NextItem() {
+        return ReadItem(*(GetFilePtr()), line_number_);
+    }
+
+    FileInfo::Ptr SingleBatchCSV::ReadItem(std::istream& manifest, uint64_t& line_number) {
         std::string line;
 
-        while (std::getline(*(GetFilePtr()), line)) {
+        while (std::getline(manifest, line)) {
+            line_number++;
             line.erase(std::remove(line.begin(), line.end(), '\n'), line.end());
             StrVector items = string_utilities::split(line, ':');
 
@@ -111,12 +131,28 @@ namespace DIMulti {
         return nullptr;
     }
 
-    DICSV::DICSV(const std::string& file_path, const std::string& quad_file_path, const std::string& out_dir_path, const std::string& config_file_path, const std::string& kml_dir_path, bool count_points) :
+    DICSV::DICSV(const std::string& file_path, const std::string& quad_file_path, const std::string& out_dir_path, const std::string& config_file_path, const std::string& kml_dir_path, bool count_points, bool resume, bool incremental, const Shard::Ptr& shard_ptr, const std::shared_ptr<CoordinatorClient>& client_ptr, bool numa, const std::string& sweep_file_path, const std::string& sidecar_dir_path) :
         SingleBatchCSV(file_path),
         out_dir_path_(out_dir_path),
         kml_dir_path_(kml_dir_path), 
-        count_points_(count_points)
+        count_points_(count_points),
+        shard_ptr_(shard_ptr),
+        client_ptr_(client_ptr),
+        n_unchanged_(0),
+        n_threads_(1)
         {
+            // A worker's results go to the coordinator, which keeps the journal.
+            if (!client_ptr_) {
+                // Each shard keeps its own journal and fingerprints so shards can share an output directory.
+                std::string journal_name = shard_ptr_ ? shard_ptr_->FileName("cv_di.journal") : "cv_di.journal";
+                std::string journal_path = out_dir_path_.empty() ? journal_name : out_dir_path_ + "/" + journal_name;
+                journal_ptr_ = std::make_shared<Journal>(journal_path, resume);
+
+                if (resume) {
+                    std::cerr << "Resuming: " << journal_ptr_->GetResumedCount() << " trip files already finished." << std::endl;
+                }
+            }
+
             if (!config_file_path.empty()) {
                 config_ptr_ = Config::DIConfig::ConfigFromFile(config_file_path);
             } else {
@@ -124,20 +160,158 @@ namespace DIMulti {
             }
 
             config_ptr_->PrintConfig(std::cerr);
-            geo::Point sw{ config_ptr_->GetQuadSWLat(), config_ptr_->GetQuadSWLng() };
-            geo::Point ne{ config_ptr_->GetQuadNELat(), config_ptr_->GetQuadNELng() };
 
-            quad_ptr_ = std::make_shared<Quad>(sw, ne);
-            shapes::CSVInputFactory shape_factory(quad_file_path);
-            shape_factory.make_shapes();
+            if (numa) {
+                topology_ptr_ = std::make_shared<MultiThread::Topology>();
+                std::cerr << "NUMA: " << topology_ptr_->NodeCount() << " nodes; threads pinned to cores; one map copy per node." << std::endl;
+            }
+
+            size_t n_nodes = topology_ptr_ ? topology_ptr_->NodeCount() : 1;
+
+            if (tiles::MapImage::is_image(quad_file_path)) {
+                // The image is mapped read-only, so concurrent cv_di processes share one copy through the page cache.
+                tiles::MapImage::Ptr image_ptr = std::make_shared<const tiles::MapImage>(quad_file_path);
+
+                for (size_t i = 0; i < n_nodes; ++i) {
+                    tile_cache_ptrs_.push_back(std::make_shared<tiles::TileCache>(image_ptr, config_ptr_->GetTileCacheSize()));
+                }
+
+                std::cerr << "Map: image with tiles of " << image_ptr->get_tile_degrees() << " degrees; caching up to " << config_ptr_->GetTileCacheSize() << " tiles." << std::endl;
+            } else if (tiles::TileCache::is_tiled(quad_file_path)) {
+                // Tiles are faulted in as trips reach them; the quad bounds in the configuration are not used.
+                for (size_t i = 0; i < n_nodes; ++i) {
+                    tile_cache_ptrs_.push_back(std::make_shared<tiles::TileCache>(quad_file_path, config_ptr_->GetTileCacheSize()));
+                }
+
+                std::cerr << "Map: tiles of " << tile_cache_ptrs_[0]->get_tile_degrees() << " degrees; caching up to " << config_ptr_->GetTileCacheSize() << " tiles." << std::endl;
+            } else {
+                geo::Point sw{ config_ptr_->GetQuadSWLat(), config_ptr_->GetQuadSWLng() };
+                geo::Point ne{ config_ptr_->GetQuadNELat(), config_ptr_->GetQuadNELng() };
+                std::vector<geo::EdgeCPtr> edges = LoadMap(quad_file_path);
+
+                index_ptrs_.resize(n_nodes);
+
+                if (!topology_ptr_) {
+                    index_ptrs_[0] = MakeIndex(edges, sw, ne);
+                } else {
+                    std::vector<std::thread> builders;
+
+                    for (size_t i = 0; i < n_nodes; ++i) {
+                        builders.emplace_back([this, i, &edges, &sw, &ne] {
+                            // The kernel places pages on the node of the thread that first touches them.
+                            MultiThread::Topology::PinCurrentThread(topology_ptr_->GetNode(i).cpus);
+                            index_ptrs_[i] = MakeIndex(CopyEdges(edges), sw, ne);
+                        });
+                    }
+
+                    for (auto& builder : builders) {
+                        builder.join();
+                    }
+                }
+            }
+
+            if (!sweep_file_path.empty()) {
+                LoadSweep(sweep_file_path);
+            }
+
+            std::string map_hash_path = tiles::TileCache::is_tiled(quad_file_path) ? tiles::TileCache::index_path(quad_file_path) : quad_file_path;
+            uint64_t map_hash = (incremental || !sidecar_dir_path.empty()) ? hash_utilities::file_hash(map_hash_path) : 0;
+
+            if (!sidecar_dir_path.empty()) {
+                // Only a change to the map or to the parsing and map matching parameters invalidates a sidecar.
+                uint64_t match_key = hash_utilities::fnv1a(hash_utilities::to_hex(config_ptr_->MapMatchFingerprint()));
+                match_key = hash_utilities::fnv1a(hash_utilities::to_hex(map_hash), match_key);
+                match_cache_ptr_ = std::make_shared<MatchCache>(sidecar_dir_path, match_key, config_ptr_->GetMapFitScale(), config_ptr_->GetFitExt());
+            }
+
+            if (incremental) {
+                // Any change to the configuration, the map, or where and what is written invalidates earlier results.
+                uint64_t run_fingerprint = hash_utilities::fnv1a(hash_utilities::to_hex(config_ptr_->Fingerprint()));
+                run_fingerprint = hash_utilities::fnv1a(hash_utilities::to_hex(map_hash), run_fingerprint);
+                run_fingerprint = hash_utilities::fnv1a(out_dir_path_ + "\t" + kml_dir_path_ + "\t" + (count_points_ ? "1" : "0") + "\t" + CVLib::CVLIB_VERSION_STR, run_fingerprint);
 
-            for (auto& edge_ptr : shape_factory.get_edges()) {
-                Quad::insert(quad_ptr_, std::dynamic_pointer_cast<const geo::Entity>(edge_ptr)); 
+                std::string db_name = shard_ptr_ ? shard_ptr_->FileName("cv_di.fingerprints") : "cv_di.fingerprints";
+                std::string db_path = out_dir_path_.empty() ? db_name : out_dir_path_ + "/" + db_name;
+                fingerprint_db_ptr_ = std::make_shared<FingerprintDB>(db_path, run_fingerprint);
             }
         }
     
+    std::vector<geo::EdgeCPtr> DICSV::LoadMap(const std::string& map_file_path) {
+        unsigned n_map_threads = std::max(1u, std::thread::hardware_concurrency());
+
+        if (osm::PBFInputFactory::is_pbf(map_file_path)) {
+            // Build the road network straight from an OpenStreetMap extract.
+            osm::PBFInputFactory pbf_factory(map_file_path);
+            pbf_factory.make_edges(n_map_threads);
+
+            const osm::PBFReport& report = pbf_factory.get_report();
+            std::cerr << "Map: " << report.edges << " edges from " << report.ways << " highway ways; " << report.filtered_ways << " ways filtered; " 
+                      << report.missing_nodes + report.bad_positions << " segments dropped." << std::endl;
+            return pbf_factory.get_edges();
+        }
+
+        shapes::CSVInputFactory shape_factory(map_file_path);
+        shape_factory.make_shapes(n_map_threads);
+
+        const shapes::ParseReport& report = shape_factory.get_report();
+
+        if (report.rejected > 0 || report.vertex_conflicts > 0) {
+            std::cerr << "Map: " << report.edges << " edges; " << report.rejected << " rejected specifications; " << report.vertex_conflicts << " vertex conflicts." << std::endl;
+
+            for (auto& diagnostic : report.diagnostics) {
+                std::cerr << "  " << diagnostic << std::endl;
+            }
+
+            if (report.diagnostics.size() == shapes::ParseReport::kMaxDiagnostics) {
+                std::cerr << "  (further messages omitted)" << std::endl;
+            }
+        }
+
+        return shape_factory.get_edges();
+    }
+
     void DICSV::Init(unsigned n_used_threads) {
         SingleBatchCSV::Init(n_used_threads);
+        n_threads_ = n_used_threads;
+
+        if (client_ptr_) {
+            // Keep one trip running and one waiting per thread; the rest stay with the coordinator for other workers.
+            client_ptr_->SetCapacity(2 * n_used_threads);
+        }
+
+        // A sweep writes only the variants' outputs.
+        bool plot_kml = variants_.empty() && config_ptr_->IsPlotKML();
+
+        for (auto& variant : variants_) {
+            plot_kml = plot_kml || variant.config_ptr->IsPlotKML();
+
+            for (unsigned i = 0; i < n_used_threads; ++i) {
+                variant.counters.push_back(std::make_shared<instrument::PointCounter>());
+            }
+        }
+
+        if (plot_kml) {
+            kml_pipeline_ptr_ = std::make_shared<KMLPipeline>(config_ptr_->GetKMLThreads());
+        }
+
+        if (config_ptr_->GetFitSegmentPoints() > 0) {
+            // The segment threads are shared by all the de-identifying threads and split across the NUMA nodes; each
+            // node's threads may run on any of its CPUs and fit segments against its copy of the map.
+            unsigned n_segment_threads = config_ptr_->GetFitSegmentThreads() > 0 ? config_ptr_->GetFitSegmentThreads() : n_used_threads;
+            size_t n_nodes = topology_ptr_ ? topology_ptr_->NodeCount() : 1;
+
+            for (size_t i = 0; i < n_nodes; ++i) {
+                unsigned n_node_threads = static_cast<unsigned>(n_segment_threads / n_nodes + (i < n_segment_threads % n_nodes ? 1 : 0));
+                SegmentPool::Task setup;
+
+                if (topology_ptr_) {
+                    std::vector<unsigned> cpus = topology_ptr_->GetNode(i).cpus;
+                    setup = [cpus]() { MultiThread::Topology::PinCurrentThread(cpus); };
+                }
+
+                segment_pools_.push_back(n_node_threads > 0 ? std::make_shared<SegmentPool>(n_node_threads, setup) : nullptr);
+            }
+        }
 
         if (!count_points_) {
             return;
@@ -148,95 +322,78 @@ namespace DIMulti {
         }
     }
 
-    trajectory::Trajectory DICSV::DeIdentify(trajectory::Trajectory& traj, const std::string& uid) const {
-        bool plot_kml = config_ptr_->IsPlotKML();
-        std::string shape_in_file_path, shape_out_file_path;
-    
-        ErrorCorrector ec(50);
-        ec.correct_error(traj, uid);
+    FileInfo::Ptr DICSV::NextItem() {
+        if (client_ptr_) {
+            return client_ptr_->NextItem();
+        }
 
-        MapFitter mf{quad_ptr_, config_ptr_->GetMapFitScale(), config_ptr_->GetFitExt()};
-        mf.fit(traj);
+        FileInfo::Ptr item_ptr;
 
-        ImplicitMapFitter imf{config_ptr_->GetHeadingGroups(), config_ptr_->GetMinEdgeTripPoints()};
-        imf.fit(traj);
+        while ((item_ptr = SingleBatchCSV::NextItem()) != nullptr) {
+            if (shard_ptr_ && !shard_ptr_->IsAssigned(GetLineNumber(), item_ptr->GetFilePath())) {
+                // Another shard's trip file.
+                continue;
+            }
 
-        IntersectionCounter ic{};
-        ic.count_intersections(traj);
+            if (!journal_ptr_->IsFinished(item_ptr->GetFilePath())) {
+                break;
+            }
+        }
 
-        Detector::TurnAround tad{config_ptr_->GetTAMaxQSize(), config_ptr_->GetTAAreaWidth(), config_ptr_->GetTAMaxSpeed(), config_ptr_->GetTAHeadingDelta()};
-        trajectory::Interval::PtrList ta_critical_intervals = tad.find_turn_arounds(traj);
+        return item_ptr;
+    }
 
-        Detector::Stop stop_detector{config_ptr_->GetStopMaxTime(), config_ptr_->GetStopMinDistance(), config_ptr_->GetStopMaxSpeed()};
-        trajectory::Interval::PtrList stop_critical_intervals = stop_detector.find_stops( traj );
+    trajectory::Trajectory DICSV::DeIdentify(trajectory::Trajectory& traj, const std::string& uid, const std::string& input_path, unsigned thread_num) const {
+        // Points are only counted with --count_pts; the counts of this trip are discarded.
+        instrument::PointCounter scratch_counter;
 
-        StartEndIntervals sei;
+        return DeIdentify(traj, uid, input_path, scratch_counter, thread_num);
+    }
 
-        IntervalMarker im( { ta_critical_intervals, stop_critical_intervals, sei.get_start_end_intervals( traj ) } );
-        im.mark_trajectory( traj );
+    trajectory::Trajectory DICSV::DeIdentify(trajectory::Trajectory& traj, const std::string& uid, const std::string& input_path, instrument::PointCounter& point_counter, unsigned thread_num) const {
+        GPSErrorFilter error_filter(50, config_ptr_->GetErrorMaxSpeed(), config_ptr_->GetErrorJumpPoints());
+        error_filter.filter(traj, point_counter);
 
-        trajectory::Interval::PtrList priv_intervals;
+        // The map tiles are held until the trip is privatized, so the vertices of its fit edges keep their edges.
+        MapFitter::TileSet held_tiles;
+        MapFitter::AreaSet explicit_areas;
+        ImplicitMapFitter::AreaSet implicit_areas;
+        MapMatch(traj, input_path, thread_num, explicit_areas, implicit_areas, held_tiles);
 
-        PrivacyIntervalFinder pif(config_ptr_->GetMinDirectDistance(), 
-                                  config_ptr_->GetMinManhattanDistance(), 
-                                  config_ptr_->GetMinOutDegree(), 
-                                  config_ptr_->GetMaxDirectDistance(), 
-                                  config_ptr_->GetMaxManhattanDistance(), 
-                                  config_ptr_->GetMaxOutDegree(), 
-                                  config_ptr_->GetRandDirectDistance(), 
-                                  config_ptr_->GetRandManhattanDistance(), 
-                                  config_ptr_->GetRandOutDegree());
-        priv_intervals = pif.find_intervals( traj );
+        return Privatize(traj, uid, *config_ptr_, kml_dir_path_, explicit_areas, implicit_areas, point_counter);
+    }
 
-        PrivacyIntervalMarker pim({ priv_intervals });
-        pim.mark_trajectory(traj);
+    void DICSV::MapMatch(trajectory::Trajectory& traj, const std::string& input_path, unsigned thread_num, MapFitter::AreaSet& explicit_areas, ImplicitMapFitter::AreaSet& implicit_areas, MapFitter::TileSet& held_tiles) const {
+        uint64_t input_fingerprint = 0;
+        bool has_sidecar = false;
 
-        if (plot_kml) {
-            std::string kml_path;
-    
-            if (kml_dir_path_.empty()) {
-                kml_path = uid + ".di.kml";
-            } else {
-                kml_path = kml_dir_path_ + "/" + uid + ".di.kml";
+        if (match_cache_ptr_) {
+            try {
+                input_fingerprint = FingerprintDB::InputFingerprint(input_path);
+                has_sidecar = true;
+            } catch (std::exception&) {
+                // Trip files that cannot be fingerprinted are map matched every run.
             }
-    
-            std::ofstream out_file(kml_path, std::ofstream::trunc);
-    
-            if (out_file.fail()) {
-                throw std::invalid_argument("Could not open kml output file: " + kml_path);
+
+            if (has_sidecar && match_cache_ptr_->Load(input_path, input_fingerprint, traj, explicit_areas, implicit_areas)) {
+                return;
             }
-    
-            KML::File kml_file(out_file, uid);
-    
-            kml_file.write_poly_style( "explicit_boxes", 0xff990000, 1 );
-            kml_file.write_poly_style( "implicit_boxes", 0xff0033ff, 1 );
-            kml_file.write_line_style( "ci_intervals", 0xffff00ff, 7 );
-            kml_file.write_line_style( "priv_intervals", 0xffffff00, 5 );
-            kml_file.write_trajectory( traj, true );
-            kml_file.write_areas(mf.area_set, "explicit_boxes");
-            kml_file.write_areas(imf.area_set, "implicit_boxes");
-            kml_file.write_intervals( stop_critical_intervals, traj, "ci_intervals", "stop_marker_style" );
-            kml_file.write_intervals( ta_critical_intervals, traj, "ci_intervals", "turnaround_marker_style" );
-            kml_file.write_intervals( priv_intervals, traj, "priv_intervals" );
-            kml_file.finish();
-    
-            out_file.close();
         }
 
-        DeIdentifier di;
-
-        return di.de_identify(traj);
-    }
-
-    trajectory::Trajectory DICSV::DeIdentify(trajectory::Trajectory& traj, const std::string& uid, instrument::PointCounter& point_counter) const {
-        bool plot_kml = config_ptr_->IsPlotKML();
-        std::string shape_in_file_path, shape_out_file_path;
-    
-        ErrorCorrector ec(50);
-        ec.correct_error(traj, uid, point_counter);
-
-        MapFitter mf{quad_ptr_, config_ptr_->GetMapFitScale(), config_ptr_->GetFitExt()};
-        mf.fit(traj);
+        if (config_ptr_->GetFitSegmentPoints() > 0) {
+            // A long trip is cut into segments fit on several threads; the implicit fitter and intersection counter
+            // below carry state along the whole trip, so they stay sequential.
+            const SegmentPool::Ptr& pool = segment_pools_[topology_ptr_ ? topology_ptr_->ThreadNode(thread_num) : 0];
+            SegmentedMapFitter smf{[this, thread_num]() { return MakeMapFitter(thread_num); }, config_ptr_->GetFitSegmentPoints(), config_ptr_->GetFitSegmentOverlap(), pool};
+            smf.fit(traj);
+            explicit_areas.swap(smf.area_set);
+            held_tiles.swap(smf.held_tiles);
+        } else {
+            MapFitter mf = MakeMapFitter(thread_num);
+            mf.fit(traj);
+            explicit_areas.swap(mf.area_set);
+            held_tiles.swap(mf.held_tiles);
+        }
 
         ImplicitMapFitter imf{config_ptr_->GetHeadingGroups(), config_ptr_->GetMinEdgeTripPoints()};
         imf.fit(traj);
@@ -244,10 +401,22 @@ namespace DIMulti {
         IntersectionCounter ic{};
         ic.count_intersections(traj);
 
-        Detector::TurnAround tad{config_ptr_->GetTAMaxQSize(), config_ptr_->GetTAAreaWidth(), config_ptr_->GetTAMaxSpeed(), config_ptr_->GetTAHeadingDelta()};
+        implicit_areas.swap(imf.area_set);
+
+        if (has_sidecar) {
+            try {
+                match_cache_ptr_->Store(input_path, input_fingerprint, traj);
+            } catch (std::exception& e) {
+                std::cerr << e.what() << std::endl;
+            }
+        }
+    }
+
+    trajectory::Trajectory DICSV::Privatize(trajectory::Trajectory& traj, const std::string& uid, const Config::DIConfig& config, const std::string& kml_dir_path, const MapFitter::AreaSet& explicit_areas, const ImplicitMapFitter::AreaSet& implicit_areas, instrument::PointCounter& point_counter) const {
+        Detector::TurnAround tad{config.GetTAMaxQSize(), config.GetTAAreaWidth(), config.GetTAMaxSpeed(), config.GetTAHeadingDelta()};
         trajectory::Interval::PtrList ta_critical_intervals = tad.find_turn_arounds(traj);
 
-        Detector::Stop stop_detector{config_ptr_->GetStopMaxTime(), config_ptr_->GetStopMinDistance(), config_ptr_->GetStopMaxSpeed()};
+        Detector::Stop stop_detector{config.GetStopMaxTime(), config.GetStopMinDistance(), config.GetStopMaxSpeed()};
         trajectory::Interval::PtrList stop_critical_intervals = stop_detector.find_stops( traj );
 
         StartEndIntervals sei;
@@ -257,50 +426,35 @@ namespace DIMulti {
 
         trajectory::Interval::PtrList priv_intervals;
 
-        PrivacyIntervalFinder pif(config_ptr_->GetMinDirectDistance(), 
-                                  config_ptr_->GetMinManhattanDistance(), 
-                                  config_ptr_->GetMinOutDegree(), 
-                                  config_ptr_->GetMaxDirectDistance(), 
-                                  config_ptr_->GetMaxManhattanDistance(), 
-                                  config_ptr_->GetMaxOutDegree(), 
-                                  config_ptr_->GetRandDirectDistance(), 
-                                  config_ptr_->GetRandManhattanDistance(), 
-                                  config_ptr_->GetRandOutDegree());
+        PrivacyIntervalFinder pif(config.GetMinDirectDistance(), 
+                                  config.GetMinManhattanDistance(), 
+                                  config.GetMinOutDegree(), 
+                                  config.GetMaxDirectDistance(), 
+                                  config.GetMaxManhattanDistance(), 
+                                  config.GetMaxOutDegree(), 
+                                  config.GetRandDirectDistance(), 
+                                  config.GetRandManhattanDistance(), 
+                                  config.GetRandOutDegree());
         priv_intervals = pif.find_intervals( traj );
 
         PrivacyIntervalMarker pim({ priv_intervals });
         pim.mark_trajectory(traj);
 
-        if (plot_kml) {
-            std::string kml_path;
-    
-            if (kml_dir_path_.empty()) {
-                kml_path = uid + ".di.kml";
-            } else {
-                kml_path = kml_dir_path_ + "/" + uid + ".di.kml";
-            }
-    
-            std::ofstream out_file(kml_path, std::ofstream::trunc);
-    
-            if (out_file.fail()) {
-                throw std::invalid_argument("Could not open kml output file: " + kml_path);
-            }
-    
-            KML::File kml_file(out_file, uid);
-    
-            kml_file.write_poly_style( "explicit_boxes", 0xff990000, 1 );
-            kml_file.write_poly_style( "implicit_boxes", 0xff0033ff, 1 );
-            kml_file.write_line_style( "ci_intervals", 0xffff00ff, 7 );
-            kml_file.write_line_style( "priv_intervals", 0xffffff00, 5 );
-            kml_file.write_trajectory( traj, true );
-            kml_file.write_areas(mf.area_set, "explicit_boxes");
-            kml_file.write_areas(imf.area_set, "implicit_boxes");
-            kml_file.write_intervals( stop_critical_intervals, traj, "ci_intervals", "stop_marker_style" );
-            kml_file.write_intervals( ta_critical_intervals, traj, "ci_intervals", "turnaround_marker_style" );
-            kml_file.write_intervals( priv_intervals, traj, "priv_intervals" );
-            kml_file.finish();
-    
-            out_file.close();
+        if (config.IsPlotKML()) {
+            KMLJob::Ptr job_ptr = std::make_shared<KMLJob>();
+            std::string extension = config.IsKMZ() ? ".di.kmz" : ".di.kml";
+
+            job_ptr->uid = uid;
+            job_ptr->file_path = kml_dir_path.empty() ? uid + extension : kml_dir_path + "/" + uid + extension;
+            job_ptr->kmz = config.IsKMZ();
+            job_ptr->tolerance = config.GetKMLTolerance();
+            job_ptr->traj = traj;
+            job_ptr->explicit_areas = explicit_areas;
+            job_ptr->implicit_areas = implicit_areas;
+            job_ptr->stop_intervals = stop_critical_intervals;
+            job_ptr->ta_intervals = ta_critical_intervals;
+            job_ptr->priv_intervals = priv_intervals;
+            kml_pipeline_ptr_->Submit(job_ptr);
         }
 
         DeIdentifier di;
@@ -308,30 +462,130 @@ namespace DIMulti {
         return di.de_identify(traj, point_counter);
     }
 
+    void DICSV::Sweep(const std::string& input_path, unsigned thread_num, std::vector<BSMP1::BSMP1CSVTrajectoryWriter>& traj_writers) {
+        instrument::PointCounter trip_counter;
+        std::string uid;
+        trajectory::Trajectory traj = MakeTrajectory(input_path, uid, &trip_counter);
+
+        // The stages that do not depend on the swept parameters run once.
+        GPSErrorFilter error_filter(50, config_ptr_->GetErrorMaxSpeed(), config_ptr_->GetErrorJumpPoints());
+        error_filter.filter(traj, trip_counter);
+
+        // The map tiles are held until the trip is privatized, so the vertices of its fit edges keep their edges.
+        MapFitter::TileSet held_tiles;
+        MapFitter::AreaSet explicit_areas;
+        ImplicitMapFitter::AreaSet implicit_areas;
+        MapMatch(traj, input_path, thread_num, explicit_areas, implicit_areas, held_tiles);
+
+        instrument::PointCounter first_counter;
+
+        for (size_t i = 0; i < variants_.size(); ++i) {
+            // Each variant marks its own copy of the points.
+            trajectory::Trajectory variant_traj;
+            variant_traj.reserve(traj.size());
+
+            for (auto& point_ptr : traj) {
+                variant_traj.push_back(std::make_shared<trajectory::Point>(*point_ptr));
+            }
+
+            instrument::PointCounter variant_counter = trip_counter;
+            traj_writers[i].write_trajectory(Privatize(variant_traj, uid, *variants_[i].config_ptr, variants_[i].kml_dir_path, explicit_areas, implicit_areas, variant_counter), uid, true);
+            *variants_[i].counters[thread_num] = *variants_[i].counters[thread_num] + variant_counter;
+
+            if (i == 0) {
+                first_counter = variant_counter;
+            }
+        }
+
+        RecordDone(input_path, uid, traj_writers[0].get_output_file_path(uid), first_counter);
+    }
+
     void DICSV::Thread(unsigned thread_num, MultiThread::SharedQueue<FileInfo::Ptr>* q) {
         SingleFileInfo::Ptr trip_file_ptr;
         trajectory::Trajectory traj;
         BSMP1::BSMP1CSVTrajectoryWriter traj_writer(out_dir_path_);
+        std::vector<BSMP1::BSMP1CSVTrajectoryWriter> variant_writers;
+
+        for (auto& variant : variants_) {
+            variant_writers.emplace_back(variant.out_dir_path);
+        }
+
+        if (topology_ptr_ && !MultiThread::Topology::PinCurrentThread({ topology_ptr_->ThreadCPU(thread_num) })) {
+            std::cerr << "Could not pin thread " << thread_num << " to CPU " << topology_ptr_->ThreadCPU(thread_num) << "." << std::endl;
+        }
 
         while ((trip_file_ptr = std::dynamic_pointer_cast<SingleFileInfo>(q->pop())) != nullptr) {
+            uint64_t input_fingerprint = 0;
+
+            if (fingerprint_db_ptr_) {
+                FingerprintDB::Entry entry;
+
+                try {
+                    input_fingerprint = FingerprintDB::InputFingerprint(trip_file_ptr->GetFilePath());
+                } catch (std::exception&) {
+                    // The factory will report the error.
+                }
+
+                if (fingerprint_db_ptr_->FindUnchanged(trip_file_ptr->GetFilePath(), input_fingerprint, entry)) {
+                    RecordDone(trip_file_ptr->GetFilePath(), entry.uid, entry.output_path, entry.point_counter);
+                    n_unchanged_++;
+
+                    if (count_points_) {
+                        *counters_[thread_num] = *counters_[thread_num] + entry.point_counter;
+                    }
+
+                    continue;
+                }
+            }
+
+            if (!variants_.empty()) {
+                try {
+                    Sweep(trip_file_ptr->GetFilePath(), thread_num, variant_writers);
+                } catch (std::exception& e) {
+                    std::cerr << "DeIdentification error: " << e.what() << std::endl;
+                    RecordFail(trip_file_ptr->GetFilePath(), instrument::PointCounter());
+                }
+
+                continue;
+            }
+
             if (count_points_) {
+                // Count this trip separately so its counts can be journaled with it.
+                instrument::PointCounter trip_counter;
+                std::shared_ptr<instrument::PointCounter> point_counter_ptr = counters_[thread_num];
+
                 try {
-                    BSMP1::BSMP1CSVTrajectoryFactory factory;
-                    std::shared_ptr<instrument::PointCounter> point_counter_ptr = counters_[thread_num];
-                    traj = factory.make_trajectory(trip_file_ptr->GetFilePath(), *point_counter_ptr);
-                    traj_writer.write_trajectory(DeIdentify(traj, factory.get_uid(), *point_counter_ptr), factory.get_uid(), true);
+                    std::string uid;
+                    traj = MakeTrajectory(trip_file_ptr->GetFilePath(), uid, &trip_counter);
+
+                    traj_writer.write_trajectory(DeIdentify(traj, uid, trip_file_ptr->GetFilePath(), trip_counter, thread_num), uid, true);
+                    RecordDone(trip_file_ptr->GetFilePath(), uid, traj_writer.get_output_file_path(uid), trip_counter);
+                    *point_counter_ptr = *point_counter_ptr + trip_counter;
+
+                    if (fingerprint_db_ptr_) {
+                        fingerprint_db_ptr_->Update(trip_file_ptr->GetFilePath(), input_fingerprint, uid, traj_writer.get_output_file_path(uid), trip_counter);
+                    }
                 } catch (std::exception& e) {
                     std::cerr << "DeIdentification error: " << e.what() << std::endl;
+                    RecordFail(trip_file_ptr->GetFilePath(), trip_counter);
+                    *point_counter_ptr = *point_counter_ptr + trip_counter;
     
                     continue;
                 }
             } else {
                 try {
-                    BSMP1::BSMP1CSVTrajectoryFactory factory;
-                    traj = factory.make_trajectory(trip_file_ptr->GetFilePath());
-                    traj_writer.write_trajectory(DeIdentify(traj, factory.get_uid()), factory.get_uid(), true);
+                    std::string uid;
+                    traj = MakeTrajectory(trip_file_ptr->GetFilePath(), uid);
+
+                    traj_writer.write_trajectory(DeIdentify(traj, uid, trip_file_ptr->GetFilePath(), thread_num), uid, true);
+                    RecordDone(trip_file_ptr->GetFilePath(), uid, traj_writer.get_output_file_path(uid), instrument::PointCounter());
+
+                    if (fingerprint_db_ptr_) {
+                        fingerprint_db_ptr_->Update(trip_file_ptr->GetFilePath(), input_fingerprint, uid, traj_writer.get_output_file_path(uid), instrument::PointCounter());
+                    }
                 } catch (std::exception& e) {
                     std::cerr << "DeIdentification error: " << e.what() << std::endl;
+                    RecordFail(trip_file_ptr->GetFilePath(), instrument::PointCounter());
     
                     continue;
                 }
@@ -341,17 +595,247 @@ namespace DIMulti {
 
     void DICSV::Close(void) {
         SingleBatchCSV::Close();
+        segment_pools_.clear();
 
-        if (!count_points_) {
+        if (kml_pipeline_ptr_) {
+            kml_pipeline_ptr_->Finish();
+        }
+
+        if (!tile_cache_ptrs_.empty()) {
+            uint64_t n_loads = 0, n_hits = 0, n_evictions = 0;
+
+            for (auto& tile_cache_ptr : tile_cache_ptrs_) {
+                n_loads += tile_cache_ptr->get_loads();
+                n_hits += tile_cache_ptr->get_hits();
+                n_evictions += tile_cache_ptr->get_evictions();
+            }
+
+            std::cerr << "Tiles: " << n_loads << " loaded; " << n_hits << " cache hits; " << n_evictions << " evicted." << std::endl;
+        }
+
+        if (match_cache_ptr_) {
+            std::cerr << "Sidecars: " << match_cache_ptr_->GetHits() << " trips restored without map matching; " << match_cache_ptr_->GetStores() << " sidecars written." << std::endl;
+        }
+
+        if (fingerprint_db_ptr_) {
+            std::cerr << "Incremental: " << n_unchanged_ << " unchanged trip files skipped." << std::endl;
+
+            try {
+                fingerprint_db_ptr_->Save();
+            } catch (std::exception& e) {
+                std::cerr << e.what() << std::endl;
+            }
+        }
+
+        for (auto& variant : variants_) {
+            instrument::PointCounter summary;
+
+            for (auto& point_counter_ptr : variant.counters) {
+                summary = summary + *point_counter_ptr;
+            }
+
+            std::string summary_path = variant.out_dir_path + "/cv_di.summary";
+            std::ofstream summary_file(summary_path, std::ofstream::trunc);
+            summary_file << "total,invalid_fields,invalid_GPS,invalid_heading,error,critical_interval,privacy_interval" << std::endl;
+            summary_file << summary << std::endl;
+
+            if (summary_file.fail()) {
+                std::cerr << "Could not write sweep summary: " << summary_path << std::endl;
+            }
+
+            std::cerr << "Sweep variant " << variant.name << " (" << variant.out_dir_path << "):" << std::endl;
+            PrintPointSummary(summary);
+        }
+
+        if (!count_points_ || !variants_.empty()) {
             return;
         }
         
-        instrument::PointCounter summary;
+        // Include the trips finished in the runs being resumed.
+        instrument::PointCounter summary = journal_ptr_ ? journal_ptr_->GetResumedCounter() : instrument::PointCounter();
 
         for (auto& point_counter_ptr : counters_) {
             summary = summary + *point_counter_ptr; 
         }
-    
+
+        PrintPointSummary(summary);
+    }
+
+    void DICSV::LoadSweep(const std::string& sweep_file_path) {
+        std::ifstream file(sweep_file_path);
+
+        if (file.fail()) {
+            throw std::invalid_argument("Could not open sweep file: " + sweep_file_path);
+        }
+
+        std::unordered_set<std::string> names;
+        std::string line;
+
+        while (std::getline(file, line)) {
+            line.erase(std::remove(line.begin(), line.end(), '\r'), line.end());
+
+            if (line.empty()) {
+                continue;
+            }
+
+            SweepVariant variant;
+            variant.config_ptr = Config::DIConfig::ConfigFromFile(line);
+
+            if (!variant.config_ptr->SharesMapMatching(*config_ptr_)) {
+                throw std::invalid_argument("Sweep configuration " + line + " changes the map matching parameters; only the detector and privacy parameters may vary.");
+            }
+
+            // Each variant writes into a directory named after its configuration file.
+            StrVector path_items = string_utilities::split(line, '/');
+            variant.name = path_items.back().substr(0, path_items.back().rfind('.'));
+
+            if (variant.name.empty() || !names.insert(variant.name).second) {
+                throw std::invalid_argument("Sweep configuration names must be unique: " + line);
+            }
+
+            variant.out_dir_path = out_dir_path_.empty() ? variant.name : out_dir_path_ + "/" + variant.name;
+            variant.kml_dir_path = kml_dir_path_.empty() ? variant.name : kml_dir_path_ + "/" + variant.name;
+
+            for (auto& dir_path : { variant.out_dir_path, variant.kml_dir_path }) {
+                if (::mkdir(dir_path.c_str(), 0755) != 0 && errno != EEXIST) {
+                    throw std::invalid_argument("Could not create sweep directory: " + dir_path);
+                }
+            }
+
+            variants_.push_back(variant);
+        }
+
+        if (variants_.empty()) {
+            throw std::invalid_argument("Sweep file lists no configurations: " + sweep_file_path);
+        }
+
+        std::cerr << "Sweep: " << variants_.size() << " configurations sharing parsing and map matching." << std::endl;
+    }
+
+    MapFitter DICSV::MakeMapFitter(unsigned thread_num) const {
+        size_t node = topology_ptr_ ? topology_ptr_->ThreadNode(thread_num) : 0;
+
+        MapFitter mf = tile_cache_ptrs_.empty() ? MapFitter{index_ptrs_[node], config_ptr_->GetMapFitScale(), config_ptr_->GetFitExt()}
+                                                : MapFitter{tile_cache_ptrs_[node], config_ptr_->GetMapFitScale(), config_ptr_->GetFitExt()};
+        mf.set_decimation(config_ptr_->GetFitDecimationDistance(), config_ptr_->GetFitDecimationHeading());
+
+        return mf;
+    }
+
+    spatial::EdgeIndex::CPtr DICSV::MakeIndex(const std::vector<geo::EdgeCPtr>& edges, const geo::Point& sw, const geo::Point& ne) const {
+        return spatial::EdgeIndex::make(config_ptr_->GetSpatialIndex(), edges, sw, ne, config_ptr_->GetMapFitScale(), config_ptr_->GetFitExt(), config_ptr_->GetQuadParams());
+    }
+
+    std::vector<geo::EdgeCPtr> DICSV::CopyEdges(const std::vector<geo::EdgeCPtr>& edges) {
+        std::unordered_map<const geo::Vertex*, geo::Vertex::Ptr> vertices;
+        std::vector<geo::EdgeCPtr> copies;
+
+        auto copy_vertex = [&vertices](const geo::Vertex::Ptr& vertex_ptr) {
+            geo::Vertex::Ptr& copy_ptr = vertices[vertex_ptr.get()];
+
+            if (!copy_ptr) {
+                copy_ptr = std::make_shared<geo::Vertex>(vertex_ptr->lat, vertex_ptr->lon, vertex_ptr->uid);
+            }
+
+            return copy_ptr;
+        };
+
+        copies.reserve(edges.size());
+
+        for (auto& edge_ptr : edges) {
+            geo::Vertex::Ptr v1 = copy_vertex(edge_ptr->v1);
+            geo::Vertex::Ptr v2 = copy_vertex(edge_ptr->v2);
+            geo::EdgePtr copy_ptr = std::make_shared<geo::Edge>( v1, v2, edge_ptr->get_way_type(), edge_ptr->get_uid() );
+            v1->add_edge( copy_ptr );
+            v2->add_edge( copy_ptr );
+            copies.push_back(copy_ptr);
+        }
+
+        return copies;
+    }
+
+    void DICSV::RecordDone(const std::string& input_path, const std::string& uid, const std::string& output_path, const instrument::PointCounter& point_counter) {
+        if (client_ptr_) {
+            client_ptr_->ReportDone(input_path, uid, output_path, point_counter);
+        } else {
+            journal_ptr_->RecordDone(input_path, uid, output_path, point_counter);
+        }
+    }
+
+    void DICSV::RecordFail(const std::string& input_path, const instrument::PointCounter& point_counter) {
+        if (client_ptr_) {
+            client_ptr_->ReportFail(input_path, point_counter);
+        } else {
+            journal_ptr_->RecordFail(input_path, point_counter);
+        }
+    }
+
+    trajectory::Trajectory DICSV::MakeTrajectory(const std::string& trip_file_path, std::string& uid, instrument::PointCounter* point_counter) {
+        trajectory::Trajectory traj;
+
+        if (BSMP1::BSMP1ColumnarTrajectoryFactory::is_columnar(trip_file_path)) {
+            BSMP1::BSMP1ColumnarTrajectoryFactory factory;
+            traj = point_counter ? factory.make_trajectory(trip_file_path, *point_counter) : factory.make_trajectory(trip_file_path);
+            uid = factory.get_uid();
+        } else {
+            BSMP1::BSMP1CSVTrajectoryFactory factory;
+            traj = point_counter ? factory.make_trajectory(trip_file_path, *point_counter) : factory.make_trajectory(trip_file_path);
+            uid = factory.get_uid();
+        }
+
+        return traj;
+    }
+
+    size_t DICSV::ConvertToColumnar(const std::string& manifest_path, const std::string& out_dir_path, std::ostream& manifest_out) {
+        std::ifstream manifest(manifest_path);
+
+        if (manifest.fail()) {
+            throw std::invalid_argument("Could not open manifest: " + manifest_path);
+        }
+
+        BSMP1::BSMP1ColumnarTrajectoryWriter writer(out_dir_path);
+        FileInfo::Ptr trip_file_ptr;
+        uint64_t line_number = 0;
+        size_t n_converted = 0;
+
+        while ((trip_file_ptr = ReadItem(manifest, line_number)) != nullptr) {
+            try {
+                BSMP1::BSMP1CSVTrajectoryFactory factory;
+                trajectory::Trajectory traj = factory.make_trajectory(trip_file_ptr->GetFilePath());
+
+                if (traj.empty()) {
+                    std::cerr << "Skipping trip file without valid points: " << trip_file_ptr->GetFilePath() << std::endl;
+                    continue;
+                }
+
+                writer.write_trajectory(traj, factory.get_uid(), true);
+                std::string file_name = factory.get_uid() + BSMP1::kColumnarExtension;
+                manifest_out << (out_dir_path.empty() ? file_name : out_dir_path + "/" + file_name) << std::endl;
+                n_converted++;
+            } catch (std::exception& e) {
+                std::cerr << "Skipping trip file: " << trip_file_ptr->GetFilePath() << " " << e.what() << std::endl;
+            }
+        }
+
+        return n_converted;
+    }
+
+    void DICSV::MergeShards(const std::string& out_dir_path, unsigned n_shards) {
+        std::vector<std::string> shard_paths;
+
+        for (unsigned i = 0; i < n_shards; ++i) {
+            std::string shard_name = Shard::FileName("cv_di.journal", i, n_shards);
+            shard_paths.push_back(out_dir_path.empty() ? shard_name : out_dir_path + "/" + shard_name);
+        }
+
+        std::string journal_path = out_dir_path.empty() ? "cv_di.journal" : out_dir_path + "/cv_di.journal";
+        Journal::MergeSummary merge_summary = Journal::Merge(shard_paths, journal_path);
+
+        std::cerr << "Merged " << n_shards << " shards into " << journal_path << ": " << merge_summary.n_done << " trips de-identified; " << merge_summary.n_failed << " failed." << std::endl;
+        PrintPointSummary(merge_summary.point_counter);
+    }
+
+    void DICSV::PrintPointSummary(const instrument::PointCounter& summary) {
         std::cerr << "********************************** Point Summary ****************************************" << std::endl;
         std::cerr << "total,invalid_fields,invalid_GPS,invalid_heading,error,critical_interval,privacy_interval" << std::endl;
         std::cerr << summary << std::endl;
@@ -0,0 +1,152 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#include "fingerprint.hpp"
+
+#include <cstdio>
+#include <sstream>
+
+namespace DIMulti {
+    FingerprintDB::FingerprintDB(const std::string& file_path, uint64_t run_fingerprint) :
+        file_path_(file_path),
+        run_fingerprint_(run_fingerprint)
+    {
+        std::ifstream in_file(file_path_);
+        std::string line;
+
+        // A missing database is the first incremental run.
+        while (!in_file.fail() && std::getline(in_file, line)) {
+            if (in_file.eof()) {
+                // The last line was not terminated; the previous run stopped while writing it.
+                break;
+            }
+
+            StrVector parts = string_utilities::split(line, '\t');
+
+            if (parts.size() != 6) {
+                std::cerr << "Skipping invalid fingerprint line: " << line << std::endl;
+                continue;
+            }
+
+            StrVector counts = string_utilities::split(parts[5], ',');
+
+            if (counts.size() != 7) {
+                std::cerr << "Skipping invalid fingerprint line: " << line << std::endl;
+                continue;
+            }
+
+            try {
+                Entry entry;
+                entry.input_fingerprint = std::stoull(parts[1], nullptr, 16);
+                entry.run_fingerprint = std::stoull(parts[2], nullptr, 16);
+                entry.uid = parts[3];
+                entry.output_path = parts[4];
+                entry.point_counter = instrument::PointCounter(std::stoull(counts[0]), std::stoull(counts[1]), std::stoull(counts[2]), std::stoull(counts[3]), std::stoull(counts[4]), std::stoull(counts[5]), std::stoull(counts[6]));
+                entries_[parts[0]] = entry;
+            } catch (std::exception&) {
+                std::cerr << "Skipping invalid fingerprint line: " << line << std::endl;
+            }
+        }
+
+        in_file.close();
+
+        // Drop the torn and superseded lines before appending to the database.
+        Rewrite();
+    }
+
+    uint64_t FingerprintDB::InputFingerprint(const std::string& input_path) {
+        return hash_utilities::file_hash(input_path);
+    }
+
+    bool FingerprintDB::FindUnchanged(const std::string& input_path, uint64_t input_fingerprint, Entry& entry) const {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = entries_.find(input_path);
+
+            if (it == entries_.end() || it->second.input_fingerprint != input_fingerprint || it->second.run_fingerprint != run_fingerprint_) {
+                return false;
+            }
+
+            entry = it->second;
+        }
+
+        std::ifstream out_file(entry.output_path);
+
+        return !out_file.fail();
+    }
+
+    void FingerprintDB::Update(const std::string& input_path, uint64_t input_fingerprint, const std::string& uid, const std::string& output_path, const instrument::PointCounter& point_counter) {
+        Entry entry;
+        entry.input_fingerprint = input_fingerprint;
+        entry.run_fingerprint = run_fingerprint_;
+        entry.uid = uid;
+        entry.output_path = output_path;
+        entry.point_counter = point_counter;
+
+        std::string line = FormatLine(input_path, entry);
+
+        // One write and flush per line so a crash can only tear the last line.
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_[input_path] = entry;
+        file_ << line;
+        file_.flush();
+    }
+
+    void FingerprintDB::Save() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Rewrite();
+    }
+
+    void FingerprintDB::Rewrite() {
+        if (file_.is_open()) {
+            file_.close();
+        }
+
+        std::string part_file_path = file_path_ + ".part";
+        std::ofstream file(part_file_path, std::ofstream::trunc);
+
+        if (file.fail()) {
+            throw std::invalid_argument("Could not open fingerprint file: " + part_file_path);
+        }
+
+        // Entries for trip files that are not in this run's manifest are kept for later runs.
+        for (auto& map_elem : entries_) {
+            file << FormatLine(map_elem.first, map_elem.second);
+        }
+
+        file.close();
+
+        if (file.fail() || (std::rename(part_file_path.c_str(), file_path_.c_str()) != 0 && 
+            (std::remove(file_path_.c_str()) != 0 || std::rename(part_file_path.c_str(), file_path_.c_str()) != 0))) {
+            throw std::invalid_argument("Could not write fingerprint file: " + file_path_);
+        }
+
+        file_.open(file_path_, std::ofstream::app);
+
+        if (file_.fail()) {
+            throw std::invalid_argument("Could not open fingerprint file: " + file_path_);
+        }
+    }
+
+    std::string FingerprintDB::FormatLine(const std::string& input_path, const Entry& entry) {
+        std::stringstream ss;
+        ss << input_path << "\t" << hash_utilities::to_hex(entry.input_fingerprint) << "\t" << hash_utilities::to_hex(entry.run_fingerprint) << "\t" << entry.uid << "\t" << entry.output_path << "\t" << entry.point_counter << "\n";
+        return ss.str();
+    }
+}
@@ -0,0 +1,224 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#include "journal.hpp"
+
+#include <cstdio>
+
+namespace DIMulti {
+    Journal::Journal(const std::string& file_path, bool resume) :
+        file_path_(file_path)
+    {
+        if (resume) {
+            Load();
+        }
+
+        std::ios::openmode mode = resume ? std::ofstream::app : std::ofstream::trunc;
+        file_.open(file_path_, mode);
+
+        if (file_.fail()) {
+            throw std::invalid_argument("Could not open journal file: " + file_path_);
+        }
+    }
+
+    void Journal::Load() {
+        std::ifstream in_file(file_path_);
+
+        if (in_file.fail()) {
+            // Nothing to resume.
+            return;
+        }
+
+        // Keep the last valid entry for each input; a rerun of the same input replaces the earlier entry.
+        std::vector<std::string> order;
+        std::unordered_map<std::string, std::pair<std::string, instrument::PointCounter>> entries;
+        std::string line;
+
+        while (std::getline(in_file, line)) {
+            if (in_file.eof()) {
+                // The last line was not terminated; the previous run was interrupted while writing it.
+                break;
+            }
+
+            StrVector parts;
+            instrument::PointCounter point_counter;
+
+            if (!ParseLine(line, parts, point_counter)) {
+                std::cerr << "Skipping invalid journal line: " << line << std::endl;
+                continue;
+            }
+
+            if (parts[0] == "done") {
+                std::ifstream out_file(parts[3]);
+
+                if (out_file.fail()) {
+                    // The output was removed or never renamed into place; redo this trip.
+                    entries.erase(parts[1]);
+                    continue;
+                }
+            }
+
+            if (entries.find(parts[1]) == entries.end()) {
+                order.push_back(parts[1]);
+            }
+
+            entries[parts[1]] = std::make_pair(line, point_counter);
+        }
+
+        in_file.close();
+
+        // Rewrite the journal without the torn and stale lines.
+        std::string part_file_path = file_path_ + ".part";
+        std::ofstream out_file(part_file_path, std::ofstream::trunc);
+
+        if (out_file.fail()) {
+            throw std::invalid_argument("Could not open journal file: " + part_file_path);
+        }
+
+        for (auto& input_path : order) {
+            auto it = entries.find(input_path);
+
+            if (it == entries.end()) {
+                continue;
+            }
+
+            out_file << it->second.first << "\n";
+            finished_.insert(input_path);
+            resumed_counter_ = resumed_counter_ + it->second.second;
+            entries.erase(it);
+        }
+
+        out_file.close();
+
+        if (out_file.fail() || (std::rename(part_file_path.c_str(), file_path_.c_str()) != 0 && 
+            (std::remove(file_path_.c_str()) != 0 || std::rename(part_file_path.c_str(), file_path_.c_str()) != 0))) {
+            throw std::invalid_argument("Could not rewrite journal file: " + file_path_);
+        }
+    }
+
+    bool Journal::ParseLine(const std::string& line, StrVector& parts, instrument::PointCounter& point_counter) {
+        parts = string_utilities::split(line, '\t');
+
+        if (parts.size() != 5 || (parts[0] != "done" && parts[0] != "fail")) {
+            return false;
+        }
+
+        StrVector counts = string_utilities::split(parts[4], ',');
+
+        if (counts.size() != 7) {
+            return false;
+        }
+
+        try {
+            point_counter = instrument::PointCounter(std::stoull(counts[0]), std::stoull(counts[1]), std::stoull(counts[2]), std::stoull(counts[3]), std::stoull(counts[4]), std::stoull(counts[5]), std::stoull(counts[6]));
+        } catch (std::exception&) {
+            return false;
+        }
+
+        return true;
+    }
+
+    bool Journal::IsFinished(const std::string& input_path) const {
+        return finished_.find(input_path) != finished_.end();
+    }
+
+    void Journal::Append(const std::string& status, const std::string& input_path, const std::string& uid, const std::string& output_path, const instrument::PointCounter& point_counter) {
+        std::string line = FormatLine(status, input_path, uid, output_path, point_counter) + "\n";
+
+        // One write and flush per line so a crash can only tear the last line.
+        std::lock_guard<std::mutex> lock(mutex_);
+        file_ << line;
+        file_.flush();
+    }
+
+    std::string Journal::FormatLine(const std::string& status, const std::string& input_path, const std::string& uid, const std::string& output_path, const instrument::PointCounter& point_counter) {
+        std::stringstream ss;
+        ss << status << "\t" << input_path << "\t" << uid << "\t" << output_path << "\t" << point_counter;
+        return ss.str();
+    }
+
+    void Journal::RecordDone(const std::string& input_path, const std::string& uid, const std::string& output_path, const instrument::PointCounter& point_counter) {
+        Append("done", input_path, uid, output_path, point_counter);
+    }
+
+    void Journal::RecordFail(const std::string& input_path, const instrument::PointCounter& point_counter) {
+        Append("fail", input_path, "", "", point_counter);
+    }
+
+    const instrument::PointCounter& Journal::GetResumedCounter() const {
+        return resumed_counter_;
+    }
+
+    uint64_t Journal::GetResumedCount() const {
+        return finished_.size();
+    }
+
+    Journal::MergeSummary Journal::Merge(const std::vector<std::string>& shard_file_paths, const std::string& file_path) {
+        MergeSummary summary{ 0, 0, instrument::PointCounter() };
+        std::string part_file_path = file_path + ".part";
+        std::ofstream out_file(part_file_path, std::ofstream::trunc);
+
+        if (out_file.fail()) {
+            throw std::invalid_argument("Could not open journal file: " + part_file_path);
+        }
+
+        for (auto& shard_file_path : shard_file_paths) {
+            std::ifstream in_file(shard_file_path);
+
+            if (in_file.fail()) {
+                throw std::invalid_argument("Missing shard journal: " + shard_file_path);
+            }
+
+            std::string line;
+
+            while (std::getline(in_file, line)) {
+                if (in_file.eof()) {
+                    // The shard was interrupted while writing its last line.
+                    break;
+                }
+
+                StrVector parts;
+                instrument::PointCounter point_counter;
+
+                if (!ParseLine(line, parts, point_counter)) {
+                    std::cerr << "Skipping invalid journal line: " << line << std::endl;
+                    continue;
+                }
+
+                if (parts[0] == "done") {
+                    summary.n_done++;
+                } else {
+                    summary.n_failed++;
+                }
+
+                summary.point_counter = summary.point_counter + point_counter;
+                out_file << line << "\n";
+            }
+        }
+
+        out_file.close();
+
+        if (out_file.fail() || (std::rename(part_file_path.c_str(), file_path.c_str()) != 0 && 
+            (std::remove(file_path.c_str()) != 0 || std::rename(part_file_path.c_str(), file_path.c_str()) != 0))) {
+            throw std::invalid_argument("Could not write journal file: " + file_path);
+        }
+
+        return summary;
+    }
+}
@@ -0,0 +1,149 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#include "kml_pipeline.hpp"
+
+#include <fstream>
+#include <sstream>
+
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace DIMulti {
+    KMLPipeline::KMLPipeline(unsigned n_threads, std::size_t max_pending) :
+        max_pending_(max_pending < 1 ? 1 : max_pending),
+        done_(false)
+    {
+        if (n_threads < 1) {
+            n_threads = 1;
+        }
+
+        for (unsigned i = 0; i < n_threads; ++i) {
+            threads_.push_back(std::thread(&KMLPipeline::Worker, this));
+        }
+    }
+
+    KMLPipeline::~KMLPipeline() {
+        Finish();
+    }
+
+    void KMLPipeline::Submit(KMLJob::Ptr job_ptr) {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        if (done_) {
+            lock.unlock();
+            Render(*job_ptr);
+            return;
+        }
+
+        while (jobs_.size() >= max_pending_) {
+            not_full_.wait(lock);
+        }
+
+        jobs_.push(job_ptr);
+        lock.unlock();
+        not_empty_.notify_one();
+    }
+
+    void KMLPipeline::Finish() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_ = true;
+        }
+
+        not_empty_.notify_all();
+
+        for (auto& thread : threads_) {
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+    }
+
+    void KMLPipeline::Worker() {
+#ifdef __linux__
+        // Renderers yield the cores to the de-identification threads; on Linux the nice value is per thread.
+        setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 10);
+#endif
+
+        while (true) {
+            KMLJob::Ptr job_ptr;
+
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+
+                while (jobs_.empty() && !done_) {
+                    not_empty_.wait(lock);
+                }
+
+                if (jobs_.empty()) {
+                    // Done and drained.
+                    return;
+                }
+
+                job_ptr = jobs_.front();
+                jobs_.pop();
+            }
+
+            not_full_.notify_one();
+
+            try {
+                Render(*job_ptr);
+            } catch (std::exception& e) {
+                std::cerr << "KML error: " << e.what() << std::endl;
+            }
+        }
+    }
+
+    void KMLPipeline::Render(const KMLJob& job) {
+        std::ostringstream buffer;
+        KML::File kml_file(buffer, job.uid);
+        kml_file.set_tolerance(job.tolerance);
+
+        kml_file.write_poly_style( "explicit_boxes", 0xff990000, 1 );
+        kml_file.write_poly_style( "implicit_boxes", 0xff0033ff, 1 );
+        kml_file.write_line_style( "ci_intervals", 0xffff00ff, 7 );
+        kml_file.write_line_style( "priv_intervals", 0xffffff00, 5 );
+        kml_file.write_trajectory( job.traj, true );
+        kml_file.write_areas(job.explicit_areas, "explicit_boxes");
+        kml_file.write_areas(job.implicit_areas, "implicit_boxes");
+        kml_file.write_intervals( job.stop_intervals, job.traj, "ci_intervals", "stop_marker_style" );
+        kml_file.write_intervals( job.ta_intervals, job.traj, "ci_intervals", "turnaround_marker_style" );
+        kml_file.write_intervals( job.priv_intervals, job.traj, "priv_intervals" );
+        kml_file.finish();
+
+        if (job.kmz) {
+            KML::write_kmz(job.file_path, buffer.str());
+            return;
+        }
+
+        std::ofstream out_file(job.file_path, std::ofstream::trunc | std::ofstream::binary);
+
+        if (out_file.fail()) {
+            throw std::invalid_argument("Could not open kml output file: " + job.file_path);
+        }
+
+        std::string kml = buffer.str();
+        out_file.write(kml.data(), kml.size());
+        out_file.close();
+    }
+}
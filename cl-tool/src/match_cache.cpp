@@ -0,0 +1,219 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#include "match_cache.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+#include <sys/stat.h>
+
+namespace {
+    const char kSidecarMagic[8] = { 'C', 'V', 'F', 'I', 'T', '1', '\0', '\0' };
+    const uint32_t kSidecarVersion = 1;
+    const uint32_t kNoEdge = 0xFFFFFFFF;
+
+    /** \brief The fixed size header at the start of a sidecar. */
+    struct SidecarHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t match_key;
+        uint64_t input_fingerprint;
+        uint64_t n_points;
+        uint64_t n_edges;
+    };
+
+    /** \brief A fit edge; the points refer to edges by their position in the sidecar. */
+    struct SidecarEdge {
+        double v1_lat;
+        double v1_lon;
+        double v2_lat;
+        double v2_lon;
+        uint64_t v1_uid;
+        uint64_t v2_uid;
+        uint64_t uid;
+        uint32_t way_type;
+        uint32_t is_explicit;
+    };
+
+    /** \brief A point's fit edge, or kNoEdge, and cumulative out-degree. */
+    struct SidecarPoint {
+        uint32_t edge;
+        uint32_t out_degree;
+    };
+}
+
+namespace DIMulti {
+    MatchCache::MatchCache(const std::string& dir_path, uint64_t match_key, double fit_width_scaling, double fit_extension) :
+        dir_path_(dir_path),
+        match_key_(match_key),
+        fit_width_scaling_(fit_width_scaling),
+        fit_extension_(fit_extension),
+        n_hits_(0),
+        n_stores_(0)
+    {
+        struct stat dir_stat;
+
+        if (::stat(dir_path_.c_str(), &dir_stat) != 0 || !S_ISDIR(dir_stat.st_mode)) {
+            throw std::invalid_argument("Sidecar directory does not exist: " + dir_path_);
+        }
+    }
+
+    std::string MatchCache::SidecarPath(const std::string& input_path) const {
+        // Sidecars made with another map or other parameters are kept under their own names.
+        return dir_path_ + "/" + hash_utilities::to_hex(hash_utilities::fnv1a(input_path, match_key_)) + ".cvfit";
+    }
+
+    bool MatchCache::Load(const std::string& input_path, uint64_t input_fingerprint, trajectory::Trajectory& traj, MapFitter::AreaSet& explicit_areas, ImplicitMapFitter::AreaSet& implicit_areas) {
+        std::ifstream file(SidecarPath(input_path), std::ios::binary);
+
+        if (file.fail()) {
+            return false;
+        }
+
+        SidecarHeader header;
+        file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+        if (file.fail() || std::memcmp(header.magic, kSidecarMagic, sizeof(kSidecarMagic)) != 0 || header.version != kSidecarVersion ||
+            header.match_key != match_key_ || header.input_fingerprint != input_fingerprint || header.n_points != traj.size()) {
+            return false;
+        }
+
+        std::vector<SidecarEdge> sidecar_edges(header.n_edges);
+        std::vector<SidecarPoint> sidecar_points(header.n_points);
+        file.read(reinterpret_cast<char*>(sidecar_edges.data()), sidecar_edges.size() * sizeof(SidecarEdge));
+        file.read(reinterpret_cast<char*>(sidecar_points.data()), sidecar_points.size() * sizeof(SidecarPoint));
+
+        if (file.fail()) {
+            return false;
+        }
+
+        std::vector<geo::EdgeCPtr> edges;
+        edges.reserve(sidecar_edges.size());
+
+        for (auto& sidecar_edge : sidecar_edges) {
+            geo::Vertex::Ptr v1 = std::make_shared<geo::Vertex>(sidecar_edge.v1_lat, sidecar_edge.v1_lon, sidecar_edge.v1_uid);
+            geo::Vertex::Ptr v2 = std::make_shared<geo::Vertex>(sidecar_edge.v2_lat, sidecar_edge.v2_lon, sidecar_edge.v2_uid);
+            edges.push_back(std::make_shared<geo::Edge>(v1, v2, static_cast<osm::Highway>(sidecar_edge.way_type), sidecar_edge.uid, sidecar_edge.is_explicit != 0));
+        }
+
+        for (auto& sidecar_point : sidecar_points) {
+            if (sidecar_point.edge != kNoEdge && sidecar_point.edge >= edges.size()) {
+                return false;
+            }
+        }
+
+        for (size_t i = 0; i < traj.size(); ++i) {
+            if (sidecar_points[i].edge != kNoEdge) {
+                traj[i]->set_fit_edge(edges[sidecar_points[i].edge]);
+            }
+
+            traj[i]->set_out_degree(sidecar_points[i].out_degree);
+        }
+
+        // Rebuild the areas the fitters would have plotted, one per fit edge.
+        for (auto& eptr : edges) {
+            try {
+                if (eptr->is_implicit()) {
+                    implicit_areas.insert(eptr->to_area(10.0, 0.0));
+                } else {
+                    explicit_areas.insert(eptr->to_area(eptr->get_way_width() * fit_width_scaling_, fit_extension_));
+                }
+            } catch (geo::ZeroAreaException) {
+                continue;
+            }
+        }
+
+        n_hits_++;
+
+        return true;
+    }
+
+    void MatchCache::Store(const std::string& input_path, uint64_t input_fingerprint, const trajectory::Trajectory& traj) {
+        std::unordered_map<const geo::Edge*, uint32_t> edge_index;
+        std::vector<SidecarEdge> sidecar_edges;
+        std::vector<SidecarPoint> sidecar_points;
+        sidecar_points.reserve(traj.size());
+
+        for (auto& point_ptr : traj) {
+            SidecarPoint sidecar_point{ kNoEdge, point_ptr->get_out_degree() };
+            geo::EdgeCPtr eptr = point_ptr->get_fit_edge();
+
+            if (eptr) {
+                auto result = edge_index.emplace(eptr.get(), static_cast<uint32_t>(sidecar_edges.size()));
+
+                if (result.second) {
+                    SidecarEdge sidecar_edge;
+                    sidecar_edge.v1_lat = eptr->v1->lat;
+                    sidecar_edge.v1_lon = eptr->v1->lon;
+                    sidecar_edge.v2_lat = eptr->v2->lat;
+                    sidecar_edge.v2_lon = eptr->v2->lon;
+                    sidecar_edge.v1_uid = eptr->v1->uid;
+                    sidecar_edge.v2_uid = eptr->v2->uid;
+                    sidecar_edge.uid = eptr->get_uid();
+                    sidecar_edge.way_type = static_cast<uint32_t>(eptr->get_way_type());
+                    sidecar_edge.is_explicit = eptr->is_implicit() ? 0 : 1;
+                    sidecar_edges.push_back(sidecar_edge);
+                }
+
+                sidecar_point.edge = result.first->second;
+            }
+
+            sidecar_points.push_back(sidecar_point);
+        }
+
+        SidecarHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, kSidecarMagic, sizeof(kSidecarMagic));
+        header.version = kSidecarVersion;
+        header.match_key = match_key_;
+        header.input_fingerprint = input_fingerprint;
+        header.n_points = sidecar_points.size();
+        header.n_edges = sidecar_edges.size();
+
+        std::string file_path = SidecarPath(input_path);
+        std::string part_file_path = file_path + ".part";
+        std::ofstream file(part_file_path, std::ios::binary | std::ios::trunc);
+
+        if (file.fail()) {
+            throw std::invalid_argument("Could not open sidecar file: " + part_file_path);
+        }
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(sidecar_edges.data()), sidecar_edges.size() * sizeof(SidecarEdge));
+        file.write(reinterpret_cast<const char*>(sidecar_points.data()), sidecar_points.size() * sizeof(SidecarPoint));
+        file.close();
+
+        if (file.fail() || std::rename(part_file_path.c_str(), file_path.c_str()) != 0) {
+            throw std::invalid_argument("Could not write sidecar file: " + file_path);
+        }
+
+        n_stores_++;
+    }
+
+    uint64_t MatchCache::GetHits() const {
+        return n_hits_;
+    }
+
+    uint64_t MatchCache::GetStores() const {
+        return n_stores_;
+    }
+}
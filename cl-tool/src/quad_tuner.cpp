@@ -0,0 +1,259 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#include "quad_tuner.hpp"
+#include "di_multi.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+
+namespace DIMulti {
+    QuadTuner::QuadTuner(const std::string& map_file_path, const Config::DIConfig::Ptr& config_ptr) :
+        config_ptr_{config_ptr},
+        edges_{},
+        sw_{config_ptr->GetQuadSWLat(), config_ptr->GetQuadSWLng()},
+        ne_{config_ptr->GetQuadNELat(), config_ptr->GetQuadNELng()},
+        trips_{},
+        containing_edges_{}
+        {
+            if (tiles::MapImage::is_image(map_file_path) || tiles::TileCache::is_tiled(map_file_path)) {
+                throw std::invalid_argument("Quad tuning needs a single map file, not tiles or a map image: " + map_file_path);
+            }
+
+            edges_ = DICSV::LoadMap(map_file_path);
+        }
+
+    size_t QuadTuner::LoadTrips(const std::string& manifest_path, size_t max_trips) {
+        std::ifstream manifest(manifest_path);
+
+        if (manifest.fail()) {
+            throw std::invalid_argument("Could not open the manifest: " + manifest_path);
+        }
+
+        std::vector<std::string> trip_paths;
+        std::string line;
+
+        while (std::getline(manifest, line)) {
+            StrVector items = string_utilities::split(line, ':');
+
+            if (!items.empty() && !items[0].empty()) {
+                trip_paths.push_back(items[0]);
+            }
+        }
+
+        // Take trips spread through the manifest, which is often ordered by time or vehicle.
+        size_t stride = std::max<size_t>(1, (trip_paths.size() + max_trips - 1) / std::max<size_t>(1, max_trips));
+        GPSErrorFilter error_filter(50, config_ptr_->GetErrorMaxSpeed(), config_ptr_->GetErrorJumpPoints());
+
+        for (size_t i = 0; i < trip_paths.size() && trips_.size() < max_trips; i += stride) {
+            try {
+                std::string uid;
+                trajectory::Trajectory traj = DICSV::MakeTrajectory(trip_paths[i], uid);
+
+                error_filter.filter(traj);
+                trips_.push_back(traj);
+            } catch (std::exception& e) {
+                std::cerr << "Skipping trip file: " << trip_paths[i] << " " << e.what() << std::endl;
+            }
+        }
+
+        // An R-tree's candidates include every edge whose fit area contains the point; keep those that do.
+        double fit_width_scaling = config_ptr_->GetMapFitScale();
+        double fit_extension = config_ptr_->GetFitExt();
+        spatial::EdgeIndex::Ptr rtree_ptr = spatial::EdgeIndex::make("rtree", edges_, sw_, ne_, fit_width_scaling, fit_extension);
+        spatial::EdgeIndex::Cursor::Ptr cursor = rtree_ptr->make_cursor();
+        containing_edges_.clear();
+
+        for (auto& traj : trips_) {
+            for (auto& point_ptr : traj) {
+                std::vector<geo::EdgeCPtr> containing;
+
+                for (auto& edge_ptr : cursor->retrieve_edges(*point_ptr, std::numeric_limits<std::size_t>::max())) {
+                    try {
+                        if (edge_ptr->to_area(edge_ptr->get_way_width() * fit_width_scaling, fit_extension)->contains(*point_ptr)) {
+                            containing.push_back(edge_ptr);
+                        }
+                    } catch (geo::ZeroAreaException&) {
+                        continue;
+                    }
+                }
+
+                containing_edges_.push_back(containing);
+            }
+        }
+
+        return trips_.size();
+    }
+
+    QuadTuner::Trial QuadTuner::Evaluate(const QuadParams& params) const {
+        using Clock = std::chrono::steady_clock;
+        Trial trial;
+        trial.params = params;
+
+        Clock::time_point start = Clock::now();
+        spatial::EdgeIndex::Ptr index_ptr = spatial::EdgeIndex::make("quad", edges_, sw_, ne_, config_ptr_->GetMapFitScale(), config_ptr_->GetFitExt(), params);
+        trial.build_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        const EdgeQuad::CPtr& quad_ptr = std::static_pointer_cast<const spatial::QuadEdgeIndex>(index_ptr)->get_quad();
+        trial.report = quad_ptr->get_report();
+
+        size_t n_points = 0;
+        size_t n_candidates = 0;
+
+        for (auto& traj : trips_) {
+            for (auto& point_ptr : traj) {
+                const EdgeQuad::ElementList& leaf_edges = quad_ptr->retrieve_elements(*point_ptr);
+                n_candidates += leaf_edges.size();
+
+                for (auto& edge_ptr : containing_edges_[n_points]) {
+                    if (std::find(leaf_edges.begin(), leaf_edges.end(), edge_ptr) == leaf_edges.end()) {
+                        ++trial.misses;
+                        break;
+                    }
+                }
+
+                ++n_points;
+            }
+        }
+
+        trial.candidates = n_points > 0 ? static_cast<double>(n_candidates) / n_points : 0.0;
+
+        // Slow settings are timed once; they cannot win.
+        for (int run = 0; run < 3 && (run == 0 || trial.fit_ms < 1000.0); ++run) {
+            // Fitting marks the points, so every run fits fresh copies.
+            std::vector<trajectory::Trajectory> copies;
+
+            for (auto& traj : trips_) {
+                trajectory::Trajectory copy;
+                copy.reserve(traj.size());
+
+                for (auto& point_ptr : traj) {
+                    copy.push_back(std::make_shared<trajectory::Point>(*point_ptr));
+                }
+
+                copies.push_back(copy);
+            }
+
+            start = Clock::now();
+
+            for (auto& copy : copies) {
+                MapFitter mf{index_ptr, config_ptr_->GetMapFitScale(), config_ptr_->GetFitExt()};
+                mf.fit(copy);
+            }
+
+            double fit_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            trial.fit_ms = run == 0 ? fit_ms : std::min(trial.fit_ms, fit_ms);
+        }
+
+        return trial;
+    }
+
+    QuadTuner::Trial QuadTuner::Tune(std::ostream& stream) const {
+        std::vector<QuadParams> candidates = Candidates(config_ptr_->GetQuadParams());
+        std::vector<Trial> trials;
+
+        stream << "max_elements,min_degrees,reduction_factor,capacity_growth,build_ms,fit_ms,candidates,misses,quads,leaves,depth,bytes" << std::endl;
+
+        for (auto& params : candidates) {
+            Trial trial = Evaluate(params);
+            stream << params.max_elements << "," << params.min_degrees << "," << params.reduction_factor << "," << params.capacity_growth << ","
+                   << std::fixed << std::setprecision(2) << trial.build_ms << "," << trial.fit_ms << "," << trial.candidates << std::defaultfloat << std::setprecision(6) << ","
+                   << trial.misses << "," << trial.report.quads << "," << trial.report.leaves << "," << trial.report.depth << "," << trial.report.bytes << std::endl;
+            trials.push_back(trial);
+        }
+
+        // The configured setting is first; nothing may miss more edges than it does, and timing noise alone should not
+        // replace it, so another setting must be at least 5% faster.
+        const Trial& base = trials.front();
+        const Trial* best = &base;
+
+        for (auto& trial : trials) {
+            if (trial.misses <= base.misses && trial.fit_ms < 0.95 * base.fit_ms && trial.fit_ms < best->fit_ms) {
+                best = &trial;
+            }
+        }
+
+        return *best;
+    }
+
+    std::vector<QuadParams> QuadTuner::Candidates(const QuadParams& base) {
+        std::vector<QuadParams> candidates{base};
+
+        for (uint32_t max_elements : {8u, 16u, 32u, 64u, 128u}) {
+            for (double min_degrees : {0.0005, 0.001, 0.002, 0.003, 0.005}) {
+                for (double reduction_factor : {5.0, 10.0, 20.0}) {
+                    for (double capacity_growth : {0.5, 1.0, 2.0}) {
+                        QuadParams params = base;
+                        params.max_elements = max_elements;
+                        params.min_degrees = min_degrees;
+                        params.reduction_factor = reduction_factor;
+                        params.capacity_growth = capacity_growth;
+
+                        if (params.max_elements != base.max_elements || params.min_degrees != base.min_degrees ||
+                            params.reduction_factor != base.reduction_factor || params.capacity_growth != base.capacity_growth) {
+                            candidates.push_back(params);
+                        }
+                    }
+                }
+            }
+        }
+
+        return candidates;
+    }
+
+    void QuadTuner::WriteConfig(const std::string& config_file_path, const std::string& out_path, const QuadParams& params) {
+        std::vector<std::string> lines;
+
+        if (!config_file_path.empty()) {
+            std::ifstream config_file(config_file_path);
+
+            if (config_file.fail()) {
+                throw std::invalid_argument("Could not open the configuration file: " + config_file_path);
+            }
+
+            std::string line;
+
+            while (std::getline(config_file, line)) {
+                StrVector parts = string_utilities::split(line, ':');
+                std::string key = parts.empty() ? "" : parts[0];
+
+                if (key != "quad_max_elements" && key != "quad_min_degrees" && key != "quad_reduction_factor" && key != "quad_capacity_growth") {
+                    lines.push_back(line);
+                }
+            }
+        }
+
+        std::ofstream out_file(out_path, std::ios::trunc);
+
+        if (out_file.fail()) {
+            throw std::invalid_argument("Could not write the configuration file: " + out_path);
+        }
+
+        for (auto& line : lines) {
+            out_file << line << "\n";
+        }
+
+        out_file << std::setprecision(15);
+        out_file << "quad_max_elements:" << params.max_elements << "\n";
+        out_file << "quad_min_degrees:" << params.min_degrees << "\n";
+        out_file << "quad_reduction_factor:" << params.reduction_factor << "\n";
+        out_file << "quad_capacity_growth:" << params.capacity_growth << "\n";
+    }
+}
@@ -0,0 +1,109 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#include "shard.hpp"
+
+#include <fstream>
+
+namespace DIMulti {
+    Shard::Shard(unsigned index, unsigned count, KeyType key_type) :
+        index_(index),
+        count_(count),
+        key_type_(key_type)
+    {
+        if (count_ == 0 || index_ >= count_) {
+            throw std::invalid_argument("Invalid shard: " + std::to_string(index_) + " of " + std::to_string(count_));
+        }
+    }
+
+    Shard::Ptr Shard::FromString(const std::string& spec, const std::string& key_name) {
+        KeyType key_type;
+
+        if (key_name == "uid") {
+            key_type = KeyType::UID;
+        } else if (key_name == "line") {
+            key_type = KeyType::LINE;
+        } else {
+            throw std::invalid_argument("Invalid shard key (expected uid or line): " + key_name);
+        }
+
+        StrVector parts = string_utilities::split(spec, '/');
+        unsigned long index, count;
+
+        try {
+            if (parts.size() != 2 || parts[0].find_first_not_of("0123456789") != std::string::npos || parts[1].find_first_not_of("0123456789") != std::string::npos) {
+                throw std::invalid_argument(spec);
+            }
+
+            index = std::stoul(parts[0]);
+            count = std::stoul(parts[1]);
+        } catch (std::exception&) {
+            throw std::invalid_argument("Invalid shard (expected <index>/<count>): " + spec);
+        }
+
+        return std::make_shared<Shard>(static_cast<unsigned>(index), static_cast<unsigned>(count), key_type);
+    }
+
+    bool Shard::IsAssigned(uint64_t line_number, const std::string& trip_file_path) const {
+        if (key_type_ == KeyType::LINE) {
+            return (line_number - 1) % count_ == index_;
+        }
+
+        return hash_utilities::fnv1a(TripKey(trip_file_path)) % count_ == index_;
+    }
+
+    unsigned Shard::GetIndex() const {
+        return index_;
+    }
+
+    unsigned Shard::GetCount() const {
+        return count_;
+    }
+
+    std::string Shard::FileName(const std::string& file_name) const {
+        return FileName(file_name, index_, count_);
+    }
+
+    std::string Shard::FileName(const std::string& file_name, unsigned index, unsigned count) {
+        std::string tag = ".shard-" + std::to_string(index) + "-of-" + std::to_string(count);
+        size_t dot = file_name.rfind('.');
+
+        return dot == std::string::npos ? file_name + tag : file_name.substr(0, dot) + tag + file_name.substr(dot);
+    }
+
+    std::string Shard::TripKey(const std::string& trip_file_path) {
+        if (BSMP1::BSMP1ColumnarTrajectoryFactory::is_columnar(trip_file_path)) {
+            return trip_file_path;
+        }
+
+        std::ifstream file(trip_file_path);
+        std::string line;
+
+        // Skip the header; the UID is on every data line.
+        if (file.fail() || !std::getline(file, line) || !std::getline(file, line)) {
+            return trip_file_path;
+        }
+
+        try {
+            return BSMP1::BSMP1CSVTrajectoryFactory::make_uid(line);
+        } catch (std::out_of_range&) {
+            return trip_file_path;
+        }
+    }
+}
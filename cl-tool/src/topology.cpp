@@ -0,0 +1,140 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#include "topology.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace MultiThread {
+    Topology::Topology() {
+        std::vector<unsigned> allowed;
+
+#ifdef __linux__
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+
+        if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0) {
+            for (unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (CPU_ISSET(cpu, &cpu_set)) {
+                    allowed.push_back(cpu);
+                }
+            }
+        }
+
+        std::ifstream online_file("/sys/devices/system/node/online");
+        std::string online;
+
+        if (std::getline(online_file, online)) {
+            for (unsigned id : ParseCPUList(online)) {
+                std::ifstream cpu_file("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+                std::string cpu_list;
+                Node node{ id, {} };
+
+                if (std::getline(cpu_file, cpu_list)) {
+                    for (unsigned cpu : ParseCPUList(cpu_list)) {
+                        if (std::binary_search(allowed.begin(), allowed.end(), cpu)) {
+                            node.cpus.push_back(cpu);
+                        }
+                    }
+                }
+
+                // Memory-only nodes and nodes outside the affinity mask get no threads.
+                if (!node.cpus.empty()) {
+                    nodes_.push_back(node);
+                }
+            }
+        }
+#endif
+
+        if (nodes_.empty()) {
+            if (allowed.empty()) {
+                for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); ++cpu) {
+                    allowed.push_back(cpu);
+                }
+            }
+
+            nodes_.push_back(Node{ 0, allowed });
+        }
+    }
+
+    size_t Topology::NodeCount() const {
+        return nodes_.size();
+    }
+
+    const Topology::Node& Topology::GetNode(size_t index) const {
+        return nodes_.at(index);
+    }
+
+    size_t Topology::ThreadNode(unsigned thread_num) const {
+        return thread_num % nodes_.size();
+    }
+
+    unsigned Topology::ThreadCPU(unsigned thread_num) const {
+        const Node& node = nodes_[ThreadNode(thread_num)];
+        return node.cpus[(thread_num / nodes_.size()) % node.cpus.size()];
+    }
+
+    bool Topology::PinCurrentThread(const std::vector<unsigned>& cpus) {
+#ifdef __linux__
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+
+        for (unsigned cpu : cpus) {
+            if (cpu < CPU_SETSIZE) {
+                CPU_SET(cpu, &cpu_set);
+            }
+        }
+
+        return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) == 0;
+#else
+        return false;
+#endif
+    }
+
+    std::vector<unsigned> Topology::ParseCPUList(const std::string& cpu_list) {
+        std::vector<unsigned> cpus;
+        std::stringstream ss(cpu_list);
+        std::string range;
+
+        while (std::getline(ss, range, ',')) {
+            try {
+                size_t dash = range.find('-');
+                unsigned long first = std::stoul(range.substr(0, dash));
+                unsigned long last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+
+                for (unsigned long cpu = first; cpu <= last; ++cpu) {
+                    cpus.push_back(static_cast<unsigned>(cpu));
+                }
+            } catch (std::logic_error&) {
+                // Skip a malformed range.
+            }
+        }
+
+        std::sort(cpus.begin(), cpus.end());
+        return cpus;
+    }
+}
@@ -934,7 +934,7 @@ class TrajectoryFactory {
         uint64_t size_;
 };
 
-Quad::Ptr qptr_ = nullptr;                          // Global quad ptr persists through the life of the module.
+spatial::EdgeIndex::CPtr qptr_ = nullptr;           // Global map index persists through the life of the module.
 
 /**
  * AsyncProgressWorkerBase provides progress reporting callback support for asynchronous communication with the GUI. An
@@ -1162,7 +1162,6 @@ class CVDI : public Nan::AsyncProgressWorkerBase<data_t>, public MultiThread::Pa
                 geo::Point sw(config_ptr_->GetQuadSWLat(), config_ptr_->GetQuadSWLon());
                 geo::Point ne(config_ptr_->GetQuadNELat(), config_ptr_->GetQuadNELon());
 
-                qptr_ = std::make_shared<Quad>(sw, ne);
                 shapes::CSVInputFactory shape_factory(quad_path_);
 
                 try {
@@ -1175,9 +1174,8 @@ class CVDI : public Nan::AsyncProgressWorkerBase<data_t>, public MultiThread::Pa
                     return false;
                 }
 
-                for (auto& edge_ptr : shape_factory.get_edges()) {
-                    Quad::insert(qptr_, std::dynamic_pointer_cast<const geo::Entity>(edge_ptr)); 
-                }
+                // The index is reused by later runs with other fit parameters, so use the quad, which does not depend on them.
+                qptr_ = spatial::EdgeIndex::make("quad", shape_factory.get_edges(), sw, ne, config_ptr_->GetMapFitScale(), config_ptr_->GetFitExt());
 
             } else {
                 ReportLog("Reusing quad from file: " + quad_path_);
@@ -29,29 +29,35 @@
 // NOTE: If test specifier includes spaces, quote the specifier on the CL.
 // NOTE: specifiers in square brackets can be used to develop predicates: [one][two],[three].  All tests tagged with one AND two OR tagged with three.
 
+#include <atomic>
 #include <memory>
 #include <bitset>
 #include <sstream>
 #include <iostream>
 #include <fstream>
+#include <iomanip>
 #include <string>
 #include <vector>
 // #include <iterator>
 // #include <algorithm>
 #include <regex>
+#include <thread>
 
 #include "cvlib.hpp"
+#include "shard.hpp"
+#include "journal.hpp"
+#include "fingerprint.hpp"
 
-Quad::Ptr buildTestQuadTree( void ) {
+EdgeQuad::Ptr buildTestQuadTree( void ) {
     geo::Point sw{ 35.946920, -83.938486 };
     geo::Point ne{ 35.955526, -83.926738 };
-    Quad::Ptr qptr = std::make_shared<Quad>(sw, ne);
+    EdgeQuad::Ptr qptr = std::make_shared<EdgeQuad>(sw, ne);
 
     shapes::CSVInputFactory shape_factory("unit-test-data/lib-test-data/utk.quad");
     shape_factory.make_shapes(); 
 
     for (auto& edge_ptr : shape_factory.get_edges()) {
-        Quad::insert(qptr, std::dynamic_pointer_cast<const geo::Entity>(edge_ptr)); 
+        EdgeQuad::insert(qptr, edge_ptr);
     }
 
     return qptr;
@@ -291,9 +297,66 @@ TEST_CASE( "Parse Shape File Data", "[quad][shapefile]" ) {
         CHECK_FALSE( sf.get_edges().back()->v2->lon == Approx(-84.1 - (i/10.0)) );
     }
 
+    // The make_<shape> methods throw the same exception types they always have.
+    shapes::CSVInputFactory typed_sf{};
+    std::vector<std::string> invalid_argument_tests {
+        "edge,1",
+        "edge,x, 1;0;0 :2;1;1",
+        "edge,42, 1;0;0 :2;x;1",
+        "edge,41, 19;0;0 :19;0;0",
+        "circle,0",
+        "circle,x,0:0:22.0",
+        "circle,0,0:x:22.0",
+        "grid,0_0",
+        "grid,0_x,0:0:1:1",
+        "grid,0_0,0:0:x:1"
+    };
+
+    std::vector<std::string> out_of_range_tests {
+        "edge,43, 1;0;0",
+        "edge,44, 1;0 :2;1;1",
+        "edge,45, 3;80.1;0 :4;1;1",
+        "edge,99999999999999999999999, 5;0;0 :6;1;1",
+        "circle,0,0:0",
+        "circle,0,80.1:0:22.0",
+        "circle,0,0:0:-22.0",
+        "circle,99999999999999999999999,0:0:22.0",
+        "grid,0,0:0:1:1",
+        "grid,0_0,0:0:1",
+        "grid,0_0,0:180.1:1:1"
+    };
+
+    for ( auto& testline : invalid_argument_tests ) {
+        StrVector parts = string_utilities::split(testline, ',');
+
+        if ( parts[0] == "edge" ) {
+            CHECK_THROWS_AS( typed_sf.make_edge( parts ), std::invalid_argument );
+        } else if ( parts[0] == "circle" ) {
+            CHECK_THROWS_AS( typed_sf.make_circle( parts ), std::invalid_argument );
+        } else {
+            CHECK_THROWS_AS( typed_sf.make_grid( parts ), std::invalid_argument );
+        }
+    }
+
+    for ( auto& testline : out_of_range_tests ) {
+        StrVector parts = string_utilities::split(testline, ',');
+
+        if ( parts[0] == "edge" ) {
+            CHECK_THROWS_AS( typed_sf.make_edge( parts ), std::out_of_range );
+        } else if ( parts[0] == "circle" ) {
+            CHECK_THROWS_AS( typed_sf.make_circle( parts ), std::out_of_range );
+        } else {
+            CHECK_THROWS_AS( typed_sf.make_grid( parts ), std::out_of_range );
+        }
+    }
+
     // Do quick read/write file tests.
     shapes::CSVInputFactory input_factory_bad_1("unit-test-data/lib-test-data/test.shapes.bad1");
     input_factory_bad_1.make_shapes();
+    CHECK(input_factory_bad_1.get_report().lines == 3);
+    CHECK(input_factory_bad_1.get_report().rejected == 2);
+    CHECK(input_factory_bad_1.get_report().edges == 1);
+    CHECK(input_factory_bad_1.get_report().diagnostics.size() == 2);
     shapes::CSVInputFactory input_factory_bad_2("unit-test-data/lib-test-data/test.shapes.bad2");
     CHECK_THROWS_AS(input_factory_bad_2.make_shapes(), std::invalid_argument);
     shapes::CSVInputFactory input_factory_bad_3("unit-test-data/lib-test-data/test.shapes.bad3");
@@ -317,6 +380,85 @@ TEST_CASE( "Parse Shape File Data", "[quad][shapefile]" ) {
     }
 
     CHECK_NOTHROW(output_factory.write_shapes());
+
+    SECTION("Parallel read matches sequential read") {
+        // Large enough to be split across threads; vertices are shared by neighboring edges and some lines are bad.
+        std::string parallel_path{"unit-test-data/lib-test-data/test.shapes.parallel"};
+        std::ofstream os{parallel_path};
+        os << "type,id,geography,attributes\n";
+
+        for (int i = 0; i < 20000; ++i) {
+            if (i % 997 == 0) {
+                os << "edge," << i << ",bad\n";
+                continue;
+            }
+
+            os << std::setprecision(10) << "edge," << i << "," << i << ";" << 35.0 + i * 1e-5 << ";" << -83.0 - i * 1e-5 << ":"
+               << i + 1 << ";" << 35.0 + (i + 1) * 1e-5 << ";" << -83.0 - (i + 1) * 1e-5 << ",way_type=secondary\n";
+        }
+
+        os.close();
+
+        shapes::CSVInputFactory sequential{parallel_path};
+        shapes::CSVInputFactory parallel{parallel_path};
+        sequential.make_shapes(1);
+        parallel.make_shapes(4);
+
+        CHECK(parallel.get_report().lines == 20000);
+        CHECK(parallel.get_report().rejected == sequential.get_report().rejected);
+        CHECK(parallel.get_report().diagnostics == sequential.get_report().diagnostics);
+        REQUIRE(parallel.get_edges().size() == sequential.get_edges().size());
+
+        for (size_t i = 0; i < parallel.get_edges().size(); ++i) {
+            const geo::EdgeCPtr& a = parallel.get_edges()[i];
+            const geo::EdgeCPtr& b = sequential.get_edges()[i];
+            CHECK(a->get_uid() == b->get_uid());
+            CHECK(a->v1->uid == b->v1->uid);
+            CHECK(a->v2->uid == b->v2->uid);
+            CHECK(a->v1->lat == b->v1->lat);
+            CHECK(a->v2->lon == b->v2->lon);
+        }
+
+        // shared vertices are the same instance in both reads.
+        CHECK(parallel.get_edges()[0]->v2 == parallel.get_edges()[1]->v1);
+    }
+}
+
+TEST_CASE("OSM PBF Import", "[quad][pbf]") {
+    // Nodes and ways are in separate blocks; way 11 is a blacklisted service road, way 12 references a node that is not
+    // in the extract, and way 13 is not a highway.
+    CHECK(osm::PBFInputFactory::is_pbf("unit-test-data/lib-test-data/test.osm.pbf"));
+    CHECK_FALSE(osm::PBFInputFactory::is_pbf("unit-test-data/lib-test-data/utk.quad"));
+
+    osm::PBFInputFactory pbf_factory("unit-test-data/lib-test-data/test.osm.pbf");
+    pbf_factory.make_edges(2);
+
+    const osm::PBFReport& report = pbf_factory.get_report();
+    CHECK(report.blocks == 2);
+    CHECK(report.ways == 2);
+    CHECK(report.filtered_ways == 1);
+    CHECK(report.missing_nodes == 1);
+    CHECK(report.vertices == 4);
+
+    const std::vector<geo::EdgeCPtr>& edges = pbf_factory.get_edges();
+    REQUIRE(edges.size() == 3);
+    CHECK(edges[0]->get_uid() == 10);
+    CHECK(edges[0]->get_way_type() == osm::Highway::SECONDARY);
+    CHECK(edges[0]->v1->uid == 1);
+    CHECK(edges[0]->v1->lat == Approx(35.9525));
+    CHECK(edges[0]->v1->lon == Approx(-83.932434));
+    CHECK(edges[1]->v2->uid == 3);
+    CHECK(edges[2]->get_uid() == 12);
+    CHECK(edges[2]->get_way_type() == osm::Highway::RESIDENTIAL);
+
+    // consecutive edges of a way and edges of different ways share vertex instances.
+    CHECK(edges[0]->v2 == edges[1]->v1);
+    CHECK(edges[1]->v2 == edges[2]->v1);
+
+    osm::PBFInputFactory missing_factory("unit-test-data/lib-test-data/missing.osm.pbf");
+    CHECK_THROWS_AS(missing_factory.make_edges(), std::invalid_argument);
+    osm::PBFInputFactory bad_factory("unit-test-data/lib-test-data/test.shapes");
+    CHECK_THROWS_AS(bad_factory.make_edges(), std::invalid_argument);
 }
 
 TEST_CASE("Entity", "[quad][entity]") {
@@ -757,6 +899,36 @@ TEST_CASE("Quad Tree", "[quad]") {
         CHECK_FALSE(quad_ptr->retrieve_bounds(test_point_3));
     }    
 
+    SECTION("Edge Quad") {
+        // an edge quad keeps the same edges in the same leaves as an entity quad.
+        Quad::insert(quad_ptr, phss);
+        Quad::insert(quad_ptr, ahw);
+        Quad::insert(quad_ptr, ahe);
+        Quad::insert(quad_ptr, twth);
+        Quad::insert(quad_ptr, utdr);
+        EdgeQuad::Ptr edge_quad_ptr = std::make_shared<EdgeQuad>(sw, ne);
+        CHECK(EdgeQuad::insert(edge_quad_ptr, phss));
+        CHECK(EdgeQuad::insert(edge_quad_ptr, ahw));
+        CHECK(EdgeQuad::insert(edge_quad_ptr, ahe));
+        CHECK(EdgeQuad::insert(edge_quad_ptr, twth));
+        CHECK(EdgeQuad::insert(edge_quad_ptr, utdr));
+        std::stringstream edge_ss;
+        edge_ss << *edge_quad_ptr;
+        CHECK(edge_ss.str().find("element count: 5") != std::string::npos);
+
+        for (auto& pt : { test_point_1, test_point_2, test_point_3 }) {
+            const EdgeQuad::ElementList& edge_list = edge_quad_ptr->retrieve_elements(pt);
+            const geo::Entity::PtrList& entity_list = quad_ptr->retrieve_elements(pt);
+            REQUIRE(edge_list.size() == entity_list.size());
+
+            for (size_t i = 0; i < edge_list.size(); ++i) {
+                CHECK(edge_list[i].get() == entity_list[i].get());
+            }
+        }
+
+        CHECK(EdgeQuad::retrieve_all_entities(edge_quad_ptr).size() == 5);
+    }
+
     SECTION("Structural") {
         // re-insert
         Quad::insert(quad_ptr, phss);     
@@ -831,10 +1003,655 @@ TEST_CASE("Quad Tree", "[quad]") {
         CHECK(Quad::retrieve_all_bounds(quad_ptr, true, true).size() == 2);
     }
 
+    SECTION("Batch Retrieval") {
+        EdgeQuad::Ptr test_quad_ptr = buildTestQuadTree();
+        BSMP1::BSMP1CSVTrajectoryFactory factory;
+        trajectory::Trajectory traj = factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv");
+        std::vector<const geo::Point*> points;
+
+        for (auto& tp : traj) {
+            points.push_back(tp.get());
+        }
+
+        points.push_back(&test_point_3);
+
+        std::vector<const EdgeQuad::ElementList*> element_lists = test_quad_ptr->retrieve_elements(points);
+        REQUIRE(element_lists.size() == points.size());
+
+        for (size_t i = 0; i < points.size(); ++i) {
+            CHECK(element_lists[i] == &test_quad_ptr->retrieve_elements(*points[i]));
+        }
+
+        CHECK(element_lists.back()->empty());
+        CHECK(test_quad_ptr->retrieve_elements(std::vector<const geo::Point*>{}).empty());
+
+        // fitting the whole trip uses the batch retrieval; fitting point by point does not.
+        trajectory::Trajectory point_traj = factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv");
+        MapFitter traj_mf(test_quad_ptr, 1.0, .5);
+        traj_mf.fit(traj);
+        MapFitter point_mf(test_quad_ptr, 1.0, .5);
+
+        for (auto& tp : point_traj) {
+            point_mf.fit(*tp);
+        }
+
+        REQUIRE(traj.size() == point_traj.size());
+
+        for (size_t i = 0; i < traj.size(); ++i) {
+            CHECK(traj[i]->get_fit_edge() == point_traj[i]->get_fit_edge());
+        }
+    }
+
+    SECTION("Cursor") {
+        EdgeQuad::Ptr test_quad_ptr = buildTestQuadTree();
+        BSMP1::BSMP1CSVTrajectoryFactory factory;
+        trajectory::Trajectory traj = factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv");
+        EdgeQuad::Cursor cursor(test_quad_ptr);
+        CHECK(cursor.get_root() == test_quad_ptr);
+
+        for (auto& tp : traj) {
+            CHECK(&cursor.retrieve_elements(*tp) == &test_quad_ptr->retrieve_elements(*tp));
+            geo::Bounds::Ptr b_cursor = cursor.retrieve_bounds(*tp, true);
+            geo::Bounds::Ptr b_ret = test_quad_ptr->retrieve_bounds(*tp, true);
+            REQUIRE(b_cursor);
+            CHECK(b_cursor->sw.lat == b_ret->sw.lat);
+            CHECK(b_cursor->ne.lon == b_ret->ne.lon);
+        }
+
+        // points on a split line belong to the first child that contains them, wherever the cursor comes from.
+        QuadParams split_params;
+        split_params.max_elements = 2;
+        split_params.min_degrees = 0.0005;
+        EdgeQuad::Ptr split_quad_ptr = std::make_shared<EdgeQuad>(test_quad_ptr->sw, test_quad_ptr->ne, split_params);
+        shapes::CSVInputFactory shape_factory("unit-test-data/lib-test-data/utk.quad");
+        shape_factory.make_shapes();
+
+        for (auto& edge_ptr : shape_factory.get_edges()) {
+            EdgeQuad::insert(split_quad_ptr, edge_ptr);
+        }
+
+        EdgeQuad::Cursor split_cursor(split_quad_ptr);
+        std::vector<geo::Bounds::Ptr> leaf_bounds = EdgeQuad::retrieve_all_bounds(split_quad_ptr, true);
+        REQUIRE(leaf_bounds.size() > 4);
+
+        for (auto& from : leaf_bounds) {
+            geo::Point center{(from->sw.lat + from->ne.lat) / 2.0, (from->sw.lon + from->ne.lon) / 2.0};
+            std::vector<geo::Point> on_boundary{from->sw, from->ne, from->nw, from->se,
+                                                geo::Point{from->sw.lat, center.lon}, geo::Point{from->ne.lat, center.lon},
+                                                geo::Point{center.lat, from->sw.lon}, geo::Point{center.lat, from->ne.lon}};
+
+            for (auto& pt : on_boundary) {
+                CHECK(&split_cursor.retrieve_elements(center) == &split_quad_ptr->retrieve_elements(center));
+                CHECK(&split_cursor.retrieve_elements(pt) == &split_quad_ptr->retrieve_elements(pt));
+                geo::Bounds::Ptr b_cursor = split_cursor.retrieve_bounds(pt);
+                geo::Bounds::Ptr b_ret = split_quad_ptr->retrieve_bounds(pt);
+                REQUIRE(b_cursor);
+                CHECK(b_cursor->sw.lat == b_ret->sw.lat);
+                CHECK(b_cursor->sw.lon == b_ret->sw.lon);
+            }
+        }
+
+        // leaving the tree and coming back.
+        CHECK(cursor.retrieve_elements(test_point_3).empty());
+        CHECK_FALSE(cursor.retrieve_bounds(test_point_3));
+        CHECK(&cursor.retrieve_elements(*traj.front()) == &test_quad_ptr->retrieve_elements(*traj.front()));
+
+        // a cursor without a tree retrieves nothing until it is given one.
+        EdgeQuad::Cursor empty_cursor;
+        CHECK(empty_cursor.retrieve_elements(*traj.front()).empty());
+        empty_cursor.reset(test_quad_ptr);
+        CHECK(&empty_cursor.retrieve_elements(*traj.front()) == &test_quad_ptr->retrieve_elements(*traj.front()));
+    }
+
+    SECTION("Parameters") {
+        QuadParams params;
+        CHECK(params.max_elements == EdgeQuad::MAX_ELEMENTS);
+        CHECK(params.capacity(0) == 32);
+        CHECK(params.capacity(5) == 32);
+        params.capacity_growth = .5;
+        CHECK(params.capacity(1) == 16);
+        CHECK(params.capacity(10) == 1);
+        params.capacity_growth = 2.0;
+        CHECK(params.capacity(2) == 128);
+
+        // the six test edges fit in one default leaf.
+        EdgeQuad::Ptr default_quad_ptr = buildTestQuadTree();
+        QuadReport default_report = default_quad_ptr->get_report();
+        CHECK(default_report.quads == 1);
+        CHECK(default_report.leaves == 1);
+        CHECK(default_report.elements == 6);
+        CHECK(default_report.depth == 0);
+
+        // leaves of one edge split down to the minimum size, and every edge is still found.
+        QuadParams small_params;
+        small_params.max_elements = 1;
+        small_params.min_degrees = .001;
+        geo::Point sw{ 35.946920, -83.938486 };
+        geo::Point ne{ 35.955526, -83.926738 };
+        EdgeQuad::Ptr small_quad_ptr = std::make_shared<EdgeQuad>(sw, ne, small_params);
+        shapes::CSVInputFactory shape_factory("unit-test-data/lib-test-data/utk.quad");
+        shape_factory.make_shapes();
+
+        for (auto& edge_ptr : shape_factory.get_edges()) {
+            EdgeQuad::insert(small_quad_ptr, edge_ptr);
+        }
+
+        CHECK(small_quad_ptr->get_params().max_elements == 1);
+        QuadReport small_report = small_quad_ptr->get_report();
+        CHECK(small_report.leaves > default_report.leaves);
+        CHECK(small_report.quads > small_report.leaves);
+        CHECK(small_report.depth > 0);
+        CHECK(small_report.bytes > default_report.bytes);
+        CHECK(small_report.elements >= 6);
+
+        for (auto& edge_ptr : shape_factory.get_edges()) {
+            EdgeQuad::ElementList v1_edges = small_quad_ptr->retrieve_elements(*edge_ptr->v1);
+            CHECK(std::find(v1_edges.begin(), v1_edges.end(), edge_ptr) != v1_edges.end());
+        }
+    }
+
+    SECTION("R-Tree") {
+        geo::Point sw{ 35.946920, -83.938486 };
+        geo::Point ne{ 35.955526, -83.926738 };
+        shapes::CSVInputFactory shape_factory("unit-test-data/lib-test-data/utk.quad");
+        shape_factory.make_shapes();
+        const std::vector<geo::EdgeCPtr>& edges = shape_factory.get_edges();
+
+        spatial::EdgeIndex::Ptr quad_index = spatial::EdgeIndex::make("quad", edges, sw, ne, 1.0, .5);
+        spatial::EdgeIndex::Ptr rtree_index = spatial::EdgeIndex::make("rtree", edges, sw, ne, 1.0, .5);
+        CHECK(quad_index->get_name() == "quad");
+        CHECK(rtree_index->get_name() == "rtree");
+        CHECK_THROWS_AS(spatial::EdgeIndex::make("grid", edges, sw, ne, 1.0, .5), std::invalid_argument);
+
+        // a 30 x 30 grid of residential streets packs into 109 leaves under 7 inner nodes under the root.
+        std::vector<geo::EdgeCPtr> grid_edges;
+        std::vector<geo::Vertex::Ptr> grid_vertices;
+
+        for (uint64_t i = 0; i < 900; ++i) {
+            grid_vertices.push_back(std::make_shared<geo::Vertex>(35.9 + (i / 30) * .001, -83.95 + (i % 30) * .001, i));
+        }
+
+        for (uint64_t i = 0; i < 900; ++i) {
+            if (i % 30 < 29) grid_edges.push_back(std::make_shared<geo::Edge>(grid_vertices[i], grid_vertices[i + 1], osm::Highway::RESIDENTIAL, 2 * i));
+            if (i / 30 < 29) grid_edges.push_back(std::make_shared<geo::Edge>(grid_vertices[i], grid_vertices[i + 30], osm::Highway::RESIDENTIAL, 2 * i + 1));
+        }
+
+        spatial::RTree rtree(grid_edges, 1.0, .5);
+        CHECK(rtree.size() == 1740);
+        CHECK(rtree.height() == 3);
+
+        spatial::RTree::Scratch scratch;
+
+        for (int i = 0; i < 200; ++i) {
+            geo::Point pt{ 35.8995 + (i * 7 % 200) * .00015, -83.9505 + (i * 13 % 200) * .00015 };
+            spatial::EdgeIndex::EdgeList candidates;
+            rtree.retrieve_edges(pt, candidates, scratch);
+
+            for (auto& edge_ptr : grid_edges) {
+                if (edge_ptr->to_area(edge_ptr->get_way_width(), .5)->contains(pt)) {
+                    CHECK(std::find(candidates.begin(), candidates.end(), edge_ptr) != candidates.end());
+                }
+            }
+        }
+
+        // the candidates include every edge whose fit area contains the point, in input order.
+        BSMP1::BSMP1CSVTrajectoryFactory factory;
+        trajectory::Trajectory traj = factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv");
+        spatial::EdgeIndex::Cursor::Ptr cursor = rtree_index->make_cursor();
+        size_t n_candidates = 0;
+
+        for (auto& tp : traj) {
+            const spatial::EdgeIndex::EdgeList& candidates = cursor->retrieve_edges(*tp, 0);
+            n_candidates += candidates.size();
+
+            for (auto& edge_ptr : edges) {
+                if (edge_ptr->to_area(edge_ptr->get_way_width(), .5)->contains(*tp)) {
+                    CHECK(std::find(candidates.begin(), candidates.end(), edge_ptr) != candidates.end());
+                }
+            }
+
+            for (size_t i = 1; i < candidates.size(); ++i) {
+                CHECK(std::find(edges.begin(), edges.end(), candidates[i - 1]) < std::find(edges.begin(), edges.end(), candidates[i]));
+            }
+        }
+
+        CHECK(n_candidates > 0);
+        CHECK(cursor->retrieve_edges(test_point_3, 0).empty());
+
+        // both indexes fit the trip to the same edges.
+        trajectory::Trajectory rtree_traj = factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv");
+        MapFitter quad_mf(quad_index, 1.0, .5);
+        quad_mf.fit(traj);
+        MapFitter rtree_mf(rtree_index, 1.0, .5);
+        rtree_mf.fit(rtree_traj);
+
+        REQUIRE(traj.size() == rtree_traj.size());
+
+        for (size_t i = 0; i < traj.size(); ++i) {
+            CHECK(traj[i]->get_fit_edge() == rtree_traj[i]->get_fit_edge());
+        }
+
+        CHECK(quad_mf.area_set.size() == rtree_mf.area_set.size());
+
+        // an empty tree retrieves nothing.
+        spatial::RTree empty_rtree(std::vector<geo::EdgeCPtr>{}, 1.0, .5);
+        spatial::EdgeIndex::EdgeList empty_list;
+        empty_rtree.retrieve_edges(*traj.front(), empty_list, scratch);
+        CHECK(empty_list.empty());
+        CHECK(empty_rtree.height() == 0);
+    }
+
+    SECTION("Edge Table") {
+        shapes::CSVInputFactory shape_factory("unit-test-data/lib-test-data/utk.quad");
+        shape_factory.make_shapes();
+        std::vector<geo::EdgeCPtr> edges = shape_factory.get_edges();
+        std::vector<geo::EdgeCPtr> listed = edges;
+        listed.insert(listed.end(), edges.begin(), edges.end());
+
+        spatial::EdgeTable table(listed);
+        REQUIRE(table.size() == edges.size());
+        CHECK(table.vertex_count() == 7);
+        CHECK(spatial::EdgeTable().size() == 0);
+
+        for (uint32_t i = 0; i < edges.size(); ++i) {
+            const geo::Edge& edge = *edges[i];
+            REQUIRE(table.row(edge) == i);
+            CHECK(table.length(i) == edge.length());
+            CHECK(table.length_haversine(i) == edge.length_haversine());
+            CHECK(table.bearing(i) == edge.bearing());
+            CHECK(table.way_width(i) == edge.get_way_width());
+            CHECK(table.way_type_index(i) == edge.get_way_type_index());
+            CHECK(table.v1(i) < table.vertex_count());
+            CHECK(table.v2(i) < table.vertex_count());
+        }
+
+        // edges sharing a Vertex instance share a vertex index.
+        for (uint32_t i = 0; i < edges.size(); ++i) {
+            for (uint32_t j = 0; j < edges.size(); ++j) {
+                CHECK((edges[i]->v1 == edges[j]->v2) == (table.v1(i) == table.v2(j)));
+            }
+        }
+
+        // a later table over the same edges numbers them its own way and leaves the first table's rows intact.
+        std::vector<geo::EdgeCPtr> reversed(edges.rbegin(), edges.rend());
+        spatial::EdgeTable later(reversed);
+        CHECK(later.row(*edges.front()) == edges.size() - 1);
+        CHECK(table.row(*edges.front()) == 0);
+        CHECK(table.row(*edges.back()) == edges.size() - 1);
+        CHECK(later.length(*edges.back()) == edges.back()->length());
+
+        geo::Edge unlisted(geo::Vertex(35.95, -83.93, 100), geo::Vertex(35.951, -83.93, 101));
+        CHECK(later.row(unlisted) == spatial::EdgeTable::kNoRow);
+        CHECK(later.bearing(unlisted) == unlisted.bearing());
+
+        // indexes and tiles keep a table over their edges.
+        geo::Point sw{ 35.946920, -83.938486 };
+        geo::Point ne{ 35.955526, -83.926738 };
+        CHECK(spatial::EdgeIndex::make("quad", edges, sw, ne, 1.0, .5)->get_table().size() == edges.size());
+        CHECK(spatial::EdgeIndex::make("rtree", edges, sw, ne, 1.0, .5)->get_table().size() == edges.size());
+        CHECK(std::make_shared<spatial::QuadEdgeIndex>(EdgeQuad::CPtr{})->get_table().size() == 0);
+    }
+
+    SECTION("Fit Area Batch") {
+        shapes::CSVInputFactory shape_factory("unit-test-data/lib-test-data/utk.quad");
+        shape_factory.make_shapes();
+        std::vector<geo::EdgeCPtr> edges = shape_factory.get_edges();
+
+        spatial::EdgeTable table(edges, 1.0, .5);
+        CHECK(table.has_fit_areas(1.0, .5));
+        CHECK_FALSE(table.has_fit_areas(1.5, .5));
+        CHECK_FALSE(spatial::EdgeTable(edges).has_fit_areas(1.0, .5));
+
+        FitAreaBatch batch;
+        std::vector<geo::AreaCPtr> areas;
+
+        for (uint32_t i = 0; i < edges.size(); ++i) {
+            geo::AreaCPtr area = edges[i]->to_area(edges[i]->get_way_width(), .5);
+            const geo::Point* corners = table.fit_area(i);
+            REQUIRE(corners != nullptr);
+
+            for (int c = 0; c < 4; ++c) {
+                CHECK(corners[c] == area->get_corners()[c]);
+            }
+
+            batch.add(corners, table.bearing(i));
+            areas.push_back(area);
+        }
+
+        REQUIRE(batch.size() == edges.size());
+
+        // the batch agrees with Area::contains everywhere on a grid over the network.
+        std::vector<double> outside;
+        std::size_t n_inside = 0;
+
+        for (double lat = 35.9469; lat < 35.9556; lat += 0.0001) {
+            for (double lon = -83.9385; lon < -83.9267; lon += 0.0001) {
+                geo::Point pt{ lat, lon };
+                batch.contains(pt, outside);
+                REQUIRE(outside.size() == areas.size());
+
+                for (std::size_t i = 0; i < areas.size(); ++i) {
+                    CHECK((outside[i] == 0.0) == areas[i]->contains(pt));
+                    n_inside += outside[i] == 0.0;
+                }
+            }
+        }
+
+        CHECK(n_inside > 0);
+
+        // the first of two equally good areas wins; nothing matches outside every area or in an empty batch.
+        geo::Point mid{ (edges[0]->v1->lat + edges[0]->v2->lat) / 2.0, (edges[0]->v1->lon + edges[0]->v2->lon) / 2.0 };
+        batch.clear();
+        batch.add(table.fit_area(0), table.bearing(0));
+        batch.add(table.fit_area(0), table.bearing(0));
+        batch.add(table.fit_area(0), table.bearing(0) + 90.0);
+        CHECK(batch.best_match(mid, table.bearing(0)) == 0);
+        CHECK(batch.best_match(mid, table.bearing(0) + 90.0) == 2);
+        CHECK(batch.best_match(geo::Point{ 0.0, 0.0 }, 0.0) == FitAreaBatch::kNoMatch);
+        CHECK(batch.make_area(2)->get_corners() == areas[0]->get_corners());
+
+        batch.clear();
+        CHECK(batch.size() == 0);
+        CHECK(batch.best_match(mid, 0.0) == FitAreaBatch::kNoMatch);
+    }
+
+    SECTION("Decimated Fit") {
+        EdgeQuad::Ptr test_quad_ptr = buildTestQuadTree();
+        BSMP1::BSMP1CSVTrajectoryFactory factory;
+        trajectory::Trajectory full_traj = factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv");
+        MapFitter full_mf(test_quad_ptr, 1.0, .5);
+        full_mf.fit(full_traj);
+
+        MapFitter bad_mf(test_quad_ptr, 1.0, .5);
+        CHECK_THROWS_AS(bad_mf.set_decimation(-1.0, 15.0), std::invalid_argument);
+        CHECK_THROWS_AS(bad_mf.set_decimation(10.0, 0.0), std::invalid_argument);
+
+        // skipped points on this trip take the edges a full fit gives them under any budget.
+        for (double distance : { 0.0, 5.0, 20.0, 100.0 }) {
+            trajectory::Trajectory traj = factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv");
+            MapFitter mf(test_quad_ptr, 1.0, .5);
+            mf.set_decimation(distance, 15.0);
+            mf.fit(traj);
+            REQUIRE(traj.size() == full_traj.size());
+
+            for (size_t i = 0; i < traj.size(); ++i) {
+                CHECK(traj[i]->get_fit_edge() == full_traj[i]->get_fit_edge());
+            }
+        }
+
+        trajectory::Trajectory empty_traj;
+        MapFitter empty_mf(test_quad_ptr, 1.0, .5);
+        empty_mf.set_decimation(20.0, 15.0);
+        empty_mf.fit(empty_traj);
+        CHECK(empty_mf.area_set.empty());
+    }
+
+    SECTION("Segmented Fit") {
+        EdgeQuad::Ptr test_quad_ptr = buildTestQuadTree();
+        SegmentedMapFitter::Factory make_fitter = [&test_quad_ptr]() { return MapFitter{ test_quad_ptr, 1.0, .5 }; };
+        BSMP1::BSMP1CSVTrajectoryFactory factory;
+        trajectory::Trajectory full_traj = factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv");
+        MapFitter full_mf = make_fitter();
+        std::vector<const geo::Edge*> states;
+        full_mf.fit(full_traj, states);
+        REQUIRE(states.size() == full_traj.size());
+        CHECK(states.back() == full_mf.get_current_edge());
+
+        for (size_t i = 0; i < full_traj.size(); ++i) {
+            CHECK((states[i] == nullptr) == !full_traj[i]->is_explicitly_fit());
+        }
+
+        SegmentPool::Ptr pool = std::make_shared<SegmentPool>(3);
+        CHECK(pool->size() == 3);
+        CHECK_THROWS_AS(SegmentPool(0), std::invalid_argument);
+        CHECK_THROWS_AS(SegmentedMapFitter(make_fitter, 0, 10, pool), std::invalid_argument);
+
+        // without an overlap every segment is stitched by fitting on until the fitters agree; either way every point
+        // gets the edge of a single fit.
+        for (size_t overlap : { 0, 5, 50 }) {
+            for (const SegmentPool::Ptr& segment_pool : { SegmentPool::Ptr{}, pool }) {
+                trajectory::Trajectory traj = factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv");
+                SegmentedMapFitter smf(make_fitter, 20, overlap, segment_pool);
+                smf.fit(traj);
+                REQUIRE(traj.size() == full_traj.size());
+
+                for (size_t i = 0; i < traj.size(); ++i) {
+                    CHECK(traj[i]->get_fit_edge() == full_traj[i]->get_fit_edge());
+                }
+
+                CHECK_FALSE(smf.area_set.empty());
+
+                if (!segment_pool) {
+                    CHECK(smf.get_refit_points() == 0);
+                }
+
+                if (overlap == 0 && segment_pool) {
+                    CHECK(smf.get_refit_points() > 0);
+                }
+            }
+        }
+
+        // trips fit at once on several threads share one pool, and a failing segment's error reaches its own trip.
+        SegmentPool::Ptr shared_pool = std::make_shared<SegmentPool>(1);
+        std::vector<trajectory::Trajectory> trips(4);
+        std::vector<std::thread> threads;
+
+        for (auto& trip : trips) {
+            trip = factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv");
+            threads.emplace_back([&make_fitter, &shared_pool, &trip]() {
+                SegmentedMapFitter smf(make_fitter, 10, 5, shared_pool);
+                smf.fit(trip);
+            });
+        }
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        for (auto& trip : trips) {
+            REQUIRE(trip.size() == full_traj.size());
+
+            for (size_t i = 0; i < trip.size(); ++i) {
+                CHECK(trip[i]->get_fit_edge() == full_traj[i]->get_fit_edge());
+            }
+        }
+
+        std::atomic<int> n_made{ 0 };
+        SegmentedMapFitter::Factory failing_fitter = [&make_fitter, &n_made]() {
+            if (n_made++ == 1) {
+                throw std::runtime_error("no fitter");
+            }
+
+            return make_fitter();
+        };
+
+        trajectory::Trajectory failing_traj = factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv");
+        CHECK_THROWS_AS(SegmentedMapFitter(failing_fitter, 10, 5, shared_pool).fit(failing_traj), std::runtime_error);
+    }
+}
+
+TEST_CASE("Map Tiles", "[quad][tiles]") {
+    shapes::CSVInputFactory shape_factory("unit-test-data/lib-test-data/utk.quad");
+    shape_factory.make_shapes();
+
+    // 0.01 degree tiles split the test network four ways.
+    CHECK_THROWS_AS(tiles::TileCache::write_tiles(shape_factory.get_edges(), "unit-test-data/lib-test-data", 0.0), std::invalid_argument);
+    CHECK(tiles::TileCache::write_tiles(shape_factory.get_edges(), "unit-test-data/lib-test-data", 0.01) == 4);
+    CHECK(tiles::TileCache::is_tiled("unit-test-data/lib-test-data"));
+    CHECK_FALSE(tiles::TileCache::is_tiled("unit-test-data"));
+    CHECK_THROWS_AS(tiles::TileCache("unit-test-data"), std::invalid_argument);
+
+    SECTION("Cache") {
+        tiles::TileCache tile_cache("unit-test-data/lib-test-data", 1);
+        CHECK(tile_cache.get_tile_degrees() == Approx(0.01));
+
+        tiles::Tile::CPtr sw_tile = tile_cache.get_tile(geo::Point{ 35.948, -83.937 });
+        REQUIRE(sw_tile);
+        CHECK(sw_tile->size() > 0);
+        CHECK(tile_cache.get_tile(geo::Point{ 35.948, -83.937 }) == sw_tile);
+        CHECK(tile_cache.get_hits() == 1);
+
+        // no roads.
+        CHECK_FALSE(tile_cache.get_tile(geo::Point{ 40.0, -100.0 }));
+
+        // a second tile evicts the first, which stays valid while held.
+        tiles::Tile::CPtr ne_tile = tile_cache.get_tile(geo::Point{ 35.952, -83.931 });
+        REQUIRE(ne_tile);
+        CHECK(ne_tile != sw_tile);
+        CHECK(tile_cache.get_evictions() == 1);
+        CHECK(tile_cache.get_loads() == 2);
+        CHECK(sw_tile->get_quad()->retrieve_elements(geo::Point{ 35.948, -83.937 }).size() > 0);
+        CHECK(tile_cache.get_tile(geo::Point{ 35.948, -83.937 }) != sw_tile);
+    }
+
+    SECTION("Map Fitting") {
+        BSMP1::BSMP1CSVTrajectoryFactory factory;
+        trajectory::Trajectory quad_traj = factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv");
+        MapFitter quad_mf(buildTestQuadTree(), 1.0, .5);
+        quad_mf.fit(quad_traj);
+        IntersectionCounter().count_intersections(quad_traj);
+        REQUIRE(quad_traj.back()->get_out_degree() > 0);
+
+        // the trip crosses every tile, and a one tile cache evicts each tile it leaves; intersections are still counted
+        // over the whole network.
+        std::vector<tiles::TileCache::Ptr> tile_caches{ std::make_shared<tiles::TileCache>("unit-test-data/lib-test-data", 1),
+                                                        std::make_shared<tiles::TileCache>(tiles::MapImage::make(shape_factory.get_edges(), 0.005, false), 1),
+                                                        std::make_shared<tiles::TileCache>(tiles::MapImage::make(shape_factory.get_edges(), 0.001, false), 1) };
+
+        for (auto& tile_cache : tile_caches) {
+            trajectory::Trajectory tile_traj = factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv");
+            MapFitter::TileSet held_tiles;
+            MapFitter::AreaSet tile_areas;
+
+            {
+                MapFitter tile_mf(tile_cache, 1.0, .5);
+                tile_mf.fit(tile_traj);
+                held_tiles.swap(tile_mf.held_tiles);
+                tile_areas.swap(tile_mf.area_set);
+            }
+
+            // the vertices of evicted tiles keep their edges while the fitter's tiles are held.
+            IntersectionCounter().count_intersections(tile_traj);
+            CHECK(tile_cache->get_evictions() > 0);
+            CHECK(held_tiles.size() > 1);
+
+            REQUIRE(quad_traj.size() == tile_traj.size());
+
+            for (size_t i = 0; i < quad_traj.size(); ++i) {
+                CHECK(quad_traj[i]->is_explicitly_fit() == tile_traj[i]->is_explicitly_fit());
+                CHECK(quad_traj[i]->get_out_degree() == tile_traj[i]->get_out_degree());
+
+                if (quad_traj[i]->is_explicitly_fit() && tile_traj[i]->is_explicitly_fit()) {
+                    CHECK(quad_traj[i]->get_fit_edge()->get_uid() == tile_traj[i]->get_fit_edge()->get_uid());
+                }
+            }
+
+            CHECK(quad_mf.area_set.size() == tile_areas.size());
+        }
+    }
+
+    SECTION("Map Image") {
+        std::string image_path = "unit-test-data/lib-test-data/test.cvmap";
+        CHECK(tiles::MapImage::is_image(image_path));
+        CHECK_FALSE(tiles::MapImage::is_image("unit-test-data/lib-test-data/utk.quad"));
+        CHECK(tiles::MapImage::write(shape_factory.get_edges(), image_path, 0.01) == 4);
+        CHECK_THROWS_AS(tiles::MapImage("unit-test-data/lib-test-data/utk.quad"), std::invalid_argument);
+
+        tiles::MapImage::Ptr image_ptr = std::make_shared<const tiles::MapImage>(image_path);
+        CHECK(image_ptr->get_tile_degrees() == Approx(0.01));
+        CHECK(image_ptr->get_tile_keys().size() == 4);
+        CHECK(image_ptr->get_edge_count() == shape_factory.get_edges().size());
+        CHECK(image_ptr->get_vertex_count() > 0);
+        CHECK(image_ptr->make_tile_edges(tiles::tile_key(40.0, -100.0, 0.01)).empty());
+
+        // the image yields the same tiles as the tile files.
+        tiles::TileCache file_cache("unit-test-data/lib-test-data", 4);
+        tiles::TileCache image_cache(image_ptr, 4);
+        tiles::Tile::CPtr file_tile = file_cache.get_tile(geo::Point{ 35.948, -83.937 });
+        tiles::Tile::CPtr image_tile = image_cache.get_tile(geo::Point{ 35.948, -83.937 });
+        REQUIRE(image_tile);
+        CHECK(image_tile->size() == file_tile->size());
+        CHECK(image_tile->get_table().size() == image_tile->size());
+
+        BSMP1::BSMP1CSVTrajectoryFactory factory;
+        trajectory::Trajectory quad_traj = factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv");
+        trajectory::Trajectory image_traj = factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv");
+
+        MapFitter quad_mf(buildTestQuadTree(), 1.0, .5);
+        quad_mf.fit(quad_traj);
+        MapFitter image_mf(std::make_shared<tiles::TileCache>(image_ptr, 1), 1.0, .5);
+        image_mf.fit(image_traj);
+
+        REQUIRE(quad_traj.size() == image_traj.size());
+
+        for (size_t i = 0; i < quad_traj.size(); ++i) {
+            CHECK(quad_traj[i]->is_explicitly_fit() == image_traj[i]->is_explicitly_fit());
+
+            if (quad_traj[i]->is_explicitly_fit() && image_traj[i]->is_explicitly_fit()) {
+                CHECK(quad_traj[i]->get_fit_edge()->get_uid() == image_traj[i]->get_fit_edge()->get_uid());
+            }
+        }
+
+        CHECK(quad_mf.area_set.size() == image_mf.area_set.size());
+    }
+
+    SECTION("Compact Map Image") {
+        tiles::MapImage::Ptr full_ptr = tiles::MapImage::make(shape_factory.get_edges(), 0.01, false);
+        tiles::MapImage::Ptr compact_ptr = tiles::MapImage::make(shape_factory.get_edges(), 0.01, true);
+        CHECK_FALSE(full_ptr->is_compact());
+        CHECK(compact_ptr->is_compact());
+        CHECK(compact_ptr->get_vertex_count() == full_ptr->get_vertex_count());
+        CHECK(compact_ptr->get_size() < full_ptr->get_size());
+        CHECK_THROWS_AS(tiles::MapImage::make(shape_factory.get_edges(), 0.0, true), std::invalid_argument);
+
+        std::string image_path = "unit-test-data/lib-test-data/test_compact.cvmap";
+        CHECK(tiles::MapImage::write(shape_factory.get_edges(), image_path, 0.01, true) == 4);
+        CHECK(tiles::MapImage(image_path).is_compact());
+
+        // positions decode to within half a microdegree (about 6 cm) of the network they were made from.
+        std::unordered_map<uint64_t, geo::EdgeCPtr> originals;
+
+        for (auto& edge_ptr : shape_factory.get_edges()) {
+            originals[edge_ptr->get_uid()] = edge_ptr;
+        }
+
+        for (tiles::TileKey key : compact_ptr->get_tile_keys()) {
+            for (auto& edge_ptr : compact_ptr->make_tile_edges(key)) {
+                const geo::EdgeCPtr& original_ptr = originals.at(edge_ptr->get_uid());
+                CHECK(edge_ptr->v1->uid == original_ptr->v1->uid);
+                CHECK(std::abs(edge_ptr->v1->lat - original_ptr->v1->lat) <= 5e-7);
+                CHECK(std::abs(edge_ptr->v1->lon - original_ptr->v1->lon) <= 5e-7);
+                CHECK(std::abs(edge_ptr->v2->lat - original_ptr->v2->lat) <= 5e-7);
+                CHECK(std::abs(edge_ptr->v2->lon - original_ptr->v2->lon) <= 5e-7);
+                CHECK(edge_ptr->get_way_type() == original_ptr->get_way_type());
+            }
+        }
+
+        BSMP1::BSMP1CSVTrajectoryFactory factory;
+        trajectory::Trajectory full_traj = factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv");
+        trajectory::Trajectory compact_traj = factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv");
+
+        MapFitter full_mf(std::make_shared<tiles::TileCache>(full_ptr, 1), 1.0, .5);
+        full_mf.fit(full_traj);
+        MapFitter compact_mf(std::make_shared<tiles::TileCache>(compact_ptr, 1), 1.0, .5);
+        compact_mf.fit(compact_traj);
+
+        REQUIRE(full_traj.size() == compact_traj.size());
+
+        for (size_t i = 0; i < full_traj.size(); ++i) {
+            CHECK(full_traj[i]->is_explicitly_fit() == compact_traj[i]->is_explicitly_fit());
+
+            if (full_traj[i]->is_explicitly_fit() && compact_traj[i]->is_explicitly_fit()) {
+                CHECK(full_traj[i]->get_fit_edge()->get_uid() == compact_traj[i]->get_fit_edge()->get_uid());
+            }
+        }
+
+        CHECK(full_mf.area_set.size() == compact_mf.area_set.size());
+    }
 }
 
 TEST_CASE("DI Algorithm", "[map match][intersection count][critical interval][privacy interval][de-identification]") {
-    Quad::Ptr qptr = buildTestQuadTree();
+    EdgeQuad::Ptr qptr = buildTestQuadTree();
 
     // map matching, intersection counting, critical intervals
     SECTION("Feature Detection") {
@@ -1249,3 +2066,376 @@ TEST_CASE("DI Algorithm", "[map match][intersection count][critical interval][pr
         CHECK(point_counter_3.n_pi_points == 254);
     }
 }
+
+TEST_CASE("BSMP1 Columnar", "[bsmp1][columnar]") {
+    BSMP1::BSMP1CSVTrajectoryFactory csv_factory;
+    trajectory::Trajectory csv_traj = csv_factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv");
+
+    BSMP1::BSMP1ColumnarTrajectoryWriter writer("unit-test-data/lib-test-data");
+    writer.write_trajectory(csv_traj, csv_factory.get_uid(), true);
+
+    std::string columnar_path = "unit-test-data/lib-test-data/" + csv_factory.get_uid() + BSMP1::kColumnarExtension;
+
+    CHECK(BSMP1::BSMP1ColumnarTrajectoryFactory::is_columnar(columnar_path));
+    CHECK_FALSE(BSMP1::BSMP1ColumnarTrajectoryFactory::is_columnar("unit-test-data/lib-test-data/utk_test.csv"));
+
+    BSMP1::BSMP1ColumnarTrajectoryFactory columnar_factory;
+    instrument::PointCounter point_counter;
+    trajectory::Trajectory columnar_traj = columnar_factory.make_trajectory(columnar_path, point_counter);
+
+    CHECK(columnar_factory.get_uid() == csv_factory.get_uid());
+    CHECK(point_counter.n_points == csv_traj.size());
+    REQUIRE(columnar_traj.size() == csv_traj.size());
+
+    for (std::size_t i = 0; i < csv_traj.size(); ++i) {
+        CHECK(columnar_traj[i]->get_time() == csv_traj[i]->get_time());
+        CHECK(columnar_traj[i]->lat == csv_traj[i]->lat);
+        CHECK(columnar_traj[i]->lon == csv_traj[i]->lon);
+        CHECK(columnar_traj[i]->get_heading() == csv_traj[i]->get_heading());
+        CHECK(columnar_traj[i]->get_speed() == csv_traj[i]->get_speed());
+        CHECK(columnar_traj[i]->get_index() == i);
+
+        std::string data = csv_traj[i]->get_data();
+
+        if (!data.empty() && data.back() == '\r') {
+            data.pop_back();
+        }
+
+        CHECK(columnar_traj[i]->get_data() == data);
+    }
+
+    BSMP1::BSMP1ColumnarTrajectoryFactory bad_factory;
+    CHECK_THROWS_AS(bad_factory.make_trajectory("unit-test-data/lib-test-data/utk_test.csv"), std::invalid_argument);
+
+    // A file cut short inside its column data is rejected rather than read past its end.
+    std::string truncated_path = "unit-test-data/lib-test-data/truncated" + BSMP1::kColumnarExtension;
+    {
+        std::ifstream columnar_file(columnar_path, std::ios::binary);
+        std::string contents((std::istreambuf_iterator<char>(columnar_file)), std::istreambuf_iterator<char>());
+        std::ofstream truncated_file(truncated_path, std::ios::binary);
+        truncated_file.write(contents.data(), contents.size() - 16);
+    }
+    CHECK_THROWS_AS(bad_factory.make_trajectory(truncated_path), std::invalid_argument);
+
+    // The factory can be reused after a failure.
+    CHECK(bad_factory.make_trajectory(columnar_path).size() == csv_traj.size());
+
+    std::remove(truncated_path.c_str());
+    std::remove(columnar_path.c_str());
+}
+
+TEST_CASE("GPS Error Filter", "[error]") {
+    // A trip heading north at 10 m/s, sampled at 10 Hz.
+    auto make_trip = [](std::size_t n_points, bool timed) {
+        trajectory::Trajectory traj;
+
+        for (std::size_t i = 0; i < n_points; ++i) {
+            traj.push_back(std::make_shared<trajectory::Point>("", timed ? 1000000 + i * 100000 : 0, 35.0 + i * 9e-6, -84.0, 0.0, 10.0, i));
+        }
+
+        return traj;
+    };
+
+    SECTION("Trip Ends") {
+        const std::vector<std::string> paths{"unit-test-data/lib-test-data/utk_err_test.csv", "unit-test-data/lib-test-data/utk_test.csv"};
+
+        for (auto& path : paths) {
+            BSMP1::BSMP1CSVTrajectoryFactory factory;
+            instrument::PointCounter corrector_counter;
+            trajectory::Trajectory corrected = factory.make_trajectory(path, corrector_counter);
+            ErrorCorrector ec(50);
+            ec.correct_error(corrected, factory.get_uid(), corrector_counter);
+
+            instrument::PointCounter filter_counter;
+            trajectory::Trajectory filtered = factory.make_trajectory(path, filter_counter);
+            GPSErrorFilter gef(50);
+            gef.filter(filtered, filter_counter);
+
+            CHECK(filter_counter.n_error_points == corrector_counter.n_error_points);
+            REQUIRE(filtered.size() == corrected.size());
+
+            for (std::size_t i = 0; i < filtered.size(); ++i) {
+                CHECK(filtered[i]->get_time() == corrected[i]->get_time());
+                CHECK(filtered[i]->lat == corrected[i]->lat);
+                CHECK(filtered[i]->lon == corrected[i]->lon);
+                CHECK(filtered[i]->get_index() == i);
+            }
+        }
+    }
+
+    SECTION("Short Trips") {
+        GPSErrorFilter gef(50);
+
+        trajectory::Trajectory empty;
+        CHECK(gef.filter(empty) == 0);
+
+        trajectory::Trajectory single = make_trip(1, true);
+        CHECK(gef.filter(single) == 0);
+        CHECK(single.size() == 1);
+
+        trajectory::Trajectory short_trip = make_trip(10, true);
+        short_trip[9]->lat += .01;
+        CHECK(gef.filter(short_trip) == 1);
+        CHECK(short_trip.size() == 9);
+        CHECK(short_trip[8]->get_index() == 8);
+
+        CHECK_THROWS_AS(GPSErrorFilter(50, 0.0), std::invalid_argument);
+    }
+
+    SECTION("Jumps") {
+        for (bool timed : {true, false}) {
+            trajectory::Trajectory traj = make_trip(300, timed);
+            traj[150]->lat += .01;
+            traj[200]->lon += .01;
+            traj[201]->lon += .01;
+            traj[202]->lon += .01;
+
+            trajectory::Trajectory ends_only = traj;
+            CHECK(GPSErrorFilter(50).filter(ends_only) == 0);
+
+            instrument::PointCounter point_counter;
+            GPSErrorFilter gef(50, 44.7, 5);
+            gef.filter(traj, point_counter);
+
+            CHECK(point_counter.n_error_points == 4);
+            REQUIRE(traj.size() == 296);
+
+            for (std::size_t i = 0; i < traj.size(); ++i) {
+                CHECK(traj[i]->lon == -84.0);
+                CHECK(traj[i]->get_index() == i);
+            }
+        }
+
+        // A trip that stays where it jumped to is kept; only a return marks the jump as error.
+        trajectory::Trajectory shifted = make_trip(300, false);
+
+        for (std::size_t i = 120; i < 300; ++i) {
+            shifted[i]->lat += .01;
+        }
+
+        CHECK(GPSErrorFilter(50, 44.7, 5).filter(shifted) == 0);
+        CHECK(shifted.size() == 300);
+
+        // A run longer than max_jump_points is not removed.
+        trajectory::Trajectory long_run = make_trip(300, true);
+
+        for (std::size_t i = 100; i < 110; ++i) {
+            long_run[i]->lat += .01;
+        }
+
+        CHECK(GPSErrorFilter(50, 44.7, 5).filter(long_run) == 0);
+    }
+}
+
+TEST_CASE("Shards", "[shard][journal]") {
+    SECTION("Assignment") {
+        CHECK_THROWS_AS(DIMulti::Shard::FromString("8/8", "uid"), std::invalid_argument);
+        CHECK_THROWS_AS(DIMulti::Shard::FromString("0/0", "line"), std::invalid_argument);
+        CHECK_THROWS_AS(DIMulti::Shard::FromString("1-8", "uid"), std::invalid_argument);
+        CHECK_THROWS_AS(DIMulti::Shard::FromString("0/8", "path"), std::invalid_argument);
+        CHECK(DIMulti::Shard::FromString("0/8", "uid")->FileName("cv_di.journal") == "cv_di.shard-0-of-8.journal");
+
+        const unsigned n_shards = 3;
+        std::vector<DIMulti::Shard::Ptr> line_shards, uid_shards;
+
+        for (unsigned i = 0; i < n_shards; ++i) {
+            line_shards.push_back(std::make_shared<DIMulti::Shard>(i, n_shards, DIMulti::Shard::KeyType::LINE));
+            uid_shards.push_back(std::make_shared<DIMulti::Shard>(i, n_shards, DIMulti::Shard::KeyType::UID));
+        }
+
+        // Every manifest line belongs to exactly one shard, round robin.
+        for (uint64_t line_number = 1; line_number <= 9; ++line_number) {
+            unsigned n_assigned = 0;
+
+            for (unsigned i = 0; i < n_shards; ++i) {
+                if (line_shards[i]->IsAssigned(line_number, "")) {
+                    n_assigned++;
+                    CHECK(i == (line_number - 1) % n_shards);
+                }
+            }
+
+            CHECK(n_assigned == 1);
+        }
+
+        // A CSV trip is keyed by its UID, wherever it is in the manifest; other files by their path.
+        std::string trip_path = "unit-test-data/lib-test-data/utk_test.csv";
+        std::ifstream trip_file(trip_path);
+        std::string line;
+        std::getline(trip_file, line);
+        std::getline(trip_file, line);
+        CHECK(DIMulti::Shard::TripKey(trip_path) == BSMP1::BSMP1CSVTrajectoryFactory::make_uid(line));
+        CHECK(DIMulti::Shard::TripKey("missing.csv") == "missing.csv");
+
+        for (auto& path : { trip_path, std::string("missing.csv") }) {
+            unsigned n_assigned = 0;
+
+            for (unsigned i = 0; i < n_shards; ++i) {
+                bool assigned = uid_shards[i]->IsAssigned(1, path);
+                CHECK(assigned == uid_shards[i]->IsAssigned(7, path));
+                CHECK(assigned == (hash_utilities::fnv1a(DIMulti::Shard::TripKey(path)) % n_shards == i));
+                n_assigned += assigned;
+            }
+
+            CHECK(n_assigned == 1);
+        }
+    }
+
+    SECTION("Journal Merge") {
+        std::vector<std::string> shard_paths{ DIMulti::Shard::FileName("unit-test-data/cv_di.journal", 0, 2),
+                                              DIMulti::Shard::FileName("unit-test-data/cv_di.journal", 1, 2) };
+        std::string merged_path = "unit-test-data/cv_di.journal";
+
+        instrument::PointCounter counter_a, counter_b, counter_c;
+        counter_a.n_points = 10;
+        counter_a.n_pi_points = 4;
+        counter_b.n_points = 20;
+        counter_b.n_error_points = 2;
+        counter_c.n_points = 5;
+        counter_c.n_invalid_geo_points = 5;
+
+        {
+            DIMulti::Journal journal_0(shard_paths[0], false);
+            journal_0.RecordDone("a.csv", "1_1", "out/1_1.csv", counter_a);
+            journal_0.RecordFail("c.csv", counter_c);
+            DIMulti::Journal journal_1(shard_paths[1], false);
+            journal_1.RecordDone("b.csv", "1_2", "out/1_2.csv", counter_b);
+        }
+
+        // An interrupted shard leaves a torn last line, which is not merged.
+        {
+            std::ofstream torn(shard_paths[1], std::ios::app);
+            torn << "done\td.csv\t1_3";
+        }
+
+        DIMulti::Journal::MergeSummary summary = DIMulti::Journal::Merge(shard_paths, merged_path);
+        CHECK(summary.n_done == 2);
+        CHECK(summary.n_failed == 1);
+        CHECK(summary.point_counter.n_points == 35);
+        CHECK(summary.point_counter.n_invalid_geo_points == 5);
+        CHECK(summary.point_counter.n_error_points == 2);
+        CHECK(summary.point_counter.n_pi_points == 4);
+
+        std::ifstream merged(merged_path);
+        std::string line;
+        std::vector<std::string> inputs;
+
+        while (std::getline(merged, line)) {
+            StrVector parts;
+            instrument::PointCounter point_counter;
+            REQUIRE(DIMulti::Journal::ParseLine(line, parts, point_counter));
+            inputs.push_back(parts[1]);
+        }
+
+        CHECK(inputs == std::vector<std::string>({ "a.csv", "c.csv", "b.csv" }));
+
+        std::vector<std::string> missing_paths{ shard_paths[0], "unit-test-data/missing.journal" };
+        CHECK_THROWS_AS(DIMulti::Journal::Merge(missing_paths, merged_path), std::invalid_argument);
+
+        for (auto& path : shard_paths) {
+            std::remove(path.c_str());
+        }
+
+        std::remove(merged_path.c_str());
+        std::remove((merged_path + ".part").c_str());
+    }
+}
+
+TEST_CASE("Incremental Fingerprints", "[incremental]") {
+    std::string db_path = "unit-test-data/cv_di.fingerprints";
+    std::string output_path = "unit-test-data/lib-test-data/utk_test.csv";
+    std::remove(db_path.c_str());
+
+    instrument::PointCounter counter;
+    counter.n_points = 12;
+
+    // Results are appended as they are recorded, so they survive a run that never saves.
+    {
+        DIMulti::FingerprintDB db(db_path, 0xabc);
+        db.Update("a.csv", 1, "1_1", output_path, counter);
+        db.Update("b.csv", 2, "1_2", output_path, counter);
+        db.Update("a.csv", 3, "1_1", output_path, counter);
+    }
+
+    // A run stopped while writing leaves a torn last line, which is dropped.
+    {
+        std::ofstream torn(db_path, std::ios::app);
+        torn << "c.csv\t4\tabc";
+    }
+
+    {
+        DIMulti::FingerprintDB db(db_path, 0xabc);
+        DIMulti::FingerprintDB::Entry entry;
+        CHECK(db.FindUnchanged("a.csv", 3, entry));
+        CHECK(entry.point_counter.n_points == 12);
+        CHECK_FALSE(db.FindUnchanged("a.csv", 1, entry));
+        CHECK(db.FindUnchanged("b.csv", 2, entry));
+        CHECK(entry.uid == "1_2");
+        CHECK_FALSE(db.FindUnchanged("c.csv", 4, entry));
+        db.Update("c.csv", 4, "1_3", "unit-test-data/missing.csv", counter);
+        CHECK_FALSE(db.FindUnchanged("c.csv", 4, entry));
+    }
+
+    // Loading rewrites the database with one line per trip file.
+    std::ifstream db_file(db_path);
+    std::string line;
+    size_t n_lines = 0;
+
+    while (std::getline(db_file, line)) {
+        ++n_lines;
+    }
+
+    CHECK(n_lines == 3);
+
+    DIMulti::FingerprintDB::Entry entry;
+    CHECK_FALSE(DIMulti::FingerprintDB(db_path, 0xdef).FindUnchanged("a.csv", 3, entry));
+
+    std::remove(db_path.c_str());
+    std::remove((db_path + ".part").c_str());
+}
+
+TEST_CASE("Hash Utilities", "[utilities][hash]") {
+    CHECK(hash_utilities::fnv1a("") == hash_utilities::FNV_OFFSET_BASIS);
+    CHECK(hash_utilities::fnv1a("a") == 0xaf63dc4c8601ec8cULL);
+    CHECK(hash_utilities::fnv1a("bar", hash_utilities::fnv1a("foo")) == hash_utilities::fnv1a("foobar"));
+    CHECK(hash_utilities::to_hex(0xaf63dc4c8601ec8cULL) == "af63dc4c8601ec8c");
+    CHECK(hash_utilities::to_hex(1) == "0000000000000001");
+
+    std::ifstream file("unit-test-data/lib-test-data/utk.config");
+    std::stringstream ss;
+    ss << file.rdbuf();
+
+    CHECK(hash_utilities::file_hash("unit-test-data/lib-test-data/utk.config") == hash_utilities::fnv1a(ss.str()));
+    CHECK_THROWS_AS(hash_utilities::file_hash("unit-test-data/lib-test-data/missing"), std::invalid_argument);
+}
+
+TEST_CASE("Trajectory Simplification", "[trajectory][kml]") {
+    trajectory::Trajectory traj;
+
+    // East along a parallel, then north; the corner is index 10.
+    for (uint64_t i = 0; i <= 10; ++i) {
+        traj.push_back(std::make_shared<trajectory::Point>("", i, 35.95, -83.93 + 0.0001 * i, 90.0, 10.0, i));
+    }
+
+    for (uint64_t i = 1; i <= 10; ++i) {
+        traj.push_back(std::make_shared<trajectory::Point>("", 10 + i, 35.95 + 0.0001 * i, -83.929, 0.0, 10.0, 10 + i));
+    }
+
+    std::vector<trajectory::Index> kept = trajectory::simplify(traj, 0, traj.size(), 1.0);
+    REQUIRE(kept.size() == 3);
+    CHECK(kept[0] == 0);
+    CHECK(kept[1] == 10);
+    CHECK(kept[2] == 20);
+
+    // A sub-range on the straight part keeps only its end points.
+    kept = trajectory::simplify(traj, 2, 8, 1.0);
+    REQUIRE(kept.size() == 2);
+    CHECK(kept[0] == 2);
+    CHECK(kept[1] == 7);
+
+    // No tolerance keeps every point; the range is clipped to the trajectory.
+    CHECK(trajectory::simplify(traj, 0, 100, 0.0).size() == traj.size());
+    CHECK(trajectory::simplify(traj, 5, 5, 1.0).empty());
+
+    // A tolerance larger than the corner offset removes the corner.
+    CHECK(trajectory::simplify(traj, 0, traj.size(), 500.0).size() == 2);
+}
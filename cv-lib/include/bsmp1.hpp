@@ -22,11 +22,26 @@
 
 #include "instrument.hpp"
 #include "trajectory.hpp"
+#include "utilities.hpp"
 
 namespace BSMP1 {
 
     const std::string kCSVHeader = "RxDevice,FileId,TxDevice,Gentime,TxRandom,MsgCount,DSecond,Latitude,Longitude,Elevation,Speed,Heading,Ax,Ay,Az,Yawrate,PathCount,RadiusOfCurve,Confidence";
     const uint32_t kNFields = 19;
+
+    const std::string kColumnarMagic = "BSMC";
+    const std::string kColumnarExtension = ".bsmc";
+    const uint32_t kColumnarVersion = 2;
+    const std::string kColumnarRecord = "Record";
+
+    /**
+     * \brief The storage types of the columns in a BSMP1 columnar file.
+     */
+    enum ColumnType : uint8_t {
+        FLOAT64 = 0,            ///< packed native doubles.
+        UINT64 = 1,             ///< packed native unsigned 64-bit integers.
+        STRING = 2              ///< (rows + 1) uint64 offsets followed by the concatenated bytes.
+    };
     
     /**
      * \brief Instances of this class build trajectories from the BSMP1 dataset.
@@ -101,6 +116,172 @@ namespace BSMP1 {
              */
             trajectory::Point::Ptr make_point(const std::string& line, instrument::PointCounter& point_counter); };
 
+    /**
+     * \brief Instances of this class build trajectories from BSMP1 columnar (.bsmc) files.
+     *
+     * A columnar file is laid out as:
+     *
+     *   magic "BSMC" | uint32 version | uint64 rows | uint32 columns |
+     *   columns x (uint16 name length | name | uint8 ColumnType | uint64 offset | uint64 length) | column data
+     *
+     * Integers and doubles are stored in native (little endian) byte order, and each column's data starts on an 8 byte
+     * boundary. The file is mapped read-only and only the columns needed to build points (RxDevice, FileId, Gentime,
+     * Latitude, Longitude, Speed, Heading) are touched, in place; the Record column holds the original BSMP1 CSV record
+     * and is passed through to the output unparsed. Columnar files are made from CSV trip files with the
+     * BSMP1ColumnarTrajectoryWriter, e.g. by cv_di --to_columnar.
+     */
+    class BSMP1ColumnarTrajectoryFactory : public trajectory::TrajectoryFactory {
+        public:
+
+            /**
+             * \brief Default constructor.
+             */
+            BSMP1ColumnarTrajectoryFactory(void);
+
+            /**
+             * \brief Unmap the file of a trajectory that failed to load.
+             */
+            ~BSMP1ColumnarTrajectoryFactory(void);
+
+            BSMP1ColumnarTrajectoryFactory(const BSMP1ColumnarTrajectoryFactory&) = delete;
+            BSMP1ColumnarTrajectoryFactory& operator=(const BSMP1ColumnarTrajectoryFactory&) = delete;
+
+            /**
+             * \brief Build a Trajectory instance from a columnar input file.
+             *
+             * \param input the name of the file containing the trajectory data.
+             * \return a Trajectory instance (a vector of pointers to Point instances).
+             * \throws invalid argument if the file cannot be opened, is not a columnar file, or is missing a column.
+             */
+            const trajectory::Trajectory make_trajectory(const std::string& input);
+
+            /**
+             * \brief Build a Trajectory instance from a columnar input file and count the number of points in the
+             * trajectory.
+             *
+             * \param input the name of the file containing the trajectory data.
+             * \param point_counter a PointCounter instance that keeps track of various statistics about a trajectory.
+             * \return a Trajectory instance (a vector of pointers to Point instances).
+             * \throws invalid argument if the file cannot be opened, is not a columnar file, or is missing a column.
+             */
+            const trajectory::Trajectory make_trajectory(const std::string& input, instrument::PointCounter& point_counter);
+
+            /**
+             * \brief Return the current trajectory unique identifier.
+             *
+             * \return the UID as a string.
+             */
+            const std::string get_uid(void) const;
+
+            /**
+             * \brief Predicate indicating the file path names a BSMP1 columnar file (by extension).
+             *
+             * \param input the path to check.
+             * \return true if the path ends with the columnar extension, false otherwise.
+             */
+            static bool is_columnar(const std::string& input);
+
+        private:
+            /**
+             * \brief The location of a single column within a columnar file.
+             */
+            struct Column {
+                ColumnType type;
+                uint64_t offset;
+                uint64_t length;
+            };
+
+            uint64_t index_;
+            uint64_t n_rows_;
+            std::string uid_;
+
+            const char* data_;                  ///< The start of the mapped file; nullptr when none is loaded.
+            size_t size_;                       ///< The size of the mapped file in bytes.
+            std::vector<uint64_t> buffer_;      ///< The file contents where files are read rather than mapped.
+
+            // The required columns, in place in the mapped file.
+            const uint64_t* gentime_;
+            const double* lat_;
+            const double* lon_;
+            const double* speed_;
+            const double* heading_;
+            const uint64_t* record_offsets_;
+            const char* record_bytes_;
+
+            /**
+             * \brief Map the file read-only (read it on Windows).
+             *
+             * \param input the name of the columnar file.
+             * \throws invalid argument if the file cannot be opened or mapped.
+             */
+            void map(const std::string& input);
+
+            /**
+             * \brief Release the mapped file and forget its columns.
+             */
+            void unload(void);
+
+            /**
+             * \brief Map the file and locate the required columns in it.
+             *
+             * \param input the name of the columnar file.
+             * \throws invalid argument if the file cannot be opened, is not a columnar file, or is missing a column.
+             */
+            void load(const std::string& input);
+
+            /**
+             * \brief Copy the original BSMP1 record of the provided row out of the mapped file.
+             */
+            std::string get_record(uint64_t row) const;
+
+            /**
+             * \brief Make a Point from the provided row of the loaded columns.
+             *
+             * \param row the row index.
+             * \throws out_of_range if the geolocation or heading is out of range.
+             */
+            trajectory::Point::Ptr make_point(uint64_t row);
+
+            /**
+             * \brief Make a Point from the provided row of the loaded columns and update the provided PointCounter.
+             *
+             * \param row the row index.
+             * \param point_counter a PointCounter instance to update based on the exception checks.
+             * \throws out_of_range if the geolocation or heading is out of range.
+             */
+            trajectory::Point::Ptr make_point(uint64_t row, instrument::PointCounter& point_counter);
+    };
+
+    /**
+     * \brief Instances of this class write trajectories in the BSMP1 columnar form; this is used to convert CSV trip
+     * files to columnar trip files.
+     */
+    class BSMP1ColumnarTrajectoryWriter : public trajectory::TrajectoryWriter {
+        public:
+
+            /**
+             * \brief Constructor
+             *
+             * \param output directory in which to store the file containing the trajectory data; file names are based
+             * on the unique id of the trajectory.
+             */
+            BSMP1ColumnarTrajectoryWriter(const std::string& output);
+
+            /**
+             * \brief Write a trajectory to a columnar file named based on the trajectories unique id (uid).
+             *
+             * \param trajectory the trajectory to write; point data must be BSMP1 CSV records.
+             * \param uid the trajectories UID -- this will be used to name the output file.
+             * \param strip_cr flag to signal carriage returns should be removed from the records.
+             *
+             * \throws invalid_argument when the output stream cannot be opened.
+             */
+            void write_trajectory(const trajectory::Trajectory& traj, const std::string& uid, bool strip_cr) const;
+
+        private:
+            std::string output_;            ///> The output directory.
+    };
+
     /**
      * \brief Instances of this class write trajectories in the BSMP1 form.
      */
@@ -122,10 +303,21 @@ namespace BSMP1 {
              * \param uid the trajectories UID -- this will be used to name the output file.
              * \param strip_cr flag to signal carriage returns should be removed.
              *
-             * \throws invalid_argument when the output stream cannot be opened.
+             * The trajectory is written to a temporary file that is renamed into place when complete, so an
+             * interrupted write never leaves a partial output file under the final name.
+             *
+             * \throws invalid_argument when the output stream cannot be opened or the file cannot be renamed.
              */
             void write_trajectory(const trajectory::Trajectory& traj, const std::string& uid, bool strip_cr) const;
 
+            /**
+             * \brief Get the path of the file a trajectory with the provided UID is written to.
+             *
+             * \param uid the trajectories UID.
+             * \return the output file path.
+             */
+            const std::string get_output_file_path(const std::string& uid) const;
+
         private:
             std::string output_;            ///> The output directory.
     };
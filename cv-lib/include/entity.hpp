@@ -547,6 +547,15 @@ class Vertex : public Location {
          */
         bool add_edges(EdgePtrSet& edges);
 
+        /**
+         * Remove all incident edges from this vertex.
+         *
+         * Edges and vertices own each other; a road network that is
+         * discarded while the program runs must clear its vertices or it is
+         * never freed.
+         */
+        void clear_edges();
+
         /**
          * Get the degree of this vertex.
          *  
@@ -71,4 +71,64 @@ class ErrorCorrector
         std::vector<trajectory::Point> edge_pts_;
 };
 
+/**
+ * \brief A linear-time replacement for ErrorCorrector. The first and last sample_size points are checked as
+ * ErrorCorrector checks them, with medians found by selection rather than sorting. Optionally, short runs of points that
+ * jump implausibly far from the trip are removed anywhere in it. Points are marked first and removed in a single pass.
+ *
+ * Speeds between points use their times when those increase, and assume 10 Hz sampling otherwise.
+ */
+class GPSErrorFilter
+{
+    public:
+
+        /**
+         * \brief Construct a GPS error filter.
+         *
+         * \param sample_size The number of points at each end of a trip compared with their median position.
+         * \param max_speed The speed, in meters per second, above which a point is taken to be in error.
+         * \param max_jump_points The longest run of points a jump anywhere in the trip may remove; 0 checks only the ends.
+         * \throws std::invalid_argument if max_speed is not positive.
+         */
+        GPSErrorFilter(uint64_t sample_size, double max_speed = 44.7, uint32_t max_jump_points = 0);
+
+        /**
+         * \brief Remove the points of traj found to be in error and, when the trip has more than one point, re-index it.
+         *
+         * \param traj The trajectory to filter.
+         * \return the number of points removed.
+         */
+        uint64_t filter(trajectory::Trajectory& traj) const;
+
+        /**
+         * \brief Remove the points of traj found to be in error and, when the trip has more than one point, re-index it.
+         * The removed points are added to the point_counter's error points.
+         *
+         * \param traj The trajectory to filter.
+         * \param point_counter The counts to update.
+         */
+        void filter(trajectory::Trajectory& traj, instrument::PointCounter& point_counter) const;
+
+    private:
+        uint64_t sample_size_;
+        double max_speed_;
+        uint32_t max_jump_points_;
+
+        /**
+         * \brief Mark the points at the positions in window that are too far from the window's median position.
+         */
+        void mark_window(const trajectory::Trajectory& traj, const std::vector<uint64_t>& window, std::vector<uint8_t>& removed) const;
+
+        /**
+         * \brief Mark the runs of up to max_jump_points points after which the trip returns to within max_speed of
+         * the point before the run.
+         */
+        void mark_jumps(const trajectory::Trajectory& traj, std::vector<uint8_t>& removed) const;
+
+        /**
+         * \brief Predicate indicating a vehicle could travel from traj[from] to traj[to] without exceeding max_speed.
+         */
+        bool is_reachable(const trajectory::Trajectory& traj, uint64_t from, uint64_t to) const;
+};
+
 #endif
@@ -58,6 +58,17 @@ namespace KML {
              */
             File(std::ostream& stream, const std::string& doc_name, bool visibility = true);
 
+            /**
+             * \brief Set the level of detail used to render trajectories and intervals.
+             *
+             * When the tolerance is positive, trajectories and intervals are simplified (Douglas-Peucker) so no removed
+             * point is more than tolerance meters from the rendered line, and the stride arguments are ignored. When it
+             * is 0 (the default) every stride-th point is rendered.
+             *
+             * \param tolerance the simplification tolerance in meters.
+             */
+            void set_tolerance( double tolerance );
+
             /**
              * \brief Finalize the KML file (write the ending tags).
              */
@@ -196,10 +207,44 @@ namespace KML {
         private:
             std::ostream& stream_;
             std::vector<unsigned int> colors;
+            std::string coord_buffer_;          ///< reused to format coordinates.
+            double tolerance_;                  ///< simplification tolerance in meters; 0 uses strides.
+
+            /**
+             * \brief Write a point as a KML coordinate (lon,lat,0) followed by the suffix.
+             */
+            void write_coordinate( const geo::Point& point, const char* suffix );
+
+            /**
+             * \brief Mark the trajectory points to render when simplifying; empty when using strides.
+             */
+            std::vector<bool> simplify_mask( const trajectory::Trajectory& traj, bool de_identify ) const;
+
+            /**
+             * \brief Step to the next rendered point after i (the point stride away, or the next marked point).
+             */
+            int advance( const std::vector<bool>& keep, int i, int stride, int n ) const;
+
+            /**
+             * \brief Step back to the rendered point before i (the point stride before, or the previous marked point).
+             */
+            int retreat( const std::vector<bool>& keep, int i, int stride ) const;
 
             unsigned int get_speed_color( double speed );
             void start_folder( const std::string& name, const std::string& description, const std::string& id, const bool open );
             void stop_folder();
     };
+
+    /**
+     * \brief Write a KML document as a KMZ file, i.e., a zip archive containing the document as its single entry.
+     *
+     * The entry is deflated when the library is built with zlib and stored uncompressed otherwise.
+     *
+     * \param file_path the path of the KMZ file to write.
+     * \param kml the complete KML document.
+     * \param entry_name the name of the KML document in the archive.
+     * \throws invalid_argument if the file cannot be opened or the document is too large for a zip entry.
+     */
+    void write_kmz( const std::string& file_path, const std::string& kml, const std::string& entry_name = "doc.kml" );
 }
 #endif
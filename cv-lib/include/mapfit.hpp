@@ -24,12 +24,73 @@
 #include "entity.hpp"
 #include "trajectory.hpp"
 #include "quad.hpp"
+#include "spatial.hpp"
+#include "tiles.hpp"
 
+#include <condition_variable>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <tuple>
 #include <unordered_map>
 #include <queue>
 
+/**
+ * \brief The fit areas of a lookup's candidate edges, gathered into contiguous corner arrays so one point is tested
+ * against all of them in a single branch-free loop the compiler can vectorize.
+ *
+ * The containment test is geo::Area::contains, evaluated term for term, so both agree exactly; a point on the boundary
+ * of an area is inside it.
+ */
+class FitAreaBatch
+{
+    public:
+        static const std::size_t kNoMatch;              ///< The result of best_match when no area contains the point.
+
+        /** \brief Remove every area; the arrays keep their capacity. */
+        void clear(void);
+
+        /**
+         * \brief Add an area.
+         *
+         * \param corners the four corners of the area, in the order geo::Area keeps them.
+         * \param bearing the bearing of the area's edge in degrees.
+         */
+        void add(const geo::Point* corners, double bearing);
+
+        /** \brief Return the number of areas. */
+        std::size_t size(void) const;
+
+        /** \brief Make a geo::Area with the corners of an area. */
+        geo::Area::Ptr make_area(std::size_t i) const;
+
+        /**
+         * \brief Test a point against every area.
+         *
+         * \param pt the point.
+         * \param outside set to one entry per area: the number of the area's sides the point lies outside, so 0 when
+         * the area contains the point.
+         */
+        void contains(const geo::Point& pt, std::vector<double>& outside) const;
+
+        /**
+         * \brief Find the area containing a point whose bearing is closest to a heading, by
+         * trajectory::Point::angle_error; on a tie the area added first wins.
+         *
+         * \param pt the point.
+         * \param heading the heading in degrees.
+         * \return the position of the area, or kNoMatch when no area contains the point.
+         */
+        std::size_t best_match(const geo::Point& pt, double heading);
+
+    private:
+        std::vector<double> lats_[4];                   ///< the latitudes of each corner of every area.
+        std::vector<double> lons_[4];                   ///< the longitudes of each corner of every area.
+        std::vector<double> bearings_;
+        std::vector<double> outside_;                   ///< scratch for best_match.
+};
+
 /**
  * \brief The map matching algorithm to use for our privacy procedures. 
  *
@@ -50,8 +111,20 @@ class MapFitter
         using PriorityPair = std::pair<double, AreaEdgePair>;
         using AreaEdgePairList = std::vector<AreaEdgePair>;
         using AreaSet = std::unordered_set<geo::AreaCPtr>;
+        using TileSet = std::unordered_set<tiles::Tile::CPtr>;
         using PriorityAreaQueue = std::priority_queue<PriorityPair, std::vector<PriorityPair>, std::function<bool(const PriorityPair&,const PriorityPair&)>>;
 
+        /**
+         * \brief Construct a map-matching instance.
+         *
+         * \param index The spatial index containing the OSM road network to match to; it must cover every edge whose
+         * fit area, using the same scaling and extension, contains a point.
+         * \param fit_width_scaling A scaling factor to apply to the prescribed widths of various types of OSM roads,
+         * e.g., 1.0 will use the prescribed width; 1.5 will increase that width by 50%.
+         * \param fit_extension The number of meters to extend the bounding box on each end (meters)
+         */
+        MapFitter( const spatial::EdgeIndex::CPtr& index, double fit_width_scaling = 1.0, double fit_extension = 5.0);
+
         /**
          * \brief Construct a map-matching instance.
          *
@@ -60,7 +133,21 @@ class MapFitter
          * e.g., 1.0 will use the prescribed width; 1.5 will increase that width by 50%.
          * \param fit_extension The number of meters to extend the bounding box on each end (meters)
          */
-        MapFitter( const Quad::CPtr& quadtree, double fit_width_scaling = 1.0, double fit_extension = 5.0);
+        MapFitter( const EdgeQuad::CPtr& quadtree, double fit_width_scaling = 1.0, double fit_extension = 5.0);
+
+        /**
+         * \brief Construct a map-matching instance that faults in map tiles as the trip reaches them.
+         *
+         * Every tile the fitter matches against is put in held_tiles. A tile the cache has evicted clears the edge lists
+         * of its vertices once its last holder releases it, so keep held_tiles for as long as the fit edges' vertices
+         * are used, e.g., by an IntersectionCounter.
+         *
+         * \param tile_cache The tile cache holding the OSM road network to match to.
+         * \param fit_width_scaling A scaling factor to apply to the prescribed widths of various types of OSM roads,
+         * e.g., 1.0 will use the prescribed width; 1.5 will increase that width by 50%.
+         * \param fit_extension The number of meters to extend the bounding box on each end (meters)
+         */
+        MapFitter( const tiles::TileCache::Ptr& tile_cache, double fit_width_scaling = 1.0, double fit_extension = 5.0);
 
         /**
          * \brief Fit a trip point to a OSM segment.
@@ -72,19 +159,59 @@ class MapFitter
         /**
          * \brief Fit an entire trip to an OSM road network.
          *
+         * With decimation on, only keyframes are fit in full: the first and last points and every point that is
+         * decimation_distance from, or whose heading is decimation_heading from, the keyframe before it. A skipped
+         * point takes the edge of the keyframe before it while it stays in that edge's fit area, then the edge of the
+         * keyframe after it when it is in that one's, and is fit on its own otherwise. Every point between two
+         * keyframes is fit in full when either keyframe is unmatched or their edges are neither the same nor adjacent.
+         *
          * \param traj the trip to match to the road network stored in the quad tree.
          */
         void fit( trajectory::Trajectory& traj );
 
+        /**
+         * \brief Fit an entire trip point by point, without decimation, recording the fitter's state after each point.
+         *
+         * \param traj the trip to match to the road network.
+         * \param states set to one entry per point: get_current_edge() after the point was fit.
+         */
+        void fit( trajectory::Trajectory& traj, std::vector<const geo::Edge*>& states );
+
+        /**
+         * \brief Return the edge whose fit area the next point is tested against first, or nullptr when the last point
+         * did not match. Fitters over the same map with the same parameters that hold the same edge fit every following
+         * point the same way.
+         */
+        const geo::Edge* get_current_edge( void ) const;
+
+        /**
+         * \brief Set the keyframe budget of fit( traj ).
+         *
+         * \param distance the distance in meters between keyframes; 0 turns decimation off.
+         * \param heading_delta the heading change in degrees that makes a point a keyframe.
+         * \throws std::invalid_argument if distance is negative or heading_delta is not positive.
+         */
+        void set_decimation( double distance, double heading_delta );
+
     private:
-        Quad::CPtr quadtree;
+        spatial::EdgeIndex::CPtr index;
+        tiles::TileCache::Ptr tile_cache;           ///> used instead of index when the map is tiled.
 
         double fit_width_scaling;                   ///> applied to uniformly to all road type widths.
         double fit_extension;                       ///> distance (in meters) area is extended from ends of edge.
+        double decimation_distance;                 ///> meters between keyframes in fit( traj ); 0 fits every point.
+        double decimation_heading;                  ///> heading change (in degrees) that makes a point a keyframe.
 
         geo::Area::Ptr current_area;                ///> the area that contained the last traj point or nullptr if no edge matched.
         geo::EdgeCPtr current_edge;                 ///> the edge that matched the last traj point.
 
+        spatial::EdgeIndex::Cursor::Ptr index_cursor;  ///> looks up the candidate edges in index; holds prefetched lookups for the trip being fit.
+        std::size_t point_index;                    ///> the position in the trip of the point being fit; past the end outside fit( traj ).
+        EdgeQuad::Cursor tile_cursor;               ///> remembers the quad tree leaf of the last lookup in a tile.
+        const spatial::EdgeTable* edge_table;       ///> widths and bearings of the index's edges, or of the last tile's.
+        FitAreaBatch candidate_areas;               ///> the fit areas of the candidates of the last lookup.
+        std::vector<const geo::EdgeCPtr*> candidate_edges;  ///> the edge of each area in candidate_areas.
+
         /**
          * \brief If the previous trip point was matched, return true (attempt to use it); otherwise, search the quad tree
          * for the set of nearest OSM edges.  All edges in this set whose encapsulating areas contain the trip point are considered.  
@@ -115,6 +242,16 @@ class MapFitter
          */
         bool set_fit_area( const trajectory::Point& tp, const geo::Vertex::Ptr shared_vertex);
 
+        /**
+         * \brief Return the instance of vertex with its complete set of incident edges. A tile only lists every edge of
+         * the vertices of the edges its Quad returns, so following the road network from tile to tile must move to the
+         * tile the vertex lies in, which is then held.
+         *
+         * \param vertex a vertex of the current edge.
+         * \return the tile's instance of vertex, or vertex itself when the map is not tiled.
+         */
+        geo::Vertex::Ptr resolve_vertex( const geo::Vertex::Ptr& vertex );
+
         /**
          * \brief Attempt to find the edge from the set of entities provided that best matches the provided point. All
          * edges whose encapsulating areas contain the trip point are considered.  The edges that best aligns with the 
@@ -128,12 +265,124 @@ class MapFitter
          * \param edges The list of edges to match to.
          * \return true if a match is made, false otherwise.
          */
-        bool set_fit_area( const trajectory::Point& tp, const geo::Entity::PtrList& edges );
+        bool set_fit_area( const trajectory::Point& tp, const EdgeQuad::ElementList& edges );
+
+        /**
+         * \brief Return the positions in traj of the keyframes fit( traj ) fits in full, in order.
+         */
+        std::vector<std::size_t> select_keyframes( const trajectory::Trajectory& traj ) const;
+
+        /**
+         * \brief Fit traj fitting only its keyframes in full; see fit( traj ).
+         */
+        void fit_decimated( trajectory::Trajectory& traj );
+
+        /**
+         * \brief Fit every point of traj in order, appending the state after each point to states when it is not null.
+         */
+        void fit_points( trajectory::Trajectory& traj, std::vector<const geo::Edge*>* states );
 
         static bool compare( const PriorityPair& p1, const PriorityPair& p2 );
 
     public:
         AreaSet area_set;
+        TileSet held_tiles;                         ///> tiles matched against by this fitter.
+};
+
+/**
+ * \brief A fixed set of threads shared by segmented map fitters, so the number of threads fitting segments does not
+ * grow with the number of trips fit at once.
+ */
+class SegmentPool
+{
+    public:
+        using Ptr = std::shared_ptr<SegmentPool>;
+        using Task = std::function<void(void)>;
+
+        /**
+         * \brief Start the pool's threads.
+         *
+         * \param n_threads the number of threads.
+         * \param setup called on each thread as it starts, e.g., to set its CPU affinity; may be empty.
+         * \throws std::invalid_argument if n_threads is 0.
+         */
+        SegmentPool( unsigned n_threads, const Task& setup = Task{} );
+
+        /** \brief Run the queued tasks and join the threads. */
+        ~SegmentPool();
+
+        SegmentPool( const SegmentPool& ) = delete;
+        SegmentPool& operator=( const SegmentPool& ) = delete;
+
+        /** \brief Return the number of threads. */
+        unsigned size( void ) const;
+
+        /**
+         * \brief Queue a task for the next free thread.
+         *
+         * \param task the task; it must not throw.
+         */
+        void submit( const Task& task );
+
+    private:
+        std::vector<std::thread> threads;
+        std::queue<Task> tasks;
+        std::mutex mutex;
+        std::condition_variable ready;                  ///< signaled when a task is queued or the pool stops.
+        bool stopping;
+
+        void run( const Task& setup );
+};
+
+/**
+ * \brief Map match a long trip on several threads. The trip is cut into segments that are fit concurrently, each by its
+ * own MapFitter, by the calling thread and the threads of a SegmentPool. Each segment's fitter first fits copies of the points just before the segment so it can pick up
+ * the state a single fitter would have reached there.
+ *
+ * Segments are then stitched in order. A segment's results are kept once its fitter, somewhere in that overlap, holds
+ * the same edge as the fit of the points before it. Otherwise the earlier fitter goes on fitting the segment until the
+ * two agree. Every point therefore gets the edge a single MapFitter would give it. Segments are fit point by point, so
+ * MapFitter decimation does not apply to them.
+ */
+class SegmentedMapFitter
+{
+    public:
+        using Factory = std::function<MapFitter(void)>;
+
+        /**
+         * \brief Construct a segmented map fitter.
+         *
+         * \param make_fitter makes a fitter for one segment; called from several threads at once.
+         * \param segment_points trips with more points than this are cut into segments of about this many points.
+         * \param overlap_points the number of points before its start each segment's fitter fits first.
+         * \param pool the threads that fit segments along with the calling thread; nullptr fits every trip whole.
+         * \throws std::invalid_argument if segment_points is 0.
+         */
+        SegmentedMapFitter( const Factory& make_fitter, std::size_t segment_points, std::size_t overlap_points, const SegmentPool::Ptr& pool );
+
+        /**
+         * \brief Fit an entire trip to the road network; the first exception thrown by a segment's fitter is rethrown.
+         *
+         * \param traj the trip to match.
+         */
+        void fit( trajectory::Trajectory& traj );
+
+        /**
+         * \brief Return the number of points of the last trip fit again while stitching because a segment's fitter had
+         * not picked up the state of the points before it.
+         */
+        std::size_t get_refit_points( void ) const;
+
+    private:
+        Factory make_fitter;
+        std::size_t segment_points;
+        std::size_t overlap_points;
+        SegmentPool::Ptr pool;
+        std::size_t refit_points;                       ///< see get_refit_points.
+
+    public:
+        MapFitter::AreaSet area_set;                    ///< the areas of every segment's fitter.
+        MapFitter::TileSet held_tiles;                  ///< the tiles held by every segment's fitter.
 };
 
 /**
@@ -0,0 +1,102 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#ifndef CVDP_PBF_HPP
+#define CVDP_PBF_HPP
+
+#include <memory>
+#include "entity.hpp"
+
+namespace osm {
+
+/**
+ * \brief Counts collected while importing an OpenStreetMap PBF extract.
+ */
+struct PBFReport {
+    uint64_t blocks = 0;                    ///< Number of OSMData blocks decoded.
+    uint64_t ways = 0;                      ///< Number of highway ways accepted.
+    uint64_t filtered_ways = 0;             ///< Number of highway ways dropped because their type is unknown or blacklisted.
+    uint64_t edges = 0;                     ///< Number of edges made.
+    uint64_t vertices = 0;                  ///< Number of distinct vertices made.
+    uint64_t missing_nodes = 0;             ///< Number of segments dropped because a node is not in the extract.
+    uint64_t bad_positions = 0;             ///< Number of segments dropped because a node position is out of range.
+};
+
+/**
+ * \brief Build the road network directly from an OpenStreetMap .osm.pbf extract.
+ *
+ * Ways with a highway tag whose value is in osm::highway_map and not in osm::highway_blacklist are split into one
+ * geo::Edge per pair of consecutive nodes. Edges that share a node share a single geo::Vertex instance, exactly as
+ * when the same network is read from a shapes file with shapes::CSVInputFactory, and each edge's identifier is its way
+ * identifier.
+ *
+ * Blocks are decoded concurrently in two passes: the first collects the highway ways and the node identifiers they
+ * reference; the second collects the positions of only those nodes. Blocks must be uncompressed or zlib compressed;
+ * zlib blocks require the library to be built with zlib.
+ */
+class PBFInputFactory
+{
+    public:
+        /**
+         * \brief Construct a PBF importer for an extract.
+         *
+         * \param file_path the .osm.pbf file, including path.
+         */
+        PBFInputFactory(const std::string& file_path);
+
+        /**
+         * \brief Decode the extract and make the road network edges.
+         *
+         * \param n_threads the maximum number of threads used to decode blocks.
+         * @throws invalid_argument when the file could not be opened, is malformed, uses an unsupported compression, or
+         * requires an unsupported feature.
+         */
+        void make_edges(unsigned n_threads = 1);
+
+        /**
+         * \brief Return an immutable vector of the edges made from the extract.
+         *
+         * \return an immutable vector containing pointers to edge instances.
+         */
+        const std::vector<geo::EdgeCPtr>& get_edges(void) const;
+
+        /**
+         * \brief Return the counts collected by make_edges.
+         *
+         * \return an immutable reference to the report.
+         */
+        const PBFReport& get_report(void) const;
+
+        /**
+         * \brief Determine if a map file should be read with this importer based on its extension.
+         *
+         * \param file_path the map file, including path.
+         * \return true if the file ends with ".pbf", false otherwise.
+         */
+        static bool is_pbf(const std::string& file_path);
+
+    private:
+        std::string file_path_;                 ///< The extract to import.
+        std::vector<geo::EdgeCPtr> edges_;      ///< The edges made from the extract.
+        PBFReport report_;                      ///< Counts from the most recent import.
+};
+
+}  // end namespace osm
+
+#endif
@@ -31,36 +31,139 @@
 #include "osm.hpp"
 
 /**
- * \brief A Quad instance is a special tree. Instances are geographically defined and divided into four children. Each
+ * \brief The parameters that shape a Quad tree as it is built. The defaults suit the road density of a mid-sized city;
+ * dense city cores and sparse rural maps are often better served by others, which cv_di --tune_quad can search for.
+ */
+struct QuadParams {
+    uint32_t max_elements = 32;             ///< The number of elements a root leaf holds before it is split.
+    double min_degrees = 0.003;             ///< The smallest width or height, in degrees, a split may produce.
+    double reduction_factor = 10.0;         ///< A Quad's fuzzy margin, used to insert elements, is its size divided by this factor.
+    double capacity_growth = 1.0;           ///< The leaf capacity is multiplied by this for each level below the root.
+
+    /**
+     * \brief Return the number of elements a leaf at the given level holds before it is split. Deep leaves only exist
+     * where the map is dense, so a growth below 1 splits dense areas more finely and a growth above 1 keeps them in
+     * fewer, larger leaves.
+     *
+     * \param level the level of the leaf; the root is 0.
+     * \return the capacity; at least 1.
+     */
+    uint32_t capacity( int level ) const;
+};
+
+/**
+ * \brief The size of a Quad tree.
+ */
+struct QuadReport {
+    std::size_t quads = 0;                  ///< The number of Quads, inner and leaf.
+    std::size_t leaves = 0;                 ///< The number of leaf Quads.
+    std::size_t elements = 0;               ///< The number of element references held by leaves; an element may be in several.
+    int depth = 0;                          ///< The level of the deepest leaf.
+    std::size_t bytes = 0;                  ///< An estimate of the memory used by the Quads, not counting the elements.
+};
+
+/**
+ * \brief A BasicQuad instance is a special tree. Instances are geographically defined and divided into four children. Each
  * Quad is a container. Leaf quads, those with no children, contain entities, e.g., Edges. This Quad implementation uses
  * two boundary definitions. One is a fuzzy boundary that is used to determine which entities are contained within a
  * quad. The actual boundary is used to retrieve entities. A Quad tree is a more efficient data structure to use for
  * searching through a geographical space since search is logarithmic in the number of levels.  The entities within a
  * leaf Quad must still be searched linearly.
+ *
+ * The tree is specialized on the type of element it holds: Quad holds any Entity and tests each through the virtual
+ * Entity::touches, while EdgeQuad holds Edges directly, so inserting and retrieving them needs no virtual calls, type
+ * checks, or pointer casts.
+ *
+ * \tparam T the element type; geo::Entity or geo::Edge.
  */
-class Quad : public geo::Bounds {
+template <typename T>
+class BasicQuad : public geo::Bounds {
     public:
         using Point  = geo::Point;
         using Edge   = geo::Edge;
         using Bounds = geo::Bounds;
         using Entity = geo::Entity;
 
-        using Ptr = std::shared_ptr<Quad>;
-        using CPtr = std::shared_ptr<const Quad>;
+        using ElementPtr = std::shared_ptr<const T>;
+        using ElementList = std::vector<ElementPtr>;
+
+        using Ptr = std::shared_ptr<BasicQuad>;
+        using CPtr = std::shared_ptr<const BasicQuad>;
         using PtrList = std::vector<Ptr>;
         using PtrStack = std::stack<Ptr>;
-        using EntityPtrStack = std::stack<Entity::CPtr>;
+        using EntityPtrStack = std::stack<ElementPtr>;
         using PtrSet = std::unordered_set<Ptr>;
 
-        constexpr static double REDUCTION_FACTOR = 10.0;            ///< When the fuzzy dimensions are not set (i.e., 0), they will be set to the width of the quad divided by this factor.
+        using Params = QuadParams;
+
+        constexpr static double REDUCTION_FACTOR = 10.0;            ///< The default QuadParams::reduction_factor.
 
-        //! Maximum number of elements allowed in a quad node. If more elements
+        //! The default maximum number of elements allowed in a quad node. If more elements
         // are added the quad will be split.
         constexpr static uint32_t MAX_ELEMENTS = 32;
-        //! Minimum degree width/height for a quad.
+        //! The default minimum degree width/height for a quad.
         constexpr static double MIN_DEGREES = 0.003;
 
         constexpr static int BUFFER_SIZE = 8 * 1024;                ///< The input stream buffer size when generating a Quad tree from a file.
+
+        /**
+         * \brief A stateful lookup into a Quad tree for a sequence of nearby points, e.g., the points of one trip. The
+         * cursor remembers the path from the root to the leaf of its last lookup; the next lookup climbs that path only
+         * until it reaches a Quad containing the new point and descends from there, so a point in the same leaf as the
+         * last one costs a single comparison.
+         */
+        class Cursor {
+            public:
+                /**
+                 * \brief Construct a cursor into a Quad tree.
+                 *
+                 * \param root The root of the Quad tree; a cursor without a root retrieves nothing.
+                 */
+                Cursor( const CPtr& root = CPtr{} );
+
+                /**
+                 * \brief Point the cursor at the root of a different Quad tree; does nothing if it is the same tree.
+                 *
+                 * \param root The root of the Quad tree.
+                 */
+                void reset( const CPtr& root );
+
+                /**
+                 * \brief Return the root of the Quad tree this cursor looks into.
+                 */
+                const CPtr& get_root() const;
+
+                /** 
+                 * \brief Return the set of pointers to Entities in the Quad that contains the provided geopoint; the same
+                 * set Quad::retrieve_elements returns.
+                 *
+                 * \param pt The point whose containing Quad we are interested in.
+                 * \return A reference to the set of entities contained in the same quad that contain pt.
+                 */
+                const ElementList& retrieve_elements( const Point& pt );
+
+                /**
+                 * \brief Return the Bounds that contains the provided point; the same Bounds Quad::retrieve_bounds returns.
+                 *
+                 * \param pt The point whose containing Quad we are interested in.
+                 * \param fuzzy When set to true, the bounds returned will reflect the fuzzy boundaries and not the actual boundaries
+                 * \return A pointer to a new Bounds instance, or nullptr if the tree does not contain the point.
+                 */
+                Bounds::Ptr retrieve_bounds( const Point& pt, bool fuzzy = false );
+
+            private:
+                CPtr root_;                                         ///< The root of the Quad tree.
+                std::vector<const BasicQuad*> path_;                ///< The Quads from the root to the leaf of the last lookup.
+
+                /**
+                 * \brief Move the cursor to the leaf that contains the provided point.
+                 *
+                 * \param pt The point to find.
+                 * \return The leaf, or nullptr if the tree does not contain the point.
+                 */
+                const BasicQuad* find_leaf( const Point& pt );
+        };
+
         /**
          * \brief Attempt to insert an Entity into the Quad tree.
          *
@@ -68,7 +171,7 @@ class Quad : public geo::Bounds {
          * \param entity_ptr A pointer to the entity to insert into the given Quad or its children.
          * @ return True if the entity is inserted into the quad, False otherwise.
          */
-        static bool insert( Ptr& quadptr, Entity::CPtr entity_ptr );
+        static bool insert( Ptr& quadptr, ElementPtr entity_ptr );
 
         /**
          * \brief Construct a Quad
@@ -78,7 +181,29 @@ class Quad : public geo::Bounds {
          * \param level The numeric level of the quad (root is 0).
          * \param position A string describing the orientation of this Quad (debugging primarily).
          */
-        Quad( const Point& swpoint, const Point& nepoint, int level = 0, const std::string& position = "" );
+        BasicQuad( const Point& swpoint, const Point& nepoint, int level = 0, const std::string& position = "" );
+
+        /**
+         * \brief Construct a Quad whose tree is shaped by the given parameters instead of the defaults; its children
+         * inherit them.
+         *
+         * \param swpoint The Southwest corner of the Quad.
+         * \param nepoint The Northeast corner of the Quad.
+         * \param params The parameters of the tree.
+         * \param level The numeric level of the quad (root is 0).
+         * \param position A string describing the orientation of this Quad (debugging primarily).
+         */
+        BasicQuad( const Point& swpoint, const Point& nepoint, const Params& params, int level = 0, const std::string& position = "" );
+
+        /**
+         * \brief Return the parameters that shape this tree.
+         */
+        const Params& get_params() const;
+
+        /**
+         * \brief Return the size of the tree rooted at this Quad.
+         */
+        QuadReport get_report() const;
 
         /**
          * \brief Predicate indicating whether this Quad is split into children.
@@ -90,7 +215,7 @@ class Quad : public geo::Bounds {
         /**
          * \brief Predicate indicating whether this Quad has exceeded the maximum allowable number of elements.
          *
-         * \return true if this Quad contains more than maxelements; false otherwise.
+         * \return true if this Quad contains more than its level's capacity; false otherwise.
          */
         bool full() const;
 
@@ -100,7 +225,18 @@ class Quad : public geo::Bounds {
          * \param pt The point whose containing Quad we are interested in.
          * \return A pointer to the set of entities contained in the same quad that contain pt.
          */
-        const Entity::PtrList& retrieve_elements( const Point& pt ) const;
+        const ElementList& retrieve_elements( const Point& pt ) const;
+
+        /** 
+         * \brief Return, for each of the provided points, the set of entities in the Quad that contains it. The result is
+         * the same as calling retrieve_elements for each point, but the points are partitioned among the children as
+         * they descend, so each Quad on the paths shared by nearby points is visited once.
+         *
+         * \param pts The points whose containing Quads we are interested in.
+         * \return One pointer per point, in the order given, to the set of entities contained in the same quad as that
+         * point.
+         */
+        std::vector<const ElementList*> retrieve_elements( const std::vector<const Point*>& pts ) const;
 
         /**
          * \brief Return the Bounds that contains the provided point.
@@ -128,7 +264,7 @@ class Quad : public geo::Bounds {
          * \param quadptr A pointer to the quad in which to get the entities for.
          * \return A pointer to a new Bounds instance.
          */
-        static geo::Entity::PtrList retrieve_all_entities( Ptr& quadptr );
+        static ElementList retrieve_all_entities( Ptr& quadptr );
 
         /**
          * \brief Write a Quad as a human-readable string to the provided output stream.
@@ -140,12 +276,15 @@ class Quad : public geo::Bounds {
          * \param quad The Quad to write in human-readable format.
          * \return The output stream after the Quad has been written.
          */
-        friend std::ostream& operator<< (std::ostream& os, const Quad& quad);
+        friend std::ostream& operator<< (std::ostream& os, const BasicQuad& quad) {
+            return quad.write( os );
+        }
 
     private:
         static geo::Vertex::IdToPtrMap elementmap;              ///< Lookup table from vertex unique identifer to pointers to Vertex instance; prevents duplicating Vertex creation.
-        static geo::Entity::PtrList empty_element_list;                ///< Fixed empty set of Edges; returned when a point is contained in a Quad with no Entities.
+        static ElementList empty_element_list;                  ///< Fixed empty set of Edges; returned when a point is contained in a Quad with no Entities.
 
+        Params params_;                                         ///< The parameters that shape this tree.
         int level_;                                             ///< The tree depth, or level, of this Quad.
         std::string position_;                                  ///< The relative position of this Quad amoung siblings.
 
@@ -155,7 +294,25 @@ class Quad : public geo::Bounds {
         Bounds fuzzybounds_;                                    ///< The fuzzy dimensions of this Quad as a Bounds instance.
 
         PtrList children_;                                      ///< The list of this Quad's children Quads.
-        Entity::PtrList element_list_;                          ///< The elements contained in this Quad.
+        ElementList element_list_;                              ///< The elements contained in this Quad.
+
+        /**
+         * \brief Predicate indicating whether an element touches the provided bounds; specialized for Edges so the test
+         * is a direct call rather than a virtual one.
+         *
+         * \param element The element to test.
+         * \param bounds The bounds to test against.
+         * \return true if the element is within or crosses the bounds, false otherwise.
+         */
+        static bool touches( const T& element, const Bounds& bounds );
+
+        /**
+         * \brief Write this Quad in the human-readable format described for operator<<.
+         *
+         * \param os The output stream to write to.
+         * \return The output stream after the Quad has been written.
+         */
+        std::ostream& write( std::ostream& os ) const;
 
         /**
          * \brief Split this Quad into four children. The child list will be cleared, the children created and inserted. The order in
@@ -190,4 +347,13 @@ class Quad : public geo::Bounds {
         bool split( );
 };
 
+using Quad = BasicQuad<geo::Entity>;                            ///< A Quad tree of any kind of Entity.
+using EdgeQuad = BasicQuad<geo::Edge>;                          ///< A Quad tree of road network Edges, used for map matching.
+
+template <>
+inline bool BasicQuad<geo::Edge>::touches( const geo::Edge& element, const geo::Bounds& bounds )
+{
+    return bounds.contains_or_intersects( element );
+}
+
 #endif
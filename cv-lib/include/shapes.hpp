@@ -38,6 +38,56 @@ static const int POINT_ID = 0;
 static const int POINT_LAT = 1;
 static const int POINT_LON = 2;
 
+/**
+ * \brief Counts and diagnostics collected while reading a shape file.
+ *
+ * A rejected specification does not stop the read; it increments rejected and, up to kMaxDiagnostics messages, adds a
+ * line-numbered explanation to diagnostics.
+ */
+struct ParseReport {
+    static const size_t kMaxDiagnostics = 100;      ///< Upper bound on the number of retained diagnostic messages.
+
+    uint64_t lines = 0;                             ///< Number of specification lines read (excludes the header).
+    uint64_t circles = 0;                           ///< Number of circles made.
+    uint64_t edges = 0;                             ///< Number of edges made.
+    uint64_t grids = 0;                             ///< Number of grids made.
+    uint64_t ignored = 0;                           ///< Number of lines with a shape type this factory does not make.
+    uint64_t rejected = 0;                          ///< Number of malformed specifications that were skipped.
+    uint64_t vertex_conflicts = 0;                  ///< Number of reused vertex identifiers with different coordinates.
+    std::vector<std::string> diagnostics;           ///< Messages describing rejections and conflicts in file order.
+
+    /**
+     * \brief Add a diagnostic message unless the retained message limit has been reached.
+     *
+     * \param line the file line number the message refers to; 0 when there is no file line.
+     * \param message the explanation.
+     */
+    void add_diagnostic(uint64_t line, const std::string& message);
+};
+
+/**
+ * \brief The kind of error that rejected a shape specification; make_edge, make_circle, and make_grid throw the matching
+ * exception.
+ */
+enum class ParseError {
+    NONE,                                           ///< The specification was accepted.
+    INVALID_ARGUMENT,                               ///< Too few components, a field that is not a number, or an edge with one vertex.
+    OUT_OF_RANGE                                    ///< A wrong number of elements, or a number outside its range.
+};
+
+/**
+ * \brief An edge specification that has been parsed but whose vertices have not been resolved against previously seen
+ * vertex identifiers.
+ */
+struct PendingEdge {
+    uint64_t line;                                  ///< The file line number of the specification.
+    uint64_t edge_id;                               ///< The edge (way) identifier.
+    osm::Highway way_type;                          ///< The way type from the attributes.
+    uint64_t vertex_id[2];                          ///< The two vertex identifiers.
+    double lat[2];                                  ///< The two vertex latitudes.
+    double lon[2];                                  ///< The two vertex longitudes.
+};
+
 /**
  * \brief Create and store a collection of shapes (Circles, Edges, and Grids) based on their definition in a file.
  *
@@ -68,12 +118,24 @@ class CSVInputFactory
 
         /** \brief Open the shape specification file, create the shapes, and close the file.
          *
-         * Shapes will be stored in the respective containers. If a shape specification is incorrect it will be skipped and a message 
-         * will be displayed on std::cerr.
+         * Shapes will be stored in the respective containers. If a shape specification is incorrect it will be skipped, counted, and
+         * described in the report returned by get_report(); specifications are never rejected by exception.
+         *
+         * The file is read into memory and split into line ranges that are tokenized concurrently by up to n_threads threads. Circles
+         * and grids are made by the threads; edges are parsed by the threads and their vertex identifiers are resolved afterwards in
+         * file order so the result is identical to a single threaded read.
          *
+         * \param n_threads the maximum number of threads used to tokenize the file; small files use fewer.
          * @throws invalid_argument when the file could not be opened or the file is malformed, e.g., no header.
          */
-        void make_shapes(void);
+        void make_shapes(unsigned n_threads = 1);
+
+        /**
+         * \brief Return the counts and diagnostics collected by make_shapes and the make_<shape> methods.
+         *
+         * \return an immutable reference to the report.
+         */
+        const ParseReport& get_report(void) const;
 
         /**
          * \brief Return an immutable vector of the Circle shapes specified in the file.
@@ -123,6 +185,7 @@ class CSVInputFactory
          * a shape specification.
          * @throws out_of_range exception for incorrect lat/lon center point or
          * radius.
+         * @throws invalid_argument exception for missing components or fields that are not numbers.
          */
         void make_circle(const StrVector& line_parts); 
 
@@ -141,6 +204,8 @@ class CSVInputFactory
          * \param line_parts A vector of strings where each string is a part of
          * a shape specification.
          * @throws out_of_range exception for incorrect positions.
+         * @throws invalid_argument exception for missing components, fields that are not numbers, or an edge whose
+         * points have the same identifier.
          */
         void make_edge(const StrVector& line_parts); 
 
@@ -156,6 +221,7 @@ class CSVInputFactory
          *
          * \param line_parts A vector of strings where each string is a part of a shape specification.
          * @throws out_of_range exception for incorrect positions.
+         * @throws invalid_argument exception for missing components or fields that are not numbers.
          */
         void make_grid(const StrVector& line_parts);
 
@@ -165,6 +231,35 @@ class CSVInputFactory
 
     private:
 
+        static const size_t kMinChunkBytes = 1 << 16;           ///< Smallest line range worth handing to its own thread.
+
+        /** \brief The shapes and rejections produced by tokenizing one line range. */
+        struct Chunk {
+            const char* begin;
+            const char* end;
+            uint64_t first_line;
+            std::vector<geo::Circle::CPtr> circles;
+            std::vector<geo::Grid::CPtr> grids;
+            std::vector<PendingEdge> edges;
+            ParseReport report;
+        };
+
+        /**
+         * \brief Tokenize each line in a chunk; does not touch any member other than the chunk.
+         *
+         * \param chunk the line range to tokenize and the place to store the results.
+         */
+        static void parse_chunk(Chunk& chunk);
+
+        /**
+         * \brief Resolve the vertices of a parsed edge against vertex_map_ and add the edge to the container.
+         *
+         * \param pending the parsed edge.
+         * \param error set to the reason when the edge is rejected.
+         * \return ParseError::NONE if the edge was added, otherwise the kind of error that rejected it.
+         */
+        ParseError resolve_edge(const PendingEdge& pending, std::string& error);
+
         std::string file_path_;                                 ///< The file containing the shape specifications.
         geo::Vertex::IdToPtrMap vertex_map_;                      ///< Map from identifiers to pointers to previously constructed vertices; prevents duplicates seen in OSM.
         geo::Vertex::IdToPtrMap implicit_edge_map_;
@@ -174,6 +269,7 @@ class CSVInputFactory
         std::vector<geo::EdgeCPtr> implicit_edges_;
         std::vector<trajectory::IntervalCPtr> critical_intervals_;
         std::vector<trajectory::IntervalCPtr> privacy_intervals_;
+        ParseReport report_;                                    ///< Counts and diagnostics from the most recent read.
 };
 
 /**
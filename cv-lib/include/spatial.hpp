@@ -0,0 +1,348 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#ifndef CVDP_SPATIAL_HPP
+#define CVDP_SPATIAL_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "entity.hpp"
+#include "quad.hpp"
+
+namespace spatial {
+
+/**
+ * \brief The per-edge attributes map matching reads for every candidate of every point, computed once when a road
+ * network is loaded and stored column by column.
+ *
+ * Each edge gets a row, which the table finds by the edge's address, so looking up an attribute is a hash lookup and a
+ * load instead of trigonometry or a width lookup. Attributes of an edge the table does not hold are computed from the
+ * edge. Vertices are numbered in the order the edges reach them; edges that share a Vertex instance share a vertex
+ * index. The table does not own or modify the edges, so any number of tables may be built over the same edges at
+ * once; whoever builds a table keeps its edges alive.
+ */
+class EdgeTable
+{
+    public:
+        static const uint32_t kNoRow;                   ///< The row of an edge the table does not hold.
+
+        /** \brief An empty table. */
+        EdgeTable();
+
+        /**
+         * \brief Compute the attributes of a road network; an edge listed more than once gets one row.
+         *
+         * \param edges the road network.
+         */
+        explicit EdgeTable(const EdgeQuad::ElementList& edges);
+
+        /**
+         * \brief Compute the attributes of a road network and the map fitter's area around each edge.
+         *
+         * \param edges the road network.
+         * \param fit_width_scaling the map fitter's scale applied to the way widths.
+         * \param fit_extension the map fitter's area extension in meters.
+         */
+        EdgeTable(const EdgeQuad::ElementList& edges, double fit_width_scaling, double fit_extension);
+
+        /** \brief Return the number of rows. */
+        std::size_t size(void) const;
+
+        /** \brief Return the number of distinct vertices. */
+        std::size_t vertex_count(void) const;
+
+        /**
+         * \brief Return the row of an edge.
+         *
+         * \param edge the edge.
+         * \return the row, or kNoRow when the table does not hold the edge.
+         */
+        uint32_t row(const geo::Edge& edge) const;
+
+        double length(uint32_t row) const;              ///< geo::Edge::length of a row's edge.
+        double length_haversine(uint32_t row) const;    ///< geo::Edge::length_haversine of a row's edge.
+        double bearing(uint32_t row) const;             ///< geo::Edge::bearing of a row's edge.
+        double way_width(uint32_t row) const;           ///< geo::Edge::get_way_width of a row's edge.
+        int way_type_index(uint32_t row) const;         ///< geo::Edge::get_way_type_index of a row's edge.
+        uint32_t v1(uint32_t row) const;                ///< The vertex index of a row's first vertex.
+        uint32_t v2(uint32_t row) const;                ///< The vertex index of a row's second vertex.
+
+        /**
+         * \brief Predicate indicating whether the table holds the fit areas for a map fitter's parameters.
+         *
+         * \param fit_width_scaling the map fitter's scale applied to the way widths.
+         * \param fit_extension the map fitter's area extension in meters.
+         * \return true if fit_area returns the areas that map fitter would make.
+         */
+        bool has_fit_areas(double fit_width_scaling, double fit_extension) const;
+
+        /**
+         * \brief Return the corners of a row's fit area, exactly as geo::Edge::to_area makes them.
+         *
+         * \param row the row; the table must have fit areas.
+         * \return the four corners, or nullptr when the area is empty.
+         */
+        const geo::Point* fit_area(uint32_t row) const;
+
+        /** \brief Return an edge's length from its row, or computed when the table does not hold it. */
+        double length(const geo::Edge& edge) const;
+
+        /** \brief Return an edge's bearing from its row, or computed when the table does not hold it. */
+        double bearing(const geo::Edge& edge) const;
+
+        /** \brief Return an edge's way width from its row, or looked up when the table does not hold it. */
+        double way_width(const geo::Edge& edge) const;
+
+    private:
+        std::vector<const geo::Edge*> edges_;           ///< the edge of each row.
+        std::unordered_map<const geo::Edge*, uint32_t> rows_;   ///< the row of each edge.
+        std::vector<double> lengths_;
+        std::vector<double> haversine_lengths_;
+        std::vector<double> bearings_;
+        std::vector<double> way_widths_;
+        std::vector<int> way_type_indices_;
+        std::vector<uint32_t> v1_;
+        std::vector<uint32_t> v2_;
+        std::size_t vertex_count_;
+
+        bool fit_areas_;                                ///< true when the fit area members below are set.
+        double fit_width_scaling_;
+        double fit_extension_;
+        std::vector<geo::Point> fit_corners_;           ///< four corners per row.
+        std::vector<uint8_t> fit_area_valid_;           ///< 0 for rows whose fit area is empty.
+};
+
+/**
+ * \brief A spatial index over the edges of a road network that returns the candidate edges for map matching a point.
+ *
+ * The candidates for a point must include every edge whose fit area could contain it; they may include others, which
+ * the map fitter discards. Lookups go through a Cursor, which holds any per-trip state, so one index can be shared by
+ * the map fitters of many threads. Indexes are always held by shared pointers.
+ */
+class EdgeIndex : public std::enable_shared_from_this<EdgeIndex>
+{
+    public:
+        using Ptr = std::shared_ptr<EdgeIndex>;
+        using CPtr = std::shared_ptr<const EdgeIndex>;
+        using EdgeList = EdgeQuad::ElementList;
+
+        /**
+         * \brief A lookup into the index for the points of one trip; not shared between threads.
+         */
+        class Cursor
+        {
+            public:
+                using Ptr = std::shared_ptr<Cursor>;
+
+                virtual ~Cursor() {}
+
+                /**
+                 * \brief Look up the candidates for every point of a trip ahead of retrieve_edges; the default does nothing.
+                 *
+                 * \param pts the points of the trip in order.
+                 */
+                virtual void prefetch(const std::vector<const geo::Point*>& pts);
+
+                /**
+                 * \brief Discard the candidates looked up by prefetch.
+                 */
+                virtual void clear_prefetch(void);
+
+                /**
+                 * \brief Return the candidate edges for a point.
+                 *
+                 * \param pt the point.
+                 * \param point_index the position of the point in the trip given to prefetch; ignored without a prefetch.
+                 * \return the candidates; valid until the next call on this cursor.
+                 */
+                virtual const EdgeList& retrieve_edges(const geo::Point& pt, std::size_t point_index) = 0;
+        };
+
+        virtual ~EdgeIndex() {}
+
+        /**
+         * \brief Make a cursor into this index; the cursor keeps the index alive.
+         *
+         * \return the cursor.
+         */
+        virtual Cursor::Ptr make_cursor(void) const = 0;
+
+        /**
+         * \brief Return the name of the index type, as used in the configuration.
+         */
+        virtual std::string get_name(void) const = 0;
+
+        /**
+         * \brief Return the attributes of the indexed edges; an index made for a map fitter's parameters also holds
+         * their fit areas.
+         */
+        virtual const EdgeTable& get_table(void) const = 0;
+
+        /**
+         * \brief Make the index type named in a configuration.
+         *
+         * \param name "quad" or "rtree".
+         * \param edges the road network; edges that share a vertex must share the Vertex instance.
+         * \param sw the southwest corner of the quad; edges outside it are not indexed by the quad.
+         * \param ne the northeast corner of the quad.
+         * \param fit_width_scaling the map fitter's scale applied to the way widths.
+         * \param fit_extension the map fitter's area extension in meters.
+         * \param quad_params the parameters of the quad tree; not used by other index types.
+         * \return the index.
+         * @throws invalid_argument when the name is not an index type.
+         */
+        static Ptr make(const std::string& name, const std::vector<geo::EdgeCPtr>& edges, const geo::Point& sw, const geo::Point& ne, double fit_width_scaling, double fit_extension, const QuadParams& quad_params = QuadParams());
+};
+
+/**
+ * \brief An EdgeIndex backed by an EdgeQuad. Candidates are the edges of the leaf containing the point; a cursor
+ * remembers its last leaf and prefetches whole trips with one batch descent.
+ */
+class QuadEdgeIndex : public EdgeIndex
+{
+    public:
+        /**
+         * \brief Index the edges of a quad tree.
+         *
+         * \param quad_ptr the quad tree.
+         */
+        QuadEdgeIndex(const EdgeQuad::CPtr& quad_ptr);
+
+        /**
+         * \brief Index the edges of a quad tree, with their fit areas for a map fitter's parameters.
+         *
+         * \param quad_ptr the quad tree.
+         * \param fit_width_scaling the map fitter's scale applied to the way widths.
+         * \param fit_extension the map fitter's area extension in meters.
+         */
+        QuadEdgeIndex(const EdgeQuad::CPtr& quad_ptr, double fit_width_scaling, double fit_extension);
+
+        Cursor::Ptr make_cursor(void) const;
+        std::string get_name(void) const;
+        const EdgeTable& get_table(void) const;
+
+        /**
+         * \brief Return the quad tree.
+         */
+        const EdgeQuad::CPtr& get_quad(void) const;
+
+    private:
+        EdgeQuad::CPtr quad_ptr_;
+        EdgeTable table_;
+};
+
+/**
+ * \brief An EdgeIndex backed by a Sort-Tile-Recursive packed R-tree over the edges' bounding boxes.
+ *
+ * Each box is grown by the most the map fitter's area can extend past its edge, half the scaled way width plus the
+ * extension, so the candidates for a point are exactly the edges whose box contains it. The tree is bulk loaded once:
+ * entries are sorted into vertical slices by longitude and packed in latitude order into full nodes, level by level, so
+ * nodes do not overlap more than the data requires and no edge is stored twice.
+ *
+ * Nodes and entries live in flat arrays; a node's children are contiguous, so the tree holds no pointers besides the
+ * edges themselves. Candidates are returned in input order, the order a quad tree built from the same edges keeps in
+ * its leaves, so both indexes break ties between equally good edges the same way.
+ */
+class RTree : public EdgeIndex
+{
+    public:
+        constexpr static std::size_t NODE_CAPACITY = 16;                ///< The maximum number of children or entries of a node.
+
+        /**
+         * \brief Bulk load an R-tree.
+         *
+         * \param edges the road network.
+         * \param fit_width_scaling the map fitter's scale applied to the way widths.
+         * \param fit_extension the map fitter's area extension in meters.
+         */
+        RTree(const std::vector<geo::EdgeCPtr>& edges, double fit_width_scaling, double fit_extension);
+
+        Cursor::Ptr make_cursor(void) const;
+        std::string get_name(void) const;
+        const EdgeTable& get_table(void) const;
+
+        /** \brief Scratch space for a lookup; a cursor keeps one so repeated lookups do not allocate. */
+        struct Scratch {
+            std::vector<uint32_t> stack;                ///< nodes still to visit.
+            std::vector<uint32_t> hits;                 ///< the input positions of the edges found.
+        };
+
+        /**
+         * \brief Append the edges whose grown bounding boxes contain a point, in the order they were given to the
+         * constructor.
+         *
+         * \param pt the point.
+         * \param edges the list the edges are appended to.
+         * \param scratch scratch space for the lookup.
+         */
+        void retrieve_edges(const geo::Point& pt, EdgeList& edges, Scratch& scratch) const;
+
+        /**
+         * \brief Return the number of edges indexed.
+         */
+        std::size_t size(void) const;
+
+        /**
+         * \brief Return the number of levels in the tree; 0 when empty.
+         */
+        std::size_t height(void) const;
+
+    private:
+        /** \brief An axis aligned box in degrees. */
+        struct Box {
+            double min_lat;
+            double min_lon;
+            double max_lat;
+            double max_lon;
+
+            bool contains(const geo::Point& pt) const;
+            void extend(const Box& box);
+        };
+
+        /** \brief A node; its children are nodes [first, first + count), or entries when it is a leaf. */
+        struct Node {
+            Box box;
+            uint32_t first;
+            uint32_t count;
+            bool leaf;
+        };
+
+        std::vector<geo::EdgeCPtr> edges_;              ///< The edges in input order.
+        std::vector<Box> entry_boxes_;                  ///< The grown edge boxes in leaf order.
+        std::vector<uint32_t> entry_edges_;             ///< The input position of each entry's edge, in leaf order.
+        std::vector<Node> nodes_;                       ///< Every node; the root is last.
+        std::size_t height_;
+        EdgeTable table_;                               ///< The attributes of the edges.
+
+        /**
+         * \brief Sort boxes into Sort-Tile-Recursive order: vertical slices by center longitude, each by center latitude.
+         *
+         * \param boxes the boxes to order.
+         * \return the positions of the boxes in packing order.
+         */
+        static std::vector<uint32_t> str_order(const std::vector<Box>& boxes);
+};
+
+}
+
+#endif
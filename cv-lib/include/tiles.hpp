@@ -0,0 +1,354 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#ifndef CVDP_TILES_HPP
+#define CVDP_TILES_HPP
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "entity.hpp"
+#include "quad.hpp"
+#include "spatial.hpp"
+
+namespace tiles {
+
+using TileKey = uint64_t;                                   ///< A tile row in the high 32 bits and column in the low 32 bits.
+
+/**
+ * \brief Return the key of the tile containing a point; rows count tiles north from latitude -90 and columns count tiles
+ * east from longitude -180.
+ *
+ * \param lat the latitude of the point.
+ * \param lon the longitude of the point.
+ * \param tile_degrees the width and height of a tile in degrees.
+ * \return the tile key.
+ */
+TileKey tile_key(double lat, double lon, double tile_degrees);
+
+/**
+ * \brief Return the southwest and northeast corners of a tile.
+ *
+ * \param key the tile key.
+ * \param tile_degrees the width and height of a tile in degrees.
+ * \return the corners as a (southwest, northeast) pair.
+ */
+std::pair<geo::Point, geo::Point> tile_corners(TileKey key, double tile_degrees);
+
+/**
+ * \brief Assign each edge to every tile whose bounds, extended by the Quad fuzzy margin, the edge touches, then add to
+ * each tile the other edges of its edges' vertices.
+ *
+ * \param edges the road network.
+ * \param tile_degrees the width and height of a tile in degrees.
+ * \return the edges of each non-empty tile, in key order.
+ * @throws invalid_argument when tile_degrees is not positive.
+ */
+std::map<TileKey, std::vector<geo::EdgeCPtr>> partition_edges(const std::vector<geo::EdgeCPtr>& edges, double tile_degrees);
+
+/**
+ * \brief One fixed-size square of the road network with a Quad over its bounds.
+ *
+ * A tile holds every edge that touches its bounds extended by the Quad fuzzy margin, and the other edges of those edges'
+ * vertices, so every vertex of an edge its Quad returns has its complete set of incident edges, as in the whole network.
+ * The vertices inside the tile bounds also have complete sets for each of their neighbors; see find_vertex.
+ */
+class Tile
+{
+    public:
+        using CPtr = std::shared_ptr<const Tile>;
+
+        /**
+         * \brief Make a tile from its edges.
+         *
+         * \param edges the tile's edges; edges that share a vertex must share the Vertex instance.
+         * \param sw the southwest corner of the tile.
+         * \param ne the northeast corner of the tile.
+         */
+        Tile(const std::vector<geo::EdgeCPtr>& edges, const geo::Point& sw, const geo::Point& ne);
+
+        /**
+         * \brief Load a tile.
+         *
+         * \param file_path the shapes file holding the tile's edges.
+         * \param sw the southwest corner of the tile.
+         * \param ne the northeast corner of the tile.
+         * @throws invalid_argument when the file could not be opened.
+         */
+        Tile(const std::string& file_path, const geo::Point& sw, const geo::Point& ne);
+
+        /**
+         * \brief Break the ownership cycles between the tile's vertices and edges so the tile is freed.
+         */
+        ~Tile();
+
+        Tile(const Tile&) = delete;
+        Tile& operator=(const Tile&) = delete;
+
+        /**
+         * \brief Return the Quad indexing this tile's edges.
+         *
+         * \return a pointer to the Quad.
+         */
+        EdgeQuad::CPtr get_quad(void) const;
+
+        /**
+         * \brief Return the attributes of this tile's edges.
+         */
+        const spatial::EdgeTable& get_table(void) const;
+
+        /**
+         * \brief Return this tile's instance of a vertex inside its bounds. That instance has its complete set of
+         * incident edges, and so do the other vertices of those edges.
+         *
+         * \param vertex a vertex, e.g., from a neighboring tile.
+         * \return the tile's instance, or nullptr when the vertex is not inside the tile.
+         */
+        geo::Vertex::Ptr find_vertex(const geo::Vertex& vertex) const;
+
+        /**
+         * \brief Return the number of edges in this tile.
+         *
+         * \return the edge count.
+         */
+        size_t size(void) const;
+
+    private:
+        EdgeQuad::Ptr quad_;                            ///< The Quad over the tile bounds.
+        std::vector<geo::EdgeCPtr> edges_;              ///< The edges in the tile.
+        spatial::EdgeTable table_;                      ///< The attributes of the edges in the tile.
+        std::unordered_map<uint64_t, geo::Vertex::Ptr> vertices_;  ///< The vertices inside the tile bounds by uid.
+};
+
+/**
+ * \brief A road network and its tile index in a single pointer-free file that is mapped read-only.
+ *
+ * Every process on a host that maps the same image shares one copy of it through the page cache; placing the file on a
+ * memory file system, e.g., /dev/shm, makes it a named shared memory segment. Nothing is built when the image is opened.
+ * Instead, make_tile_edges materializes the geo::Edge and geo::Vertex instances of one tile on request, so a process
+ * only holds the tiles in its TileCache.
+ *
+ * Layout (native byte order): a 64 byte header, then the vertex array (lat, lon, uid), the edge array (vertex indices,
+ * uid, way type), the tile array sorted by key (key, first, count), and the tile edge index array.
+ *
+ * A compact image (version 2) stores vertex positions as 32-bit fixed-point microdegrees, at most 6 cm from the
+ * original, in one array followed by the vertex uid array, and decodes only the vertices of a tile as it is made. Its
+ * vertex data is a third smaller, and an image made in memory holds an untiled network in well under half the memory of
+ * its geo::Edge and geo::Vertex graph.
+ */
+class MapImage
+{
+    public:
+        using Ptr = std::shared_ptr<const MapImage>;
+
+        static const std::string kExtension;                ///< The extension of a map image file.
+
+        /**
+         * \brief Map an image file read-only.
+         *
+         * \param file_path the image file.
+         * @throws invalid_argument when the file could not be mapped or is not a valid image.
+         */
+        MapImage(const std::string& file_path);
+
+        /** \brief Unmap the image. */
+        ~MapImage();
+
+        MapImage(const MapImage&) = delete;
+        MapImage& operator=(const MapImage&) = delete;
+
+        /** \brief Return the width and height of a tile in degrees. */
+        double get_tile_degrees(void) const;
+
+        /** \brief Return the keys of the non-empty tiles. */
+        std::vector<TileKey> get_tile_keys(void) const;
+
+        /** \brief Return the number of edges in the image. */
+        uint64_t get_edge_count(void) const;
+
+        /** \brief Return the number of distinct vertices in the image. */
+        uint64_t get_vertex_count(void) const;
+
+        /** \brief Return the size of the image in bytes. */
+        size_t get_size(void) const;
+
+        /** \brief Return true if the image stores vertex positions in fixed-point microdegrees. */
+        bool is_compact(void) const;
+
+        /**
+         * \brief Make new Edge and Vertex instances for the edges of one tile; edges share vertices as they do in the
+         * network the image was written from.
+         *
+         * \param key the tile key.
+         * \return the edges, or an empty vector when the tile is empty.
+         * @throws invalid_argument when the tile refers to edges or vertices outside the image.
+         */
+        std::vector<geo::EdgeCPtr> make_tile_edges(TileKey key) const;
+
+        /**
+         * \brief Determine if a map file is an image based on its extension.
+         *
+         * \param file_path the map file, including path.
+         * \return true if the file ends with ".cvmap", false otherwise.
+         */
+        static bool is_image(const std::string& file_path);
+
+        /**
+         * \brief Write a road network and its tile index as an image.
+         *
+         * \param edges the road network.
+         * \param file_path the image file to write.
+         * \param tile_degrees the width and height of a tile in degrees.
+         * \param compact true to write a compact image.
+         * \return the number of tiles in the image.
+         * @throws invalid_argument when tile_degrees is not positive or the file could not be written.
+         */
+        static size_t write(const std::vector<geo::EdgeCPtr>& edges, const std::string& file_path, double tile_degrees, bool compact = false);
+
+        /**
+         * \brief Make an image of a road network in memory instead of writing it to a file.
+         *
+         * \param edges the road network.
+         * \param tile_degrees the width and height of a tile in degrees.
+         * \param compact true to make a compact image.
+         * \return the image.
+         * @throws invalid_argument when tile_degrees is not positive.
+         */
+        static Ptr make(const std::vector<geo::EdgeCPtr>& edges, double tile_degrees, bool compact);
+
+    private:
+        /** \brief Hold an image made in memory. */
+        MapImage(std::vector<uint64_t>&& image, size_t size);
+
+        std::string file_path_;                             ///< The image file.
+        const char* data_;                                  ///< The start of the mapped image.
+        size_t size_;                                       ///< The size of the mapped image in bytes.
+        std::vector<uint64_t> buffer_;                      ///< Holds an image made in memory, or read on platforms that do not map it.
+};
+
+/**
+ * \brief A directory of map tiles, or a map image, with a bounded, least recently used, cache of loaded tiles that can
+ * be shared by all worker threads.
+ *
+ * The directory holds an index file (tiles.index) and one shapes file per non-empty tile named <row>_<col>.tile, where
+ * row and col count tiles north from latitude -90 and east from longitude -180. The index lists the tile size and each
+ * tile with a hash of its content, so the index alone identifies the network. Tiles are loaded on first use and are
+ * evicted once more than capacity tiles are cached; a tile that is evicted stays valid for as long as it is held.
+ */
+class TileCache
+{
+    public:
+        using Ptr = std::shared_ptr<TileCache>;
+
+        static const std::string kIndexFile;            ///< The name of the index file in a tile directory.
+        static const std::string kTileExtension;        ///< The extension of a tile file.
+
+        /**
+         * \brief Open a tile directory.
+         *
+         * \param dir_path the directory holding the index and tile files.
+         * \param capacity the maximum number of loaded tiles to cache; at least 1.
+         * @throws invalid_argument when the index is missing or malformed.
+         */
+        TileCache(const std::string& dir_path, size_t capacity = 64);
+
+        /**
+         * \brief Use the tiles of a map image.
+         *
+         * \param image_ptr the mapped image.
+         * \param capacity the maximum number of loaded tiles to cache; at least 1.
+         */
+        TileCache(const MapImage::Ptr& image_ptr, size_t capacity = 64);
+
+        /**
+         * \brief Return the tile containing a point, loading it if it is not cached.
+         *
+         * \param pt the point.
+         * \return the tile, or nullptr when there are no roads near the point.
+         * @throws invalid_argument when the tile's file could not be opened.
+         */
+        Tile::CPtr get_tile(const geo::Point& pt);
+
+        /** \brief Return the width and height of a tile in degrees. */
+        double get_tile_degrees(void) const;
+
+        /** \brief Return the number of tiles loaded from disk. */
+        uint64_t get_loads(void) const;
+
+        /** \brief Return the number of requests served from the cache. */
+        uint64_t get_hits(void) const;
+
+        /** \brief Return the number of tiles evicted from the cache. */
+        uint64_t get_evictions(void) const;
+
+        /**
+         * \brief Return the path of the index file in a tile directory.
+         *
+         * \param dir_path the tile directory.
+         * \return the index file path.
+         */
+        static std::string index_path(const std::string& dir_path);
+
+        /**
+         * \brief Determine if a map path is a tile directory.
+         *
+         * \param path the map path.
+         * \return true if path is a directory containing an index file, false otherwise.
+         */
+        static bool is_tiled(const std::string& path);
+
+        /**
+         * \brief Partition a road network into tiles and write the tile files and index into an existing directory.
+         *
+         * \param edges the road network.
+         * \param dir_path the directory to write to.
+         * \param tile_degrees the width and height of a tile in degrees.
+         * \return the number of tiles written.
+         * @throws invalid_argument when tile_degrees is not positive or a file could not be written.
+         */
+        static size_t write_tiles(const std::vector<geo::EdgeCPtr>& edges, const std::string& dir_path, double tile_degrees);
+
+    private:
+        using Key = TileKey;
+        using Entry = std::pair<Key, Tile::CPtr>;
+
+        std::string dir_path_;                                      ///< The tile directory; not used with an image.
+        MapImage::Ptr image_ptr_;                                   ///< The map image; nullptr with a tile directory.
+        double tile_degrees_;                                       ///< The tile size in degrees.
+        size_t capacity_;                                           ///< The maximum number of cached tiles.
+        std::unordered_set<Key> index_;                             ///< The non-empty tiles; immutable after construction.
+
+        mutable std::mutex mutex_;                                  ///< Guards the members below.
+        std::list<Entry> lru_;                                      ///< Cached tiles, most recently used first.
+        std::unordered_map<Key, std::list<Entry>::iterator> entries_;   ///< Lookup from key to position in lru_.
+        uint64_t loads_;
+        uint64_t hits_;
+        uint64_t evictions_;
+
+        /** \brief Return the path of a tile's file. */
+        static std::string tile_path(const std::string& dir_path, Key key);
+};
+
+}  // end namespace tiles
+
+#endif
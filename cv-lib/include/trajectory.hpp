@@ -367,6 +367,22 @@ namespace trajectory {
             Index _id;
     };
 
+    /**
+     * \brief Simplify the polyline through the points in [left, right) of a trajectory with the Douglas-Peucker
+     * algorithm.
+     *
+     * Points are projected onto a local plane (meters) around the first point; a point is dropped when it is within
+     * tolerance meters of the segment that replaces it. The first and last points of the range are always kept.
+     *
+     * \param traj the trajectory.
+     * \param left the index of the first point in the range.
+     * \param right one past the index of the last point in the range; clipped to the trajectory size.
+     * \param tolerance the maximum distance (meters) a dropped point may be from the simplified line; when <= 0 every
+     * point is kept.
+     * \return the indices of the kept points in increasing order.
+     */
+    std::vector<Index> simplify( const Trajectory& traj, Index left, Index right, double tolerance );
+
     /**
      * \brief Abstract base class for classes that must create a trajectory from a file.
      */
@@ -20,6 +20,7 @@
 #ifndef CTES_UTILITIES_H
 #define CTES_UTILITIES_H
 
+#include <cstdint>
 #include <string>
 #include <sstream>
 #include <iterator>
@@ -169,4 +170,47 @@ namespace double_utilities {
 
 }  // end namespace.
 
+namespace hash_utilities {
+
+const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;     ///< 64-bit FNV-1a offset basis.
+const uint64_t FNV_PRIME = 1099511628211ULL;                    ///< 64-bit FNV-1a prime.
+
+/**
+ * \brief Compute (or continue) the 64-bit FNV-1a hash of a block of bytes.
+ *
+ * \param data the bytes to hash.
+ * \param size the number of bytes.
+ * \param hash the hash to continue; the offset basis to start a new hash.
+ * \return the hash value.
+ */
+uint64_t fnv1a_bytes(const char* data, std::size_t size, uint64_t hash = FNV_OFFSET_BASIS);
+
+/**
+ * \brief Compute (or continue) the 64-bit FNV-1a hash of a string.
+ *
+ * \param s the string to hash.
+ * \param hash the hash to continue; the offset basis to start a new hash.
+ * \return the hash value.
+ */
+uint64_t fnv1a(const std::string& s, uint64_t hash = FNV_OFFSET_BASIS);
+
+/**
+ * \brief Compute the 64-bit FNV-1a hash of the contents of a file.
+ *
+ * \param file_path the file to hash.
+ * \return the hash value.
+ * \throws invalid_argument if the file cannot be opened.
+ */
+uint64_t file_hash(const std::string& file_path);
+
+/**
+ * \brief Convert a hash value to a fixed width (16 character) hexadecimal string.
+ *
+ * \param hash the hash value.
+ * \return the hexadecimal string.
+ */
+std::string to_hex(uint64_t hash);
+
+}  // end namespace.
+
 #endif
@@ -20,7 +20,17 @@
 #include "bsmp1.hpp"
 #include "utilities.hpp"
 
+#include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <tuple>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace BSMP1 {
     BSMP1CSVTrajectoryFactory::BSMP1CSVTrajectoryFactory() :
@@ -188,23 +198,467 @@ namespace BSMP1 {
         return uid_;
     }
 
-    BSMP1CSVTrajectoryWriter::BSMP1CSVTrajectoryWriter(const std::string& output) :
+    namespace {
+        /**
+         * \brief Read a single fixed width value from a memory buffer and advance past it.
+         *
+         * \return false if the value does not fit before end.
+         */
+        template<typename T>
+        bool read_value(const char*& p, const char* end, T& value) {
+            if (static_cast<size_t>(end - p) < sizeof(T)) {
+                return false;
+            }
+
+            std::memcpy(&value, p, sizeof(T));
+            p += sizeof(T);
+            return true;
+        }
+
+        /**
+         * \brief Write a single fixed width value to the stream.
+         */
+        template<typename T>
+        void write_value(std::ostream& os, const T& value) {
+            os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+        }
+    }
+
+    BSMP1ColumnarTrajectoryFactory::BSMP1ColumnarTrajectoryFactory() :
+        index_(0),
+        n_rows_(0),
+        data_(nullptr),
+        size_(0),
+        buffer_{},
+        gentime_(nullptr),
+        lat_(nullptr),
+        lon_(nullptr),
+        speed_(nullptr),
+        heading_(nullptr),
+        record_offsets_(nullptr),
+        record_bytes_(nullptr)
+        {}
+
+    BSMP1ColumnarTrajectoryFactory::~BSMP1ColumnarTrajectoryFactory() {
+        unload();
+    }
+
+    bool BSMP1ColumnarTrajectoryFactory::is_columnar(const std::string& input) {
+        return input.size() > kColumnarExtension.size() && 
+            input.compare(input.size() - kColumnarExtension.size(), kColumnarExtension.size(), kColumnarExtension) == 0;
+    }
+
+    void BSMP1ColumnarTrajectoryFactory::map(const std::string& input) {
+#ifdef _WIN32
+        std::ifstream file(input, std::ios::binary | std::ios::ate);
+
+        if (file.fail()) {
+            throw std::invalid_argument("Could not open BSMP1 columnar file: " + input);
+        }
+
+        size_ = static_cast<size_t>(file.tellg());
+        buffer_.resize((size_ + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+        file.seekg(0);
+
+        if (!file.read(reinterpret_cast<char*>(buffer_.data()), static_cast<std::streamsize>(size_))) {
+            throw std::invalid_argument("Could not read BSMP1 columnar file: " + input);
+        }
+
+        data_ = reinterpret_cast<const char*>(buffer_.data());
+#else
+        int fd = ::open(input.c_str(), O_RDONLY);
+
+        if (fd < 0) {
+            throw std::invalid_argument("Could not open BSMP1 columnar file: " + input);
+        }
+
+        struct stat st;
+
+        if (::fstat(fd, &st) != 0 || st.st_size <= 0) {
+            ::close(fd);
+            throw std::invalid_argument("BSMP1 columnar: " + input + " is not a columnar file!");
+        }
+
+        size_ = static_cast<size_t>(st.st_size);
+        void* mapped = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+
+        if (mapped == MAP_FAILED) {
+            size_ = 0;
+            throw std::invalid_argument("Could not map BSMP1 columnar file: " + input);
+        }
+
+        data_ = static_cast<const char*>(mapped);
+#endif
+    }
+
+    void BSMP1ColumnarTrajectoryFactory::unload() {
+#ifndef _WIN32
+        if (data_ != nullptr && buffer_.empty()) {
+            ::munmap(const_cast<char*>(data_), size_);
+        }
+#endif
+
+        buffer_.clear();
+        data_ = nullptr;
+        size_ = 0;
+        gentime_ = nullptr;
+        lat_ = lon_ = speed_ = heading_ = nullptr;
+        record_offsets_ = nullptr;
+        record_bytes_ = nullptr;
+    }
+
+    void BSMP1ColumnarTrajectoryFactory::load(const std::string& input) {
+        unload();
+        map(input);
+
+        const char* p = data_;
+        const char* end = data_ + size_;
+        uint32_t version = 0;
+        uint32_t n_cols = 0;
+
+        if (size_ < kColumnarMagic.size() || std::string(p, kColumnarMagic.size()) != kColumnarMagic) {
+            throw std::invalid_argument("BSMP1 columnar: " + input + " is not a columnar file!");
+        }
+
+        p += kColumnarMagic.size();
+
+        if (!read_value(p, end, version) || version != kColumnarVersion) {
+            throw std::invalid_argument("BSMP1 columnar: " + input + " has unsupported version: " + std::to_string(version));
+        }
+
+        if (!read_value(p, end, n_rows_) || !read_value(p, end, n_cols)) {
+            throw std::invalid_argument("BSMP1 columnar: " + input + " has a truncated header!");
+        }
+
+        std::unordered_map<std::string, Column> columns;
+
+        for (uint32_t i = 0; i < n_cols; ++i) {
+            uint16_t name_size = 0;
+            uint8_t type = 0;
+            Column column;
+
+            if (!read_value(p, end, name_size) || static_cast<size_t>(end - p) < name_size) {
+                throw std::invalid_argument("BSMP1 columnar: " + input + " has a truncated header!");
+            }
+
+            std::string name(p, name_size);
+            p += name_size;
+
+            if (!read_value(p, end, type) || !read_value(p, end, column.offset) || !read_value(p, end, column.length)) {
+                throw std::invalid_argument("BSMP1 columnar: " + input + " has a truncated header!");
+            }
+
+            column.type = static_cast<ColumnType>(type);
+            columns[name] = column;
+        }
+
+        if (n_rows_ == 0) {
+            throw std::invalid_argument("BSMP1 columnar: " + input + " is empty!");
+        }
+
+        // Find a column and make sure it has the expected type, size, and alignment; return its data in the mapping.
+        auto find_column = [&](const std::string& name, ColumnType type) -> const char* {
+            auto it = columns.find(name);
+
+            if (it == columns.end()) {
+                throw std::invalid_argument("BSMP1 columnar: " + input + " missing column: " + name);
+            }
+
+            const Column& column = it->second;
+            uint64_t min_length = type == STRING ? (n_rows_ + 1) * sizeof(uint64_t) : n_rows_ * sizeof(uint64_t);
+
+            if (column.type != type || column.offset % sizeof(uint64_t) != 0 || column.length < min_length || (type != STRING && column.length != min_length)) {
+                throw std::invalid_argument("BSMP1 columnar: " + input + " bad column: " + name);
+            }
+
+            if (column.offset > size_ || column.length > size_ - column.offset) {
+                throw std::invalid_argument("BSMP1 columnar: " + input + " truncated column: " + name);
+            }
+
+            return data_ + column.offset;
+        };
+
+        // String columns are (rows + 1) offsets followed by the bytes the offsets index.
+        auto find_string = [&](const std::string& name, const uint64_t*& offsets, const char*& bytes) {
+            const char* column = find_column(name, STRING);
+            uint64_t n_bytes = columns[name].length - (n_rows_ + 1) * sizeof(uint64_t);
+            offsets = reinterpret_cast<const uint64_t*>(column);
+            bytes = column + (n_rows_ + 1) * sizeof(uint64_t);
+
+            for (uint64_t row = 0; row < n_rows_; ++row) {
+                if (offsets[row] > offsets[row + 1]) {
+                    throw std::invalid_argument("BSMP1 columnar: " + input + " bad column: " + name);
+                }
+            }
+
+            if (offsets[n_rows_] > n_bytes) {
+                throw std::invalid_argument("BSMP1 columnar: " + input + " truncated column: " + name);
+            }
+        };
+
+        // UID fields are constant across the trip; only the first row is needed.
+        const uint64_t* rx_device_offsets;
+        const uint64_t* file_id_offsets;
+        const char* rx_device;
+        const char* file_id;
+        find_string("RxDevice", rx_device_offsets, rx_device);
+        find_string("FileId", file_id_offsets, file_id);
+        uid_ = std::string(rx_device + rx_device_offsets[0], rx_device_offsets[1] - rx_device_offsets[0]) + "_" +
+               std::string(file_id + file_id_offsets[0], file_id_offsets[1] - file_id_offsets[0]);
+
+        // Fixed width columns are used in place.
+        gentime_ = reinterpret_cast<const uint64_t*>(find_column("Gentime", UINT64));
+        lat_ = reinterpret_cast<const double*>(find_column("Latitude", FLOAT64));
+        lon_ = reinterpret_cast<const double*>(find_column("Longitude", FLOAT64));
+        speed_ = reinterpret_cast<const double*>(find_column("Speed", FLOAT64));
+        heading_ = reinterpret_cast<const double*>(find_column("Heading", FLOAT64));
+        find_string(kColumnarRecord, record_offsets_, record_bytes_);
+    }
+
+    std::string BSMP1ColumnarTrajectoryFactory::get_record(uint64_t row) const {
+        return std::string(record_bytes_ + record_offsets_[row], record_offsets_[row + 1] - record_offsets_[row]);
+    }
+
+    trajectory::Point::Ptr BSMP1ColumnarTrajectoryFactory::make_point(uint64_t row) {
+        double lat = lat_[row];
+
+        if (lat > 80.0 || lat < -84.0) {
+            throw std::out_of_range("BSMP1 columnar: bad latitude: " + std::to_string(lat));
+        }
+
+        double lon = lon_[row];
+
+        if (lon >= 180.0 || lon <= -180.0) {
+            throw std::out_of_range("BSMP1 columnar: bad longitude: " + std::to_string(lon));
+        }
+
+        if (lat == 0.0 && lon == 0.0) {
+            throw std::out_of_range("BSMP1 columnar: equator point");
+        }
+
+        double heading = heading_[row];
+
+        if (heading > 360.0 || heading < 0.0) {
+            throw std::out_of_range("BSMP1 columnar: bad heading: " + std::to_string(heading));
+        }
+
+        return std::make_shared<trajectory::Point>(get_record(row), gentime_[row], lat, lon, heading, speed_[row], index_++);
+    }
+
+    trajectory::Point::Ptr BSMP1ColumnarTrajectoryFactory::make_point(uint64_t row, instrument::PointCounter& point_counter) {
+        double lat = lat_[row];
+
+        if (lat > 80.0 || lat < -84.0) {
+            point_counter.n_invalid_geo_points++;
+            throw std::out_of_range("BSMP1 columnar: bad latitude: " + std::to_string(lat));
+        }
+
+        double lon = lon_[row];
+
+        if (lon >= 180.0 || lon <= -180.0) {
+            point_counter.n_invalid_geo_points++;
+            throw std::out_of_range("BSMP1 columnar: bad longitude: " + std::to_string(lon));
+        }
+
+        if (lat == 0.0 && lon == 0.0) {
+            point_counter.n_invalid_geo_points++;
+            throw std::out_of_range("BSMP1 columnar: equator point");
+        }
+
+        double heading = heading_[row];
+
+        if (heading > 360.0 || heading < 0.0) {
+            point_counter.n_invalid_heading_points++;
+            throw std::out_of_range("BSMP1 columnar: bad heading: " + std::to_string(heading));
+        }
+
+        return std::make_shared<trajectory::Point>(get_record(row), gentime_[row], lat, lon, heading, speed_[row], index_++);
+    }
+
+    const trajectory::Trajectory BSMP1ColumnarTrajectoryFactory::make_trajectory(const std::string& input) {
+        trajectory::Trajectory traj;
+
+        load(input);
+        traj.reserve(n_rows_);
+
+        for (uint64_t row = 0; row < n_rows_; ++row) {
+            try {
+                traj.push_back(make_point(row));
+            } catch (std::exception&) {
+                continue;
+            }
+        }
+
+        // The points hold their own copies of the records; release the file.
+        unload();
+
+        // NRVO / copy elision.
+        return traj;
+    }
+
+    const trajectory::Trajectory BSMP1ColumnarTrajectoryFactory::make_trajectory(const std::string& input, instrument::PointCounter& point_counter) {
+        trajectory::Trajectory traj;
+
+        load(input);
+        traj.reserve(n_rows_);
+
+        for (uint64_t row = 0; row < n_rows_; ++row) {
+            point_counter.n_points++;
+
+            try {
+                traj.push_back(make_point(row, point_counter));
+            } catch (std::exception&) {
+                continue;
+            }
+        }
+
+        // The points hold their own copies of the records; release the file.
+        unload();
+
+        // NRVO / copy elision.
+        return traj;
+    }
+
+    const std::string BSMP1ColumnarTrajectoryFactory::get_uid() const {
+        return uid_;
+    }
+
+    BSMP1ColumnarTrajectoryWriter::BSMP1ColumnarTrajectoryWriter(const std::string& output) :
         output_(output)
         {}
 
-    void BSMP1CSVTrajectoryWriter::write_trajectory(const trajectory::Trajectory& traj, const std::string& uid, bool strip_cr) const {
+    void BSMP1ColumnarTrajectoryWriter::write_trajectory(const trajectory::Trajectory& traj, const std::string& uid, bool strip_cr) const {
         std::string output_file_path;
 
         if (output_.empty()) {
-            output_file_path = uid + ".csv";
+            output_file_path = uid + kColumnarExtension;
         } else {
-            output_file_path = output_ + "/" + uid + ".csv";
+            output_file_path = output_ + "/" + uid + kColumnarExtension;
+        }
+
+        uint64_t n_rows = traj.size();
+        StrVector rx_device, file_id, record;
+        std::vector<uint64_t> gentime;
+        std::vector<double> lat, lon, speed, heading;
+
+        for (auto& tp : traj) {
+            std::string data = tp->get_data();
+
+            if (strip_cr && !data.empty() && data[data.size() - 1] == '\r') {
+                data.erase(data.size() - 1);
+            }
+
+            StrVector parts = string_utilities::split(data, ',');
+
+            if (parts.size() != kNFields) {
+                throw std::invalid_argument("BSMP1 columnar: point record is not a BSMP1 record: " + data);
+            }
+
+            rx_device.push_back(parts[0]);
+            file_id.push_back(parts[1]);
+            gentime.push_back(tp->get_time());
+            lat.push_back(tp->lat);
+            lon.push_back(tp->lon);
+            speed.push_back(tp->get_speed());
+            heading.push_back(tp->get_heading());
+            record.push_back(data);
+        }
+
+        // Name, type, and packed contents for each column; data follows the header directly.
+        std::vector<std::tuple<std::string, ColumnType, std::string>> columns;
+
+        auto pack_fixed = [&](const std::string& name, ColumnType type, const char* data) {
+            columns.emplace_back(name, type, std::string(data, n_rows * 8));
+        };
+
+        auto pack_string = [&](const std::string& name, const StrVector& values) {
+            std::vector<uint64_t> offsets{ 0 };
+            std::string bytes;
+
+            for (auto& value : values) {
+                bytes += value;
+                offsets.push_back(bytes.size());
+            }
+
+            columns.emplace_back(name, STRING, std::string(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(uint64_t)) + bytes);
+        };
+
+        pack_string("RxDevice", rx_device);
+        pack_string("FileId", file_id);
+        pack_fixed("Gentime", UINT64, reinterpret_cast<const char*>(gentime.data()));
+        pack_fixed("Latitude", FLOAT64, reinterpret_cast<const char*>(lat.data()));
+        pack_fixed("Longitude", FLOAT64, reinterpret_cast<const char*>(lon.data()));
+        pack_fixed("Speed", FLOAT64, reinterpret_cast<const char*>(speed.data()));
+        pack_fixed("Heading", FLOAT64, reinterpret_cast<const char*>(heading.data()));
+        pack_string(kColumnarRecord, record);
+
+        // Column data starts on 8 byte boundaries so a mapped file's columns can be read in place.
+        auto align = [](uint64_t offset) {
+            return (offset + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t);
+        };
+
+        uint64_t offset = kColumnarMagic.size() + sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t);
+
+        for (auto& column : columns) {
+            offset += sizeof(uint16_t) + std::get<0>(column).size() + sizeof(uint8_t) + 2 * sizeof(uint64_t);
+        }
+
+        uint64_t header_size = offset;
+        offset = align(offset);
+
+        std::ofstream os(output_file_path, std::ofstream::trunc | std::ofstream::binary);
+
+        if (os.fail()) {
+            throw std::invalid_argument("Could not open BSMP1 columnar output file: " + output_file_path);
         }
 
-        std::ofstream os(output_file_path, std::ofstream::trunc);
+        os.write(kColumnarMagic.data(), kColumnarMagic.size());
+        write_value<uint32_t>(os, kColumnarVersion);
+        write_value<uint64_t>(os, n_rows);
+        write_value<uint32_t>(os, static_cast<uint32_t>(columns.size()));
+
+        for (auto& column : columns) {
+            const std::string& name = std::get<0>(column);
+            write_value<uint16_t>(os, static_cast<uint16_t>(name.size()));
+            os.write(name.data(), name.size());
+            write_value<uint8_t>(os, std::get<1>(column));
+            write_value<uint64_t>(os, offset);
+            write_value<uint64_t>(os, std::get<2>(column).size());
+            offset = align(offset + std::get<2>(column).size());
+        }
+
+        const char padding[sizeof(uint64_t)] = {};
+        os.write(padding, align(header_size) - header_size);
+
+        for (auto& column : columns) {
+            os.write(std::get<2>(column).data(), std::get<2>(column).size());
+            os.write(padding, align(std::get<2>(column).size()) - std::get<2>(column).size());
+        }
+
+        os.close();
+    }
+
+    BSMP1CSVTrajectoryWriter::BSMP1CSVTrajectoryWriter(const std::string& output) :
+        output_(output)
+        {}
+
+    const std::string BSMP1CSVTrajectoryWriter::get_output_file_path(const std::string& uid) const {
+        if (output_.empty()) {
+            return uid + ".csv";
+        } 
+
+        return output_ + "/" + uid + ".csv";
+    }
+
+    void BSMP1CSVTrajectoryWriter::write_trajectory(const trajectory::Trajectory& traj, const std::string& uid, bool strip_cr) const {
+        std::string output_file_path = get_output_file_path(uid);
+        std::string part_file_path = output_file_path + ".part";
+
+        std::ofstream os(part_file_path, std::ofstream::trunc);
 
         if (os.fail()) {
-            throw std::invalid_argument("Could not open BSMP1 CSV output file: " + output_file_path);
+            throw std::invalid_argument("Could not open BSMP1 CSV output file: " + part_file_path);
         }
 
         os << kCSVHeader << std::endl;
@@ -220,5 +674,19 @@ namespace BSMP1 {
         }
 
         os.close();
+
+        if (os.fail()) {
+            std::remove(part_file_path.c_str());
+            throw std::invalid_argument("Could not write BSMP1 CSV output file: " + part_file_path);
+        }
+
+        // Windows will not rename over an existing file.
+        if (std::rename(part_file_path.c_str(), output_file_path.c_str()) != 0) {
+            std::remove(output_file_path.c_str());
+
+            if (std::rename(part_file_path.c_str(), output_file_path.c_str()) != 0) {
+                throw std::invalid_argument("Could not rename BSMP1 CSV output file: " + part_file_path);
+            }
+        }
     }
 }
@@ -242,6 +242,11 @@ bool Vertex::add_edges( EdgePtrSet& eptrs )
     return (degree() > before);
 }
 
+void Vertex::clear_edges()
+{
+    edges_.clear();
+}
+
 void Vertex::update_location( const Location& loc )
 {
     uid = loc.uid;
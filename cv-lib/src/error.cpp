@@ -21,6 +21,7 @@
 
 #include <algorithm>
 #include <cmath>
+#include <stdexcept>
 
 ErrorCorrector::ErrorCorrector(uint64_t sample_size) :
     sample_size_(sample_size),
@@ -128,3 +129,152 @@ void ErrorCorrector::correct_indices(trajectory::Trajectory& traj) {
         traj[i]->set_index(i);
     }
 }
+
+GPSErrorFilter::GPSErrorFilter(uint64_t sample_size, double max_speed, uint32_t max_jump_points) :
+    sample_size_(sample_size),
+    max_speed_(max_speed),
+    max_jump_points_(max_jump_points)
+{
+    if (max_speed <= 0.0) {
+        throw std::invalid_argument("GPS error filter maximum speed must be positive.");
+    }
+}
+
+uint64_t GPSErrorFilter::filter(trajectory::Trajectory& traj) const {
+    if (traj.size() <= 1) {
+        return 0;
+    }
+
+    std::vector<uint8_t> removed(traj.size(), 0);
+    std::vector<uint64_t> window;
+
+    for (uint64_t i = 0; i < traj.size() && i < sample_size_; ++i) {
+        window.push_back(i);
+    }
+
+    mark_window(traj, window, removed);
+
+    // the end is checked only when more than sample_size points are left, over the last sample_size of them.
+    uint64_t n_left = traj.size() - std::count(removed.begin(), removed.end(), 1);
+
+    if (n_left > sample_size_) {
+        window.clear();
+
+        for (uint64_t i = traj.size(); i > 0 && window.size() < sample_size_; --i) {
+            if (!removed[i - 1]) {
+                window.push_back(i - 1);
+            }
+        }
+
+        mark_window(traj, window, removed);
+    }
+
+    if (max_jump_points_ > 0) {
+        mark_jumps(traj, removed);
+    }
+
+    uint64_t n_kept = 0;
+
+    for (uint64_t i = 0; i < traj.size(); ++i) {
+        if (!removed[i]) {
+            traj[n_kept] = std::move(traj[i]);
+            traj[n_kept]->set_index(n_kept);
+            ++n_kept;
+        }
+    }
+
+    uint64_t n_removed = traj.size() - n_kept;
+    traj.resize(n_kept);
+
+    return n_removed;
+}
+
+void GPSErrorFilter::filter(trajectory::Trajectory& traj, instrument::PointCounter& point_counter) const {
+    point_counter.n_error_points += filter(traj);
+}
+
+void GPSErrorFilter::mark_window(const trajectory::Trajectory& traj, const std::vector<uint64_t>& window, std::vector<uint8_t>& removed) const {
+    if (window.empty()) {
+        return;
+    }
+
+    std::vector<double> lats;
+    std::vector<double> lons;
+    lats.reserve(window.size());
+    lons.reserve(window.size());
+
+    for (uint64_t i : window) {
+        lats.push_back(traj[i]->lat);
+        lons.push_back(traj[i]->lon);
+    }
+
+    // the same element a full sort would put at the middle of the window.
+    uint64_t med_index = window.size() / 2;
+    std::nth_element(lats.begin(), lats.begin() + med_index, lats.end());
+    std::nth_element(lons.begin(), lons.begin() + med_index, lons.end());
+    double med_lat = lats[med_index];
+    double med_lon = lons[med_index];
+
+    double time_est = (static_cast<double>(window.size()) / 2.0) * 0.1;
+
+    for (uint64_t i : window) {
+        double distance = geo::Location::distance(traj[i]->lat, traj[i]->lon, med_lat, med_lon);
+
+        if (distance / time_est > max_speed_) {
+            removed[i] = 1;
+        }
+    }
+}
+
+void GPSErrorFilter::mark_jumps(const trajectory::Trajectory& traj, std::vector<uint8_t>& removed) const {
+    uint64_t last = 0;
+
+    while (last < traj.size() && removed[last]) {
+        ++last;
+    }
+
+    for (uint64_t i = last + 1; i < traj.size(); ++i) {
+        if (removed[i]) continue;
+
+        if (is_reachable(traj, last, i)) {
+            last = i;
+            continue;
+        }
+
+        // traj[i] is out of reach; when one of the next few points is back within reach, the points between jumped.
+        uint64_t back = traj.size();
+        uint32_t n_looked = 0;
+
+        for (uint64_t j = i + 1; j < traj.size() && n_looked < max_jump_points_; ++j) {
+            if (removed[j]) continue;
+
+            if (is_reachable(traj, last, j)) {
+                back = j;
+                break;
+            }
+
+            ++n_looked;
+        }
+
+        if (back == traj.size()) {
+            // the trip stays away, e.g. after a gap in the data; take it from here.
+            last = i;
+            continue;
+        }
+
+        for (uint64_t j = i; j < back; ++j) {
+            removed[j] = 1;
+        }
+
+        last = back;
+        i = back;
+    }
+}
+
+bool GPSErrorFilter::is_reachable(const trajectory::Trajectory& traj, uint64_t from, uint64_t to) const {
+    uint64_t t_from = traj[from]->get_time();
+    uint64_t t_to = traj[to]->get_time();
+    double seconds = t_to > t_from ? static_cast<double>(t_to - t_from) / 1e6 : static_cast<double>(to - from) * 0.1;
+
+    return geo::Location::distance(traj[from]->lat, traj[from]->lon, traj[to]->lat, traj[to]->lon) <= max_speed_ * seconds;
+}
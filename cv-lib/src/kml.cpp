@@ -19,15 +19,23 @@
  *******************************************************************************/
 #include "kml.hpp"
 #include "quad.hpp"
+#include <array>
+#include <cstdio>
+#include <fstream>
 #include <iomanip>
 
+#ifdef CVLIB_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 namespace KML {
 
     // meters per second - 36 m/s ~= 80 MPH.
     const double File::MAX_SPEED = 36.0;
 
     File::File(std::ostream& stream, const std::string& doc_name, bool visibility ) :
-        stream_{ stream }
+        stream_{ stream },
+        tolerance_{ 0.0 }
     {
         unsigned int color;
 
@@ -78,6 +86,25 @@ namespace KML {
         return colors[i];
     }
 
+    namespace {
+        /**
+         * \brief Append "lon,lat,0" to the string using the given number of significant digits; this matches the
+         * ostream setprecision formatting without the locale and stream state overhead.
+         */
+        void append_coordinate(std::string& out, double lon, double lat, int precision) {
+            char buffer[64];
+            int n = std::snprintf(buffer, sizeof(buffer), "%.*g,%.*g,0", precision, lon, precision, lat);
+            out.append(buffer, n);
+        }
+    }
+
+    void File::write_coordinate(const geo::Point& point, const char* suffix) {
+        coord_buffer_.clear();
+        append_coordinate(coord_buffer_, point.lon, point.lat, 10);
+        coord_buffer_ += suffix;
+        stream_.write(coord_buffer_.data(), coord_buffer_.size());
+    }
+
     void File::write_circle(const geo::Circle& circle, const std::string& style, uint32_t n_segments) {
         if (n_segments < 3) {
             throw std::invalid_argument("KML circle must be made up of 3 or more segments!");
@@ -85,67 +112,73 @@ namespace KML {
 
         double arc_len = 360.0 / static_cast<double>(n_segments);
         double curr_degree = 0.0;
-        std::stringstream coord_str;
-        bool first = true;
-        geo::Location::CPtr next_loc, curr_loc, first_loc;
+        std::string coord_str;
+        geo::Location first_loc{ 0.0, 0.0 };
+        geo::Location curr_loc{ 0.0, 0.0 };
 
         for (uint32_t i = 0; i < n_segments; ++i) {
-            geo::Location next = geo::Location::project_position(circle, curr_degree, circle.radius);
-            next_loc = std::make_shared<geo::Location>(next.lat, next.lon);
+            geo::Location next_loc = geo::Location::project_position(circle, curr_degree, circle.radius);
 
-            if (first) {
-                //first_loc = std::make_shard<geo::Location>(next.lat, next.lon);
+            if (i == 0) {
                 first_loc = next_loc;
-                first = false;
             } else {
-                coord_str << std::setprecision(16) << " " << curr_loc->lon << "," << curr_loc->lat << ",0 " << next_loc->lon << "," << next_loc->lat << ",0";
+                coord_str += " ";
+                append_coordinate(coord_str, curr_loc.lon, curr_loc.lat, 16);
+                coord_str += " ";
+                append_coordinate(coord_str, next_loc.lon, next_loc.lat, 16);
             }
 
-            //curr_loc = std::make_shard<geo::Location>(next.lat, next.lon);
             curr_loc = next_loc;
             curr_degree += arc_len;
         }
         
-        coord_str << std::setprecision(16) << " " << curr_loc->lon << "," << curr_loc->lat << ",0 " << first_loc->lon << "," << first_loc->lat << ",0";
-
-        stream_ << "<Placemark>" << std::endl;
-        stream_ << "<name>" << circle.uid << "</name>" << std::endl;
-        stream_ << "<styleUrl>#" << style << "</styleUrl>" << std::endl;
-        stream_ << "<Polygon>" << std::endl;
-        stream_ << "<tessellate>1</tessellate>" << std::endl;
-        stream_ << "<gx:altitudeMode>clampToGround</gx:altitudeMode>" << std::endl;
-        stream_ << "<outerBoundaryIs>" << std::endl;
-        stream_ << "<LinearRing>" << std::endl;
-        stream_ << "<coordinates>" << coord_str.str() << "</coordinates>" << std::endl;
-        stream_ << "</LinearRing>" << std::endl;
-        stream_ << "</outerBoundaryIs>" << std::endl;
-        stream_ << "</Polygon>" << std::endl;
-        stream_ << "</Placemark>" << std::endl;
+        coord_str += " ";
+        append_coordinate(coord_str, curr_loc.lon, curr_loc.lat, 16);
+        coord_str += " ";
+        append_coordinate(coord_str, first_loc.lon, first_loc.lat, 16);
+
+        stream_ << "<Placemark>\n";
+        stream_ << "<name>" << circle.uid << "</name>\n";
+        stream_ << "<styleUrl>#" << style << "</styleUrl>\n";
+        stream_ << "<Polygon>\n";
+        stream_ << "<tessellate>1</tessellate>\n";
+        stream_ << "<gx:altitudeMode>clampToGround</gx:altitudeMode>\n";
+        stream_ << "<outerBoundaryIs>\n";
+        stream_ << "<LinearRing>\n";
+        stream_ << "<coordinates>" << coord_str << "</coordinates>\n";
+        stream_ << "</LinearRing>\n";
+        stream_ << "</outerBoundaryIs>\n";
+        stream_ << "</Polygon>\n";
+        stream_ << "</Placemark>\n";
     }
 
     void File::write_bounds(const geo::Bounds& bounds, const std::string& style) {
-        std::stringstream coord_str;
-
-        coord_str << std::setprecision(16) << bounds.sw.lon << "," << bounds.sw.lat << ",0 ";
-        coord_str << std::setprecision(16) << bounds.se.lon << "," << bounds.se.lat << ",0 ";
-        coord_str << std::setprecision(16) << bounds.ne.lon << "," << bounds.ne.lat << ",0 ";
-        coord_str << std::setprecision(16) << bounds.nw.lon << "," << bounds.nw.lat << ",0 ";
-        coord_str << std::setprecision(16) << bounds.sw.lon << "," << bounds.sw.lat << ",0";
+        std::string coord_str;
+
+        append_coordinate(coord_str, bounds.sw.lon, bounds.sw.lat, 16);
+        coord_str += " ";
+        append_coordinate(coord_str, bounds.se.lon, bounds.se.lat, 16);
+        coord_str += " ";
+        append_coordinate(coord_str, bounds.ne.lon, bounds.ne.lat, 16);
+        coord_str += " ";
+        append_coordinate(coord_str, bounds.nw.lon, bounds.nw.lat, 16);
+        coord_str += " ";
+        append_coordinate(coord_str, bounds.sw.lon, bounds.sw.lat, 16);
         
-        stream_ << "<Placemark>" << std::endl;
-        stream_ << "<styleUrl>#" << style << "</styleUrl>" << std::endl;
-        stream_ << "<Polygon>" << std::endl;
-        stream_ << "<extrude>0</extrude>" << std::endl;
-        stream_ << "<altitudeMode>clampToGround</altitudeMode>" << std::endl;
-        stream_ << "<outerBoundaryIs>" << std::endl;
-        stream_ << "<LinearRing>" << std::endl;
-        stream_ << "<coordinates>" << std::endl;
-        stream_ << coord_str.str() << std::endl;;
-        stream_ << "\n</coordinates>" << std::endl;
-        stream_ << "</LinearRing>" << std::endl;
-        stream_ << "</outerBoundaryIs>" << std::endl;
-        stream_ << "</Polygon>" << std::endl;
-        stream_ << "</Placemark>" << std::endl;
+        stream_ << "<Placemark>\n";
+        stream_ << "<styleUrl>#" << style << "</styleUrl>\n";
+        stream_ << "<Polygon>\n";
+        stream_ << "<extrude>0</extrude>\n";
+        stream_ << "<altitudeMode>clampToGround</altitudeMode>\n";
+        stream_ << "<outerBoundaryIs>\n";
+        stream_ << "<LinearRing>\n";
+        stream_ << "<coordinates>\n";
+        stream_ << coord_str << "\n";
+        stream_ << "\n</coordinates>\n";
+        stream_ << "</LinearRing>\n";
+        stream_ << "</outerBoundaryIs>\n";
+        stream_ << "</Polygon>\n";
+        stream_ << "</Placemark>\n";
     }
 
     void File::start_folder( const std::string& name, const std::string& description, const std::string& id, const bool open )
@@ -174,7 +207,8 @@ namespace KML {
         stream_ << "<description>" << style_name << "</description>\n";
         stream_ << "<Point>\n";
         stream_ << "<gx:altitudeMode>clampToGround</gx:altitudeMode>\n";
-        stream_ << "<coordinates>" << point.lon << "," << point.lat << ",0</coordinates>\n";
+        stream_ << "<coordinates>";
+        write_coordinate(point, "</coordinates>\n");
         stream_ << "</Point>\n";
         stream_ << "</Placemark>\n";
     }
@@ -241,7 +275,7 @@ namespace KML {
 
             stream_ << "<coordinates>\n";
             for (auto& pt : points) {
-                stream_ << pt.lon << "," << pt.lat << ",0 ";
+                write_coordinate(pt, " ");
             }
             stream_ << "\n</coordinates>\n";
             stream_ << "</LineString>\n";
@@ -250,6 +284,70 @@ namespace KML {
         stream_ << "</Placemark>\n";
     }
 
+    void File::set_tolerance( double tolerance )
+    {
+        tolerance_ = tolerance;
+    }
+
+    std::vector<bool> File::simplify_mask( const trajectory::Trajectory& traj, bool de_identify ) const
+    {
+        std::vector<bool> keep;
+
+        if (tolerance_ <= 0.0) {
+            return keep;
+        }
+
+        keep.resize(traj.size(), false);
+        trajectory::Index run_start = 0;
+
+        // Simplify each run of points with the same visibility separately so removed points never shape a visible
+        // line and each run keeps its end points.
+        for (trajectory::Index i = 1; i <= traj.size(); ++i) {
+            bool split = i == traj.size();
+
+            if (!split && de_identify) {
+                bool run_hidden = traj[run_start]->is_critical() || traj[run_start]->is_private();
+                split = run_hidden != (traj[i]->is_critical() || traj[i]->is_private());
+            }
+
+            if (split) {
+                for (auto index : trajectory::simplify( traj, run_start, i, tolerance_ )) {
+                    keep[index] = true;
+                }
+
+                run_start = i;
+            }
+        }
+
+        return keep;
+    }
+
+    int File::advance( const std::vector<bool>& keep, int i, int stride, int n ) const
+    {
+        if (keep.empty()) {
+            return i + stride;
+        }
+
+        do {
+            ++i;
+        } while (i < n && !keep[i]);
+
+        return i;
+    }
+
+    int File::retreat( const std::vector<bool>& keep, int i, int stride ) const
+    {
+        if (keep.empty()) {
+            return i - stride;
+        }
+
+        do {
+            --i;
+        } while (i > 0 && !keep[i]);
+
+        return i;
+    }
+
     void File::write_trajectory( const trajectory::Trajectory& traj, bool de_identify, int stride )
     {
         int next, c;
@@ -263,6 +361,8 @@ namespace KML {
             return;
         }
 
+        std::vector<bool> keep = simplify_mask( traj, de_identify );
+
         start_folder( "trajectory-full", "trip point list", "TRAJ", false );
         write_point( *(traj.front()), "start_style" );
 
@@ -297,17 +397,17 @@ namespace KML {
                 is_private = de_identify ? traj[next]->is_critical() || traj[next]->is_private() : false;
                 speed = traj[next]->get_speed();
                 color = get_speed_color(speed);
-                stream_ << traj[next]->lon << "," << traj[next]->lat << ",0 ";
-                next += stride;
+                write_coordinate(*traj[next], " ");
+                next = advance( keep, next, stride, n_trippoints );
                 ++c;
             } while (!is_private && next < n_trippoints && (c < 2 || color == previous_color));
             
             if (!is_private && next >= n_trippoints) {
                 // write the segment that extends to the last point.
-                stream_ << traj.back()->lon << "," << traj.back()->lat << ",0";
+                write_coordinate(*traj.back(), "");
             } else {
                 // so the next segment starts correctly.
-                next -= stride;
+                next = retreat( keep, next, stride );
             }
 
             stream_ << "\n</coordinates>\n";
@@ -326,6 +426,8 @@ namespace KML {
         int n_trippoints = static_cast<int>(traj.size());
 
         if (traj.size() > 0) {
+            std::vector<bool> keep = simplify_mask( traj, false );
+
             start_folder( "trajectory-simple", "trip point list", "TRAJ", false );
             int next = 0;
             write_point( *(traj.front()), "start_style" );
@@ -342,11 +444,11 @@ namespace KML {
             stream_ << "<LineString>\n";
             stream_ << "<coordinates>\n";
             while (next < n_trippoints) {
-                stream_ << traj[next]->lon << "," << traj[next]->lat << ",0 ";
-                next += stride;
+                write_coordinate(*traj[next], " ");
+                next = advance( keep, next, stride, n_trippoints );
             }
             if (next >= n_trippoints) {
-                stream_ << traj.back()->lon << "," << traj.back()->lat << ",0";
+                write_coordinate(*traj.back(), "");
             }
             stream_ << "\n</coordinates>\n";
             stream_ << "</LineString>\n";
@@ -374,19 +476,26 @@ namespace KML {
             stream_ << "<LineString>\n";
             stream_ << "<coordinates>\n";
 
-            last = intptr->right();
-            for ( i = intptr->left(); i < last; i+=stride ) {
-                stream_ << traj[i]->lon << "," << traj[i]->lat << ",0 ";
+            if (tolerance_ > 0.0) {
+                // the simplified points always include the first and last point of the interval.
+                for ( auto index : trajectory::simplify( traj, intptr->left(), intptr->right(), tolerance_ ) ) {
+                    write_coordinate(*traj[index], " ");
+                }
+            } else {
+                last = intptr->right();
+                for ( i = intptr->left(); i < last; i+=stride ) {
+                    write_coordinate(*traj[i], " ");
+                }
+
+                // open on the right.
+                --last;
+
+                if (i >= last) {
+                    // skipped the last point of the interval (one before the spec); write it.
+                    write_coordinate(*traj[last], " ");
+                } 
             }
 
-            // open on the right.
-            --last;
-
-            if (i >= last) {
-                // skipped the last point of the interval (one before the spec); write it.
-                stream_ << traj[last]->lon << "," << traj[last]->lat << ",0 ";
-            } 
-
             stream_ << "\n</coordinates>\n";
             stream_ << "</LineString>\n";
             stream_ << "</Placemark>\n";
@@ -409,19 +518,26 @@ namespace KML {
             stream_ << "<LineString>\n";
             stream_ << "<coordinates>\n";
 
-            last = intptr->right();
-            for ( i = intptr->left(); i < last; i+=stride ) {
-                stream_ << traj[i]->lon << "," << traj[i]->lat << ",0 ";
+            if (tolerance_ > 0.0) {
+                // the simplified points always include the first and last point of the interval.
+                for ( auto index : trajectory::simplify( traj, intptr->left(), intptr->right(), tolerance_ ) ) {
+                    write_coordinate(*traj[index], " ");
+                }
+            } else {
+                last = intptr->right();
+                for ( i = intptr->left(); i < last; i+=stride ) {
+                    write_coordinate(*traj[i], " ");
+                }
+
+                // open on the right.
+                --last;
+
+                if (i >= last) {
+                    // skipped the last point of the interval (one before the spec); write it.
+                    write_coordinate(*traj[last], " ");
+                } 
             }
 
-            // open on the right.
-            --last;
-
-            if (i >= last) {
-                // skipped the last point of the interval (one before the spec); write it.
-                stream_ << traj[last]->lon << "," << traj[last]->lat << ",0 ";
-            } 
-
             stream_ << "\n</coordinates>\n";
             stream_ << "</LineString>\n";
             stream_ << "</Placemark>\n";
@@ -491,4 +607,127 @@ namespace KML {
 
         stop_folder();
     }
+
+    namespace {
+        /**
+         * \brief Compute the CRC-32 (IEEE 802.3) checksum zip entries require.
+         */
+        uint32_t crc32(const std::string& data) {
+            // Initialized once, thread safely, by the first renderer thread to get here.
+            static const std::array<uint32_t, 256> table = [] {
+                std::array<uint32_t, 256> t;
+
+                for (uint32_t i = 0; i < 256; ++i) {
+                    uint32_t c = i;
+
+                    for (int k = 0; k < 8; ++k) {
+                        c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                    }
+
+                    t[i] = c;
+                }
+
+                return t;
+            }();
+
+            uint32_t crc = 0xffffffffu;
+
+            for (unsigned char byte : data) {
+                crc = table[(crc ^ byte) & 0xff] ^ (crc >> 8);
+            }
+
+            return crc ^ 0xffffffffu;
+        }
+
+        void put16(std::string& out, uint16_t value) {
+            out += static_cast<char>(value & 0xff);
+            out += static_cast<char>((value >> 8) & 0xff);
+        }
+
+        void put32(std::string& out, uint32_t value) {
+            put16(out, static_cast<uint16_t>(value & 0xffff));
+            put16(out, static_cast<uint16_t>(value >> 16));
+        }
+    }
+
+    void write_kmz(const std::string& file_path, const std::string& kml, const std::string& entry_name) {
+        uint32_t checksum = crc32(kml);
+        uint16_t method = 0;                    // stored.
+        std::string data;
+
+#ifdef CVLIB_HAVE_ZLIB
+        // Raw deflate stream (negative window bits) as the zip format requires.
+        z_stream zs{};
+
+        if (deflateInit2(&zs, Z_BEST_SPEED, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK) {
+            data.resize(deflateBound(&zs, static_cast<uLong>(kml.size())));
+            zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(kml.data()));
+            zs.avail_in = static_cast<uInt>(kml.size());
+            zs.next_out = reinterpret_cast<Bytef*>(&data[0]);
+            zs.avail_out = static_cast<uInt>(data.size());
+
+            if (deflate(&zs, Z_FINISH) == Z_STREAM_END) {
+                data.resize(zs.total_out);
+                method = 8;
+            }
+
+            deflateEnd(&zs);
+        }
+#endif
+
+        if (method == 0) {
+            data = kml;
+        }
+
+        if (data.size() > 0xffffffffu || kml.size() > 0xffffffffu) {
+            throw std::invalid_argument("KMZ entry is too large: " + file_path);
+        }
+
+        std::string header;
+        put32(header, 0x04034b50);              // local file header signature.
+        put16(header, 20);                      // version needed to extract.
+        put16(header, 0);                       // flags.
+        put16(header, method);
+        put16(header, 0);                       // modification time.
+        put16(header, 0x21);                    // modification date (1980-01-01).
+        put32(header, checksum);
+        put32(header, static_cast<uint32_t>(data.size()));
+        put32(header, static_cast<uint32_t>(kml.size()));
+        put16(header, static_cast<uint16_t>(entry_name.size()));
+        put16(header, 0);                       // extra field length.
+        header += entry_name;
+
+        std::string directory;
+        put32(directory, 0x02014b50);           // central directory header signature.
+        put16(directory, 20);                   // version made by.
+        directory += header.substr(4, 26);      // shared with the local header.
+        put16(directory, 0);                    // comment length.
+        put16(directory, 0);                    // disk number.
+        put16(directory, 0);                    // internal attributes.
+        put32(directory, 0);                    // external attributes.
+        put32(directory, 0);                    // local header offset.
+        directory += entry_name;
+
+        std::string end;
+        put32(end, 0x06054b50);                 // end of central directory signature.
+        put16(end, 0);
+        put16(end, 0);
+        put16(end, 1);
+        put16(end, 1);
+        put32(end, static_cast<uint32_t>(directory.size()));
+        put32(end, static_cast<uint32_t>(header.size() + data.size()));
+        put16(end, 0);
+
+        std::ofstream os(file_path, std::ofstream::trunc | std::ofstream::binary);
+
+        if (os.fail()) {
+            throw std::invalid_argument("Could not open KMZ output file: " + file_path);
+        }
+
+        os.write(header.data(), header.size());
+        os.write(data.data(), data.size());
+        os.write(directory.data(), directory.size());
+        os.write(end.data(), end.size());
+        os.close();
+    }
 }
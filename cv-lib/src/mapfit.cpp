@@ -22,21 +22,161 @@
 #include "utilities.hpp"
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <exception>
 #include <map>
+#include <mutex>
 #include <iomanip>
 #include <iterator>
+#include <limits>
 #include <queue>
+#include <stdexcept>
+#include <thread>
 #include <unordered_set>
 #include <utility>
 
+/******************************** FitAreaBatch *********************************************/
+
+namespace {
+    /**
+     * \brief geo::Area::outside_edge for the side from corner 1 to corner 2, term for term, as 1.0 when the point is
+     * outside that side and 0.0 otherwise; doubles keep the batch loop in one vector type so the compiler can
+     * vectorize it.
+     */
+    inline double outside_side( double lat1, double lon1, double lat2, double lon2, double plat, double plon )
+    {
+        double C = lat1 * ( lon2 - lon1 ) - lon1 * ( lat2 - lat1 );
+        double D = -plat * ( lon2 - lon1 ) + plon * ( lat2 - lat1 ) + C;
+        return D < 0.0 ? 1.0 : 0.0;
+    }
+}
+
+const std::size_t FitAreaBatch::kNoMatch = std::numeric_limits<std::size_t>::max();
+
+void FitAreaBatch::clear()
+{
+    for (int c = 0; c < 4; ++c) {
+        lats_[c].clear();
+        lons_[c].clear();
+    }
+
+    bearings_.clear();
+}
+
+void FitAreaBatch::add( const geo::Point* corners, double bearing )
+{
+    for (int c = 0; c < 4; ++c) {
+        lats_[c].push_back( corners[c].lat );
+        lons_[c].push_back( corners[c].lon );
+    }
+
+    bearings_.push_back( bearing );
+}
+
+std::size_t FitAreaBatch::size() const
+{
+    return bearings_.size();
+}
+
+geo::Area::Ptr FitAreaBatch::make_area( std::size_t i ) const
+{
+    return std::make_shared<geo::Area>( geo::Point{ lats_[0][i], lons_[0][i] }, geo::Point{ lats_[1][i], lons_[1][i] },
+                                        geo::Point{ lats_[2][i], lons_[2][i] }, geo::Point{ lats_[3][i], lons_[3][i] } );
+}
+
+void FitAreaBatch::contains( const geo::Point& pt, std::vector<double>& outside ) const
+{
+    std::size_t n = size();
+    outside.resize( n );
+
+    const double plat = pt.lat;
+    const double plon = pt.lon;
+    double* out = outside.data();
+
+    const double* lat0 = lats_[0].data();
+    const double* lat1 = lats_[1].data();
+    const double* lat2 = lats_[2].data();
+    const double* lat3 = lats_[3].data();
+    const double* lon0 = lons_[0].data();
+    const double* lon1 = lons_[1].data();
+    const double* lon2 = lons_[2].data();
+    const double* lon3 = lons_[3].data();
+
+    // one area per iteration and no branches.
+    for (std::size_t i = 0; i < n; ++i) {
+        out[i] = outside_side( lat0[i], lon0[i], lat1[i], lon1[i], plat, plon ) +
+                 outside_side( lat1[i], lon1[i], lat2[i], lon2[i], plat, plon ) +
+                 outside_side( lat2[i], lon2[i], lat3[i], lon3[i], plat, plon ) +
+                 outside_side( lat3[i], lon3[i], lat0[i], lon0[i], plat, plon );
+    }
+}
+
+std::size_t FitAreaBatch::best_match( const geo::Point& pt, double heading )
+{
+    contains( pt, outside_ );
+
+    std::size_t best = kNoMatch;
+    double best_error = 0.0;
+
+    for (std::size_t i = 0; i < outside_.size(); ++i) {
+        if (outside_[i] != 0.0) continue;
+
+        double e = trajectory::Point::angle_error( heading, bearings_[i] );
+
+        // strictly less, so the first of equally good areas wins as it did from the priority queue.
+        if (best == kNoMatch || e < best_error) {
+            best = i;
+            best_error = e;
+        }
+    }
+
+    return best;
+}
+
 /******************************** MapFitter ************************************************/
 
-MapFitter::MapFitter( const Quad::CPtr& quadtree, double fit_width_scaling, double fit_extension) :
-    quadtree{ quadtree },
+namespace {
+    /** \brief The table a tiled map fitter reads before its first tile; it holds no edges. */
+    const spatial::EdgeTable no_edge_table{};
+}
+
+MapFitter::MapFitter( const spatial::EdgeIndex::CPtr& index, double fit_width_scaling, double fit_extension) :
+    index{ index },
+    tile_cache{},
     fit_width_scaling{ fit_width_scaling },
     fit_extension{ fit_extension },
-    area_set{}
+    decimation_distance{ 0.0 },
+    decimation_heading{ 0.0 },
+    index_cursor{ index->make_cursor() },
+    point_index{ std::numeric_limits<std::size_t>::max() },
+    tile_cursor{},
+    edge_table{ &index->get_table() },
+    candidate_areas{},
+    candidate_edges{},
+    area_set{},
+    held_tiles{}
+{}
+
+MapFitter::MapFitter( const EdgeQuad::CPtr& quadtree, double fit_width_scaling, double fit_extension) :
+    MapFitter{ std::make_shared<spatial::QuadEdgeIndex>( quadtree, fit_width_scaling, fit_extension ), fit_width_scaling, fit_extension }
+{}
+
+MapFitter::MapFitter( const tiles::TileCache::Ptr& tile_cache, double fit_width_scaling, double fit_extension) :
+    index{},
+    tile_cache{ tile_cache },
+    fit_width_scaling{ fit_width_scaling },
+    fit_extension{ fit_extension },
+    decimation_distance{ 0.0 },
+    decimation_heading{ 0.0 },
+    index_cursor{},
+    point_index{ std::numeric_limits<std::size_t>::max() },
+    tile_cursor{},
+    edge_table{ &no_edge_table },
+    candidate_areas{},
+    candidate_edges{},
+    area_set{},
+    held_tiles{}
 {}
 
 /**
@@ -72,7 +212,7 @@ void MapFitter::fit( trajectory::Point& tp )
 
         if (current_area->outside_edge( 1, tp )) {
             // this trip point is to the left of the area.
-            if (!set_fit_area( tp, current_edge->v2)) {
+            if (!set_fit_area( tp, resolve_vertex( current_edge->v2 ))) {
                 // The trip point skipped an edge and no needs to hit the quad 
                 // tree again
                 current_area = nullptr;             // make sure this method doesn't just return.
@@ -81,7 +221,7 @@ void MapFitter::fit( trajectory::Point& tp )
 
         } else if (current_area->outside_edge( 3, tp )) {
             // this trip point is to the right of the area (edge 2).
-            if (!set_fit_area( tp, current_edge->v1 )) {
+            if (!set_fit_area( tp, resolve_vertex( current_edge->v1 ) )) {
                 // The trip point skipped an edge and no needs to hit the quad 
                 // tree again
                 current_area = nullptr;             // make sure this method doesn't just return.
@@ -102,75 +242,268 @@ void MapFitter::fit( trajectory::Point& tp )
     }
 }
 
+void MapFitter::set_decimation( double distance, double heading_delta )
+{
+    if (!(distance >= 0.0)) {
+        throw std::invalid_argument( "The decimation distance must not be negative." );
+    }
+
+    if (!(heading_delta > 0.0)) {
+        throw std::invalid_argument( "The decimation heading change must be positive." );
+    }
+
+    decimation_distance = distance;
+    decimation_heading = heading_delta;
+}
+
 void MapFitter::fit( trajectory::Trajectory& traj )
 {
-    for (auto& tp : traj) {
-        fit( *tp );
+    if (decimation_distance > 0.0) {
+        fit_decimated( traj );
+        return;
+    }
+
+    fit_points( traj, nullptr );
+}
+
+void MapFitter::fit( trajectory::Trajectory& traj, std::vector<const geo::Edge*>& states )
+{
+    states.clear();
+    states.reserve( traj.size() );
+    fit_points( traj, &states );
+}
+
+const geo::Edge* MapFitter::get_current_edge() const
+{
+    return current_area ? current_edge.get() : nullptr;
+}
+
+void MapFitter::fit_points( trajectory::Trajectory& traj, std::vector<const geo::Edge*>* states )
+{
+    if (index_cursor) {
+        // let the index retrieve the candidate edges for every trip point at once.
+        std::vector<const geo::Point*> points;
+        points.reserve( traj.size() );
+
+        for (auto& tp : traj) {
+            points.push_back( tp.get() );
+        }
+
+        index_cursor->prefetch( points );
+    }
+
+    for (point_index = 0; point_index < traj.size(); ++point_index) {
+        fit( *traj[point_index] );
+
+        if (states) {
+            states->push_back( get_current_edge() );
+        }
+    }
+
+    point_index = std::numeric_limits<std::size_t>::max();
+
+    if (index_cursor) {
+        index_cursor->clear_prefetch();
     }
 } 
 
+std::vector<std::size_t> MapFitter::select_keyframes( const trajectory::Trajectory& traj ) const
+{
+    // meters per degree of latitude; a local flat earth is plenty for budgets of tens of meters.
+    static const double kMetersPerDegree = geo::kEarthRadiusM * geo::kPi / 180.0;
+    const double max_squared = decimation_distance * decimation_distance;
+
+    std::vector<std::size_t> keyframes;
+
+    if (traj.empty()) return keyframes;
+
+    keyframes.push_back( 0 );
+    const trajectory::Point* key = traj[0].get();
+    double lon_scale = kMetersPerDegree * std::cos( key->latr );
+
+    for (std::size_t i = 1; i < traj.size(); ++i) {
+        const trajectory::Point& tp = *traj[i];
+        double dy = ( tp.lat - key->lat ) * kMetersPerDegree;
+        double dx = ( tp.lon - key->lon ) * lon_scale;
+
+        if (i + 1 == traj.size() || dx * dx + dy * dy >= max_squared ||
+            trajectory::Point::angle_error( key->get_heading(), tp.get_heading() ) >= decimation_heading) {
+            keyframes.push_back( i );
+            key = &tp;
+            lon_scale = kMetersPerDegree * std::cos( key->latr );
+        }
+    }
+
+    return keyframes;
+}
+
+void MapFitter::fit_decimated( trajectory::Trajectory& traj )
+{
+    std::vector<std::size_t> keyframes = select_keyframes( traj );
+
+    if (index_cursor) {
+        // the index only retrieves candidates for the keyframes up front; point_index is a keyframe's position below.
+        std::vector<const geo::Point*> points;
+        points.reserve( keyframes.size() );
+
+        for (std::size_t i : keyframes) {
+            points.push_back( traj[i].get() );
+        }
+
+        index_cursor->prefetch( points );
+    }
+
+    static const std::size_t kNoPrefetch = std::numeric_limits<std::size_t>::max();
+
+    for (std::size_t k = 0; k < keyframes.size(); ++k) {
+        geo::Area::Ptr prev_area = current_area;
+        geo::EdgeCPtr prev_edge = current_edge;
+
+        point_index = k;
+        fit( *traj[keyframes[k]] );
+        point_index = kNoPrefetch;
+
+        if (k == 0 || keyframes[k] == keyframes[k - 1] + 1) continue;
+
+        std::size_t first = keyframes[k - 1] + 1;
+        std::size_t last = keyframes[k];
+
+        bool adjacent = prev_area && current_area &&
+                        ( prev_edge == current_edge ||
+                          prev_edge->v1->uid == current_edge->v1->uid || prev_edge->v1->uid == current_edge->v2->uid ||
+                          prev_edge->v2->uid == current_edge->v1->uid || prev_edge->v2->uid == current_edge->v2->uid );
+
+        if (!adjacent) {
+            // lost at either end, or the keyframes skipped past an edge: fit the gap and the keyframe again in full.
+            current_area = prev_area;
+            current_edge = prev_edge;
+
+            for (std::size_t i = first; i <= last; ++i) {
+                fit( *traj[i] );
+            }
+
+            continue;
+        }
+
+        geo::Area::Ptr next_area = current_area;
+        geo::EdgeCPtr next_edge = current_edge;
+        bool on_prev = true;
+
+        for (std::size_t i = first; i < last; ++i) {
+            trajectory::Point& tp = *traj[i];
+
+            // the trip stays on the earlier edge until it leaves that edge's area, as in a full fit.
+            on_prev = on_prev && prev_area->contains( tp );
+
+            if (on_prev) {
+                tp.set_fit_edge( prev_edge );
+            } else if (next_area->contains( tp )) {
+                tp.set_fit_edge( next_edge );
+            } else {
+                // in neither area: look the point up on its own and pick up after the later keyframe again.
+                current_area = nullptr;
+                fit( tp );
+                current_area = next_area;
+                current_edge = next_edge;
+            }
+        }
+    }
+
+    if (index_cursor) {
+        index_cursor->clear_prefetch();
+    }
+}
+
 bool MapFitter::set_fit_area( const trajectory::Point& tp )
 {
     if (current_area) return true;
 
-    // don't have a current fit area; hit the quad tree and find one.
-    return set_fit_area( tp, quadtree->retrieve_elements( tp ) );
+    // don't have a current fit area; hit the spatial index and find one.
+    if (!tile_cache) {
+        return set_fit_area( tp, index_cursor->retrieve_edges( tp, point_index ) );
+    }
+
+    tiles::Tile::CPtr tile_ptr = tile_cache->get_tile( tp );
+
+    if (!tile_ptr) {
+        // no roads near this point.
+        static const EdgeQuad::ElementList no_edges{};
+        return set_fit_area( tp, no_edges );
+    }
+
+    held_tiles.insert( tile_ptr );
+    tile_cursor.reset( tile_ptr->get_quad() );
+    edge_table = &tile_ptr->get_table();
+    return set_fit_area( tp, tile_cursor.retrieve_elements( tp ) );
 }
 
-bool MapFitter::set_fit_area( const trajectory::Point& tp, const geo::Entity::PtrList& entities )
+geo::Vertex::Ptr MapFitter::resolve_vertex( const geo::Vertex::Ptr& vertex )
 {
-    // assume no match
-    bool successful_match = false;
+    if (!tile_cache) return vertex;
 
-    // an empty priority queue.
-    PriorityAreaQueue priority_areas{ compare };
+    tiles::Tile::CPtr tile_ptr = tile_cache->get_tile( *vertex );
+    geo::Vertex::Ptr tile_vertex = tile_ptr ? tile_ptr->find_vertex( *vertex ) : nullptr;
+
+    if (!tile_vertex) {
+        // no tile lists the vertex; keep the instance at hand.
+        return vertex;
+    }
 
+    held_tiles.insert( tile_ptr );
+    return tile_vertex;
+}
+
+bool MapFitter::set_fit_area( const trajectory::Point& tp, const EdgeQuad::ElementList& edges )
+{
     current_area = nullptr;
     current_edge = nullptr;
+
+    // gather the fit areas of the candidates; the edge table holds them when it was built for this fitter's width
+    // scaling and extension, otherwise they are made here.
+    bool precomputed = edge_table->has_fit_areas( fit_width_scaling, fit_extension );
+    candidate_areas.clear();
+    candidate_edges.clear();
         
-    geo::EdgeCPtr eptr = nullptr;
-    
-    for (auto& entity_ptr : entities) {
-        if (entity_ptr->get_entity_type() != geo::EntityType::EDGE) {
-            // matching only happens with edge types.
-            continue;
-        }
+    for (auto& eptr : edges) {
+        uint32_t row = precomputed ? edge_table->row( *eptr ) : spatial::EdgeTable::kNoRow;
 
-        eptr = std::static_pointer_cast<const geo::Edge>(entity_ptr);
-     
-        geo::Area::Ptr aptr = nullptr;
+        if (row != spatial::EdgeTable::kNoRow) {
+            const geo::Point* corners = edge_table->fit_area( row );
 
-        // build the area that encapsulates this edge using the OSM width information.
-        try {
-            aptr = eptr->to_area( eptr->get_way_width() * fit_width_scaling, fit_extension );
+            if (!corners) continue;
 
-        } catch (geo::ZeroAreaException) {
+            candidate_areas.add( corners, edge_table->bearing( row ) );
 
-            continue;
-        }
+        } else {
+            geo::Area::Ptr aptr = nullptr;
 
-        if ( aptr->contains( tp ) ) {
-            
-            // compute the POSITIVE error between the heading of the vehicle and this road segment.
-            // this is how we prioritize selection of areas when there are multiple candidates.
-            // this method ELIMINATES the effect of having heading and bearing 180 degree out from one another.
-            double e = trajectory::Point::angle_error( tp.get_heading(), eptr->bearing() );
+            // build the area that encapsulates this edge using the OSM width information.
+            try {
+                aptr = eptr->to_area( edge_table->way_width( *eptr ) * fit_width_scaling, fit_extension );
 
-            // ordered with LEAST error between heading and bearing at the top of the queue.
-            priority_areas.emplace( e, std::make_pair( aptr, eptr ) );
+            } catch (geo::ZeroAreaException) {
+
+                continue;
+            }
+
+            candidate_areas.add( aptr->get_corners().data(), edge_table->bearing( *eptr ) );
         }
+
+        candidate_edges.push_back( &eptr );
     }
 
-    if (!priority_areas.empty()) {
-        // area condiates (edges) were found and the best one is at the top.
-        auto& best = priority_areas.top();
-        current_area = best.second.first;
-        current_edge = best.second.second;
-        area_set.insert(current_area);
-        successful_match = true;
+    // of the areas that contain the point, take the one whose edge best aligns with the vehicle's heading; this
+    // ELIMINATES the effect of having heading and bearing 180 degree out from one another.
+    std::size_t best = candidate_areas.best_match( tp, tp.get_heading() );
+
+    if (best == FitAreaBatch::kNoMatch) {
+        return false;
     }
 
-    return successful_match;
+    current_area = candidate_areas.make_area( best );
+    current_edge = *candidate_edges[best];
+    area_set.insert(current_area);
+    return true;
 }
 
 /**
@@ -205,7 +538,7 @@ bool MapFitter::set_fit_area( const trajectory::Point& tp, const geo::Vertex::Pt
 
         // build the area that encapsulates this edge using the OSM width information.
         try {
-            aptr = eptr->to_area( eptr->get_way_width() * fit_width_scaling, fit_extension );
+            aptr = eptr->to_area( edge_table->way_width( *eptr ) * fit_width_scaling, fit_extension );
 
         } catch (geo::ZeroAreaException) {
 
@@ -245,6 +578,244 @@ bool MapFitter::set_fit_area( const trajectory::Point& tp, const geo::Vertex::Pt
     return successful_match;
 }
 
+/******************************** SegmentPool ***********************************************/
+
+SegmentPool::SegmentPool( unsigned n_threads, const Task& setup ) :
+    threads{},
+    tasks{},
+    mutex{},
+    ready{},
+    stopping{ false }
+{
+    if (n_threads == 0) {
+        throw std::invalid_argument( "A segment pool must have at least 1 thread." );
+    }
+
+    for (unsigned t = 0; t < n_threads; ++t) {
+        threads.emplace_back( &SegmentPool::run, this, setup );
+    }
+}
+
+SegmentPool::~SegmentPool()
+{
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+        stopping = true;
+    }
+
+    ready.notify_all();
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+unsigned SegmentPool::size() const
+{
+    return static_cast<unsigned>( threads.size() );
+}
+
+void SegmentPool::submit( const Task& task )
+{
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+        tasks.push( task );
+    }
+
+    ready.notify_one();
+}
+
+void SegmentPool::run( const Task& setup )
+{
+    if (setup) {
+        setup();
+    }
+
+    for (;;) {
+        Task task;
+
+        {
+            std::unique_lock<std::mutex> lock( mutex );
+            ready.wait( lock, [this]() { return stopping || !tasks.empty(); } );
+
+            if (tasks.empty()) {
+                return;
+            }
+
+            task = std::move( tasks.front() );
+            tasks.pop();
+        }
+
+        task();
+    }
+}
+
+/******************************** SegmentedMapFitter ***********************************************/
+
+SegmentedMapFitter::SegmentedMapFitter( const Factory& make_fitter, std::size_t segment_points, std::size_t overlap_points, const SegmentPool::Ptr& pool ) :
+    make_fitter{ make_fitter },
+    segment_points{ segment_points },
+    overlap_points{ overlap_points },
+    pool{ pool },
+    refit_points{ 0 },
+    area_set{},
+    held_tiles{}
+{
+    if (segment_points == 0) {
+        throw std::invalid_argument( "A trip segment must hold at least 1 point." );
+    }
+}
+
+std::size_t SegmentedMapFitter::get_refit_points() const
+{
+    return refit_points;
+}
+
+void SegmentedMapFitter::fit( trajectory::Trajectory& traj )
+{
+    refit_points = 0;
+    std::size_t n_segments = ( traj.size() + segment_points - 1 ) / segment_points;
+
+    if (n_segments < 2 || !pool) {
+        MapFitter mf = make_fitter();
+        mf.fit( traj );
+        area_set.insert( mf.area_set.begin(), mf.area_set.end() );
+        held_tiles.insert( mf.held_tiles.begin(), mf.held_tiles.end() );
+        return;
+    }
+
+    // the segments are claimed one at a time by this thread and by pool threads. A pool thread may only start after
+    // this thread has fit every segment, so what the pool's tasks use is shared with them and outlives this call.
+    struct Batch {
+        Factory make_fitter;
+        std::vector<trajectory::Trajectory> windows;
+        std::vector<std::shared_ptr<MapFitter>> fitters;
+        std::vector<std::vector<const geo::Edge*>> states;
+        std::atomic<std::size_t> next;
+        std::atomic<bool> failed;
+        std::size_t finished;                           ///< the segments fit or skipped; guarded by mutex.
+        std::exception_ptr error;                       ///< guarded by mutex.
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+
+    std::shared_ptr<Batch> batch = std::make_shared<Batch>();
+    batch->make_fitter = make_fitter;
+    batch->windows.resize( n_segments );
+    batch->fitters.resize( n_segments );
+    batch->states.resize( n_segments );
+    batch->next = 0;
+    batch->failed = false;
+    batch->finished = 0;
+
+    // segment k is traj[first[k], first[k + 1]); its window starts with copies of the points before it, so no two
+    // fitters write the same point.
+    std::vector<std::size_t> first( n_segments + 1 );
+    std::vector<std::size_t> n_warmup( n_segments, 0 );
+
+    for (std::size_t k = 0; k <= n_segments; ++k) {
+        first[k] = k * traj.size() / n_segments;
+    }
+
+    for (std::size_t k = 0; k < n_segments; ++k) {
+        n_warmup[k] = k == 0 ? 0 : std::min( overlap_points, first[k] );
+
+        for (std::size_t i = first[k] - n_warmup[k]; i < first[k]; ++i) {
+            trajectory::Point::Ptr copy = std::make_shared<trajectory::Point>( *traj[i] );
+            copy->set_fit_edge( nullptr );
+            batch->windows[k].push_back( copy );
+        }
+
+        batch->windows[k].insert( batch->windows[k].end(), traj.begin() + first[k], traj.begin() + first[k + 1] );
+    }
+
+    // after the first failure the remaining segments are claimed but not fit.
+    auto worker = [batch, n_segments]() {
+        for (std::size_t k = batch->next++; k < n_segments; k = batch->next++) {
+            if (!batch->failed) {
+                try {
+                    batch->fitters[k] = std::make_shared<MapFitter>( batch->make_fitter() );
+                    batch->fitters[k]->fit( batch->windows[k], batch->states[k] );
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock( batch->mutex );
+
+                    if (!batch->error) {
+                        batch->error = std::current_exception();
+                    }
+
+                    batch->failed = true;
+                }
+            }
+
+            std::lock_guard<std::mutex> lock( batch->mutex );
+
+            if (++batch->finished == n_segments) {
+                batch->done.notify_all();
+            }
+        }
+    };
+
+    std::size_t n_helpers = std::min<std::size_t>( pool->size(), n_segments - 1 );
+
+    for (std::size_t t = 0; t < n_helpers; ++t) {
+        pool->submit( worker );
+    }
+
+    worker();
+
+    {
+        std::unique_lock<std::mutex> lock( batch->mutex );
+        batch->done.wait( lock, [&batch, n_segments]() { return batch->finished == n_segments; } );
+
+        if (batch->error) {
+            std::rethrow_exception( batch->error );
+        }
+    }
+
+    const std::vector<std::shared_ptr<MapFitter>>& fitters = batch->fitters;
+    const std::vector<std::vector<const geo::Edge*>>& states = batch->states;
+
+    // stitch: fit_states holds the state of a single fitter after each point of the segments stitched so far, and
+    // carry is a fitter in the state after the last of them.
+    std::vector<const geo::Edge*> fit_states( states[0] );
+    fit_states.resize( traj.size() );
+    std::shared_ptr<MapFitter> carry = fitters[0];
+
+    for (std::size_t k = 1; k < n_segments; ++k) {
+        std::size_t window_start = first[k] - n_warmup[k];
+        const std::vector<const geo::Edge*>& window_states = states[k];
+        bool synced = false;
+
+        for (std::size_t i = window_start; i < first[k] && !synced; ++i) {
+            synced = fit_states[i] == window_states[i - window_start];
+        }
+
+        std::size_t i = first[k];
+
+        // not synced in the overlap: the earlier fitter goes on until it holds the same edge as this segment's.
+        for (; !synced && i < first[k + 1]; ++i) {
+            traj[i]->set_fit_edge( nullptr );
+            carry->fit( *traj[i] );
+            fit_states[i] = carry->get_current_edge();
+            synced = fit_states[i] == window_states[i - window_start];
+            ++refit_points;
+        }
+
+        for (; i < first[k + 1]; ++i) {
+            fit_states[i] = window_states[i - window_start];
+        }
+
+        if (synced) {
+            carry = fitters[k];
+        }
+    }
+
+    for (auto& fitter : fitters) {
+        area_set.insert( fitter->area_set.begin(), fitter->area_set.end() );
+        held_tiles.insert( fitter->held_tiles.begin(), fitter->held_tiles.end() );
+    }
+}
+
 /******************************** ImplicitMapFitter ************************************************/
 ImplicitMapFitter::ImplicitMapFitter( uint32_t num_sectors, uint32_t min_fit_points  ) :
     next_edge_id{ 0 },
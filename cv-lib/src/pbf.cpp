@@ -0,0 +1,718 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#ifdef CVLIB_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "pbf.hpp"
+#include "osm.hpp"
+
+namespace osm {
+
+namespace {
+
+const uint32_t kMaxBlobHeaderSize = 64 * 1024;                  ///< Largest BlobHeader the format allows.
+const uint32_t kMaxBlobSize = 32 * 1024 * 1024;                 ///< Largest Blob, compressed or not, the format allows.
+
+/**
+ * \brief A minimal reader for the protocol buffer wire format; enough to walk the OSM PBF messages without generated
+ * code.
+ *
+ * Malformed input throws invalid_argument.
+ */
+class ProtoReader
+{
+    public:
+        ProtoReader() : pos_{nullptr}, end_{nullptr}, field_{0}, wire_type_{0} {}
+
+        ProtoReader(const char* begin, const char* end) : pos_{begin}, end_{end}, field_{0}, wire_type_{0} {}
+
+        /** \brief Advance to the next field; return false at the end of the message. */
+        bool next() {
+            if (pos_ >= end_) {
+                return false;
+            }
+
+            uint64_t key = varint();
+            field_ = static_cast<uint32_t>(key >> 3);
+            wire_type_ = static_cast<int>(key & 0x7);
+            return true;
+        }
+
+        uint32_t field() const {
+            return field_;
+        }
+
+        bool at_end() const {
+            return pos_ >= end_;
+        }
+
+        const char* data() const {
+            return pos_;
+        }
+
+        size_t size() const {
+            return static_cast<size_t>(end_ - pos_);
+        }
+
+        uint64_t varint() {
+            uint64_t result = 0;
+
+            for (int shift = 0; shift < 64; shift += 7) {
+                if (pos_ >= end_) {
+                    throw std::invalid_argument("Truncated PBF varint.");
+                }
+
+                uint8_t byte = static_cast<uint8_t>(*pos_++);
+                result |= static_cast<uint64_t>(byte & 0x7F) << shift;
+
+                if ((byte & 0x80) == 0) {
+                    return result;
+                }
+            }
+
+            throw std::invalid_argument("PBF varint is too long.");
+        }
+
+        /** \brief Decode a zigzag encoded signed varint (sint32/sint64). */
+        int64_t svarint() {
+            uint64_t value = varint();
+            return static_cast<int64_t>((value >> 1) ^ (0 - (value & 1)));
+        }
+
+        /** \brief Return the payload of a length-delimited field as its own reader. */
+        ProtoReader bytes() {
+            uint64_t length = varint();
+
+            if (length > size()) {
+                throw std::invalid_argument("Truncated PBF field.");
+            }
+
+            ProtoReader payload{pos_, pos_ + length};
+            pos_ += length;
+            return payload;
+        }
+
+        std::string string() {
+            ProtoReader payload = bytes();
+            return std::string(payload.data(), payload.size());
+        }
+
+        /** \brief Skip the value of the current field. */
+        void skip() {
+            switch (wire_type_) {
+                case 0:
+                    varint();
+                    break;
+                case 1:
+                    advance(8);
+                    break;
+                case 2:
+                    bytes();
+                    break;
+                case 5:
+                    advance(4);
+                    break;
+                default:
+                    throw std::invalid_argument("Unsupported PBF wire type: " + std::to_string(wire_type_));
+            }
+        }
+
+    private:
+        const char* pos_;
+        const char* end_;
+        uint32_t field_;
+        int wire_type_;
+
+        void advance(size_t n) {
+            if (n > size()) {
+                throw std::invalid_argument("Truncated PBF field.");
+            }
+
+            pos_ += n;
+        }
+};
+
+/** \brief The location and size of one Blob in the file. */
+struct BlobRef {
+    std::streamoff offset;
+    uint32_t size;
+};
+
+/** \brief A highway way accepted by the filter. */
+struct WayRecord {
+    uint64_t id;
+    Highway type;
+    std::vector<int64_t> refs;
+};
+
+/** \brief The position of a node referenced by an accepted way. */
+struct NodeRecord {
+    int64_t id;
+    double lat;
+    double lon;
+
+    bool operator<(const NodeRecord& other) const {
+        return id < other.id;
+    }
+};
+
+/** \brief What one pass found in one OSMData block. */
+struct BlockResult {
+    std::vector<WayRecord> ways;
+    std::vector<NodeRecord> nodes;
+    uint64_t filtered_ways = 0;
+    bool has_nodes = false;
+};
+
+/**
+ * \brief Read one Blob and leave its decompressed PrimitiveBlock (or HeaderBlock) in data.
+ */
+void read_blob(std::ifstream& file, const BlobRef& ref, const std::string& path, std::string& raw, std::string& data) {
+    raw.resize(ref.size);
+    file.seekg(ref.offset);
+
+    if (!file.read(&raw[0], ref.size)) {
+        throw std::invalid_argument("Truncated PBF file: " + path);
+    }
+
+    ProtoReader blob{raw.data(), raw.data() + raw.size()};
+    ProtoReader zlib_data;
+    bool compressed = false;
+    uint64_t raw_size = 0;
+
+    while (blob.next()) {
+        switch (blob.field()) {
+            case 1: {
+                // uncompressed.
+                ProtoReader payload = blob.bytes();
+                data.assign(payload.data(), payload.size());
+                return;
+            }
+            case 2:
+                raw_size = blob.varint();
+                break;
+            case 3:
+                zlib_data = blob.bytes();
+                compressed = true;
+                break;
+            case 4:
+            case 6:
+            case 7:
+                throw std::invalid_argument("Unsupported PBF compression (only zlib is supported): " + path);
+            default:
+                blob.skip();
+        }
+    }
+
+    if (!compressed) {
+        throw std::invalid_argument("PBF blob without data: " + path);
+    }
+
+    if (raw_size > kMaxBlobSize) {
+        throw std::invalid_argument("PBF blob is too large: " + path);
+    }
+
+#ifdef CVLIB_HAVE_ZLIB
+    data.resize(raw_size);
+    uLongf inflated_size = static_cast<uLongf>(raw_size);
+
+    if (uncompress(reinterpret_cast<Bytef*>(&data[0]), &inflated_size, reinterpret_cast<const Bytef*>(zlib_data.data()),
+                   static_cast<uLong>(zlib_data.size())) != Z_OK || inflated_size != raw_size) {
+        throw std::invalid_argument("Corrupt zlib data in PBF file: " + path);
+    }
+#else
+    throw std::invalid_argument("zlib compressed PBF blocks require CVLib to be built with zlib: " + path);
+#endif
+}
+
+/**
+ * \brief Reject extracts that require features this importer does not implement, e.g., history files.
+ */
+void check_header(const std::string& data, const std::string& path) {
+    ProtoReader header{data.data(), data.data() + data.size()};
+
+    while (header.next()) {
+        if (header.field() == 4) {
+            std::string feature = header.string();
+
+            if (feature != "OsmSchema-V0.6" && feature != "DenseNodes") {
+                throw std::invalid_argument("Unsupported PBF required feature \"" + feature + "\": " + path);
+            }
+        } else {
+            header.skip();
+        }
+    }
+}
+
+/**
+ * \brief Decode a PrimitiveBlock.
+ *
+ * \param data the decompressed block.
+ * \param want_ways collect the accepted highway ways when true.
+ * \param needed when not null, collect the positions of the nodes whose identifiers are in this sorted vector.
+ * \param result where the ways, nodes, and counts are stored.
+ */
+void decode_block(const std::string& data, bool want_ways, const std::vector<int64_t>* needed, BlockResult& result) {
+    ProtoReader block{data.data(), data.data() + data.size()};
+    std::vector<ProtoReader> strings;
+    std::vector<ProtoReader> groups;
+    int64_t granularity = 100;
+    int64_t lat_offset = 0;
+    int64_t lon_offset = 0;
+
+    // The string table precedes the groups, but the coordinate scaling fields follow them.
+    while (block.next()) {
+        switch (block.field()) {
+            case 1: {
+                ProtoReader table = block.bytes();
+
+                while (table.next()) {
+                    if (table.field() == 1) {
+                        strings.push_back(table.bytes());
+                    } else {
+                        table.skip();
+                    }
+                }
+                break;
+            }
+            case 2:
+                groups.push_back(block.bytes());
+                break;
+            case 17:
+                granularity = static_cast<int64_t>(block.varint());
+                break;
+            case 19:
+                lat_offset = static_cast<int64_t>(block.varint());
+                break;
+            case 20:
+                lon_offset = static_cast<int64_t>(block.varint());
+                break;
+            default:
+                block.skip();
+        }
+    }
+
+    static const std::string kHighway{"highway"};
+    uint64_t highway_key = strings.size();
+
+    for (size_t i = 0; i < strings.size(); ++i) {
+        if (strings[i].size() == kHighway.size() && std::equal(kHighway.begin(), kHighway.end(), strings[i].data())) {
+            highway_key = i;
+            break;
+        }
+    }
+
+    auto add_node = [&](int64_t id, int64_t lat, int64_t lon) {
+        if (std::binary_search(needed->begin(), needed->end(), id)) {
+            result.nodes.push_back(NodeRecord{ id, 1e-9 * (lat_offset + granularity * lat), 1e-9 * (lon_offset + granularity * lon) });
+        }
+    };
+
+    for (auto& group : groups) {
+        while (group.next()) {
+            switch (group.field()) {
+                case 1: {
+                    result.has_nodes = true;
+
+                    if (needed == nullptr) {
+                        group.skip();
+                        break;
+                    }
+
+                    ProtoReader node = group.bytes();
+                    int64_t id = 0, lat = 0, lon = 0;
+
+                    while (node.next()) {
+                        switch (node.field()) {
+                            case 1: id = node.svarint(); break;
+                            case 8: lat = node.svarint(); break;
+                            case 9: lon = node.svarint(); break;
+                            default: node.skip();
+                        }
+                    }
+
+                    add_node(id, lat, lon);
+                    break;
+                }
+                case 2: {
+                    result.has_nodes = true;
+
+                    if (needed == nullptr) {
+                        group.skip();
+                        break;
+                    }
+
+                    ProtoReader dense = group.bytes();
+                    ProtoReader ids, lats, lons;
+
+                    while (dense.next()) {
+                        switch (dense.field()) {
+                            case 1: ids = dense.bytes(); break;
+                            case 8: lats = dense.bytes(); break;
+                            case 9: lons = dense.bytes(); break;
+                            default: dense.skip();
+                        }
+                    }
+
+                    // all three are delta coded.
+                    int64_t id = 0, lat = 0, lon = 0;
+
+                    while (!ids.at_end()) {
+                        id += ids.svarint();
+                        lat += lats.svarint();
+                        lon += lons.svarint();
+                        add_node(id, lat, lon);
+                    }
+                    break;
+                }
+                case 3: {
+                    if (!want_ways || highway_key == strings.size()) {
+                        group.skip();
+                        break;
+                    }
+
+                    ProtoReader way = group.bytes();
+                    ProtoReader keys, vals, refs;
+                    uint64_t id = 0;
+
+                    while (way.next()) {
+                        switch (way.field()) {
+                            case 1: id = way.varint(); break;
+                            case 2: keys = way.bytes(); break;
+                            case 3: vals = way.bytes(); break;
+                            case 8: refs = way.bytes(); break;
+                            default: way.skip();
+                        }
+                    }
+
+                    uint64_t value = strings.size();
+
+                    while (!keys.at_end() && !vals.at_end()) {
+                        uint64_t key = keys.varint();
+                        uint64_t val = vals.varint();
+
+                        if (key == highway_key) {
+                            value = val;
+                            break;
+                        }
+                    }
+
+                    if (value >= strings.size()) {
+                        // not a highway.
+                        break;
+                    }
+
+                    auto type_item = highway_map.find(std::string(strings[value].data(), strings[value].size()));
+
+                    if (type_item == highway_map.end() || highway_blacklist.count(type_item->second) > 0) {
+                        ++result.filtered_ways;
+                        break;
+                    }
+
+                    WayRecord record{ id, type_item->second, {} };
+                    int64_t ref = 0;
+
+                    while (!refs.at_end()) {
+                        ref += refs.svarint();
+                        record.refs.push_back(ref);
+                    }
+
+                    result.ways.push_back(std::move(record));
+                    break;
+                }
+                default:
+                    group.skip();
+            }
+        }
+    }
+}
+
+/**
+ * \brief Call work(i, block) for every blobs[items[i]] using up to n_threads threads; each thread reads the file
+ * through its own stream. The first exception thrown by any thread is rethrown on the calling thread.
+ */
+void decode_blobs(const std::string& path, const std::vector<BlobRef>& blobs, const std::vector<size_t>& items, unsigned n_threads,
+                  const std::function<void(size_t, const std::string&)>& work) {
+    std::atomic<size_t> next{0};
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    auto worker = [&]() {
+        try {
+            std::ifstream file(path, std::ios::binary);
+
+            if (file.fail()) {
+                throw std::invalid_argument("Could not open PBF file: " + path);
+            }
+
+            std::string raw;
+            std::string data;
+
+            for (size_t i = next++; i < items.size() && !failed; i = next++) {
+                read_blob(file, blobs[items[i]], path, raw, data);
+                work(i, data);
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+
+            if (!error) {
+                error = std::current_exception();
+            }
+
+            failed = true;
+        }
+    };
+
+    size_t n_workers = std::max<size_t>(1, std::min<size_t>(n_threads, items.size()));
+    std::vector<std::thread> threads;
+
+    for (size_t t = 1; t < n_workers; ++t) {
+        threads.emplace_back(worker);
+    }
+
+    worker();
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+}  // end anonymous namespace
+
+PBFInputFactory::PBFInputFactory(const std::string& file_path) :
+    file_path_{file_path}
+{}
+
+bool PBFInputFactory::is_pbf(const std::string& file_path) {
+    static const std::string kExtension{".pbf"};
+    return file_path.size() >= kExtension.size() && file_path.compare(file_path.size() - kExtension.size(), kExtension.size(), kExtension) == 0;
+}
+
+void PBFInputFactory::make_edges(unsigned n_threads) {
+    std::ifstream file(file_path_, std::ios::binary);
+
+    if (file.fail()) {
+        throw std::invalid_argument("Could not open PBF file: " + file_path_);
+    }
+
+    edges_.clear();
+    report_ = PBFReport{};
+
+    file.seekg(0, std::ios::end);
+    std::streamoff file_size = file.tellg();
+    file.seekg(0, std::ios::beg);
+
+    // Index the blobs; each is preceded by a 4 byte big-endian header length and a BlobHeader.
+    std::vector<BlobRef> blobs;
+    std::string header_bytes;
+    std::string raw;
+    std::string data;
+    bool have_header = false;
+    std::streamoff offset = 0;
+
+    while (offset < file_size) {
+        unsigned char length_bytes[4];
+
+        if (!file.read(reinterpret_cast<char*>(length_bytes), 4)) {
+            throw std::invalid_argument("Truncated PBF file: " + file_path_);
+        }
+
+        uint32_t header_size = (static_cast<uint32_t>(length_bytes[0]) << 24) | (static_cast<uint32_t>(length_bytes[1]) << 16) |
+                               (static_cast<uint32_t>(length_bytes[2]) << 8) | static_cast<uint32_t>(length_bytes[3]);
+
+        if (header_size > kMaxBlobHeaderSize) {
+            throw std::invalid_argument("PBF blob header is too large: " + file_path_);
+        }
+
+        header_bytes.resize(header_size);
+
+        if (header_size > 0 && !file.read(&header_bytes[0], header_size)) {
+            throw std::invalid_argument("Truncated PBF file: " + file_path_);
+        }
+
+        ProtoReader header{header_bytes.data(), header_bytes.data() + header_bytes.size()};
+        std::string type;
+        uint64_t data_size = 0;
+
+        while (header.next()) {
+            switch (header.field()) {
+                case 1: type = header.string(); break;
+                case 3: data_size = header.varint(); break;
+                default: header.skip();
+            }
+        }
+
+        offset += 4 + header_size;
+
+        if (data_size > kMaxBlobSize || offset + static_cast<std::streamoff>(data_size) > file_size) {
+            throw std::invalid_argument("Truncated or corrupt PBF file: " + file_path_);
+        }
+
+        BlobRef ref{ offset, static_cast<uint32_t>(data_size) };
+        offset += data_size;
+
+        if (type == "OSMHeader") {
+            read_blob(file, ref, file_path_, raw, data);
+            check_header(data, file_path_);
+            have_header = true;
+        } else if (type == "OSMData") {
+            blobs.push_back(ref);
+        }   // unknown blob types are skipped as the format requires.
+
+        file.seekg(offset);
+    }
+
+    if (!have_header) {
+        throw std::invalid_argument("PBF file missing OSMHeader: " + file_path_);
+    }
+
+    file.close();
+    report_.blocks = blobs.size();
+
+    // Pass 1: the highway ways and which blocks hold nodes.
+    std::vector<BlockResult> results(blobs.size());
+    std::vector<size_t> items(blobs.size());
+
+    for (size_t i = 0; i < items.size(); ++i) {
+        items[i] = i;
+    }
+
+    decode_blobs(file_path_, blobs, items, n_threads, [&](size_t i, const std::string& block) {
+        decode_block(block, true, nullptr, results[i]);
+    });
+
+    std::vector<int64_t> needed;
+    items.clear();
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        for (auto& way : results[i].ways) {
+            needed.insert(needed.end(), way.refs.begin(), way.refs.end());
+        }
+
+        if (results[i].has_nodes) {
+            items.push_back(i);
+        }
+    }
+
+    std::sort(needed.begin(), needed.end());
+    needed.erase(std::unique(needed.begin(), needed.end()), needed.end());
+
+    // Pass 2: the positions of only the referenced nodes.
+    std::vector<std::vector<NodeRecord>> node_results(items.size());
+
+    decode_blobs(file_path_, blobs, items, n_threads, [&](size_t i, const std::string& block) {
+        BlockResult result;
+        decode_block(block, false, &needed, result);
+        node_results[i].swap(result.nodes);
+    });
+
+    std::vector<NodeRecord> nodes;
+
+    for (auto& node_result : node_results) {
+        nodes.insert(nodes.end(), node_result.begin(), node_result.end());
+        std::vector<NodeRecord>().swap(node_result);
+    }
+
+    std::sort(nodes.begin(), nodes.end());
+
+    // Merge: one vertex per node, made on first use, in block order so the result does not depend on n_threads.
+    std::vector<geo::Vertex::Ptr> vertices(nodes.size());
+
+    auto find_node = [&](int64_t id) -> ptrdiff_t {
+        auto node_item = std::lower_bound(nodes.begin(), nodes.end(), NodeRecord{ id, 0.0, 0.0 });
+        return (node_item == nodes.end() || node_item->id != id) ? -1 : node_item - nodes.begin();
+    };
+
+    auto valid_position = [&](ptrdiff_t i) {
+        return !(nodes[i].lat > 80.0 || nodes[i].lat < -84.0 || nodes[i].lon >= 180.0 || nodes[i].lon <= -180.0);
+    };
+
+    auto get_vertex = [&](ptrdiff_t i) {
+        if (!vertices[i]) {
+            vertices[i] = std::make_shared<geo::Vertex>(nodes[i].lat, nodes[i].lon, static_cast<uint64_t>(nodes[i].id));
+            ++report_.vertices;
+        }
+
+        return vertices[i];
+    };
+
+    for (auto& result : results) {
+        report_.ways += result.ways.size();
+        report_.filtered_ways += result.filtered_ways;
+
+        for (auto& way : result.ways) {
+            for (size_t k = 1; k < way.refs.size(); ++k) {
+                ptrdiff_t a = find_node(way.refs[k - 1]);
+                ptrdiff_t b = find_node(way.refs[k]);
+
+                if (a < 0 || b < 0) {
+                    ++report_.missing_nodes;
+                    continue;
+                }
+
+                if (a == b) {
+                    // repeated node; no segment.
+                    continue;
+                }
+
+                if (!valid_position(a) || !valid_position(b)) {
+                    ++report_.bad_positions;
+                    continue;
+                }
+
+                geo::Vertex::Ptr va = get_vertex(a);
+                geo::Vertex::Ptr vb = get_vertex(b);
+                geo::EdgePtr edge_ptr = std::make_shared<geo::Edge>( va, vb, way.type, way.id );
+                va->add_edge( edge_ptr );
+                vb->add_edge( edge_ptr );
+                edges_.push_back(edge_ptr);
+            }
+        }
+
+        std::vector<WayRecord>().swap(result.ways);
+    }
+
+    report_.edges = edges_.size();
+}
+
+const std::vector<geo::EdgeCPtr>& PBFInputFactory::get_edges() const {
+    return edges_;
+}
+
+const PBFReport& PBFInputFactory::get_report() const {
+    return report_;
+}
+
+}  // end namespace osm
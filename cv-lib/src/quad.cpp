@@ -20,16 +20,56 @@
 #include "quad.hpp"
 #include "utilities.hpp"
 
-geo::Vertex::IdToPtrMap Quad::elementmap{};
-geo::Entity::PtrList Quad::empty_element_list{};
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <tuple>
 
-Quad::Quad( const geo::Point& swpoint, const geo::Point& nepoint, int level, const std::string& position )
+uint32_t QuadParams::capacity( int level ) const
+{
+    double scaled = std::round( max_elements * std::pow( capacity_growth, level ) );
+
+    if (scaled < 1.0) return 1;
+    if (scaled > std::numeric_limits<uint32_t>::max()) return std::numeric_limits<uint32_t>::max();
+
+    return static_cast<uint32_t>( scaled );
+}
+
+template <typename T>
+constexpr double BasicQuad<T>::REDUCTION_FACTOR;
+
+template <typename T>
+constexpr uint32_t BasicQuad<T>::MAX_ELEMENTS;
+
+template <typename T>
+constexpr double BasicQuad<T>::MIN_DEGREES;
+
+template <typename T>
+geo::Vertex::IdToPtrMap BasicQuad<T>::elementmap{};
+
+template <typename T>
+typename BasicQuad<T>::ElementList BasicQuad<T>::empty_element_list{};
+
+template <typename T>
+bool BasicQuad<T>::touches( const T& element, const geo::Bounds& bounds )
+{
+    return element.touches( bounds );
+}
+
+template <typename T>
+BasicQuad<T>::BasicQuad( const geo::Point& swpoint, const geo::Point& nepoint, int level, const std::string& position )
+    : BasicQuad{ swpoint, nepoint, Params{}, level, position }
+{}
+
+template <typename T>
+BasicQuad<T>::BasicQuad( const geo::Point& swpoint, const geo::Point& nepoint, const Params& params, int level, const std::string& position )
     : geo::Bounds{ swpoint, nepoint }, 
+    params_{params},
     level_{level}, 
     position_{position}
 {
-    fuzzywidth_ = width() / REDUCTION_FACTOR;
-    fuzzyheight_ = height() / REDUCTION_FACTOR;
+    fuzzywidth_ = width() / params_.reduction_factor;
+    fuzzyheight_ = height() / params_.reduction_factor;
 
     fuzzybounds_.sw.lat = sw.lat - fuzzyheight_;
     fuzzybounds_.sw.lon = sw.lon - fuzzywidth_;
@@ -44,36 +84,40 @@ Quad::Quad( const geo::Point& swpoint, const geo::Point& nepoint, int level, con
     fuzzybounds_.se.lon = se.lon + fuzzywidth_;
 }
 
-void Quad::quadsplit()
+template <typename T>
+void BasicQuad<T>::quadsplit()
 {
     children_.clear();
     int nextlevel = level_ + 1;
-    children_.emplace_back( std::make_shared<Quad>( west_midpoint(), north_midpoint(), nextlevel ) );
-    children_.emplace_back( std::make_shared<Quad>( center(), ne, nextlevel ) );
-    children_.emplace_back( std::make_shared<Quad>( sw, center(), nextlevel ) );
-    children_.emplace_back( std::make_shared<Quad>( south_midpoint(), east_midpoint(), nextlevel ) );
+    children_.emplace_back( std::make_shared<BasicQuad>( west_midpoint(), north_midpoint(), params_, nextlevel ) );
+    children_.emplace_back( std::make_shared<BasicQuad>( center(), ne, params_, nextlevel ) );
+    children_.emplace_back( std::make_shared<BasicQuad>( sw, center(), params_, nextlevel ) );
+    children_.emplace_back( std::make_shared<BasicQuad>( south_midpoint(), east_midpoint(), params_, nextlevel ) );
 }
 
-void Quad::horizontalsplit()
+template <typename T>
+void BasicQuad<T>::horizontalsplit()
 {
     children_.clear();
     int nextlevel = level_ + 1;
-    children_.emplace_back( std::make_shared<Quad>( sw, north_midpoint(), nextlevel ) );
-    children_.emplace_back( std::make_shared<Quad>( south_midpoint(), ne, nextlevel ) );
+    children_.emplace_back( std::make_shared<BasicQuad>( sw, north_midpoint(), params_, nextlevel ) );
+    children_.emplace_back( std::make_shared<BasicQuad>( south_midpoint(), ne, params_, nextlevel ) );
 }
 
-void Quad::verticalsplit()
+template <typename T>
+void BasicQuad<T>::verticalsplit()
 {
     children_.clear();
     int nextlevel = level_ + 1;
-    children_.emplace_back( std::make_shared<Quad>( west_midpoint(), ne, nextlevel ) );
-    children_.emplace_back( std::make_shared<Quad>( sw, east_midpoint(), nextlevel ) );
+    children_.emplace_back( std::make_shared<BasicQuad>( west_midpoint(), ne, params_, nextlevel ) );
+    children_.emplace_back( std::make_shared<BasicQuad>( sw, east_midpoint(), params_, nextlevel ) );
 }
 
-bool Quad::split()
+template <typename T>
+bool BasicQuad<T>::split()
 {
-    bool isverticalsplit = height() / 2.0 >= Quad::MIN_DEGREES;
-    bool ishorizontalsplit = width() / 2.0 >= Quad::MIN_DEGREES;
+    bool isverticalsplit = height() / 2.0 >= params_.min_degrees;
+    bool ishorizontalsplit = width() / 2.0 >= params_.min_degrees;
 
     if (isverticalsplit && ishorizontalsplit) {
         quadsplit();
@@ -92,19 +136,56 @@ bool Quad::split()
     return false;
 }
 
-bool Quad::haschildren() const
+template <typename T>
+const QuadParams& BasicQuad<T>::get_params() const
+{
+    return params_;
+}
+
+template <typename T>
+QuadReport BasicQuad<T>::get_report() const
+{
+    QuadReport report;
+    std::stack<const BasicQuad*> quadstack;
+    quadstack.push( this );
+
+    while (!quadstack.empty()) {
+        const BasicQuad* currquad = quadstack.top();
+        quadstack.pop();
+
+        ++report.quads;
+        report.bytes += sizeof( BasicQuad ) + currquad->children_.capacity() * sizeof( Ptr ) + currquad->element_list_.capacity() * sizeof( ElementPtr );
+
+        if (currquad->haschildren()) {
+            for (auto& child : currquad->children_) {
+                quadstack.push( child.get() );
+            }
+        } else {
+            ++report.leaves;
+            report.elements += currquad->element_list_.size();
+            report.depth = std::max( report.depth, currquad->level_ );
+        }
+    }
+
+    return report;
+}
+
+template <typename T>
+bool BasicQuad<T>::haschildren() const
 {
     return !children_.empty();
 }
 
-bool Quad::full() const
+template <typename T>
+bool BasicQuad<T>::full() const
 {
-    return static_cast<int>(element_list_.size()) > MAX_ELEMENTS;
+    return element_list_.size() > params_.capacity( level_ );
 }
 
-bool Quad::insert( Quad::Ptr& quadptr, geo::Entity::CPtr entity_ptr )
+template <typename T>
+bool BasicQuad<T>::insert( Ptr& quadptr, ElementPtr entity_ptr )
 {
-    if ( !entity_ptr->touches(quadptr->fuzzybounds_) ) return false;
+    if ( !touches( *entity_ptr, quadptr->fuzzybounds_ ) ) return false;
 
     PtrStack quadstack;
     quadstack.push(quadptr);
@@ -120,7 +201,7 @@ bool Quad::insert( Quad::Ptr& quadptr, geo::Entity::CPtr entity_ptr )
             // this quad has children (implies no elements in this quad)
             for ( auto& quad : currquad->children_ ) {
                 // attempt to insert into all child quads that contain the edge.
-                if (entity_ptr->touches(quad->fuzzybounds_)) {
+                if (touches( *entity_ptr, quad->fuzzybounds_ )) {
                     quadstack.push( quad );
                 } 
             }
@@ -143,21 +224,24 @@ bool Quad::insert( Quad::Ptr& quadptr, geo::Entity::CPtr entity_ptr )
                 }
             }
 
-            currquad->element_list_.clear();
+            // inner quads hold no elements; release the storage too.
+            ElementList{}.swap( currquad->element_list_ );
         } 
     }
 
     return true;
 }
 
-std::ostream& operator<<( std::ostream& os, const Quad& quad )
+template <typename T>
+std::ostream& BasicQuad<T>::write( std::ostream& os ) const
 {
-    return os << "Quad: {" << quad.sw << ", " << quad.ne << "} element count: " << quad.element_list_.size() << " level: " << quad.level_ << " children: " << quad.children_.size() << " fuzzy: {" << quad.fuzzybounds_.sw << ", " << quad.fuzzybounds_.ne << ", " << quad.fuzzybounds_.height() << ", " << quad.fuzzybounds_.width() << "}";
+    return os << "Quad: {" << sw << ", " << ne << "} element count: " << element_list_.size() << " level: " << level_ << " children: " << children_.size() << " fuzzy: {" << fuzzybounds_.sw << ", " << fuzzybounds_.ne << ", " << fuzzybounds_.height() << ", " << fuzzybounds_.width() << "}";
 }
 
-const geo::Entity::PtrList& Quad::retrieve_elements( const geo::Point& pt ) const
+template <typename T>
+const typename BasicQuad<T>::ElementList& BasicQuad<T>::retrieve_elements( const geo::Point& pt ) const
 {
-    const Quad* currquad = this;
+    const BasicQuad* currquad = this;
 
     if (currquad->contains(pt)) {
         // guard against providing a point that is not contained in the top level quad.
@@ -175,13 +259,152 @@ const geo::Entity::PtrList& Quad::retrieve_elements( const geo::Point& pt ) cons
         return currquad->element_list_;
 
     } else {
-        return Quad::empty_element_list;
+        return BasicQuad::empty_element_list;
     }
 }
 
-geo::Bounds::Ptr Quad::retrieve_bounds( const geo::Point& pt, bool fuzzy) const
+template <typename T>
+std::vector<const typename BasicQuad<T>::ElementList*> BasicQuad<T>::retrieve_elements( const std::vector<const geo::Point*>& pts ) const
 {
-    const Quad* currquad = this;
+    std::vector<const ElementList*> element_lists( pts.size(), &BasicQuad::empty_element_list );
+    std::vector<std::size_t> order;
+    order.reserve( pts.size() );
+
+    for (std::size_t i = 0; i < pts.size(); ++i) {
+        // guard against providing points that are not contained in the top level quad.
+        if (contains( *pts[i] )) {
+            order.push_back( i );
+        }
+    }
+
+    // each entry is a quad and the range of order holding the points it contains.
+    std::stack<std::tuple<const BasicQuad*, std::size_t, std::size_t>> quadstack;
+    quadstack.emplace( this, 0, order.size() );
+
+    while (!quadstack.empty()) {
+        const BasicQuad* currquad = std::get<0>( quadstack.top() );
+        std::size_t first = std::get<1>( quadstack.top() );
+        std::size_t last = std::get<2>( quadstack.top() );
+        quadstack.pop();
+
+        if (!currquad->haschildren()) {
+            for (std::size_t i = first; i < last; ++i) {
+                element_lists[order[i]] = &currquad->element_list_;
+            }
+
+            continue;
+        }
+
+        for (auto& child : currquad->children_) {
+            // points go to the first child that contains them; retrieval quads are disjoint.
+            auto middle = std::partition( order.begin() + first, order.begin() + last, [&child, &pts]( std::size_t i ) { return child->contains( *pts[i] ); } );
+            std::size_t split = static_cast<std::size_t>( middle - order.begin() );
+
+            if (split > first) {
+                quadstack.emplace( child.get(), first, split );
+            }
+
+            first = split;
+        }
+    }
+
+    return element_lists;
+}
+
+template <typename T>
+BasicQuad<T>::Cursor::Cursor( const CPtr& root ) :
+    root_{ root },
+    path_{}
+{}
+
+template <typename T>
+void BasicQuad<T>::Cursor::reset( const CPtr& root )
+{
+    if (root != root_) {
+        root_ = root;
+        path_.clear();
+    }
+}
+
+template <typename T>
+const typename BasicQuad<T>::CPtr& BasicQuad<T>::Cursor::get_root() const
+{
+    return root_;
+}
+
+template <typename T>
+const BasicQuad<T>* BasicQuad<T>::Cursor::find_leaf( const geo::Point& pt )
+{
+    // climb from the last leaf to the nearest quad that holds the point inside its boundary. A point on a quad's
+    // boundary may also be in a sibling that comes first in child order, which retrieve_elements would descend into,
+    // so such quads are climbed past and the descent starts again from their parent.
+    auto holds_inside = []( const BasicQuad* quad, const geo::Point& pt ) {
+        return quad->sw.lat < pt.lat && pt.lat < quad->ne.lat && quad->sw.lon < pt.lon && pt.lon < quad->ne.lon;
+    };
+
+    while (!path_.empty() && !holds_inside( path_.back(), pt )) {
+        path_.pop_back();
+    }
+
+    if (path_.empty()) {
+        if (!root_ || !root_->contains( pt )) {
+            return nullptr;
+        }
+
+        path_.push_back( root_.get() );
+    }
+
+    const BasicQuad* currquad = path_.back();
+
+    while (currquad->haschildren()) {
+        const BasicQuad* nextquad = nullptr;
+
+        for (auto& child : currquad->children_) {
+            if (child->contains( pt )) {
+                nextquad = child.get();
+                break;                   // stop at the first child; retrieval quads are disjoint.
+            }
+        }
+
+        if (!nextquad) {
+            break;
+        }
+
+        currquad = nextquad;
+        path_.push_back( currquad );
+    }
+
+    return currquad;
+}
+
+template <typename T>
+const typename BasicQuad<T>::ElementList& BasicQuad<T>::Cursor::retrieve_elements( const geo::Point& pt )
+{
+    const BasicQuad* leaf = find_leaf( pt );
+
+    return leaf ? leaf->element_list_ : BasicQuad::empty_element_list;
+}
+
+template <typename T>
+geo::Bounds::Ptr BasicQuad<T>::Cursor::retrieve_bounds( const geo::Point& pt, bool fuzzy )
+{
+    const BasicQuad* leaf = find_leaf( pt );
+
+    if (!leaf) {
+        return geo::Bounds::Ptr{};
+    }
+
+    if (fuzzy) {
+        return std::make_shared<geo::Bounds>(leaf->fuzzybounds_);
+    }
+
+    return std::make_shared<geo::Bounds>(*leaf);
+}
+
+template <typename T>
+geo::Bounds::Ptr BasicQuad<T>::retrieve_bounds( const geo::Point& pt, bool fuzzy) const
+{
+    const BasicQuad* currquad = this;
 
     if (currquad->contains(pt)) {
         // guard against providing a point that is not contained in the top level quad.
@@ -209,7 +432,8 @@ geo::Bounds::Ptr Quad::retrieve_bounds( const geo::Point& pt, bool fuzzy) const
     }
 }
 
-std::vector<geo::Bounds::Ptr> Quad::retrieve_all_bounds( Quad::Ptr& quadptr, bool leaf_only, bool fuzzy )
+template <typename T>
+std::vector<geo::Bounds::Ptr> BasicQuad<T>::retrieve_all_bounds( Ptr& quadptr, bool leaf_only, bool fuzzy )
 {
     std::vector<geo::Bounds::Ptr> ret;
     PtrStack quadstack;
@@ -243,9 +467,10 @@ std::vector<geo::Bounds::Ptr> Quad::retrieve_all_bounds( Quad::Ptr& quadptr, boo
     return ret;
 }
 
-geo::Entity::PtrList Quad::retrieve_all_entities( Quad::Ptr& quadptr )
+template <typename T>
+typename BasicQuad<T>::ElementList BasicQuad<T>::retrieve_all_entities( Ptr& quadptr )
 {
-    Entity::PtrList ret;
+    ElementList ret;
     PtrStack quadstack;
     quadstack.push(quadptr);
 
@@ -265,3 +490,6 @@ geo::Entity::PtrList Quad::retrieve_all_entities( Quad::Ptr& quadptr )
     return ret;
 }
 
+
+template class BasicQuad<geo::Entity>;
+template class BasicQuad<geo::Edge>;
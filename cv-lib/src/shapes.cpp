@@ -18,8 +18,12 @@
  * For issues, question, and comments, please submit a issue via GitHub.
  *******************************************************************************/
 #include <algorithm>
+#include <cerrno>
+#include <cstdlib>
 #include <fstream>
 #include <iomanip>
+#include <iterator>
+#include <thread>
 
 #include "shapes.hpp"
 #include "osm.hpp"
@@ -29,13 +33,78 @@ namespace shapes {
 
 using StreamPtr = std::shared_ptr<std::istream>;
 
-CSVInputFactory::CSVInputFactory() :
-    file_path_{}
-{}
+namespace {
 
-CSVInputFactory::CSVInputFactory(const std::string& file_path) :
-    file_path_{file_path}
-{}
+/**
+ * Non-throwing counterparts of std::stoull and std::stod; they accept exactly the strings those functions accept and
+ * report the kinds of error those functions throw.
+ */
+ParseError to_uint64(const std::string& s, uint64_t& value) {
+    const char* begin = s.c_str();
+    char* end = nullptr;
+
+    errno = 0;
+    unsigned long long result = std::strtoull(begin, &end, 10);
+
+    if (end == begin) {
+        return ParseError::INVALID_ARGUMENT;
+    }
+
+    if (errno == ERANGE) {
+        return ParseError::OUT_OF_RANGE;
+    }
+
+    value = static_cast<uint64_t>(result);
+    return ParseError::NONE;
+}
+
+ParseError to_double(const std::string& s, double& value) {
+    const char* begin = s.c_str();
+    char* end = nullptr;
+
+    errno = 0;
+    double result = std::strtod(begin, &end);
+
+    if (end == begin) {
+        return ParseError::INVALID_ARGUMENT;
+    }
+
+    if (errno == ERANGE) {
+        return ParseError::OUT_OF_RANGE;
+    }
+
+    value = result;
+    return ParseError::NONE;
+}
+
+ParseError check_lat(double lat, std::string& error) {
+    if (lat > 80.0 || lat < -84.0) {
+        error = "bad latitude: " + std::to_string(lat);
+        return ParseError::OUT_OF_RANGE;
+    }
+
+    return ParseError::NONE;
+}
+
+ParseError check_lon(double lon, std::string& error) {
+    if (lon >= 180.0 || lon <= -180.0) {
+        error = "bad longitude: " + std::to_string(lon);
+        return ParseError::OUT_OF_RANGE;
+    }
+
+    return ParseError::NONE;
+}
+
+/**
+ * Throw the exception the make_<shape> methods have always thrown for this kind of error.
+ */
+void throw_parse_error(ParseError kind, const std::string& error) {
+    if (kind == ParseError::INVALID_ARGUMENT) {
+        throw std::invalid_argument{ error };
+    }
+
+    throw std::out_of_range{ error };
+}
 
 /**
  * Edge Specification:
@@ -45,17 +114,17 @@ CSVInputFactory::CSVInputFactory(const std::string& file_path) :
  *      - Point: <uid>;latitude;longitude
  * - line_parts[3] : A sequence of colon-split key=value attributes.
  *      - Attribute Pair: <attribute>=<value>
+ *
+ * Vertex identifiers are not resolved here; see CSVInputFactory::resolve_edge.
  */
-void CSVInputFactory::make_edge(const StrVector& line_parts) {
-    double lat;
-    double lon;
-    uint64_t edge_id;
-    uint64_t vertex_id;
-    osm::Highway way_type{osm::Highway::OTHER};                     // default value.
+ParseError parse_edge(const StrVector& line_parts, PendingEdge& edge, std::string& error) {
+    edge.way_type = osm::Highway::OTHER;                            // default value.
+    ParseError result;
 
     if ( line_parts.size() < 3) {
         // lines cannot be defined without points.
-        throw std::invalid_argument("insufficient number of components to create an edge: " + std::to_string(line_parts.size()) + "; requires 3." );
+        error = "insufficient number of components to create an edge: " + std::to_string(line_parts.size()) + "; requires 3.";
+        return ParseError::INVALID_ARGUMENT;
     }
 
     // Attributes must be processed first (if they exist) so we pickup the specified way_type.
@@ -83,53 +152,221 @@ void CSVInputFactory::make_edge(const StrVector& line_parts) {
             std::transform( s1->second.begin(), s1->second.end(), s1->second.begin(), ::tolower );
             auto s2 = osm::highway_map.find( s1->second );
             if ( s2 != osm::highway_map.end() ) {
-                way_type = s2->second;
+                edge.way_type = s2->second;
             } // othewise, use the default value.
         }
     }
 
-    edge_id = std::stoull( line_parts[SHAPE_ID] );                  // throws.
+    if ( (result = to_uint64( line_parts[SHAPE_ID], edge.edge_id )) != ParseError::NONE ) {
+        error = "bad edge identifier: " + line_parts[SHAPE_ID];
+        return result;
+    }
+
     StrVector geo_parts{ string_utilities::split( line_parts[SHAPE_GEOGRAPHY], ':' ) };
 
     if ( geo_parts.size() != 2 ) {
         // too many or too few points.
-        throw std::out_of_range{ "too many or too few points to define an edge: " + std::to_string(geo_parts.size()) };
+        error = "too many or too few points to define an edge: " + std::to_string(geo_parts.size());
+        return ParseError::OUT_OF_RANGE;
     }
 
-    geo::Vertex::Ptr vp[2];
     for ( int pi = 0; pi < 2; ++pi ) {
 
         // A point in a geometry is a triple: uid; latitude; longitude.
         StrVector point_parts{ string_utilities::split( geo_parts[pi], ';' ) };
 
         if ( point_parts.size() != 3 ) {
-            // too many or too few components to define a point -- just skip this point.
-            throw std::out_of_range{ "too many or too few elements to define a point: " + std::to_string(point_parts.size()) };
+            error = "too many or too few elements to define a point: " + std::to_string(point_parts.size());
+            return ParseError::OUT_OF_RANGE;
+        }
+
+        if ( (result = to_uint64( point_parts[POINT_ID], edge.vertex_id[pi] )) != ParseError::NONE ||
+             (result = to_double( point_parts[POINT_LAT], edge.lat[pi] )) != ParseError::NONE ||
+             (result = to_double( point_parts[POINT_LON], edge.lon[pi] )) != ParseError::NONE ) {
+            error = "bad point: " + geo_parts[pi];
+            return result;
         }
+    }
+
+    return ParseError::NONE;
+}
+
+/**
+ * Circle Specification:
+ * - line_parts[0] : "circle"
+ * - line_parts[1] : unique 64-bit integer identifier
+ * - line_parts[2] : A sequence of colon-split elements that define the center.
+ *      - Center: <lat>:<lon>:<radius in meters>
+ */
+ParseError parse_circle(const StrVector& line_parts, geo::Circle::CPtr& circle_ptr, std::string& error) {
+    ParseError result;
+
+    if ( line_parts.size() < 3) {
+        // lines cannot be defined without points.
+        error = "insufficient number of components to create a circle: " + std::to_string(line_parts.size()) + "; requires 3.";
+        return ParseError::INVALID_ARGUMENT;
+    }
+
+    uint64_t uid;
+
+    if ( (result = to_uint64( line_parts[1], uid )) != ParseError::NONE ) {
+        error = "bad circle identifier: " + line_parts[1];
+        return result;
+    }
+
+    StrVector parts = string_utilities::split(line_parts[2], ':');
+
+    if ( parts.size() != 3 ) {
+        error = "wrong number of elements for circle center: " + std::to_string( parts.size() );
+        return ParseError::OUT_OF_RANGE;
+    } 
+
+    // Each value is checked as soon as it is converted, so the first problem decides the kind of error.
+    double lat, lon, radius;
+
+    if ( (result = to_double( parts[0], lat )) != ParseError::NONE ) {
+        error = "bad circle center: " + line_parts[2];
+        return result;
+    }
+
+    if ( (result = check_lat( lat, error )) != ParseError::NONE ) {
+        return result;
+    }
+
+    if ( (result = to_double( parts[1], lon )) != ParseError::NONE ) {
+        error = "bad circle center: " + line_parts[2];
+        return result;
+    }
+
+    if ( (result = check_lon( lon, error )) != ParseError::NONE ) {
+        return result;
+    }
+
+    if ( (result = to_double( parts[2], radius )) != ParseError::NONE ) {
+        error = "bad circle center: " + line_parts[2];
+        return result;
+    }
+
+    if (radius < 0.0) {
+        error = "bad radius: " + std::to_string(radius);
+        return ParseError::OUT_OF_RANGE;
+    }
+    
+    circle_ptr = std::make_shared<geo::Circle>(lat, lon, uid, radius);
+    return ParseError::NONE;
+}
+
+/**
+ * Grid Specification:
+ * - line_parts[0] : "grid"
+ * - line_parts[1] : A '_' split row-column pair.
+ * - line_parts[2] : A sequence of colon-split elements defining the grid position.
+ *      - Point: <sw lat>:<sw lon>:<ne lat>:<ne lon>
+ */
+ParseError parse_grid(const StrVector& line_parts, geo::Grid::CPtr& grid_ptr, std::string& error) {
+    ParseError result;
+
+    if ( line_parts.size() < 3) {
+        // lines cannot be defined without points.
+        error = "insufficient number of components to create a grid: " + std::to_string(line_parts.size()) + "; requires 3.";
+        return ParseError::INVALID_ARGUMENT;
+    }
+
+    StrVector id_parts = string_utilities::split(line_parts[1], '_');
+    
+    if (id_parts.size() != 2) {
+        error = "geo::Grid missing row/col fields.";
+        return ParseError::OUT_OF_RANGE;
+    }
+
+    // id_parts has 2 elements ROW and COL
+    uint64_t row, col;
+
+    if ( (result = to_uint64( id_parts[0], row )) != ParseError::NONE || (result = to_uint64( id_parts[1], col )) != ParseError::NONE ) {
+        error = "bad grid row/col: " + line_parts[1];
+        return result;
+    }
+
+    StrVector geo_parts = string_utilities::split(line_parts[2], ':');
+
+    if (geo_parts.size() != 4) {
+        error = "geo::Grid missing bounds data.";
+        return ParseError::OUT_OF_RANGE;
+    }
+
+    // geo_parts has 2 points each defined as a pair (lat, lon)
+    double sw_lat, sw_lon, ne_lat, ne_lon;
+
+    if ( (result = to_double( geo_parts[0], sw_lat )) != ParseError::NONE || (result = to_double( geo_parts[1], sw_lon )) != ParseError::NONE || 
+         (result = to_double( geo_parts[2], ne_lat )) != ParseError::NONE || (result = to_double( geo_parts[3], ne_lon )) != ParseError::NONE ) {
+        error = "bad grid bounds: " + line_parts[2];
+        return result;
+    }
+
+    if ( (result = check_lat( sw_lat, error )) != ParseError::NONE || (result = check_lon( sw_lon, error )) != ParseError::NONE ||
+         (result = check_lat( ne_lat, error )) != ParseError::NONE || (result = check_lon( ne_lon, error )) != ParseError::NONE ) {
+        return result;
+    }
+    
+    geo::Bounds bounds(geo::Point(sw_lat, sw_lon), geo::Point(ne_lat, ne_lon));
+    grid_ptr = std::make_shared<const geo::Grid>(bounds, static_cast<uint32_t>(row), static_cast<uint32_t>(col));
+    return ParseError::NONE;
+}
+
+}  // end anonymous namespace
+
+void ParseReport::add_diagnostic(uint64_t line, const std::string& message) {
+    if (diagnostics.size() >= kMaxDiagnostics) {
+        return;
+    }
+
+    diagnostics.push_back(line == 0 ? message : "line " + std::to_string(line) + ": " + message);
+}
+
+CSVInputFactory::CSVInputFactory() :
+    file_path_{}
+{}
+
+CSVInputFactory::CSVInputFactory(const std::string& file_path) :
+    file_path_{file_path}
+{}
+
+void CSVInputFactory::make_edge(const StrVector& line_parts) {
+    PendingEdge pending;
+    std::string error;
 
-        // convert all the parts so we can perform checks when the id was previously used.
-        vertex_id = std::stoull( point_parts[POINT_ID] );           // throws.
-        lat = std::stod( point_parts[POINT_LAT] );                  // throws.
-        lon = std::stod( point_parts[POINT_LON] );                  // throws.
+    ParseError result;
+
+    pending.line = 0;
+
+    if ( (result = parse_edge( line_parts, pending, error )) != ParseError::NONE || (result = resolve_edge( pending, error )) != ParseError::NONE ) {
+        throw_parse_error( result, error );
+    }
+}
+
+ParseError CSVInputFactory::resolve_edge(const PendingEdge& pending, std::string& error) {
+    geo::Vertex::Ptr vp[2];
+    ParseError result;
+
+    for ( int pi = 0; pi < 2; ++pi ) {
+        uint64_t vertex_id = pending.vertex_id[pi];
+        double lat = pending.lat[pi];
+        double lon = pending.lon[pi];
 
         auto element_item = vertex_map_.find(vertex_id);
         if (element_item != vertex_map_.end()) {
             // point already defined; use existing instance.
             // needed because we have an incident edge list.
-            vp[pi] = vertex_map_[vertex_id];
+            vp[pi] = element_item->second;
             if ( !double_utilities::are_equal(vp[pi]->lat, lat, geo::kGPSEpsilon) || !double_utilities::are_equal(vp[pi]->lon, lon, geo::kGPSEpsilon)) {
-                std::cerr << "WARNING: identical vertex id with different coordinates!\n";
+                ++report_.vertex_conflicts;
+                report_.add_diagnostic( pending.line, "identical vertex id " + std::to_string(vertex_id) + " with different coordinates" );
             }
 
         } else {
             // point must be instantiated.
-
-            if (lat > 80.0 || lat < -84.0) {
-                throw std::out_of_range{ "bad latitude: " + std::to_string(lat) };
-            }
-
-            if (lon >= 180.0 || lon <= -180.0) {
-                throw std::out_of_range{"bad longitude: " + std::to_string(lon) };
+            if ( (result = check_lat( lat, error )) != ParseError::NONE || (result = check_lon( lon, error )) != ParseError::NONE ) {
+                return result;
             }
 
             vp[pi] = std::make_shared<geo::Vertex>(lat,lon,vertex_id);  
@@ -138,14 +375,17 @@ void CSVInputFactory::make_edge(const StrVector& line_parts) {
     }
 
     if ( vp[0]->uid == vp[1]->uid ) {
-        throw std::invalid_argument("The identifiers for the edges points are the same.");
+        error = "The identifiers for the edges points are the same.";
+        return ParseError::INVALID_ARGUMENT;
     }
 
     // NOTE: the way id does not uniquely identify the edge, as a way is sequence of edges.
-    geo::EdgePtr edge_ptr = std::make_shared<geo::Edge>( vp[0], vp[1], way_type, edge_id ); 
+    geo::EdgePtr edge_ptr = std::make_shared<geo::Edge>( vp[0], vp[1], pending.way_type, pending.edge_id ); 
     vp[0]->add_edge( edge_ptr );
     vp[1]->add_edge( edge_ptr );
     edges_.push_back(edge_ptr);
+    ++report_.edges;
+    return ParseError::NONE;
 }
 
 void CSVInputFactory::make_implicit_edge(const StrVector& line_parts) {
@@ -272,147 +512,181 @@ void CSVInputFactory::make_privacy_interval(const StrVector& line_parts) {
 
 void CSVInputFactory::make_circle(const StrVector& line_parts) 
 {
-    // Circle Specification:
-    // - line_parts[0] : "circle"
-    // - line_parts[1] : unique 64-bit integer identifier
-    // - line_parts[2] : A sequence of colon-split elements that define the center.
-    //      - Center: <lat>:<lon>:<radius in meters>
-    // 
-    if ( line_parts.size() < 3) {
-        // lines cannot be defined without points.
-        throw std::invalid_argument("insufficient number of components to create a circle: " + std::to_string(line_parts.size()) + "; requires 3." );
-    }
-
-    uint64_t uid = std::stoull(line_parts[1]);
+    geo::Circle::CPtr circle_ptr;
+    std::string error;
 
-    StrVector parts = string_utilities::split(line_parts[2], ':');
+    ParseError result = parse_circle( line_parts, circle_ptr, error );
 
-    if ( parts.size() != 3 ) {
-	    throw std::out_of_range{ "wrong number of elements for circle center: " + std::to_string( parts.size() ) };
-    } 
+    if ( result != ParseError::NONE ) {
+        throw_parse_error( result, error );
+    }
 
-    double lat = std::stod(parts[0]);
+    circles_.push_back(circle_ptr);
+    ++report_.circles;
+}
 
-    if (lat > 80.0 || lat < -84.0) {
-        throw std::out_of_range{ "bad latitude: " + std::to_string(lat) };
-    }
+void CSVInputFactory::make_grid(const StrVector& line_parts) {
+    geo::Grid::CPtr grid_ptr;
+    std::string error;
 
-    double lon = std::stod(parts[1]);
+    ParseError result = parse_grid( line_parts, grid_ptr, error );
 
-    if (lon >= 180.0 || lon <= -180.0) {
-        throw std::out_of_range{"bad longitude: " + std::to_string(lon) };
+    if ( result != ParseError::NONE ) {
+        throw_parse_error( result, error );
     }
 
-    double radius = std::stod(parts[2]);
+    grids_.push_back(grid_ptr); 
+    ++report_.grids;
+}
 
-    if (radius < 0.0) {
-        throw std::out_of_range{"bad radius: " + std::to_string(radius) };
+void CSVInputFactory::parse_chunk(Chunk& chunk) {
+    std::string line;
+    std::string error;
+    uint64_t line_number = chunk.first_line;
+    const char* pos = chunk.begin;
+
+    while (pos < chunk.end) {
+        const char* eol = std::find(pos, chunk.end, '\n');
+        line.assign(pos, eol);
+        pos = (eol == chunk.end) ? eol : eol + 1;
+        ++chunk.report.lines;
+
+        StrVector parts = string_utilities::split(line, ',');
+
+        if (parts.size() < 3 || parts.size() > 4) {
+            // Shape file attribute order: type,id,geography[,attributes]
+            // First 3 are required; fourth is optional.
+            ++chunk.report.rejected;
+            chunk.report.add_diagnostic(line_number, "too few or too many elements in shape specification: " + std::to_string(parts.size()) + " fields");
+        } else if (parts[0] == "edge") {
+            PendingEdge pending;
+            pending.line = line_number;
+
+            if (parse_edge(parts, pending, error) == ParseError::NONE) {
+                chunk.edges.push_back(pending);
+            } else {
+                ++chunk.report.rejected;
+                chunk.report.add_diagnostic(line_number, error);
+            }
+        } else if (parts[0] == "circle") {
+            geo::Circle::CPtr circle_ptr;
+
+            if (parse_circle(parts, circle_ptr, error) == ParseError::NONE) {
+                chunk.circles.push_back(circle_ptr);
+                ++chunk.report.circles;
+            } else {
+                ++chunk.report.rejected;
+                chunk.report.add_diagnostic(line_number, error);
+            }
+        } else if (parts[0] == "grid") {
+            geo::Grid::CPtr grid_ptr;
+
+            if (parse_grid(parts, grid_ptr, error) == ParseError::NONE) {
+                chunk.grids.push_back(grid_ptr);
+                ++chunk.report.grids;
+            } else {
+                ++chunk.report.rejected;
+                chunk.report.add_diagnostic(line_number, error);
+            }
+        } else {
+            ++chunk.report.ignored;
+        }
+
+        ++line_number;
     }
-    
-    circles_.push_back(std::make_shared<geo::Circle>(lat, lon, uid, radius));
 }
 
-void CSVInputFactory::make_grid(const StrVector& line_parts) {
+void CSVInputFactory::make_shapes(unsigned n_threads) {
+    std::ifstream file(file_path_, std::ios::binary);
 
-    // Grid Specification:
-    // - line_parts[0] : "grid"
-    // - line_parts[1] : A '_' split row-column pair.
-    // - line_parts[2] : A sequence of colon-split elements defining the grid position.
-    //      - Point: <sw lat>:<sw lon>:<ne lat>:<ne lon>
-    //
-    if ( line_parts.size() < 3) {
-        // lines cannot be defined without points.
-        throw std::invalid_argument("insufficient number of components to create a grid: " + std::to_string(line_parts.size()) + "; requires 3." );
+    if (file.fail()) {
+        throw std::invalid_argument("Could not open shape file: " + file_path_);
     }
 
-    StrVector id_parts = string_utilities::split(line_parts[1], '_');
-    
-    if (id_parts.size() != 2) {
-        throw std::out_of_range("geo::Grid missing row/col fields.");
-    }
+    std::string content{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+    file.close();
 
-    // id_parts has 2 elements ROW and COL
+    // Get the header.
+    if (content.empty()) {
+        throw std::invalid_argument("Shape file missing header!");
+    }
 
-    uint32_t row = std::stoul(id_parts[0]);
-    uint32_t col = std::stoul(id_parts[1]);
+    report_ = ParseReport{};
 
-    StrVector geo_parts = string_utilities::split(line_parts[2], ':');
+    const char* stop = content.data() + content.size();
+    const char* body = std::find(content.data(), stop, '\n');
 
-    if (geo_parts.size() != 4) {
-        throw std::out_of_range("geo::Grid missing bounds data.");
+    if (body != stop) {
+        ++body;
     }
 
-    // geo_parts has 2 points each defined as a pair (lat, lon)
+    // Split the body into line ranges; each range ends just after a newline (or at the end of the file).
+    size_t body_size = static_cast<size_t>(stop - body);
+    size_t n_chunks = std::max<size_t>(1, std::min<size_t>(n_threads, body_size / kMinChunkBytes + 1));
+    std::vector<Chunk> chunks(n_chunks);
+    const char* begin = body;
+    uint64_t first_line = 2;                                        // the header is line 1.
 
-    double sw_lat = std::stod(geo_parts[0]);
-    double sw_lon = std::stod(geo_parts[1]);
-    double ne_lat = std::stod(geo_parts[2]);
-    double ne_lon = std::stod(geo_parts[3]);
+    for (size_t i = 0; i < n_chunks; ++i) {
+        const char* end = (i + 1 == n_chunks) ? stop : std::max(begin, body + body_size * (i + 1) / n_chunks);
+        end = std::find(end, stop, '\n');
 
-    if (sw_lat > 80.0 || sw_lat < -84.0) {
-        throw std::out_of_range{ "bad latitude: " + std::to_string(sw_lat) };
-    }
+        if (end != stop) {
+            ++end;
+        }
 
-    if (sw_lon >= 180.0 || sw_lon <= -180.0) {
-        throw std::out_of_range{"bad longitude: " + std::to_string(sw_lon) };
+        chunks[i].begin = begin;
+        chunks[i].end = end;
+        chunks[i].first_line = first_line;
+        first_line += std::count(begin, end, '\n');
+        begin = end;
     }
 
-    if (ne_lat > 80.0 || ne_lat < -84.0) {
-        throw std::out_of_range{ "bad latitude: " + std::to_string(ne_lat) };
-    }
+    // Tokenize the ranges concurrently; this thread takes the first one.
+    std::vector<std::thread> threads;
 
-    if (ne_lon >= 180.0 || ne_lon <= -180.0) {
-        throw std::out_of_range{"bad longitude: " + std::to_string(ne_lon) };
+    for (size_t i = 1; i < n_chunks; ++i) {
+        threads.emplace_back(&CSVInputFactory::parse_chunk, std::ref(chunks[i]));
     }
-    
-    geo::Bounds bounds(geo::Point(sw_lat, sw_lon), geo::Point(ne_lat, ne_lon));
-    geo::Grid::CPtr grid_ptr = std::make_shared<const geo::Grid>(bounds, row, col);
-    grids_.push_back(grid_ptr); 
-}
 
-void CSVInputFactory::make_shapes() {
-    std::string line;
-    std::ifstream file(file_path_);
+    parse_chunk(chunks[0]);
 
-    if (file.fail()) {
-        throw std::invalid_argument("Could not open shape file: " + file_path_);
+    for (auto& thread : threads) {
+        thread.join();
     }
 
-    // Get the header.
-    if (!std::getline(file, line)) {
-        throw std::invalid_argument("Shape file missing header!");
-    }
-
-    while (std::getline(file, line)) {
-        try {
-            StrVector parts = string_utilities::split(line, ',');
-
-            if (parts.size() < 3 || parts.size() > 4) {
-		        // Shape file attribute order: type,id,geography[,attributes]
-		        // First 3 are required; fourth is optional.
-                std::cerr << "Too few or too many elements in shape specification: " << parts.size() << " fields.\n";
-
-                continue;
+    // Merge in file order; vertex identifiers resolve to the first definition seen, exactly as a sequential read would.
+    std::string error;
+
+    for (auto& chunk : chunks) {
+        circles_.insert(circles_.end(), chunk.circles.begin(), chunk.circles.end());
+        grids_.insert(grids_.end(), chunk.grids.begin(), chunk.grids.end());
+        report_.lines += chunk.report.lines;
+        report_.circles += chunk.report.circles;
+        report_.grids += chunk.report.grids;
+        report_.ignored += chunk.report.ignored;
+        report_.rejected += chunk.report.rejected;
+
+        for (auto& diagnostic : chunk.report.diagnostics) {
+            if (report_.diagnostics.size() < ParseReport::kMaxDiagnostics) {
+                report_.diagnostics.push_back(diagnostic);
             }
+        }
 
-            std::string type = parts[0];
-
-            if (type == "circle") {
-                make_circle(parts);
-            } else if (type == "edge") {
-                make_edge(parts);
-            } else if (type == "grid") {
-                make_grid(parts);
+        for (auto& pending : chunk.edges) {
+            if (resolve_edge(pending, error) != ParseError::NONE) {
+                ++report_.rejected;
+                report_.add_diagnostic(pending.line, error);
             }
-
-        } catch (std::exception& e) {
-            // Deal with all the exceptions thrown from the make_<shape> methods.
-            // Skip the specification and move to the next shape.
-            std::cerr << "Failed to make shape: " << e.what() << std::endl;
         }
+
+        // release each range's intermediate results as soon as they are merged.
+        chunk = Chunk{};
     }
+}
 
-    file.close();
+const ParseReport& CSVInputFactory::get_report() const {
+    return report_;
 }
 
 const std::vector<geo::Circle::CPtr>& CSVInputFactory::get_circles() const {
@@ -0,0 +1,551 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#include "spatial.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace spatial {
+
+/******************************** EdgeTable ************************************************/
+
+const uint32_t EdgeTable::kNoRow = std::numeric_limits<uint32_t>::max();
+
+EdgeTable::EdgeTable() :
+    edges_{},
+    rows_{},
+    lengths_{},
+    haversine_lengths_{},
+    bearings_{},
+    way_widths_{},
+    way_type_indices_{},
+    v1_{},
+    v2_{},
+    vertex_count_{ 0 },
+    fit_areas_{ false },
+    fit_width_scaling_{ 0.0 },
+    fit_extension_{ 0.0 },
+    fit_corners_{},
+    fit_area_valid_{}
+{}
+
+EdgeTable::EdgeTable( const EdgeQuad::ElementList& edges ) :
+    EdgeTable{}
+{
+    std::unordered_map<const geo::Vertex*, uint32_t> vertex_indices;
+
+    auto vertex_index = [&vertex_indices]( const geo::Vertex::Ptr& vertex_ptr ) {
+        return vertex_indices.emplace( vertex_ptr.get(), static_cast<uint32_t>( vertex_indices.size() ) ).first->second;
+    };
+
+    edges_.reserve( edges.size() );
+    rows_.reserve( edges.size() );
+
+    for (auto& edge_ptr : edges) {
+        if (!rows_.emplace( edge_ptr.get(), static_cast<uint32_t>( edges_.size() ) ).second) {
+            // listed more than once, e.g., by several leaves of a quad tree.
+            continue;
+        }
+
+        edges_.push_back( edge_ptr.get() );
+        lengths_.push_back( edge_ptr->length() );
+        haversine_lengths_.push_back( edge_ptr->length_haversine() );
+        bearings_.push_back( edge_ptr->bearing() );
+        way_widths_.push_back( edge_ptr->get_way_width() );
+        way_type_indices_.push_back( edge_ptr->get_way_type_index() );
+        v1_.push_back( vertex_index( edge_ptr->v1 ) );
+        v2_.push_back( vertex_index( edge_ptr->v2 ) );
+    }
+
+    vertex_count_ = vertex_indices.size();
+}
+
+EdgeTable::EdgeTable( const EdgeQuad::ElementList& edges, double fit_width_scaling, double fit_extension ) :
+    EdgeTable{ edges }
+{
+    fit_areas_ = true;
+    fit_width_scaling_ = fit_width_scaling;
+    fit_extension_ = fit_extension;
+    fit_corners_.reserve( 4 * edges_.size() );
+    fit_area_valid_.reserve( edges_.size() );
+
+    for (std::size_t r = 0; r < edges_.size(); ++r) {
+        try {
+            geo::AreaPtr aptr = edges_[r]->to_area( way_widths_[r] * fit_width_scaling, fit_extension );
+            const std::vector<geo::Point>& corners = aptr->get_corners();
+            fit_corners_.insert( fit_corners_.end(), corners.begin(), corners.end() );
+            fit_area_valid_.push_back( 1 );
+
+        } catch (geo::ZeroAreaException) {
+            fit_corners_.resize( fit_corners_.size() + 4 );
+            fit_area_valid_.push_back( 0 );
+        }
+    }
+}
+
+std::size_t EdgeTable::size() const
+{
+    return edges_.size();
+}
+
+std::size_t EdgeTable::vertex_count() const
+{
+    return vertex_count_;
+}
+
+uint32_t EdgeTable::row( const geo::Edge& edge ) const
+{
+    auto it = rows_.find( &edge );
+    return it == rows_.end() ? kNoRow : it->second;
+}
+
+double EdgeTable::length( uint32_t row ) const
+{
+    return lengths_[row];
+}
+
+double EdgeTable::length_haversine( uint32_t row ) const
+{
+    return haversine_lengths_[row];
+}
+
+double EdgeTable::bearing( uint32_t row ) const
+{
+    return bearings_[row];
+}
+
+double EdgeTable::way_width( uint32_t row ) const
+{
+    return way_widths_[row];
+}
+
+int EdgeTable::way_type_index( uint32_t row ) const
+{
+    return way_type_indices_[row];
+}
+
+uint32_t EdgeTable::v1( uint32_t row ) const
+{
+    return v1_[row];
+}
+
+uint32_t EdgeTable::v2( uint32_t row ) const
+{
+    return v2_[row];
+}
+
+bool EdgeTable::has_fit_areas( double fit_width_scaling, double fit_extension ) const
+{
+    return fit_areas_ && fit_width_scaling == fit_width_scaling_ && fit_extension == fit_extension_;
+}
+
+const geo::Point* EdgeTable::fit_area( uint32_t row ) const
+{
+    return fit_area_valid_[row] ? &fit_corners_[4 * row] : nullptr;
+}
+
+double EdgeTable::length( const geo::Edge& edge ) const
+{
+    uint32_t r = row( edge );
+    return r == kNoRow ? edge.length() : lengths_[r];
+}
+
+double EdgeTable::bearing( const geo::Edge& edge ) const
+{
+    uint32_t r = row( edge );
+    return r == kNoRow ? edge.bearing() : bearings_[r];
+}
+
+double EdgeTable::way_width( const geo::Edge& edge ) const
+{
+    uint32_t r = row( edge );
+    return r == kNoRow ? edge.get_way_width() : way_widths_[r];
+}
+
+/******************************** EdgeIndex ************************************************/
+
+void EdgeIndex::Cursor::prefetch( const std::vector<const geo::Point*>& /* pts */ )
+{}
+
+void EdgeIndex::Cursor::clear_prefetch()
+{}
+
+EdgeIndex::Ptr EdgeIndex::make( const std::string& name, const std::vector<geo::EdgeCPtr>& edges, const geo::Point& sw, const geo::Point& ne, double fit_width_scaling, double fit_extension, const QuadParams& quad_params )
+{
+    if (name == "quad") {
+        EdgeQuad::Ptr quad_ptr = std::make_shared<EdgeQuad>( sw, ne, quad_params );
+
+        for (auto& edge_ptr : edges) {
+            EdgeQuad::insert( quad_ptr, edge_ptr );
+        }
+
+        return std::make_shared<QuadEdgeIndex>( quad_ptr, fit_width_scaling, fit_extension );
+    }
+
+    if (name == "rtree") {
+        // index the same part of the map as the quad tree would.
+        geo::Bounds bounds{ sw, ne };
+        std::vector<geo::EdgeCPtr> bounded_edges;
+
+        for (auto& edge_ptr : edges) {
+            if (bounds.contains_or_intersects( *edge_ptr )) {
+                bounded_edges.push_back( edge_ptr );
+            }
+        }
+
+        return std::make_shared<RTree>( bounded_edges, fit_width_scaling, fit_extension );
+    }
+
+    throw std::invalid_argument( "Unknown spatial index: " + name + " (expected quad or rtree)." );
+}
+
+/******************************** QuadEdgeIndex ********************************************/
+
+namespace {
+
+/**
+ * \brief A cursor into a quad tree that looks up a whole trip in one descent, or else starts each lookup from the
+ * leaf of the last one.
+ */
+class QuadCursor : public EdgeIndex::Cursor
+{
+    public:
+        QuadCursor( const EdgeQuad::CPtr& quad_ptr ) :
+            quad_ptr_{ quad_ptr },
+            cursor_{ quad_ptr },
+            prefetched_{}
+        {}
+
+        void prefetch( const std::vector<const geo::Point*>& pts )
+        {
+            if (quad_ptr_) {
+                prefetched_ = quad_ptr_->retrieve_elements( pts );
+            }
+        }
+
+        void clear_prefetch()
+        {
+            prefetched_.clear();
+        }
+
+        const EdgeIndex::EdgeList& retrieve_edges( const geo::Point& pt, std::size_t point_index )
+        {
+            if (point_index < prefetched_.size()) {
+                return *prefetched_[point_index];
+            }
+
+            return cursor_.retrieve_elements( pt );
+        }
+
+    private:
+        EdgeQuad::CPtr quad_ptr_;
+        EdgeQuad::Cursor cursor_;
+        std::vector<const EdgeQuad::ElementList*> prefetched_;      ///< the leaf edges of each point of the trip.
+};
+
+}
+
+QuadEdgeIndex::QuadEdgeIndex( const EdgeQuad::CPtr& quad_ptr ) :
+    quad_ptr_{ quad_ptr },
+    table_{}
+{
+    if (quad_ptr_) {
+        EdgeQuad::Ptr root_ptr = std::const_pointer_cast<EdgeQuad>( quad_ptr_ );
+        table_ = EdgeTable{ EdgeQuad::retrieve_all_entities( root_ptr ) };
+    }
+}
+
+QuadEdgeIndex::QuadEdgeIndex( const EdgeQuad::CPtr& quad_ptr, double fit_width_scaling, double fit_extension ) :
+    quad_ptr_{ quad_ptr },
+    table_{}
+{
+    if (quad_ptr_) {
+        EdgeQuad::Ptr root_ptr = std::const_pointer_cast<EdgeQuad>( quad_ptr_ );
+        table_ = EdgeTable{ EdgeQuad::retrieve_all_entities( root_ptr ), fit_width_scaling, fit_extension };
+    }
+}
+
+EdgeIndex::Cursor::Ptr QuadEdgeIndex::make_cursor() const
+{
+    return std::make_shared<QuadCursor>( quad_ptr_ );
+}
+
+std::string QuadEdgeIndex::get_name() const
+{
+    return "quad";
+}
+
+const EdgeTable& QuadEdgeIndex::get_table() const
+{
+    return table_;
+}
+
+const EdgeQuad::CPtr& QuadEdgeIndex::get_quad() const
+{
+    return quad_ptr_;
+}
+
+/******************************** RTree ****************************************************/
+
+namespace {
+
+/**
+ * \brief A cursor into an R-tree; lookups are independent, so it only holds the scratch space and the result.
+ */
+class RTreeCursor : public EdgeIndex::Cursor
+{
+    public:
+        RTreeCursor( const std::shared_ptr<const RTree>& rtree_ptr ) :
+            rtree_ptr_{ rtree_ptr },
+            scratch_{},
+            edges_{}
+        {}
+
+        const EdgeIndex::EdgeList& retrieve_edges( const geo::Point& pt, std::size_t /* point_index */ )
+        {
+            edges_.clear();
+            rtree_ptr_->retrieve_edges( pt, edges_, scratch_ );
+            return edges_;
+        }
+
+    private:
+        std::shared_ptr<const RTree> rtree_ptr_;
+        RTree::Scratch scratch_;
+        EdgeIndex::EdgeList edges_;
+};
+
+}
+
+constexpr std::size_t RTree::NODE_CAPACITY;
+
+bool RTree::Box::contains( const geo::Point& pt ) const
+{
+    return pt.lat >= min_lat && pt.lat <= max_lat && pt.lon >= min_lon && pt.lon <= max_lon;
+}
+
+void RTree::Box::extend( const Box& box )
+{
+    min_lat = std::min( min_lat, box.min_lat );
+    min_lon = std::min( min_lon, box.min_lon );
+    max_lat = std::max( max_lat, box.max_lat );
+    max_lon = std::max( max_lon, box.max_lon );
+}
+
+RTree::RTree( const std::vector<geo::EdgeCPtr>& edges, double fit_width_scaling, double fit_extension ) :
+    edges_{ edges },
+    entry_boxes_{},
+    entry_edges_{},
+    nodes_{},
+    height_{ 0 },
+    table_{ edges_, fit_width_scaling, fit_extension }
+{
+    // fewer meters per degree than anywhere on the ellipsoid, plus a meter of slack, so rounding in the area
+    // projection never leaves part of an area outside its box.
+    const double kMetersPerDegree = 110000.0;
+    const double kMinCosine = 0.01;
+
+    std::vector<Box> boxes;
+    boxes.reserve( edges_.size() );
+
+    for (auto& edge_ptr : edges_) {
+        double margin = std::max( 0.0, edge_ptr->get_way_width() * fit_width_scaling / 2.0 ) + std::max( 0.0, fit_extension ) + 1.0;
+
+        Box box;
+        box.min_lat = std::min( edge_ptr->v1->lat, edge_ptr->v2->lat );
+        box.max_lat = std::max( edge_ptr->v1->lat, edge_ptr->v2->lat );
+        box.min_lon = std::min( edge_ptr->v1->lon, edge_ptr->v2->lon );
+        box.max_lon = std::max( edge_ptr->v1->lon, edge_ptr->v2->lon );
+
+        // a degree of longitude is shortest at the poleward side of the box.
+        double lat_margin = margin / kMetersPerDegree;
+        double poleward_lat = std::min( 90.0, std::max( std::fabs( box.min_lat ), std::fabs( box.max_lat ) ) + lat_margin );
+        double lon_margin = margin / (kMetersPerDegree * std::max( kMinCosine, std::cos( geo::to_radians( poleward_lat ) ) ));
+
+        box.min_lat -= lat_margin;
+        box.max_lat += lat_margin;
+        box.min_lon -= lon_margin;
+        box.max_lon += lon_margin;
+        boxes.push_back( box );
+    }
+
+    if (boxes.empty()) {
+        return;
+    }
+
+    // pack the entries into leaves.
+    std::vector<uint32_t> order = str_order( boxes );
+    std::vector<Node> level;
+
+    entry_boxes_.reserve( order.size() );
+    entry_edges_.reserve( order.size() );
+
+    for (std::size_t first = 0; first < order.size(); first += NODE_CAPACITY) {
+        Node leaf{ boxes[order[first]], static_cast<uint32_t>( first ), 0, true };
+
+        for (std::size_t i = first; i < order.size() && i < first + NODE_CAPACITY; ++i) {
+            entry_boxes_.push_back( boxes[order[i]] );
+            entry_edges_.push_back( order[i] );
+            leaf.box.extend( boxes[order[i]] );
+            ++leaf.count;
+        }
+
+        level.push_back( leaf );
+    }
+
+    ++height_;
+
+    // pack each level into the one above it until a single root is left.
+    while (level.size() > 1) {
+        std::vector<Box> level_boxes;
+        level_boxes.reserve( level.size() );
+
+        for (auto& node : level) {
+            level_boxes.push_back( node.box );
+        }
+
+        order = str_order( level_boxes );
+        uint32_t base = static_cast<uint32_t>( nodes_.size() );
+
+        for (auto i : order) {
+            nodes_.push_back( level[i] );
+        }
+
+        std::vector<Node> parents;
+
+        for (std::size_t first = 0; first < order.size(); first += NODE_CAPACITY) {
+            Node parent{ nodes_[base + first].box, static_cast<uint32_t>( base + first ), 0, false };
+
+            for (std::size_t i = first; i < order.size() && i < first + NODE_CAPACITY; ++i) {
+                parent.box.extend( nodes_[base + i].box );
+                ++parent.count;
+            }
+
+            parents.push_back( parent );
+        }
+
+        level.swap( parents );
+        ++height_;
+    }
+
+    nodes_.push_back( level.front() );
+}
+
+std::vector<uint32_t> RTree::str_order( const std::vector<Box>& boxes )
+{
+    std::vector<uint32_t> order( boxes.size() );
+
+    for (std::size_t i = 0; i < order.size(); ++i) {
+        order[i] = static_cast<uint32_t>( i );
+    }
+
+    auto center_lon = [&boxes]( uint32_t i ) { return boxes[i].min_lon + boxes[i].max_lon; };
+    auto center_lat = [&boxes]( uint32_t i ) { return boxes[i].min_lat + boxes[i].max_lat; };
+
+    std::sort( order.begin(), order.end(), [&center_lon]( uint32_t a, uint32_t b ) {
+        return center_lon( a ) < center_lon( b ) || (center_lon( a ) == center_lon( b ) && a < b);
+    });
+
+    // ceil(sqrt(P)) slices of ceil(sqrt(P)) full nodes each, where P is the number of nodes needed.
+    std::size_t n_nodes = (boxes.size() + NODE_CAPACITY - 1) / NODE_CAPACITY;
+    std::size_t n_slices = static_cast<std::size_t>( std::ceil( std::sqrt( static_cast<double>( n_nodes ) ) ) );
+    std::size_t slice_size = ((n_nodes + n_slices - 1) / n_slices) * NODE_CAPACITY;
+
+    for (std::size_t first = 0; first < order.size(); first += slice_size) {
+        auto slice_end = order.begin() + std::min( order.size(), first + slice_size );
+
+        std::sort( order.begin() + first, slice_end, [&center_lat]( uint32_t a, uint32_t b ) {
+            return center_lat( a ) < center_lat( b ) || (center_lat( a ) == center_lat( b ) && a < b);
+        });
+    }
+
+    return order;
+}
+
+EdgeIndex::Cursor::Ptr RTree::make_cursor() const
+{
+    return std::make_shared<RTreeCursor>( std::static_pointer_cast<const RTree>( shared_from_this() ) );
+}
+
+std::string RTree::get_name() const
+{
+    return "rtree";
+}
+
+const EdgeTable& RTree::get_table() const
+{
+    return table_;
+}
+
+void RTree::retrieve_edges( const geo::Point& pt, EdgeList& edges, Scratch& scratch ) const
+{
+    if (nodes_.empty()) {
+        return;
+    }
+
+    scratch.stack.clear();
+    scratch.hits.clear();
+
+    if (!nodes_.back().box.contains( pt )) {
+        return;
+    }
+
+    // only nodes whose boxes contain the point are stacked.
+    scratch.stack.push_back( static_cast<uint32_t>( nodes_.size() - 1 ) );
+
+    while (!scratch.stack.empty()) {
+        const Node& node = nodes_[scratch.stack.back()];
+        scratch.stack.pop_back();
+
+        if (node.leaf) {
+            for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+                if (entry_boxes_[i].contains( pt )) {
+                    scratch.hits.push_back( entry_edges_[i] );
+                }
+            }
+        } else {
+            for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+                if (nodes_[i].box.contains( pt )) {
+                    scratch.stack.push_back( i );
+                }
+            }
+        }
+    }
+
+    std::sort( scratch.hits.begin(), scratch.hits.end() );
+
+    for (auto i : scratch.hits) {
+        edges.push_back( edges_[i] );
+    }
+}
+
+std::size_t RTree::size() const
+{
+    return edges_.size();
+}
+
+std::size_t RTree::height() const
+{
+    return height_;
+}
+
+}
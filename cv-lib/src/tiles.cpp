@@ -0,0 +1,768 @@
+/*******************************************************************************
+ * Copyright 2018 UT-Battelle, LLC
+ * All rights reserved
+ * Route Sanitizer, version 0.9
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For issues, question, and comments, please submit a issue via GitHub.
+ *******************************************************************************/
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "tiles.hpp"
+#include "shapes.hpp"
+#include "utilities.hpp"
+
+namespace tiles {
+
+namespace {
+
+const char kImageMagic[8] = { 'C', 'V', 'M', 'A', 'P', '1', '\0', '\0' };
+const uint32_t kImageVersion = 1;
+const uint32_t kCompactImageVersion = 2;
+const uint32_t kByteOrderMark = 0x01020304;
+const double kMicrodegrees = 1e6;
+
+/** \brief The fixed size header at the start of a map image. */
+struct ImageHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    double tile_degrees;
+    uint64_t n_vertices;
+    uint64_t n_edges;
+    uint64_t n_tiles;
+    uint64_t n_tile_edges;
+    uint64_t reserved;
+};
+
+struct ImageVertex {
+    double lat;
+    double lon;
+    uint64_t uid;
+};
+
+/** \brief A vertex position in a compact image in 32-bit fixed-point microdegrees; within 6 cm of the original. */
+struct CompactVertex {
+    int32_t lat;
+    int32_t lon;
+};
+
+struct ImageEdge {
+    uint32_t v1;
+    uint32_t v2;
+    uint64_t uid;
+    uint32_t way_type;
+    uint32_t reserved;
+};
+
+struct ImageTile {
+    uint64_t key;
+    uint64_t first;
+    uint64_t count;
+};
+
+static_assert(sizeof(ImageHeader) == 64, "map image header must be 64 bytes");
+static_assert(sizeof(ImageVertex) == 24 && sizeof(ImageEdge) == 24 && sizeof(ImageTile) == 24, "map image records must be 24 bytes");
+static_assert(sizeof(CompactVertex) == 8, "compact map image positions must be 8 bytes");
+
+/**
+ * \brief The sections of an image. A compact image keeps the vertex positions and uids in separate arrays, so each
+ * stays 8 byte aligned.
+ */
+struct ImageSections {
+    const ImageVertex* vertices;            ///< nullptr in a compact image.
+    const CompactVertex* positions;         ///< nullptr unless the image is compact.
+    const uint64_t* vertex_uids;            ///< nullptr unless the image is compact.
+    const ImageEdge* edges;
+    const ImageTile* tiles;
+    const uint32_t* tile_edges;
+};
+
+const ImageHeader* image_header(const char* data) {
+    return reinterpret_cast<const ImageHeader*>(data);
+}
+
+uint64_t vertex_record_size(uint32_t version) {
+    return version == kCompactImageVersion ? sizeof(CompactVertex) + sizeof(uint64_t) : sizeof(ImageVertex);
+}
+
+ImageSections image_sections(const char* data) {
+    const ImageHeader* header = image_header(data);
+    const char* vertex_data = data + sizeof(ImageHeader);
+    ImageSections sections;
+
+    if (header->version == kCompactImageVersion) {
+        sections.vertices = nullptr;
+        sections.positions = reinterpret_cast<const CompactVertex*>(vertex_data);
+        sections.vertex_uids = reinterpret_cast<const uint64_t*>(sections.positions + header->n_vertices);
+    } else {
+        sections.vertices = reinterpret_cast<const ImageVertex*>(vertex_data);
+        sections.positions = nullptr;
+        sections.vertex_uids = nullptr;
+    }
+
+    sections.edges = reinterpret_cast<const ImageEdge*>(vertex_data + header->n_vertices * vertex_record_size(header->version));
+    sections.tiles = reinterpret_cast<const ImageTile*>(sections.edges + header->n_edges);
+    sections.tile_edges = reinterpret_cast<const uint32_t*>(sections.tiles + header->n_tiles);
+    return sections;
+}
+
+/**
+ * \brief Check an image's header and that its sections fit in it; tile contents are checked as tiles are made.
+ */
+bool is_valid_image(const char* data, size_t size) {
+    if (size < sizeof(ImageHeader)) {
+        return false;
+    }
+
+    const ImageHeader* header = image_header(data);
+
+    if (std::memcmp(header->magic, kImageMagic, sizeof(kImageMagic)) != 0 || (header->version != kImageVersion && header->version != kCompactImageVersion) ||
+        header->byte_order != kByteOrderMark || !(header->tile_degrees > 0.0)) {
+        return false;
+    }
+
+    uint64_t vertex_size = vertex_record_size(header->version);
+
+    return header->n_vertices <= size / vertex_size && header->n_edges <= size / sizeof(ImageEdge) &&
+           header->n_tiles <= size / sizeof(ImageTile) && header->n_tile_edges <= size / sizeof(uint32_t) &&
+           sizeof(ImageHeader) + header->n_vertices * vertex_size + header->n_edges * sizeof(ImageEdge) +
+           header->n_tiles * sizeof(ImageTile) + header->n_tile_edges * sizeof(uint32_t) <= size;
+}
+
+template <typename T>
+void copy_records(char*& out, const std::vector<T>& records) {
+    if (!records.empty()) {
+        std::memcpy(out, records.data(), records.size() * sizeof(T));
+        out += records.size() * sizeof(T);
+    }
+}
+
+/**
+ * \brief Lay out a road network and its tile index as an image.
+ *
+ * \param edges the road network.
+ * \param tile_degrees the width and height of a tile in degrees.
+ * \param compact true to store vertex positions in fixed-point microdegrees.
+ * \param size set to the size of the image in bytes.
+ * \param n_tiles set to the number of tiles in the image.
+ * \return the image, padded to a whole number of words.
+ */
+std::vector<uint64_t> make_image(const std::vector<geo::EdgeCPtr>& edges, double tile_degrees, bool compact, size_t& size, size_t& n_tiles) {
+    std::map<TileKey, std::vector<geo::EdgeCPtr>> tile_edges = partition_edges(edges, tile_degrees);
+
+    // Number the vertices and edges; shared Vertex instances become shared indices.
+    std::unordered_map<const geo::Vertex*, uint32_t> vertex_indices;
+    std::unordered_map<const geo::Edge*, uint32_t> edge_indices;
+    std::vector<ImageVertex> image_vertex_array;
+    std::vector<ImageEdge> image_edge_array;
+
+    auto vertex_index = [&](const geo::Vertex::Ptr& vertex_ptr) {
+        auto result = vertex_indices.emplace(vertex_ptr.get(), static_cast<uint32_t>(image_vertex_array.size()));
+
+        if (result.second) {
+            image_vertex_array.push_back(ImageVertex{ vertex_ptr->lat, vertex_ptr->lon, vertex_ptr->uid });
+        }
+
+        return result.first->second;
+    };
+
+    for (auto& edge_ptr : edges) {
+        if (edge_indices.emplace(edge_ptr.get(), static_cast<uint32_t>(image_edge_array.size())).second) {
+            image_edge_array.push_back(ImageEdge{ vertex_index(edge_ptr->v1), vertex_index(edge_ptr->v2), edge_ptr->get_uid(), static_cast<uint32_t>(edge_ptr->get_way_type()), 0 });
+        }
+    }
+
+    std::vector<ImageTile> image_tile_array;
+    std::vector<uint32_t> image_tile_edge_array;
+
+    for (auto& tile : tile_edges) {
+        image_tile_array.push_back(ImageTile{ tile.first, image_tile_edge_array.size(), tile.second.size() });
+
+        for (auto& edge_ptr : tile.second) {
+            image_tile_edge_array.push_back(edge_indices[edge_ptr.get()]);
+        }
+    }
+
+    ImageHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, kImageMagic, sizeof(kImageMagic));
+    header.version = compact ? kCompactImageVersion : kImageVersion;
+    header.byte_order = kByteOrderMark;
+    header.tile_degrees = tile_degrees;
+    header.n_vertices = image_vertex_array.size();
+    header.n_edges = image_edge_array.size();
+    header.n_tiles = image_tile_array.size();
+    header.n_tile_edges = image_tile_edge_array.size();
+
+    size = sizeof(ImageHeader) + header.n_vertices * vertex_record_size(header.version) + header.n_edges * sizeof(ImageEdge) +
+           header.n_tiles * sizeof(ImageTile) + header.n_tile_edges * sizeof(uint32_t);
+    n_tiles = image_tile_array.size();
+
+    std::vector<uint64_t> image((size + sizeof(uint64_t) - 1) / sizeof(uint64_t), 0);
+    char* out = reinterpret_cast<char*>(image.data());
+    std::memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+
+    if (compact) {
+        std::vector<CompactVertex> positions;
+        std::vector<uint64_t> uids;
+        positions.reserve(image_vertex_array.size());
+        uids.reserve(image_vertex_array.size());
+
+        for (auto& vertex : image_vertex_array) {
+            positions.push_back(CompactVertex{ static_cast<int32_t>(std::llround(vertex.lat * kMicrodegrees)), static_cast<int32_t>(std::llround(vertex.lon * kMicrodegrees)) });
+            uids.push_back(vertex.uid);
+        }
+
+        copy_records(out, positions);
+        copy_records(out, uids);
+    } else {
+        copy_records(out, image_vertex_array);
+    }
+
+    copy_records(out, image_edge_array);
+    copy_records(out, image_tile_array);
+    copy_records(out, image_tile_edge_array);
+    return image;
+}
+
+}  // end anonymous namespace
+
+TileKey tile_key(double lat, double lon, double tile_degrees) {
+    TileKey row = static_cast<TileKey>(std::floor((lat + 90.0) / tile_degrees));
+    TileKey col = static_cast<TileKey>(std::floor((lon + 180.0) / tile_degrees));
+    return (row << 32) | col;
+}
+
+std::pair<geo::Point, geo::Point> tile_corners(TileKey key, double tile_degrees) {
+    double row = static_cast<double>(key >> 32);
+    double col = static_cast<double>(key & 0xFFFFFFFF);
+    return std::make_pair(geo::Point{ row * tile_degrees - 90.0, col * tile_degrees - 180.0 }, 
+                          geo::Point{ (row + 1.0) * tile_degrees - 90.0, (col + 1.0) * tile_degrees - 180.0 });
+}
+
+std::map<TileKey, std::vector<geo::EdgeCPtr>> partition_edges(const std::vector<geo::EdgeCPtr>& edges, double tile_degrees) {
+    if (!(tile_degrees > 0.0)) {
+        throw std::invalid_argument("Tile size must be positive: " + std::to_string(tile_degrees));
+    }
+
+    // Same margin a Quad over the tile uses for insertion, so a tile holds exactly the edges its Quad would keep.
+    double margin = tile_degrees / Quad::REDUCTION_FACTOR;
+    std::map<TileKey, std::vector<geo::EdgeCPtr>> tile_edges;
+
+    for (auto& edge_ptr : edges) {
+        double min_lat = std::min(edge_ptr->v1->lat, edge_ptr->v2->lat) - margin;
+        double max_lat = std::max(edge_ptr->v1->lat, edge_ptr->v2->lat) + margin;
+        double min_lon = std::min(edge_ptr->v1->lon, edge_ptr->v2->lon) - margin;
+        double max_lon = std::max(edge_ptr->v1->lon, edge_ptr->v2->lon) + margin;
+
+        TileKey first = tile_key(min_lat, min_lon, tile_degrees);
+        TileKey last = tile_key(max_lat, max_lon, tile_degrees);
+
+        for (TileKey row = first >> 32; row <= last >> 32; ++row) {
+            for (TileKey col = first & 0xFFFFFFFF; col <= (last & 0xFFFFFFFF); ++col) {
+                tile_edges[(row << 32) | col].push_back(edge_ptr);
+            }
+        }
+    }
+
+    // Add the other edges of each tile edge's vertices, so a vertex outside the tile still has its complete set of
+    // incident edges; the Quad over the tile ignores these edges, since they do not touch its bounds.
+    std::unordered_map<const geo::Vertex*, std::vector<geo::EdgeCPtr>> vertex_edges;
+
+    for (auto& edge_ptr : edges) {
+        vertex_edges[edge_ptr->v1.get()].push_back(edge_ptr);
+        vertex_edges[edge_ptr->v2.get()].push_back(edge_ptr);
+    }
+
+    for (auto& tile : tile_edges) {
+        std::unordered_set<const geo::Edge*> listed;
+        size_t n_touching = tile.second.size();
+
+        for (auto& edge_ptr : tile.second) {
+            listed.insert(edge_ptr.get());
+        }
+
+        for (size_t i = 0; i < n_touching; ++i) {
+            const geo::EdgeCPtr edge_ptr = tile.second[i];
+
+            for (const geo::Vertex* vertex : { edge_ptr->v1.get(), edge_ptr->v2.get() }) {
+                for (auto& neighbor_ptr : vertex_edges[vertex]) {
+                    if (listed.insert(neighbor_ptr.get()).second) {
+                        tile.second.push_back(neighbor_ptr);
+                    }
+                }
+            }
+        }
+    }
+
+    return tile_edges;
+}
+
+namespace {
+
+std::vector<geo::EdgeCPtr> load_tile_file(const std::string& file_path) {
+    shapes::CSVInputFactory shape_factory(file_path);
+    shape_factory.make_shapes();
+    return shape_factory.get_edges();
+}
+
+}  // end anonymous namespace
+
+Tile::Tile(const std::vector<geo::EdgeCPtr>& edges, const geo::Point& sw, const geo::Point& ne) :
+    quad_{ std::make_shared<EdgeQuad>(sw, ne) },
+    edges_{ edges },
+    table_{ edges },
+    vertices_{}
+{
+    // Every edge of a vertex this close to the tile touches the tile's fuzzy bounds, so it was partitioned here.
+    double margin = (ne.lat - sw.lat) / Quad::REDUCTION_FACTOR / 2.0;
+    geo::Bounds bounds{ geo::Point{ sw.lat - margin, sw.lon - margin }, geo::Point{ ne.lat + margin, ne.lon + margin } };
+
+    for (auto& edge_ptr : edges_) {
+        EdgeQuad::insert(quad_, edge_ptr);
+
+        for (const geo::Vertex::Ptr& vertex_ptr : { edge_ptr->v1, edge_ptr->v2 }) {
+            if (bounds.contains(*vertex_ptr)) {
+                vertices_.emplace(vertex_ptr->uid, vertex_ptr);
+            }
+        }
+    }
+}
+
+Tile::Tile(const std::string& file_path, const geo::Point& sw, const geo::Point& ne) :
+    Tile(load_tile_file(file_path), sw, ne)
+{}
+
+Tile::~Tile() {
+    for (auto& edge_ptr : edges_) {
+        edge_ptr->v1->clear_edges();
+        edge_ptr->v2->clear_edges();
+    }
+}
+
+EdgeQuad::CPtr Tile::get_quad() const {
+    return quad_;
+}
+
+const spatial::EdgeTable& Tile::get_table() const {
+    return table_;
+}
+
+geo::Vertex::Ptr Tile::find_vertex(const geo::Vertex& vertex) const {
+    auto vertex_item = vertices_.find(vertex.uid);
+    return vertex_item == vertices_.end() ? nullptr : vertex_item->second;
+}
+
+size_t Tile::size() const {
+    return edges_.size();
+}
+
+const std::string MapImage::kExtension{".cvmap"};
+
+MapImage::MapImage(const std::string& file_path) :
+    file_path_{file_path},
+    data_{nullptr},
+    size_{0},
+    buffer_{}
+{
+#ifdef _WIN32
+    std::ifstream file(file_path_, std::ios::binary | std::ios::ate);
+
+    if (file.fail()) {
+        throw std::invalid_argument("Could not open map image: " + file_path_);
+    }
+
+    size_ = static_cast<size_t>(file.tellg());
+    buffer_.resize((size_ + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+    file.seekg(0);
+
+    if (!file.read(reinterpret_cast<char*>(buffer_.data()), static_cast<std::streamsize>(size_))) {
+        throw std::invalid_argument("Could not read map image: " + file_path_);
+    }
+
+    data_ = reinterpret_cast<const char*>(buffer_.data());
+#else
+    int fd = ::open(file_path_.c_str(), O_RDONLY);
+
+    if (fd < 0) {
+        throw std::invalid_argument("Could not open map image: " + file_path_);
+    }
+
+    struct stat st;
+
+    if (::fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        throw std::invalid_argument("Could not map map image: " + file_path_);
+    }
+
+    size_ = static_cast<size_t>(st.st_size);
+    void* mapped = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (mapped == MAP_FAILED) {
+        throw std::invalid_argument("Could not map map image: " + file_path_);
+    }
+
+    data_ = static_cast<const char*>(mapped);
+#endif
+
+    if (!is_valid_image(data_, size_)) {
+#ifndef _WIN32
+        ::munmap(const_cast<char*>(data_), size_);
+#endif
+        throw std::invalid_argument("Not a valid map image: " + file_path_);
+    }
+}
+
+MapImage::MapImage(std::vector<uint64_t>&& image, size_t size) :
+    file_path_{"(in memory)"},
+    data_{nullptr},
+    size_{size},
+    buffer_{std::move(image)}
+{
+    data_ = reinterpret_cast<const char*>(buffer_.data());
+}
+
+MapImage::~MapImage() {
+#ifndef _WIN32
+    if (buffer_.empty()) {
+        ::munmap(const_cast<char*>(data_), size_);
+    }
+#endif
+}
+
+double MapImage::get_tile_degrees() const {
+    return image_header(data_)->tile_degrees;
+}
+
+std::vector<TileKey> MapImage::get_tile_keys() const {
+    std::vector<TileKey> keys;
+    const ImageTile* tiles = image_sections(data_).tiles;
+
+    for (uint64_t i = 0; i < image_header(data_)->n_tiles; ++i) {
+        keys.push_back(tiles[i].key);
+    }
+
+    return keys;
+}
+
+uint64_t MapImage::get_edge_count() const {
+    return image_header(data_)->n_edges;
+}
+
+uint64_t MapImage::get_vertex_count() const {
+    return image_header(data_)->n_vertices;
+}
+
+size_t MapImage::get_size() const {
+    return size_;
+}
+
+bool MapImage::is_compact() const {
+    return image_header(data_)->version == kCompactImageVersion;
+}
+
+std::vector<geo::EdgeCPtr> MapImage::make_tile_edges(TileKey key) const {
+    const ImageHeader* header = image_header(data_);
+    const ImageSections sections = image_sections(data_);
+    const ImageTile* tiles = sections.tiles;
+    const ImageTile* tile = std::lower_bound(tiles, tiles + header->n_tiles, key, [](const ImageTile& t, TileKey k) { return t.key < k; });
+    std::vector<geo::EdgeCPtr> edges;
+
+    if (tile == tiles + header->n_tiles || tile->key != key) {
+        return edges;
+    }
+
+    if (tile->first > header->n_tile_edges || tile->count > header->n_tile_edges - tile->first) {
+        throw std::invalid_argument("Corrupt map image tile: " + file_path_);
+    }
+
+    const ImageEdge* image_edge_array = sections.edges;
+    const uint32_t* tile_edges = sections.tile_edges + tile->first;
+    std::unordered_map<uint32_t, geo::Vertex::Ptr> tile_vertices;
+
+    auto get_vertex = [&](uint32_t index) {
+        if (index >= header->n_vertices) {
+            throw std::invalid_argument("Corrupt map image vertex: " + file_path_);
+        }
+
+        geo::Vertex::Ptr& vertex_ptr = tile_vertices[index];
+
+        if (!vertex_ptr) {
+            if (sections.positions) {
+                // Decode the fixed-point position only for the vertices of the tile being made.
+                vertex_ptr = std::make_shared<geo::Vertex>(sections.positions[index].lat / kMicrodegrees, sections.positions[index].lon / kMicrodegrees, sections.vertex_uids[index]);
+            } else {
+                vertex_ptr = std::make_shared<geo::Vertex>(sections.vertices[index].lat, sections.vertices[index].lon, sections.vertices[index].uid);
+            }
+        }
+
+        return vertex_ptr;
+    };
+
+    edges.reserve(tile->count);
+
+    for (uint64_t i = 0; i < tile->count; ++i) {
+        if (tile_edges[i] >= header->n_edges) {
+            throw std::invalid_argument("Corrupt map image edge: " + file_path_);
+        }
+
+        const ImageEdge& image_edge = image_edge_array[tile_edges[i]];
+        geo::Vertex::Ptr v1 = get_vertex(image_edge.v1);
+        geo::Vertex::Ptr v2 = get_vertex(image_edge.v2);
+        geo::EdgePtr edge_ptr = std::make_shared<geo::Edge>( v1, v2, static_cast<osm::Highway>(image_edge.way_type), image_edge.uid );
+        v1->add_edge( edge_ptr );
+        v2->add_edge( edge_ptr );
+        edges.push_back(edge_ptr);
+    }
+
+    return edges;
+}
+
+bool MapImage::is_image(const std::string& file_path) {
+    return file_path.size() >= kExtension.size() && file_path.compare(file_path.size() - kExtension.size(), kExtension.size(), kExtension) == 0;
+}
+
+MapImage::Ptr MapImage::make(const std::vector<geo::EdgeCPtr>& edges, double tile_degrees, bool compact) {
+    size_t size = 0;
+    size_t n_tiles = 0;
+    std::vector<uint64_t> image = make_image(edges, tile_degrees, compact, size, n_tiles);
+    return Ptr(new MapImage(std::move(image), size));
+}
+
+size_t MapImage::write(const std::vector<geo::EdgeCPtr>& edges, const std::string& file_path, double tile_degrees, bool compact) {
+    size_t size = 0;
+    size_t n_tiles = 0;
+    std::vector<uint64_t> image = make_image(edges, tile_degrees, compact, size, n_tiles);
+
+    // Write beside the target and rename so processes never map a partial image.
+    std::string part_file_path = file_path + ".part";
+    std::ofstream file(part_file_path, std::ios::binary | std::ios::trunc);
+
+    if (file.fail()) {
+        throw std::invalid_argument("Could not open map image: " + part_file_path);
+    }
+
+    file.write(reinterpret_cast<const char*>(image.data()), static_cast<std::streamsize>(size));
+    file.close();
+
+    if (file.fail()) {
+        throw std::invalid_argument("Could not write map image: " + part_file_path);
+    }
+
+    if (std::rename(part_file_path.c_str(), file_path.c_str()) != 0) {
+        // Windows will not rename over an existing file.
+        std::remove(file_path.c_str());
+
+        if (std::rename(part_file_path.c_str(), file_path.c_str()) != 0) {
+            throw std::invalid_argument("Could not rename map image: " + part_file_path);
+        }
+    }
+
+    return n_tiles;
+}
+
+const std::string TileCache::kIndexFile{"tiles.index"};
+const std::string TileCache::kTileExtension{".tile"};
+
+TileCache::TileCache(const std::string& dir_path, size_t capacity) :
+    dir_path_{dir_path},
+    image_ptr_{},
+    tile_degrees_{0.0},
+    capacity_{std::max<size_t>(1, capacity)},
+    index_{},
+    mutex_{},
+    lru_{},
+    entries_{},
+    loads_{0},
+    hits_{0},
+    evictions_{0}
+{
+    std::ifstream file(index_path(dir_path_));
+
+    if (file.fail()) {
+        throw std::invalid_argument("Could not open tile index: " + index_path(dir_path_));
+    }
+
+    // Index format: a tile_degrees,<size> line followed by one tile,<row>,<col>,<content hash> line per tile file.
+    std::string line;
+
+    while (std::getline(file, line)) {
+        StrVector parts = string_utilities::split(line, ',');
+
+        try {
+            if (parts.size() == 2 && parts[0] == "tile_degrees") {
+                tile_degrees_ = std::stod(parts[1]);
+            } else if (parts.size() == 4 && parts[0] == "tile") {
+                index_.insert((static_cast<Key>(std::stoul(parts[1])) << 32) | static_cast<Key>(std::stoul(parts[2])));
+            }
+        } catch (std::logic_error&) {
+            throw std::invalid_argument("Malformed tile index line: " + line);
+        }
+    }
+
+    if (tile_degrees_ <= 0.0) {
+        throw std::invalid_argument("Tile index missing tile_degrees: " + index_path(dir_path_));
+    }
+}
+
+TileCache::TileCache(const MapImage::Ptr& image_ptr, size_t capacity) :
+    dir_path_{},
+    image_ptr_{image_ptr},
+    tile_degrees_{image_ptr->get_tile_degrees()},
+    capacity_{std::max<size_t>(1, capacity)},
+    index_{},
+    mutex_{},
+    lru_{},
+    entries_{},
+    loads_{0},
+    hits_{0},
+    evictions_{0}
+{
+    for (auto key : image_ptr_->get_tile_keys()) {
+        index_.insert(key);
+    }
+}
+
+Tile::CPtr TileCache::get_tile(const geo::Point& pt) {
+    Key key = tile_key(pt.lat, pt.lon, tile_degrees_);
+
+    if (index_.find(key) == index_.end()) {
+        // no roads here.
+        return nullptr;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto entry_item = entries_.find(key);
+
+        if (entry_item != entries_.end()) {
+            lru_.splice(lru_.begin(), lru_, entry_item->second);
+            ++hits_;
+            return entry_item->second->second;
+        }
+    }
+
+    // Load without holding the lock so other threads keep using cached tiles.
+    std::pair<geo::Point, geo::Point> corners = tile_corners(key, tile_degrees_);
+    Tile::CPtr tile_ptr = image_ptr_ ? std::make_shared<const Tile>(image_ptr_->make_tile_edges(key), corners.first, corners.second)
+                                     : std::make_shared<const Tile>(tile_path(dir_path_, key), corners.first, corners.second);
+
+    // Evicted tiles are released after the lock, since releasing the last reference frees the whole tile.
+    std::vector<Tile::CPtr> evicted;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto entry_item = entries_.find(key);
+
+    if (entry_item != entries_.end()) {
+        // another thread loaded it first; use that copy.
+        lru_.splice(lru_.begin(), lru_, entry_item->second);
+        return entry_item->second->second;
+    }
+
+    lru_.emplace_front(key, tile_ptr);
+    entries_[key] = lru_.begin();
+    ++loads_;
+
+    while (lru_.size() > capacity_) {
+        evicted.push_back(lru_.back().second);
+        entries_.erase(lru_.back().first);
+        lru_.pop_back();
+        ++evictions_;
+    }
+
+    return tile_ptr;
+}
+
+double TileCache::get_tile_degrees() const {
+    return tile_degrees_;
+}
+
+uint64_t TileCache::get_loads() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return loads_;
+}
+
+uint64_t TileCache::get_hits() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return hits_;
+}
+
+uint64_t TileCache::get_evictions() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return evictions_;
+}
+
+std::string TileCache::index_path(const std::string& dir_path) {
+    return dir_path.empty() ? kIndexFile : dir_path + "/" + kIndexFile;
+}
+
+bool TileCache::is_tiled(const std::string& path) {
+    std::ifstream file(index_path(path));
+    return !file.fail();
+}
+
+std::string TileCache::tile_path(const std::string& dir_path, Key key) {
+    std::string name = std::to_string(key >> 32) + "_" + std::to_string(key & 0xFFFFFFFF) + kTileExtension;
+    return dir_path.empty() ? name : dir_path + "/" + name;
+}
+
+size_t TileCache::write_tiles(const std::vector<geo::EdgeCPtr>& edges, const std::string& dir_path, double tile_degrees) {
+    std::map<Key, std::vector<geo::EdgeCPtr>> tile_edges = partition_edges(edges, tile_degrees);
+
+    // The index records each tile's content hash so that any change to the tiles changes the index.
+    std::map<Key, uint64_t> tile_hashes;
+
+    for (auto& tile : tile_edges) {
+        shapes::CSVOutputFactory output_factory(tile_path(dir_path, tile.first));
+
+        for (auto& edge_ptr : tile.second) {
+            output_factory.add_edge(edge_ptr);
+        }
+
+        output_factory.write_shapes();
+        tile_hashes[tile.first] = hash_utilities::file_hash(tile_path(dir_path, tile.first));
+    }
+
+    std::ofstream file(index_path(dir_path), std::ofstream::trunc);
+
+    if (file.fail()) {
+        throw std::invalid_argument("Could not open tile index: " + index_path(dir_path));
+    }
+
+    file << std::setprecision(17) << "tile_degrees," << tile_degrees << std::endl;
+
+    for (auto& tile : tile_hashes) {
+        file << "tile," << (tile.first >> 32) << "," << (tile.first & 0xFFFFFFFF) << "," << hash_utilities::to_hex(tile.second) << std::endl;
+    }
+
+    file.close();
+    return tile_edges.size();
+}
+
+}  // end namespace tiles
@@ -20,6 +20,7 @@
 #include "trajectory.hpp"
 #include "utilities.hpp"
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <fstream>
@@ -288,4 +289,92 @@ namespace trajectory {
 
         return os << "id = " << interval._id << " [" << interval._left << ", " << interval._right << " ) types: { " << aux_types << " }";
     }
+
+    std::vector<Index> simplify( const Trajectory& traj, Index left, Index right, double tolerance )
+    {
+        std::vector<Index> kept;
+
+        if (right > traj.size()) {
+            right = traj.size();
+        }
+
+        if (left >= right) {
+            return kept;
+        }
+
+        Index n = right - left;
+
+        if (n <= 2 || tolerance <= 0.0) {
+            for (Index i = left; i < right; ++i) {
+                kept.push_back(i);
+            }
+
+            return kept;
+        }
+
+        // Equirectangular projection around the first point; accurate to well under a meter over a trip.
+        double lat0 = traj[left]->latr;
+        double lon0 = traj[left]->lonr;
+        double x_scale = geo::kEarthRadiusM * std::cos(lat0);
+        std::vector<double> x(n), y(n);
+
+        for (Index i = 0; i < n; ++i) {
+            x[i] = (traj[left + i]->lonr - lon0) * x_scale;
+            y[i] = (traj[left + i]->latr - lat0) * geo::kEarthRadiusM;
+        }
+
+        std::vector<bool> keep(n, false);
+        keep[0] = keep[n - 1] = true;
+        double tolerance2 = tolerance * tolerance;
+
+        // Explicit stack instead of recursion; trips can have tens of thousands of points.
+        std::vector<std::pair<Index, Index>> stack{ { 0, n - 1 } };
+
+        while (!stack.empty()) {
+            Index first = stack.back().first;
+            Index last = stack.back().second;
+            stack.pop_back();
+
+            double dx = x[last] - x[first];
+            double dy = y[last] - y[first];
+            double len2 = dx * dx + dy * dy;
+            double max_d2 = -1.0;
+            Index max_i = first;
+
+            for (Index i = first + 1; i < last; ++i) {
+                double px = x[i] - x[first];
+                double py = y[i] - y[first];
+                double d2;
+
+                if (len2 == 0.0) {
+                    d2 = px * px + py * py;
+                } else {
+                    // Squared distance to the segment (clamped projection).
+                    double t = std::max(0.0, std::min(1.0, (px * dx + py * dy) / len2));
+                    double ex = px - t * dx;
+                    double ey = py - t * dy;
+                    d2 = ex * ex + ey * ey;
+                }
+
+                if (d2 > max_d2) {
+                    max_d2 = d2;
+                    max_i = i;
+                }
+            }
+
+            if (max_d2 > tolerance2) {
+                keep[max_i] = true;
+                stack.push_back({ first, max_i });
+                stack.push_back({ max_i, last });
+            }
+        }
+
+        for (Index i = 0; i < n; ++i) {
+            if (keep[i]) {
+                kept.push_back(left + i);
+            }
+        }
+
+        return kept;
+    }
 }
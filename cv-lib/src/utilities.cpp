@@ -20,6 +20,9 @@
 #include "utilities.hpp"
 
 #include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
 
 const std::string string_utilities::DELIMITERS = " \f\n\r\t\v";
 
@@ -61,3 +64,39 @@ StrPair string_utilities::split_attribute( const std::string& s, char delim) {
 bool double_utilities::are_equal(double a, double b, double epsilon) {
     return std::fabs(a - b) < epsilon;
 }
+
+uint64_t hash_utilities::fnv1a_bytes(const char* data, std::size_t size, uint64_t hash) {
+    for (std::size_t i = 0; i < size; ++i) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+uint64_t hash_utilities::fnv1a(const std::string& s, uint64_t hash) {
+    return fnv1a_bytes(s.data(), s.size(), hash);
+}
+
+uint64_t hash_utilities::file_hash(const std::string& file_path) {
+    std::ifstream file(file_path, std::ios::binary);
+
+    if (file.fail()) {
+        throw std::invalid_argument("Could not open file: " + file_path);
+    }
+
+    uint64_t hash = FNV_OFFSET_BASIS;
+    std::vector<char> buffer(1 << 16);
+
+    while (file.read(buffer.data(), buffer.size()) || file.gcount() > 0) {
+        hash = fnv1a_bytes(buffer.data(), static_cast<std::size_t>(file.gcount()), hash);
+    }
+
+    return hash;
+}
+
+std::string hash_utilities::to_hex(uint64_t hash) {
+    std::stringstream ss;
+    ss << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return ss.str();
+}